@@ -0,0 +1,144 @@
+/* arena.c - Bump-pointer arenas for parse-time copies
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memcpy */
+#include <string.h>
+
+#include <mcp_base/mcp.h>
+#include <mcp_base/trace.h>
+#include <mcp_base/arena.h>
+
+/* the chunks are chained in the order they are used. after a reset they
+ * are used again in the same order, and a chunk that is too small for an
+ * allocation is passed over but kept */
+struct mcp_arena_chunk {
+	struct mcp_arena_chunk *next;
+	size_t size;
+};
+
+/* the data of a chunk starts after its header, aligned */
+#define CHUNK_HEADER		((sizeof(struct mcp_arena_chunk) +				\
+								MCP_ARENA_ALIGN - 1) & ~(MCP_ARENA_ALIGN - 1))
+
+static inline unsigned char *chunk_data(struct mcp_arena_chunk *chunk)
+{
+	return (unsigned char *)chunk + CHUNK_HEADER;
+}
+
+void mcp_arena_free(struct mcp_arena *arena)
+{
+	struct mcp_arena_chunk *chunk, *next;
+
+	for (chunk = arena->first; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	mcp_arena_init(arena);
+}
+
+void mcp_arena_reset(struct mcp_arena *arena)
+{
+	if (arena->first == NULL)
+		return;
+
+	arena->current = arena->first;
+	arena->next = chunk_data(arena->first);
+	arena->end = arena->next + arena->first->size;
+}
+
+void *mcp_arena_grow(struct mcp_arena *arena, size_t size, size_t align)
+{
+	struct mcp_arena_chunk *chunk;
+	size_t need = size + align - 1, chunk_size;
+	uintptr_t next;
+
+	/* overflow check */
+	if (need < size || need > (size_t)-1 - CHUNK_HEADER)
+		return NULL;
+
+	chunk = arena->current != NULL ? arena->current->next : NULL;
+
+	if (chunk == NULL || chunk->size < need) {
+		chunk_size = MCP_ARENA_CHUNK - CHUNK_HEADER;
+		if (need > chunk_size)
+			chunk_size = need;
+
+		chunk = malloc(CHUNK_HEADER + chunk_size);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->size = chunk_size;
+
+		/* chained after the current chunk, before any unused ones */
+		if (arena->current != NULL) {
+			chunk->next = arena->current->next;
+			arena->current->next = chunk;
+		} else {
+			chunk->next = NULL;
+			arena->first = chunk;
+		}
+	}
+
+	arena->current = chunk;
+	next = ((uintptr_t)chunk_data(chunk) + align - 1) & ~(uintptr_t)(align - 1);
+	arena->next = (unsigned char *)next + size;
+	arena->end = chunk_data(chunk) + chunk->size;
+	return (void *)next;
+}
+
+/* copies a value into the arena with a NUL-terminator, or asserts
+ * MCP_ENOMEM on buf */
+static void *arena_copy(struct mcp_parse *buf, struct mcp_arena *arena,
+						const void *value, size_t size)
+{
+	unsigned char *copy;
+
+	/* copies need no alignment */
+	if ((size_t)(arena->end - arena->next) > size) {
+		copy = arena->next;
+		arena->next += size + 1;
+	} else {
+		copy = mcp_arena_grow(arena, size + 1, 1);
+		if (copy == NULL) {
+			buf->error = MCP_ENOMEM;
+			MCP_TRACE_ERROR(MCP_SITE_ARENA, MCP_ENOMEM, mcp_consumed(buf));
+			return NULL;
+		}
+	}
+
+	if (size > 0)
+		memcpy(copy, value, size);
+	copy[size] = 0;
+	return copy;
+}
+
+void *mcp_arena_bytes(struct mcp_parse *buf, struct mcp_arena *arena,
+						size_t *size)
+{
+	const void *value = mcp_bytes(buf, size);
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return NULL;
+
+	return arena_copy(buf, arena, value, *size);
+}
+
+char *mcp_arena_string(struct mcp_parse *buf, struct mcp_arena *arena,
+						size_t *size, size_t max_units)
+{
+	const char *value = mcp_string(buf, size, max_units);
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return NULL;
+
+	return arena_copy(buf, arena, value, *size);
+}
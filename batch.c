@@ -0,0 +1,180 @@
+/* batch.c - Structure-of-arrays batch decoding
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memcpy, memset */
+#include <string.h>
+/* for assert */
+#include <assert.h>
+
+#include <mcp_base/mcp.h>
+#include <mcp_base/batch.h>
+
+/* number of frames decoded together, column by column */
+#define BATCH_BLOCK			(256)
+
+/* size of each field type on the wire */
+static const unsigned char field_sizes[] = {
+	1, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8
+};
+
+/* size of each field type in its column */
+static const size_t field_strides[] = {
+	sizeof(uint8_t), sizeof(int8_t), sizeof(int),
+	sizeof(uint16_t), sizeof(int16_t), sizeof(uint32_t), sizeof(int32_t),
+	sizeof(uint64_t), sizeof(int64_t), sizeof(float), sizeof(double)
+};
+
+/* the loops below have a constant stride and no branches, so the
+ * byte-swaps are vectorized by the compiler */
+
+static inline uint16_t load16(const unsigned char *src)
+{
+	return ((uint16_t)src[0] << 8) | src[1];
+}
+
+static inline uint32_t load32(const unsigned char *src)
+{
+	return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) |
+			((uint32_t)src[2] << 8) | src[3];
+}
+
+static inline uint64_t load64(const unsigned char *src)
+{
+	return ((uint64_t)src[0] << 56) | ((uint64_t)src[1] << 48) |
+			((uint64_t)src[2] << 40) | ((uint64_t)src[3] << 32) |
+			((uint64_t)src[4] << 24) | ((uint64_t)src[5] << 16) |
+			((uint64_t)src[6] << 8) | src[7];
+}
+
+/* decodes one column of n rows */
+static void batch_column(enum mcp_field type, void *dest,
+							const unsigned char **rows, size_t n, size_t offset)
+{
+	size_t i;
+	uint32_t i32;
+	uint64_t i64;
+
+	switch (type) {
+	case MCP_FIELD_UBYTE:
+	case MCP_FIELD_BYTE:
+		for (i = 0; i < n; i++)
+			((uint8_t *)dest)[i] = rows[i][offset];
+		break;
+	case MCP_FIELD_BOOL:
+		for (i = 0; i < n; i++)
+			((int *)dest)[i] = !!rows[i][offset];
+		break;
+	case MCP_FIELD_USHORT:
+	case MCP_FIELD_SHORT:
+		for (i = 0; i < n; i++)
+			((uint16_t *)dest)[i] = load16(rows[i] + offset);
+		break;
+	case MCP_FIELD_UINT:
+	case MCP_FIELD_INT:
+		for (i = 0; i < n; i++)
+			((uint32_t *)dest)[i] = load32(rows[i] + offset);
+		break;
+	case MCP_FIELD_ULONG:
+	case MCP_FIELD_LONG:
+		for (i = 0; i < n; i++)
+			((uint64_t *)dest)[i] = load64(rows[i] + offset);
+		break;
+	case MCP_FIELD_FLOAT:
+		/* check our assumption that float is type-punnable to uint32_t */
+		assert(sizeof(uint32_t) == sizeof(float));
+		for (i = 0; i < n; i++) {
+			i32 = load32(rows[i] + offset);
+			memcpy((float *)dest + i, &i32, sizeof(i32));
+		}
+		break;
+	case MCP_FIELD_DOUBLE:
+		/* check our assumption that double is type-punnable to uint64_t */
+		assert(sizeof(uint64_t) == sizeof(double));
+		for (i = 0; i < n; i++) {
+			i64 = load64(rows[i] + offset);
+			memcpy((double *)dest + i, &i64, sizeof(i64));
+		}
+		break;
+	}
+}
+
+size_t mcp_batch_size(const struct mcp_column *columns, size_t ncolumns)
+{
+	size_t i, size = 0;
+
+	for (i = 0; i < ncolumns; i++) {
+		assert(columns[i].type <= MCP_FIELD_DOUBLE);
+		size += field_sizes[columns[i].type];
+	}
+
+	return size;
+}
+
+size_t mcp_batch(const struct mcp_column *columns, size_t ncolumns,
+					struct mcp_parse *frames, size_t nframes)
+{
+	const unsigned char *rows[BATCH_BLOCK], *good;
+	size_t size = mcp_batch_size(columns, ncolumns);
+	size_t base, n, i, j, offset, stride, bad, decoded = 0;
+	unsigned char *dest;
+
+	assert(columns || ncolumns == 0);
+	assert(frames || nframes == 0);
+
+	for (base = 0; base < nframes; base += n) {
+		n = nframes - base;
+		if (n > BATCH_BLOCK)
+			n = BATCH_BLOCK;
+
+		/* bounds check every frame once for the whole layout */
+		good = NULL;
+		bad = 0;
+		for (i = 0; i < n; i++) {
+			struct mcp_parse *frame = &frames[base + i];
+
+			if (mcp_ok(frame) && mcp_avail(frame) < size)
+				frame->error = MCP_EAGAIN;
+
+			if (!mcp_ok(frame)) {
+				rows[i] = NULL;
+				bad++;
+				continue;
+			}
+
+			rows[i] = mcp_ptr(frame);
+			mcp_consume(frame, size);
+			if (good == NULL)
+				good = rows[i];
+		}
+
+		/* point bad rows at a good one so the column loops do not
+		 * need to branch, their values are zeroed below */
+		for (i = 0; i < n && bad > 0 && good != NULL; i++)
+			if (rows[i] == NULL)
+				rows[i] = good;
+
+		for (j = 0, offset = 0; j < ncolumns; j++) {
+			stride = field_strides[columns[j].type];
+			dest = (unsigned char *)columns[j].dest + base * stride;
+
+			if (good != NULL)
+				batch_column(columns[j].type, dest, rows, n, offset);
+
+			for (i = 0; i < n && bad > 0; i++)
+				if (!mcp_ok(&frames[base + i]))
+					memset(dest + i * stride, 0, stride);
+
+			offset += field_sizes[columns[j].type];
+		}
+
+		decoded += n - bad;
+	}
+
+	return decoded;
+}
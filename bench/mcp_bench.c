@@ -0,0 +1,1081 @@
+/* mcp_bench.c - microbenchmarks of the fbuf, mcp and mcg primitives
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for clock_gettime */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/intern.h>
+#include <mcp_base/rewrite.h>
+#include <mcp_base/dispatch.h>
+#include <mcp_base/delta.h>
+#include <mcp_base/arena.h>
+
+/* values encoded back to back in each input, so that the loops can not
+ * be hoisted and the branch predictor sees a realistic stream */
+#define NUM_VALUES			(1024)
+/* bound on the size of the input */
+#define MAX_INPUT			(4194304)
+/* largest bytes or string value */
+#define MAX_BYTES			(65536)
+
+/* what the input of a benchmark is filled with before it is timed */
+enum kind {
+	KIND_NONE,
+	KIND_VARINT,
+	KIND_VARLONG,
+	KIND_UBYTE,
+	KIND_USHORT,
+	KIND_UINT,
+	KIND_ULONG,
+	KIND_FLOAT,
+	KIND_DOUBLE,
+	KIND_BYTES,
+	KIND_TEXT,
+	KIND_IDENTS,
+	KIND_MIXED,
+	KIND_FRAMES
+};
+
+/* a benchmark runs n operations, and reports the bytes each one handles */
+struct bench {
+	const char *name;
+	size_t param;
+	enum kind kind;
+	size_t (*run)(long n, size_t param);
+};
+
+struct result {
+	double min, median;
+	long n;
+	size_t bytes;
+};
+
+/* results are written here so that nothing is optimized out */
+static volatile uint64_t sink;
+
+/* the encoded input of the parse benchmarks */
+static struct fbuf input;
+static unsigned char data[MAX_BYTES];
+/* chat-like text with a multibyte character every few bytes */
+static unsigned char text[MAX_BYTES];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* the smallest value that encodes to a varint of length bytes */
+static uint64_t varint_value(size_t length)
+{
+	return length <= 1 ? 0 : (uint64_t)1 << (7 * (length - 1));
+}
+
+/* identifiers, as they repeat in registries and plugin messages */
+#define NUM_IDENTS			(64)
+static char idents[NUM_IDENTS][32];
+static struct mcp_intern *ident_table;
+
+static int generate_mixed_one(struct fbuf *buf, long i);
+static int generate_frame(struct fbuf *buf, long i);
+
+/* fills the input of a benchmark, outside of the timed loop */
+static void encode(enum kind kind, size_t param)
+{
+	int i, ret = 0;
+
+	fbuf_clear(&input);
+	for (i = 0; i < NUM_VALUES && fbuf_avail(&input) < MAX_INPUT; i++) {
+		switch (kind) {
+		case KIND_NONE:
+			return;
+		case KIND_VARINT:
+			ret |= mcg_varint(&input, varint_value(param) + i % 7);
+			break;
+		case KIND_VARLONG:
+			ret |= mcg_varlong(&input, varint_value(param) + i % 7);
+			break;
+		case KIND_UBYTE:
+			ret |= mcg_ubyte(&input, i);
+			break;
+		case KIND_USHORT:
+			ret |= mcg_ushort(&input, i);
+			break;
+		case KIND_UINT:
+			ret |= mcg_uint(&input, i);
+			break;
+		case KIND_ULONG:
+			ret |= mcg_ulong(&input, i);
+			break;
+		case KIND_FLOAT:
+			ret |= mcg_float(&input, i * 0.5f);
+			break;
+		case KIND_DOUBLE:
+			ret |= mcg_double(&input, i * 0.5);
+			break;
+		case KIND_BYTES:
+			ret |= mcg_bytes(&input, data, param);
+			break;
+		case KIND_TEXT:
+			ret |= mcg_bytes(&input, text, param);
+			break;
+		case KIND_IDENTS:
+			ret |= mcg_string(&input, idents[i * 7 % NUM_IDENTS]);
+			break;
+		case KIND_MIXED:
+			ret |= generate_mixed_one(&input, i);
+			break;
+		case KIND_FRAMES:
+			ret |= generate_frame(&input, i);
+			break;
+		}
+	}
+
+	if (ret) {
+		fprintf(stderr, "out of memory\n");
+		abort();
+	}
+}
+
+/* parse benchmarks loop over the encoded input, restarting at the end */
+#define PARSE_LOOP(n, expr)											\
+	do {															\
+		struct mcp_parse buf;										\
+		uint64_t sum = 0;											\
+		long left = (n);											\
+		while (left > 0) {											\
+			mcp_start(&buf, fbuf_ptr(&input), fbuf_avail(&input));	\
+			for (; left > 0 && !mcp_eof(&buf); left--)				\
+				sum += (uint64_t)(expr);							\
+			if (!mcp_ok(&buf))										\
+				abort();											\
+		}															\
+		sink = sum;													\
+	} while (0)
+
+/* generate benchmarks fill a buffer with up to NUM_VALUES values, then
+ * clear it */
+#define GENERATE_LOOP(n, expr)										\
+	do {															\
+		static struct fbuf buf = FBUF_INITIALIZER;					\
+		int ret = 0;												\
+		long left = (n), i;											\
+		while (left > 0) {											\
+			fbuf_clear(&buf);										\
+			for (i = 0; i < NUM_VALUES && i < left &&				\
+					fbuf_avail(&buf) < MAX_INPUT; i++)				\
+				ret |= (expr);										\
+			left -= i;												\
+		}															\
+		if (ret)													\
+			abort();												\
+		sink = fbuf_avail(&buf);									\
+	} while (0)
+
+static size_t parse_varint(long n, size_t param)
+{
+	PARSE_LOOP(n, mcp_varint(&buf));
+	return param;
+}
+
+static size_t parse_varlong(long n, size_t param)
+{
+	PARSE_LOOP(n, mcp_varlong(&buf));
+	return param;
+}
+
+static size_t parse_skip_varint(long n, size_t param)
+{
+	PARSE_LOOP(n, (mcp_skip_varint(&buf), 0));
+	return param;
+}
+
+/* a run of varints skipped at once, e.g. the block states of a palette.
+ * NUM_VALUES is a multiple of the run, so every run is whole */
+#define SKIP_RUN			(64)
+
+static size_t parse_skip_varints(long n, size_t param)
+{
+	PARSE_LOOP(n, (mcp_skip_varints(&buf, SKIP_RUN), 0));
+	return SKIP_RUN * param;
+}
+
+static size_t parse_ubyte(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, mcp_ubyte(&buf));
+	return 1;
+}
+
+static size_t parse_ushort(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, mcp_ushort(&buf));
+	return 2;
+}
+
+static size_t parse_uint(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, mcp_uint(&buf));
+	return 4;
+}
+
+static size_t parse_ulong(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, mcp_ulong(&buf));
+	return 8;
+}
+
+static size_t parse_float(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, mcp_float(&buf));
+	return 4;
+}
+
+static size_t parse_double(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, mcp_double(&buf));
+	return 8;
+}
+
+static size_t parse_bytes(long n, size_t param)
+{
+	size_t size;
+
+	PARSE_LOOP(n, ((const unsigned char *)mcp_bytes(&buf, &size))[0] + size);
+	return param;
+}
+
+static size_t parse_copy_string(long n, size_t param)
+{
+	static char dest[MAX_BYTES + 1];
+
+	PARSE_LOOP(n, mcp_copy_string(dest, &buf, sizeof(dest)));
+	return param;
+}
+
+static size_t parse_string(long n, size_t param)
+{
+	size_t size;
+
+	PARSE_LOOP(n, (uintptr_t)mcp_string(&buf, &size, MAX_BYTES) + size);
+	return param;
+}
+
+/* each string copied into an allocation of its own, then freed */
+static uint64_t malloc_string_one(struct mcp_parse *buf)
+{
+	const char *value;
+	size_t size;
+	char *copy;
+
+	value = mcp_string(buf, &size, MAX_BYTES);
+	if (!mcp_ok(buf))
+		return 0;
+
+	copy = malloc(size + 1);
+	if (copy == NULL)
+		abort();
+	memcpy(copy, value, size);
+	copy[size] = 0;
+	free(copy);
+	return size;
+}
+
+static size_t parse_malloc_string(long n, size_t param)
+{
+	PARSE_LOOP(n, malloc_string_one(&buf));
+	return param;
+}
+
+/* each string copied into an arena, which is reset every few strings, as
+ * if after each packet */
+static uint64_t arena_string_one(struct mcp_parse *buf, long i)
+{
+	static struct mcp_arena arena = MCP_ARENA_INITIALIZER;
+	size_t size = 0;
+
+	if (i % 4 == 0)
+		mcp_arena_reset(&arena);
+
+	return (uintptr_t)mcp_arena_string(buf, &arena, &size, MAX_BYTES) + size;
+}
+
+static size_t parse_arena_string(long n, size_t param)
+{
+	PARSE_LOOP(n, arena_string_one(&buf, left));
+	return param;
+}
+
+/* each identifier copied into a new allocation, then looked up by name */
+static size_t parse_ident_copy(long n, size_t param)
+{
+	char *copy;
+	size_t size, id;
+
+	(void)param;
+	PARSE_LOOP(n, (size = mcp_copy_string(NULL, &buf, 0),
+			copy = malloc(size), mcp_copy_string(copy, &buf, size),
+			id = mcp_intern_find(ident_table, copy, size - 1),
+			free(copy), id));
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+static size_t parse_ident_intern(long n, size_t param)
+{
+	const char *value;
+	size_t size;
+
+	(void)param;
+	PARSE_LOOP(n, mcp_intern_parse(&buf, ident_table, &value, &size));
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+static size_t generate_varint(long n, size_t param)
+{
+	mcp_varint_t value = varint_value(param);
+	GENERATE_LOOP(n, mcg_varint(&buf, value + i % 7));
+	return param;
+}
+
+static size_t generate_varlong(long n, size_t param)
+{
+	mcp_varlong_t value = varint_value(param);
+	GENERATE_LOOP(n, mcg_varlong(&buf, value + i % 7));
+	return param;
+}
+
+static size_t generate_ubyte(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, mcg_ubyte(&buf, i));
+	return 1;
+}
+
+static size_t generate_ushort(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, mcg_ushort(&buf, i));
+	return 2;
+}
+
+static size_t generate_uint(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, mcg_uint(&buf, i));
+	return 4;
+}
+
+static size_t generate_ulong(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, mcg_ulong(&buf, i));
+	return 8;
+}
+
+static size_t generate_float(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, mcg_float(&buf, i * 0.5f));
+	return 4;
+}
+
+static size_t generate_double(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, mcg_double(&buf, i * 0.5));
+	return 8;
+}
+
+static size_t generate_bytes(long n, size_t param)
+{
+	GENERATE_LOOP(n, mcg_bytes(&buf, data, param));
+	return param;
+}
+
+static size_t generate_string(long n, size_t param)
+{
+	static char value[MAX_BYTES + 1];
+
+	memset(value, 'a', param);
+	value[param] = 0;
+	GENERATE_LOOP(n, mcg_string(&buf, value));
+	return param;
+}
+
+/* grows an empty buffer to param bytes in small writes, then frees it */
+static size_t fbuf_grow(long n, size_t param)
+{
+	struct fbuf buf;
+	size_t done;
+	long i;
+
+	for (i = 0; i < n; i++) {
+		fbuf_init(&buf, FBUF_MAX);
+		for (done = 0; done < param; done += 64)
+			if (fbuf_copy(&buf, data, 64))
+				abort();
+		sink = fbuf_avail(&buf);
+		fbuf_free(&buf);
+	}
+
+	return param;
+}
+
+/* a stream: param bytes arrive, all but a partial frame are consumed and
+ * the rest is compacted to the front, like a connection's read buffer */
+static size_t fbuf_stream(long n, size_t param)
+{
+	static struct fbuf buf = FBUF_INITIALIZER;
+	long i;
+
+	fbuf_clear(&buf);
+	for (i = 0; i < n; i++) {
+		if (fbuf_copy(&buf, data, param))
+			abort();
+		fbuf_consume(&buf, fbuf_avail(&buf) - (i % 31));
+		fbuf_compact(&buf);
+	}
+
+	sink = fbuf_avail(&buf);
+	return param;
+}
+
+/* like fbuf_stream, but the buffer is never compacted by hand */
+static size_t fbuf_append(long n, size_t param)
+{
+	static struct fbuf buf = FBUF_INITIALIZER;
+	long i;
+
+	fbuf_clear(&buf);
+	for (i = 0; i < n; i++) {
+		if (fbuf_copy(&buf, data, param))
+			abort();
+		fbuf_consume(&buf, fbuf_avail(&buf) - (i % 31));
+	}
+
+	sink = fbuf_avail(&buf);
+	return param;
+}
+
+/* large buffers are copied from a source of this size */
+#define MAX_LARGE			(16777216)
+
+/* the pool of fbuf_copy_huge and fbuf_grow_huge, for buffers of a
+ * megabyte or more */
+static struct fbuf_pages large_pages;
+
+static const unsigned char *large_source(void)
+{
+	static unsigned char *source;
+
+	if (source == NULL) {
+		source = malloc(MAX_LARGE);
+		if (source == NULL)
+			abort();
+		memset(source, 0x5a, MAX_LARGE);
+		fbuf_pages_init(&large_pages, 1048576, 64 * FBUF_HUGE_PAGE);
+	}
+
+	return source;
+}
+
+/* param bytes are copied in, then all but a quarter consumed and compacted
+ * to the front, like a region or broadcast buffer */
+static size_t copy_large(struct fbuf *buf, long n, size_t param)
+{
+	const unsigned char *source = large_source();
+	long i;
+
+	fbuf_clear(buf);
+	for (i = 0; i < n; i++) {
+		if (fbuf_copy(buf, source, param))
+			abort();
+		fbuf_consume(buf, fbuf_avail(buf) - param / 4);
+		fbuf_compact(buf);
+	}
+
+	sink = fbuf_avail(buf);
+	return param + param / 4;
+}
+
+static size_t fbuf_copy_large(long n, size_t param)
+{
+	static struct fbuf buf = FBUF_INITIALIZER;
+	return copy_large(&buf, n, param);
+}
+
+static size_t fbuf_copy_huge(long n, size_t param)
+{
+	static struct fbuf buf = FBUF_INITIALIZER;
+
+	large_source();
+	if (fbuf_set_pages(&buf, &large_pages))
+		abort();
+	return copy_large(&buf, n, param);
+}
+
+/* like fbuf_grow, in large writes to a buffer of the pool */
+static size_t fbuf_grow_huge(long n, size_t param)
+{
+	const unsigned char *source = large_source();
+	struct fbuf buf;
+	size_t done;
+	long i;
+
+	for (i = 0; i < n; i++) {
+		fbuf_init(&buf, FBUF_MAX);
+		fbuf_set_pages(&buf, &large_pages);
+		for (done = 0; done < param; done += 65536)
+			if (fbuf_copy(&buf, source + done % MAX_LARGE, 65536))
+				abort();
+		sink = fbuf_avail(&buf);
+		fbuf_free(&buf);
+	}
+
+	return param;
+}
+
+/* a tick of entities, of which param percent move a little */
+#define NUM_ENTITIES		(1024)
+
+static mcp_varint_t entity_ids[NUM_ENTITIES];
+static double entity_x[NUM_ENTITIES], entity_y[NUM_ENTITIES];
+static double entity_z[NUM_ENTITIES];
+static uint8_t entity_yaw[NUM_ENTITIES], entity_pitch[NUM_ENTITIES];
+static uint8_t entity_ground[NUM_ENTITIES];
+static struct mcp_delta entity_last[NUM_ENTITIES];
+
+static const struct mcp_delta_ids delta_ids = {0x25, 0x26, 0x27, 0x56, 0x44};
+static const struct mcp_entities entities = {
+	NUM_ENTITIES, entity_ids, entity_x, entity_y, entity_z, entity_yaw,
+	entity_pitch, entity_ground, NULL, NULL, NULL
+};
+
+static void entity_tick(long tick, size_t param)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ENTITIES; i++) {
+		entity_ids[i] = 1000 + i;
+		if ((i * 37 + tick) % 100 < param) {
+			entity_x[i] += 0.125;
+			entity_yaw[i] += 3;
+		}
+	}
+}
+
+/* only what changed since the last tick, per entity */
+static size_t delta_entities(long n, size_t param)
+{
+	static struct fbuf buf = FBUF_INITIALIZER;
+	long tick;
+
+	mcp_delta_reset(entity_last, NUM_ENTITIES);
+	entity_tick(0, 0);
+	if (mcp_delta_encode(&buf, &delta_ids, &entities, entity_last))
+		abort();
+
+	for (tick = 1; n > 0; tick++, n -= NUM_ENTITIES) {
+		entity_tick(tick, param);
+		fbuf_clear(&buf);
+		if (mcp_delta_encode(&buf, &delta_ids, &entities, entity_last))
+			abort();
+	}
+
+	sink = fbuf_avail(&buf);
+	return fbuf_avail(&buf) / NUM_ENTITIES;
+}
+
+/* a teleport of every entity, every tick */
+static size_t teleport_entities(long n, size_t param)
+{
+	static struct fbuf buf = FBUF_INITIALIZER, body = FBUF_INITIALIZER;
+	long tick;
+	size_t i;
+	int ret = 0;
+
+	for (tick = 1; n > 0; tick++, n -= NUM_ENTITIES) {
+		entity_tick(tick, param);
+		fbuf_clear(&buf);
+		for (i = 0; i < NUM_ENTITIES; i++) {
+			fbuf_clear(&body);
+			ret |= mcg_varint(&body, 0x56) ||
+					mcg_varint(&body, entity_ids[i]) ||
+					mcg_double(&body, entity_x[i]) ||
+					mcg_double(&body, entity_y[i]) ||
+					mcg_double(&body, entity_z[i]) ||
+					mcg_ubyte(&body, entity_yaw[i]) ||
+					mcg_ubyte(&body, entity_pitch[i]) ||
+					mcg_bool(&body, entity_ground[i]) ||
+					mcg_bytes(&buf, fbuf_ptr(&body), fbuf_avail(&body));
+		}
+	}
+
+	if (ret)
+		abort();
+	sink = fbuf_avail(&buf);
+	return fbuf_avail(&buf) / NUM_ENTITIES;
+}
+
+/* a movement packet: id, entity, x, y, z, yaw, pitch, on ground */
+static int generate_move(struct fbuf *buf, long i)
+{
+	return mcg_varint(buf, 0x15) ||
+			mcg_varint(buf, 1000 + i % 100) ||
+			mcg_double(buf, i * 0.25) ||
+			mcg_double(buf, 64) ||
+			mcg_double(buf, -i * 0.25) ||
+			mcg_ubyte(buf, i) ||
+			mcg_ubyte(buf, i >> 8) ||
+			mcg_bool(buf, i & 1);
+}
+
+/* a chat packet: id, message, position */
+static int generate_chat(struct fbuf *buf, long i)
+{
+	static const char *messages[] = {"hi", "hello, world",
+		"{\"text\":\"a longer chat message with some json around it\"}"};
+
+	return mcg_varint(buf, 0x0f) ||
+			mcg_string(buf, messages[i % 3]) ||
+			mcg_byte(buf, 0);
+}
+
+/* a block change packet: id, position, block */
+static int generate_block(struct fbuf *buf, long i)
+{
+	return mcg_varint(buf, 0x0b) ||
+			mcg_ulong(buf, i * 0x100001) ||
+			mcg_varint(buf, i % 4096);
+}
+
+static int generate_mixed_one(struct fbuf *buf, long i)
+{
+	/* mostly movement, as on a busy server */
+	switch (i % 8) {
+	case 0:
+		return generate_chat(buf, i);
+	case 1:
+	case 2:
+		return generate_block(buf, i);
+	default:
+		return generate_move(buf, i);
+	}
+}
+
+static uint64_t parse_mixed_one(struct mcp_parse *buf)
+{
+	static char message[256];
+	uint64_t sum = 0;
+
+	switch (mcp_varint(buf)) {
+	case 0x15:
+		sum += mcp_varint(buf);
+		sum += mcp_double(buf);
+		sum += mcp_double(buf);
+		sum += mcp_double(buf);
+		sum += mcp_ubyte(buf);
+		sum += mcp_ubyte(buf);
+		sum += mcp_bool(buf);
+		break;
+	case 0x0f:
+		sum += mcp_copy_string(message, buf, sizeof(message));
+		sum += mcp_byte(buf);
+		break;
+	case 0x0b:
+		sum += mcp_ulong(buf);
+		sum += mcp_varint(buf);
+		break;
+	default:
+		abort();
+	}
+
+	return sum;
+}
+
+/* the same packets through a dispatch table instead of a switch */
+static int on_move(void *context, struct mcp_parse *buf)
+{
+	uint64_t *sum = context;
+
+	*sum += mcp_varint(buf);
+	*sum += mcp_double(buf);
+	*sum += mcp_double(buf);
+	*sum += mcp_double(buf);
+	*sum += mcp_ubyte(buf);
+	*sum += mcp_ubyte(buf);
+	*sum += mcp_bool(buf);
+	return 0;
+}
+
+static int on_chat(void *context, struct mcp_parse *buf)
+{
+	static char message[256];
+	uint64_t *sum = context;
+
+	*sum += mcp_copy_string(message, buf, sizeof(message));
+	*sum += mcp_byte(buf);
+	return 0;
+}
+
+static int on_block(void *context, struct mcp_parse *buf)
+{
+	uint64_t *sum = context;
+
+	*sum += mcp_ulong(buf);
+	*sum += mcp_varint(buf);
+	return 0;
+}
+
+static const mcp_handler_t mixed_handlers[] = {
+	[0x0b] = on_block,
+	[0x0f] = on_chat,
+	[0x15] = on_move
+};
+static const struct mcp_dispatch mixed_table = MCP_DISPATCH(mixed_handlers);
+static uint64_t mixed_counts[MCP_DISPATCH_COUNTS(mixed_handlers)];
+
+static uint64_t dispatch_mixed_one(struct mcp_parse *buf)
+{
+	uint64_t sum = 0;
+
+	if (mcp_dispatch(&mixed_table, mixed_counts, &sum, buf) != 0)
+		abort();
+	return sum;
+}
+
+static size_t dispatch_mixed(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, dispatch_mixed_one(&buf));
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+static size_t parse_mixed(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, parse_mixed_one(&buf));
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+static size_t generate_mixed(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, generate_mixed_one(&buf, i));
+	/* the same packets are in the input */
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+/* frames a packet with its length, as it is sent on a connection */
+static int generate_frame(struct fbuf *buf, long i)
+{
+	static struct fbuf body = FBUF_INITIALIZER;
+
+	fbuf_clear(&body);
+	return generate_mixed_one(&body, i) ||
+			mcg_bytes(buf, fbuf_ptr(&body), fbuf_avail(&body));
+}
+
+static uint64_t parse_frame(struct mcp_parse *buf)
+{
+	struct mcp_parse body;
+	const void *ptr;
+	size_t size;
+
+	ptr = mcp_bytes(buf, &size);
+	if (!mcp_ok(buf))
+		return 0;
+
+	mcp_start(&body, ptr, size);
+	return parse_mixed_one(&body);
+}
+
+static size_t parse_frames(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, parse_frame(&buf));
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+/* remaps the packet id of a frame in place, as a proxy would */
+static uint64_t rewrite_frame(struct mcp_parse *buf)
+{
+	size_t frame = mcp_consumed(buf), size;
+	const unsigned char *body;
+
+	body = mcp_bytes(buf, &size);
+	if (!mcp_ok(buf))
+		return 0;
+
+	return mcp_rewrite_varint(&input, frame, 0, body[0] ^ 0x40);
+}
+
+static size_t rewrite_frames(long n, size_t param)
+{
+	(void)param;
+	PARSE_LOOP(n, rewrite_frame(&buf));
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+static size_t generate_frames(long n, size_t param)
+{
+	(void)param;
+	GENERATE_LOOP(n, generate_frame(&buf, i));
+	return fbuf_avail(&input) / NUM_VALUES;
+}
+
+static const struct bench benches[] = {
+	{"mcp_varint", 1, KIND_VARINT, parse_varint},
+	{"mcp_varint", 2, KIND_VARINT, parse_varint},
+	{"mcp_varint", 3, KIND_VARINT, parse_varint},
+	{"mcp_varint", 4, KIND_VARINT, parse_varint},
+	{"mcp_varint", 5, KIND_VARINT, parse_varint},
+	{"mcp_varlong", 1, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 2, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 3, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 4, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 5, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 6, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 7, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 8, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 9, KIND_VARLONG, parse_varlong},
+	{"mcp_varlong", 10, KIND_VARLONG, parse_varlong},
+	{"mcp_skip_varint", 1, KIND_VARLONG, parse_skip_varint},
+	{"mcp_skip_varint", 5, KIND_VARLONG, parse_skip_varint},
+	{"mcp_skip_varint", 10, KIND_VARLONG, parse_skip_varint},
+	{"mcp_skip_varints", 1, KIND_VARLONG, parse_skip_varints},
+	{"mcp_skip_varints", 2, KIND_VARLONG, parse_skip_varints},
+	{"mcp_skip_varints", 5, KIND_VARLONG, parse_skip_varints},
+	{"mcp_skip_varints", 10, KIND_VARLONG, parse_skip_varints},
+	{"mcp_ubyte", 0, KIND_UBYTE, parse_ubyte},
+	{"mcp_ushort", 0, KIND_USHORT, parse_ushort},
+	{"mcp_uint", 0, KIND_UINT, parse_uint},
+	{"mcp_ulong", 0, KIND_ULONG, parse_ulong},
+	{"mcp_float", 0, KIND_FLOAT, parse_float},
+	{"mcp_double", 0, KIND_DOUBLE, parse_double},
+	{"mcp_bytes", 16, KIND_BYTES, parse_bytes},
+	{"mcp_bytes", 256, KIND_BYTES, parse_bytes},
+	{"mcp_bytes", 4096, KIND_BYTES, parse_bytes},
+	{"mcp_bytes", 65536, KIND_BYTES, parse_bytes},
+	{"mcp_copy_string", 16, KIND_BYTES, parse_copy_string},
+	{"mcp_copy_string", 256, KIND_BYTES, parse_copy_string},
+	{"mcp_copy_string", 4096, KIND_BYTES, parse_copy_string},
+	{"mcp_string", 16, KIND_BYTES, parse_string},
+	{"mcp_string", 256, KIND_BYTES, parse_string},
+	{"mcp_string", 4096, KIND_BYTES, parse_string},
+	{"mcp_string_utf8", 16, KIND_TEXT, parse_string},
+	{"mcp_string_utf8", 256, KIND_TEXT, parse_string},
+	{"mcp_string_utf8", 4096, KIND_TEXT, parse_string},
+	{"malloc_string", 16, KIND_BYTES, parse_malloc_string},
+	{"malloc_string", 256, KIND_BYTES, parse_malloc_string},
+	{"malloc_string", 4096, KIND_BYTES, parse_malloc_string},
+	{"mcp_arena_string", 16, KIND_BYTES, parse_arena_string},
+	{"mcp_arena_string", 256, KIND_BYTES, parse_arena_string},
+	{"mcp_arena_string", 4096, KIND_BYTES, parse_arena_string},
+	{"ident_copy", 0, KIND_IDENTS, parse_ident_copy},
+	{"ident_intern", 0, KIND_IDENTS, parse_ident_intern},
+	{"mcg_varint", 1, KIND_NONE, generate_varint},
+	{"mcg_varint", 2, KIND_NONE, generate_varint},
+	{"mcg_varint", 3, KIND_NONE, generate_varint},
+	{"mcg_varint", 4, KIND_NONE, generate_varint},
+	{"mcg_varint", 5, KIND_NONE, generate_varint},
+	{"mcg_varlong", 1, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 2, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 3, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 4, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 5, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 6, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 7, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 8, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 9, KIND_NONE, generate_varlong},
+	{"mcg_varlong", 10, KIND_NONE, generate_varlong},
+	{"mcg_ubyte", 0, KIND_NONE, generate_ubyte},
+	{"mcg_ushort", 0, KIND_NONE, generate_ushort},
+	{"mcg_uint", 0, KIND_NONE, generate_uint},
+	{"mcg_ulong", 0, KIND_NONE, generate_ulong},
+	{"mcg_float", 0, KIND_NONE, generate_float},
+	{"mcg_double", 0, KIND_NONE, generate_double},
+	{"mcg_bytes", 16, KIND_NONE, generate_bytes},
+	{"mcg_bytes", 256, KIND_NONE, generate_bytes},
+	{"mcg_bytes", 4096, KIND_NONE, generate_bytes},
+	{"mcg_bytes", 65536, KIND_NONE, generate_bytes},
+	{"mcg_string", 16, KIND_NONE, generate_string},
+	{"mcg_string", 256, KIND_NONE, generate_string},
+	{"mcg_string", 4096, KIND_NONE, generate_string},
+	{"fbuf_grow", 4096, KIND_NONE, fbuf_grow},
+	{"fbuf_grow", 65536, KIND_NONE, fbuf_grow},
+	{"fbuf_grow", 1048576, KIND_NONE, fbuf_grow},
+	{"fbuf_grow", 8388608, KIND_NONE, fbuf_grow},
+	{"fbuf_grow_huge", 8388608, KIND_NONE, fbuf_grow_huge},
+	{"fbuf_stream", 64, KIND_NONE, fbuf_stream},
+	{"fbuf_stream", 1460, KIND_NONE, fbuf_stream},
+	{"fbuf_stream", 16384, KIND_NONE, fbuf_stream},
+	{"fbuf_append", 64, KIND_NONE, fbuf_append},
+	{"fbuf_append", 1460, KIND_NONE, fbuf_append},
+	{"fbuf_append", 16384, KIND_NONE, fbuf_append},
+	{"fbuf_copy_large", 1048576, KIND_NONE, fbuf_copy_large},
+	{"fbuf_copy_large", 8388608, KIND_NONE, fbuf_copy_large},
+	{"fbuf_copy_huge", 1048576, KIND_NONE, fbuf_copy_huge},
+	{"fbuf_copy_huge", 8388608, KIND_NONE, fbuf_copy_huge},
+	{"mcp_delta_encode", 1, KIND_NONE, delta_entities},
+	{"mcp_delta_encode", 10, KIND_NONE, delta_entities},
+	{"mcp_delta_encode", 100, KIND_NONE, delta_entities},
+	{"mcg_teleports", 10, KIND_NONE, teleport_entities},
+	{"mcp_mixed", 0, KIND_MIXED, parse_mixed},
+	{"mcp_dispatch_mixed", 0, KIND_MIXED, dispatch_mixed},
+	{"mcg_mixed", 0, KIND_MIXED, generate_mixed},
+	{"mcp_frames", 0, KIND_FRAMES, parse_frames},
+	{"mcg_frames", 0, KIND_FRAMES, generate_frames},
+	{"mcp_rewrite_frames", 0, KIND_FRAMES, rewrite_frames}
+};
+
+#define NUM_BENCHES		(sizeof(benches) / sizeof(benches[0]))
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* runs a benchmark for reps repetitions of about seconds each, after
+ * finding how many operations that takes and warming up */
+static void measure(const struct bench *bench, int reps, double seconds,
+					struct result *result)
+{
+	static double times[256];
+	double start, elapsed;
+	long n = 1;
+	int i;
+
+	encode(bench->kind, bench->param);
+
+	/* warmup and calibration: double n until a run takes long enough */
+	for (;;) {
+		start = now();
+		result->bytes = bench->run(n, bench->param);
+		elapsed = now() - start;
+		if (elapsed >= seconds / 4 || n >= (1L << 40))
+			break;
+		n *= 2;
+	}
+
+	if (elapsed > 0)
+		n = n * (seconds / elapsed);
+	if (n < 1)
+		n = 1;
+
+	for (i = 0; i < reps; i++) {
+		start = now();
+		bench->run(n, bench->param);
+		times[i] = (now() - start) * 1e9 / n;
+	}
+
+	qsort(times, reps, sizeof(times[0]), compare_double);
+	result->min = times[0];
+	result->median = times[reps / 2];
+	result->n = n;
+}
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: ./mcp_bench <reps> <ms> <json> <filter>\n"
+					"\treps    repetitions of each benchmark (1-256)\n"
+					"\tms      length of each repetition\n"
+					"\tjson    1 for json output\n"
+					"\tfilter  only run benchmarks whose names contain it\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct result result;
+	const char *filter = NULL;
+	int reps = 5, json = 0, first = 1;
+	double ms = 50;
+	size_t i;
+
+	if (argc > 1 && sscanf(argv[1], "%i", &reps) != 1)
+		return usage();
+	if (argc > 2 && sscanf(argv[2], "%lf", &ms) != 1)
+		return usage();
+	if (argc > 3 && sscanf(argv[3], "%i", &json) != 1)
+		return usage();
+	if (argc > 4)
+		filter = argv[4];
+	if (reps < 1 || reps > 256 || ms <= 0)
+		return usage();
+
+	memset(data, 'a', sizeof(data));
+	/* sixteen bytes, so that no string ends inside a character */
+	for (i = 0; i < sizeof(text); i += 16)
+		memcpy(text + i, "h\xc3\xa9llo w\xc3\xb6rld\xe2\x82\xac", 16);
+	fbuf_init(&input, FBUF_MAX);
+
+	ident_table = mcp_intern_new(NUM_IDENTS);
+	if (ident_table == NULL)
+		abort();
+	for (i = 0; i < NUM_IDENTS; i++) {
+		sprintf(idents[i], "minecraft:block_%lu", (unsigned long)i);
+		mcp_intern_add(ident_table, idents[i], strlen(idents[i]));
+	}
+
+	if (json)
+		printf("{\"reps\": %i, \"ms\": %g, \"results\": [\n", reps, ms);
+	else
+		printf("%-24s %12s %12s %14s\n", "benchmark", "ns/op", "min ns/op",
+				"bytes/sec");
+
+	for (i = 0; i < NUM_BENCHES; i++) {
+		char name[64];
+
+		if (benches[i].param)
+			sprintf(name, "%s/%lu", benches[i].name,
+					(unsigned long)benches[i].param);
+		else
+			sprintf(name, "%s", benches[i].name);
+
+		if (filter && strstr(name, filter) == NULL)
+			continue;
+
+		measure(&benches[i], reps, ms / 1000, &result);
+
+		if (json) {
+			printf("%s  {\"name\": \"%s\", \"ops\": %li, \"ns_per_op\": %.3f, "
+					"\"min_ns_per_op\": %.3f, \"bytes_per_sec\": %.0f}",
+					first ? "" : ",\n", name, result.n, result.median,
+					result.min, result.bytes * 1e9 / result.median);
+		} else {
+			printf("%-24s %12.2f %12.2f %14.0f\n", name, result.median,
+					result.min, result.bytes * 1e9 / result.median);
+		}
+
+		first = 0;
+		fflush(stdout);
+	}
+
+	if (json)
+		printf("\n]}\n");
+
+	mcp_intern_free(ident_table);
+	fbuf_free(&input);
+	return 0;
+}
@@ -0,0 +1,146 @@
+/* mcp_hpp_bench.cpp - C++ packet layouts against the hand-written C
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/mcp.hpp>
+
+/* packets encoded back to back in the input */
+#define NUM_PACKETS			(1024)
+
+/* entity, x, y, z, yaw, pitch, on ground */
+typedef mcp::layout<mcp::varint, mcp::double_, mcp::double_, mcp::double_,
+					mcp::ubyte, mcp::ubyte, mcp::bool_> move;
+
+/* results are written here so that nothing is optimized out */
+static volatile double sink;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int generate_c(struct fbuf *buf, long i)
+{
+	return mcg_varint(buf, 1000 + i % 100) ||
+			mcg_double(buf, i * 0.25) ||
+			mcg_double(buf, 64) ||
+			mcg_double(buf, -i * 0.25) ||
+			mcg_ubyte(buf, i) ||
+			mcg_ubyte(buf, i >> 8) ||
+			mcg_bool(buf, i & 1);
+}
+
+static int generate_cpp(struct fbuf *buf, long i)
+{
+	return move::write(*buf, 1000 + i % 100, i * 0.25, 64, -i * 0.25,
+						i & 0xff, (i >> 8) & 0xff, i & 1);
+}
+
+static double parse_c(struct mcp_parse *buf)
+{
+	double sum = mcp_varint(buf);
+
+	sum += mcp_double(buf);
+	sum += mcp_double(buf);
+	sum += mcp_double(buf);
+	sum += mcp_ubyte(buf);
+	sum += mcp_ubyte(buf);
+	sum += mcp_bool(buf);
+	return sum;
+}
+
+static double parse_cpp(struct mcp_parse *buf)
+{
+	move::value_type value = move::parse(*buf);
+
+	return std::get<0>(value) + std::get<1>(value) + std::get<2>(value) +
+			std::get<3>(value) + std::get<4>(value) + std::get<5>(value) +
+			std::get<6>(value);
+}
+
+static double run_generate(int (*generate)(struct fbuf *, long), long n)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	double start = now();
+	long i;
+
+	for (i = 0; i < n; i++) {
+		if (i % NUM_PACKETS == 0)
+			fbuf_clear(&buf);
+		if (generate(&buf, i))
+			abort();
+	}
+
+	start = now() - start;
+	sink = fbuf_avail(&buf);
+	fbuf_free(&buf);
+	return start * 1e9 / n;
+}
+
+static double run_parse(double (*parse)(struct mcp_parse *), struct fbuf *input,
+						long n)
+{
+	struct mcp_parse buf;
+	double start = now(), sum = 0;
+	long i;
+
+	mcp_start(&buf, fbuf_ptr(input), fbuf_avail(input));
+	for (i = 0; i < n; i++) {
+		if (mcp_eof(&buf))
+			mcp_start(&buf, fbuf_ptr(input), fbuf_avail(input));
+		sum += parse(&buf);
+	}
+
+	if (!mcp_ok(&buf))
+		abort();
+
+	start = now() - start;
+	sink = sum;
+	return start * 1e9 / n;
+}
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: ./mcp_hpp_bench <packets>\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct fbuf input = FBUF_INITIALIZER;
+	long n = 10000000, i;
+
+	if (argc > 1 && sscanf(argv[1], "%li", &n) != 1)
+		return usage();
+	if (n <= 0)
+		return usage();
+
+	for (i = 0; i < NUM_PACKETS; i++)
+		if (generate_c(&input, i))
+			abort();
+
+	/* warm up both */
+	run_generate(generate_c, n / 10);
+	run_generate(generate_cpp, n / 10);
+
+	printf("generate  c: %6.2f ns/packet  c++: %6.2f ns/packet\n",
+			run_generate(generate_c, n), run_generate(generate_cpp, n));
+	printf("parse     c: %6.2f ns/packet  c++: %6.2f ns/packet\n",
+			run_parse(parse_c, &input, n), run_parse(parse_cpp, &input, n));
+
+	fbuf_free(&input);
+	return 0;
+}
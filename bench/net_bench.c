@@ -0,0 +1,206 @@
+/* net_bench.c - loopback benchmark of the connection engine
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for nanosleep and clock_gettime */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/net.h>
+#include <mcp_base/capture.h>
+
+/* frames in flight on each connection */
+#define PIPELINE			(16)
+/* size of each frame body, about the size of a movement packet */
+#define FRAME_SIZE			(34)
+
+static int opened, measuring, stopping;
+
+/* frames echoed by each server worker while measuring, one cache line
+ * each so that the workers do not share them */
+struct counter {
+	uint64_t frames, bytes;
+	char pad[64 - 2 * sizeof(uint64_t)];
+};
+
+static struct counter *counters;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_ms(long ms)
+{
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+static void server_open(struct mcp_conn *conn, void *user)
+{
+	(void)conn;
+	(void)user;
+	__atomic_fetch_add(&opened, 1, __ATOMIC_RELAXED);
+}
+
+static void echo_frame(struct mcp_conn *conn, struct mcp_parse *frame, void *user)
+{
+	struct counter *counter = &counters[mcp_conn_worker(conn)];
+	(void)user;
+
+	/* only the frames of the steady state, once every client is connected */
+	if (__atomic_load_n(&measuring, __ATOMIC_RELAXED)) {
+		counter->frames++;
+		counter->bytes += mcp_consumed(frame) + mcp_avail(frame);
+	}
+
+	mcp_conn_send(conn, mcp_ptr(frame), mcp_avail(frame));
+}
+
+static void client_open(struct mcp_conn *conn, void *user)
+{
+	static const unsigned char data[FRAME_SIZE];
+	int i;
+	(void)user;
+
+	for (i = 0; i < PIPELINE; i++)
+		mcp_conn_send(conn, data, sizeof(data));
+}
+
+static void client_frame(struct mcp_conn *conn, struct mcp_parse *frame, void *user)
+{
+	(void)user;
+
+	/* keep the pipeline full until the benchmark stops */
+	if (!__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+		mcp_conn_send(conn, mcp_ptr(frame), mcp_avail(frame));
+}
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: ./net_bench <workers> <connections> <seconds> "
+					"<capture>\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct mcp_net_config config;
+	struct mcp_net *server, *client;
+	const struct mcp_net_stats *stats;
+	struct mcp_capture *capture = NULL;
+	int workers = 1, conns = 100, seconds = 5, i;
+	double start, connect_time, run_time;
+	uint64_t frames = 0, bytes = 0, reads = 0, writes = 0, total = 0;
+
+	if (argc > 1 && sscanf(argv[1], "%i", &workers) != 1)
+		return usage();
+	if (argc > 2 && sscanf(argv[2], "%i", &conns) != 1)
+		return usage();
+	if (argc > 3 && sscanf(argv[3], "%i", &seconds) != 1)
+		return usage();
+	if (workers <= 0 || conns <= 0 || seconds <= 0)
+		return usage();
+
+	counters = calloc(workers, sizeof(*counters));
+	if (counters == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	/* record the traffic of the server, e.g. for replay_bench */
+	if (argc > 4 && (capture = mcp_capture_open(argv[4])) == NULL) {
+		perror(argv[4]);
+		return 1;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.host = "127.0.0.1";
+	config.listen = 1;
+	config.workers = workers;
+	config.pin = 1;
+	config.capture = capture;
+	config.on_open = server_open;
+	config.on_frame = echo_frame;
+	server = mcp_net_start(&config);
+	if (server == NULL) {
+		perror("mcp_net_start");
+		return 1;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.workers = workers;
+	config.on_open = client_open;
+	config.on_frame = client_frame;
+	client = mcp_net_start(&config);
+	if (client == NULL) {
+		perror("mcp_net_start");
+		return 1;
+	}
+
+	/* how fast can connections be accepted and set up */
+	start = now();
+	for (i = 0; i < conns; i++) {
+		if (mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) < 0) {
+			perror("mcp_net_connect");
+			return 1;
+		}
+	}
+	while (__atomic_load_n(&opened, __ATOMIC_RELAXED) < conns)
+		sleep_ms(1);
+	connect_time = now() - start;
+
+	/* how many frames can be echoed, once every client is connected */
+	start = now();
+	__atomic_store_n(&measuring, 1, __ATOMIC_RELAXED);
+	sleep_ms(seconds * 1000L);
+	__atomic_store_n(&measuring, 0, __ATOMIC_RELAXED);
+	run_time = now() - start;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+	mcp_net_stop(server);
+	mcp_net_stop(client);
+
+	/* the batching of reads and writes over the whole run */
+	for (i = 0; i < workers; i++) {
+		stats = mcp_net_stats(server, i);
+		frames += counters[i].frames;
+		bytes += counters[i].bytes;
+		reads += stats->reads;
+		writes += stats->writes;
+		total += stats->frames_in;
+	}
+
+	printf("workers:           %i\n", workers);
+	printf("connections:       %i\n", conns);
+	printf("connections/sec:   %.0f\n", conns / connect_time);
+	printf("packets/sec:       %.0f\n", frames / run_time);
+	printf("packets/sec/core:  %.0f\n", frames / run_time / workers);
+	printf("frame bytes/sec:   %.0f\n", bytes / run_time);
+	printf("packets/read:      %.2f\n", reads ? (double)total / reads : 0.0);
+	printf("packets/write:     %.2f\n", writes ? (double)total / writes : 0.0);
+
+	mcp_net_free(client);
+	mcp_net_free(server);
+	free(counters);
+
+	if (mcp_capture_close(capture)) {
+		perror(argv[4]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+#!/bin/sh
+# pgo.sh - builds a profile-guided, link-time optimized release of
+# mcp_base and reports its speedup over a plain release on mcp_bench
+#
+# Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+# All rights reserved.
+#
+# This software may be modified and distributed under the terms
+# of the ISC license. See the LICENSE file for details.
+#
+# usage: bench/pgo.sh <build dir>
+#	REPS and MS set the repetitions and length of each benchmark run.
+#	the optimized build is left in <build dir>/pgo
+
+set -e
+
+src=$(cd "$(dirname "$0")/.." && pwd)
+out=$(mkdir -p "${1:-$src/_pgo_build}" && cd "${1:-$src/_pgo_build}" && pwd)
+reps=${REPS:-5}
+ms=${MS:-50}
+jobs=$(nproc 2>/dev/null || echo 1)
+
+configure() {
+	dir=$1
+	shift
+	cmake -S "$src" -B "$dir" -DCMAKE_BUILD_TYPE=Release -DBUILD_TESTING=OFF \
+		-DMCP_BASE_PGO_DIR="$out/profile" "$@" > /dev/null
+}
+
+build() {
+	cmake --build "$1" -j"$jobs" > /dev/null
+}
+
+echo "building the baseline release"
+configure "$out/base" -DMCP_BASE_LTO=OFF -DMCP_BASE_PGO=
+build "$out/base"
+
+echo "building the instrumented release"
+rm -rf "$out/profile"
+configure "$out/pgo" -DMCP_BASE_LTO=OFF -DMCP_BASE_PGO=GENERATE
+build "$out/pgo"
+
+# the training workload: parse, generate and framing loops over values of
+# every size. a workload skewed to one size makes gcc specialize memcpy for
+# it, and the fallback for other sizes gets slower
+echo "training"
+"$out/pgo/bench/mcp_bench" 1 10 > /dev/null
+
+if command -v llvm-profdata > /dev/null && ls "$out/profile"/*.profraw \
+		> /dev/null 2>&1; then
+	llvm-profdata merge -o "$out/profile/default.profdata" \
+		"$out/profile"/*.profraw
+fi
+
+echo "building the optimized release"
+configure "$out/pgo" -DMCP_BASE_LTO=ON -DMCP_BASE_PGO=USE
+build "$out/pgo"
+
+echo "benchmarking"
+"$out/base/bench/mcp_bench" "$reps" "$ms" 1 > "$out/base.json"
+"$out/pgo/bench/mcp_bench" "$reps" "$ms" 1 > "$out/pgo.json"
+
+# one "name ns_per_op" line per benchmark
+results() {
+	sed -n 's/.*"name": "\([^"]*\)".*"ns_per_op": \([0-9.]*\).*/\1 \2/p' "$1"
+}
+
+results "$out/base.json" > "$out/base.txt"
+results "$out/pgo.json" > "$out/pgo.txt"
+
+awk '
+	BEGIN {
+		printf("%-24s %12s %12s %9s\n", "benchmark", "base ns/op",
+				"pgo ns/op", "speedup")
+	}
+	NR == FNR {
+		base[$1] = $2
+		next
+	}
+	base[$1] > 0 && $2 > 0 {
+		printf("%-24s %12.2f %12.2f %8.2fx\n", $1, base[$1], $2, base[$1] / $2)
+		sum += log(base[$1] / $2)
+		n++
+	}
+	END {
+		if (n > 0)
+			printf("geometric mean speedup: %.3fx\n", exp(sum / n))
+	}' "$out/base.txt" "$out/pgo.txt"
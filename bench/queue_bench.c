@@ -0,0 +1,214 @@
+/* queue_bench.c - contention benchmark of the fbuf handoff queues
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for clock_gettime and sched_yield */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/queue.h>
+
+/* capacity of the queues and the batch the consumer pops at once */
+#define CAPACITY			(1024)
+#define BATCH				(64)
+/* largest handed off buffer */
+#define MAX_SIZE			(65536)
+
+enum kind {
+	KIND_MUTEX,
+	KIND_SPSC,
+	KIND_MPSC
+};
+
+static const char *kind_names[] = {"mutex+copy", "spsc", "mpsc"};
+
+static enum kind kind;
+static long per_producer;
+/* size of each handed off buffer */
+static size_t size = 64;
+
+static struct mcp_spsc *spsc;
+static struct mcp_mpsc *mpsc;
+
+/* the baseline: one buffer guarded by a mutex that producers copy into */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fbuf shared;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *producer(void *arg)
+{
+	static const unsigned char message[MAX_SIZE];
+	struct fbuf buf;
+	long i;
+	int full = 0;
+	(void)arg;
+
+	fbuf_init(&buf, FBUF_MAX);
+	for (i = 0; i < per_producer; i++) {
+		/* encode into a buffer of our own */
+		if (fbuf_copy(&buf, message, size))
+			abort();
+
+		do {
+			switch (kind) {
+			case KIND_MUTEX:
+				pthread_mutex_lock(&lock);
+				full = fbuf_copy(&shared, fbuf_ptr(&buf), fbuf_avail(&buf));
+				pthread_mutex_unlock(&lock);
+				if (!full)
+					fbuf_clear(&buf);
+				break;
+			case KIND_SPSC:
+				full = mcp_spsc_push(spsc, &buf);
+				break;
+			case KIND_MPSC:
+				full = mcp_mpsc_push(mpsc, &buf);
+				break;
+			}
+
+			if (full)
+				sched_yield();
+		} while (full);
+	}
+
+	fbuf_free(&buf);
+	return NULL;
+}
+
+/* receives total messages, returns the number of empty polls */
+static long consume(long total)
+{
+	struct fbuf bufs[BATCH], swap;
+	long received = 0, empty = 0;
+	size_t n, i;
+
+	fbuf_init(&swap, CAPACITY * size);
+	while (received < total) {
+		switch (kind) {
+		case KIND_MUTEX:
+			/* swap the shared buffer for our empty one */
+			pthread_mutex_lock(&lock);
+			bufs[0] = shared;
+			shared = swap;
+			pthread_mutex_unlock(&lock);
+			swap = bufs[0];
+			n = fbuf_avail(&swap) / size;
+			fbuf_clear(&swap);
+			break;
+		case KIND_SPSC:
+			n = mcp_spsc_pop(spsc, bufs, BATCH);
+			for (i = 0; i < n; i++)
+				fbuf_free(&bufs[i]);
+			break;
+		case KIND_MPSC:
+			n = mcp_mpsc_pop(mpsc, bufs, BATCH);
+			for (i = 0; i < n; i++)
+				fbuf_free(&bufs[i]);
+			break;
+		default:
+			n = 0;
+			break;
+		}
+
+		received += n;
+		if (n == 0) {
+			empty++;
+			sched_yield();
+		}
+	}
+
+	fbuf_free(&swap);
+	return empty;
+}
+
+static int run(enum kind k, int producers, long total)
+{
+	pthread_t threads[16];
+	double start, elapsed;
+	long empty;
+	int i;
+
+	kind = k;
+	per_producer = total / producers;
+	total = per_producer * producers;
+
+	start = now();
+	for (i = 0; i < producers; i++) {
+		if (pthread_create(&threads[i], NULL, producer, NULL)) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	empty = consume(total);
+
+	for (i = 0; i < producers; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = now() - start;
+
+	printf("%-12s producers: %2i  messages/sec: %10.0f  ns/message: %7.1f  "
+			"bytes/sec: %12.0f  empty polls: %li\n", kind_names[k], producers,
+			total / elapsed, elapsed * 1e9 / total, total * size / elapsed, empty);
+	return 0;
+}
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: ./queue_bench <messages> <size>\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static const int producers[] = {1, 4, 16};
+	long total = 1000000;
+	size_t i;
+
+	if (argc > 1 && sscanf(argv[1], "%li", &total) != 1)
+		return usage();
+	if (argc > 2 && sscanf(argv[2], "%zu", &size) != 1)
+		return usage();
+	if (total <= 0 || size == 0 || size > MAX_SIZE)
+		return usage();
+
+	/* the baseline buffer holds as many messages as the queues */
+	fbuf_init(&shared, CAPACITY * size);
+	spsc = mcp_spsc_new(CAPACITY);
+	mpsc = mcp_mpsc_new(CAPACITY);
+	if (spsc == NULL || mpsc == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if (run(KIND_SPSC, 1, total))
+		return 1;
+
+	for (i = 0; i < sizeof(producers) / sizeof(producers[0]); i++) {
+		if (run(KIND_MUTEX, producers[i], total))
+			return 1;
+		if (run(KIND_MPSC, producers[i], total))
+			return 1;
+	}
+
+	mcp_spsc_free(spsc);
+	mcp_mpsc_free(mpsc);
+	fbuf_free(&shared);
+	return 0;
+}
@@ -0,0 +1,286 @@
+/* region_bench.c - chunk load throughput over a region file
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for clock_gettime, pread and mkdtemp */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <zlib.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/region.h>
+
+struct totals {
+	uint64_t chunks, bytes;
+};
+
+/* the nbt of every chunk of the region, to save again */
+static struct fbuf chunks[MCP_REGION_CHUNKS];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void count_chunk(int index, struct fbuf *nbt, void *user)
+{
+	struct totals *totals = user;
+
+	(void)index;
+	__atomic_fetch_add(&totals->chunks, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&totals->bytes, fbuf_avail(nbt), __ATOMIC_RELAXED);
+}
+
+/* the way it was done before the reader: read the sectors of each chunk
+ * into a buffer, copy out the blob and inflate the copy */
+static size_t load_buffered(const char *path, struct mcp_region *region,
+							struct totals *totals)
+{
+	static unsigned char sectors[255 * MCP_REGION_SECTOR];
+	struct fbuf blob = FBUF_INITIALIZER, nbt = FBUF_INITIALIZER;
+	struct mcp_region_chunk chunk;
+	size_t failed = 0, offset, size;
+	uint32_t length;
+	ssize_t ret;
+	int fd, index;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return MCP_REGION_CHUNKS;
+
+	for (index = 0; index < MCP_REGION_CHUNKS; index++) {
+		if (region->locations[index] == 0)
+			continue;
+
+		offset = (region->locations[index] >> 8) * MCP_REGION_SECTOR;
+		size = (region->locations[index] & 0xff) * MCP_REGION_SECTOR;
+		ret = pread(fd, sectors, size, offset);
+		if (ret < 0) {
+			failed++;
+			continue;
+		}
+
+		fbuf_clear(&blob);
+		fbuf_copy(&blob, sectors, ret);
+
+		mcp_start(&chunk.data, fbuf_ptr(&blob), fbuf_avail(&blob));
+		length = mcp_uint(&chunk.data);
+		chunk.compression = mcp_ubyte(&chunk.data);
+		if (length == 0 || length - 1 > mcp_avail(&chunk.data))
+			chunk.data.error = MCP_EINVAL;
+		else
+			mcp_start(&chunk.data, mcp_ptr(&chunk.data), length - 1);
+
+		fbuf_clear(&nbt);
+		if (mcp_region_inflate(&nbt, &chunk)) {
+			failed++;
+			continue;
+		}
+		count_chunk(index, &nbt, totals);
+	}
+
+	close(fd);
+	fbuf_free(&blob);
+	fbuf_free(&nbt);
+	return failed;
+}
+
+static void keep_chunk(int index, struct fbuf *nbt, void *user)
+{
+	(void)user;
+	fbuf_copy(&chunks[index], fbuf_ptr(nbt), fbuf_avail(nbt));
+}
+
+/* the way it was done before the writer: compress, write and sync each
+ * chunk on the tick thread. the sectors are appended, as only the stall
+ * is measured */
+static void save_sync(const char *dir)
+{
+	static unsigned char data[255 * MCP_REGION_SECTOR];
+	char path[256];
+	uLongf size;
+	off_t offset = MCP_REGION_HEADER;
+	int fd, index;
+
+	snprintf(path, sizeof(path), "%s/r.0.0.mca", dir);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return;
+
+	for (index = 0; index < MCP_REGION_CHUNKS; index++) {
+		if (fbuf_avail(&chunks[index]) == 0)
+			continue;
+
+		size = sizeof(data) - 5;
+		if (compress(data + 5, &size, fbuf_ptr(&chunks[index]),
+						fbuf_avail(&chunks[index])) != Z_OK)
+			continue;
+
+		size = (size + 5 + MCP_REGION_SECTOR - 1) / MCP_REGION_SECTOR *
+					MCP_REGION_SECTOR;
+		if (pwrite(fd, data, size, offset) < 0 || fsync(fd) < 0)
+			break;
+		offset += size;
+	}
+
+	close(fd);
+	unlink(path);
+}
+
+/* saves every chunk through a writer, and returns the time spent saving
+ * them on this thread, without the flush */
+static double save_writer(struct mcp_region_writer *writer,
+							struct fbuf_pages *pages, size_t *failed)
+{
+	struct fbuf nbt;
+	double start, stall = 0;
+	int index;
+
+	for (index = 0; index < MCP_REGION_CHUNKS; index++) {
+		if (fbuf_avail(&chunks[index]) == 0)
+			continue;
+
+		/* the snapshot, serialized by the tick thread */
+		fbuf_init(&nbt, FBUF_MAX);
+		fbuf_set_pages(&nbt, pages);
+		fbuf_copy(&nbt, fbuf_ptr(&chunks[index]), fbuf_avail(&chunks[index]));
+
+		start = now();
+		while (mcp_region_save(writer, index & 31, index >> 5, 0, &nbt))
+			*failed += mcp_region_flush(writer);
+		stall += now() - start;
+	}
+
+	return stall;
+}
+
+static void report(const char *name, struct totals *totals, size_t failed,
+					double elapsed)
+{
+	printf("%s:\n", name);
+	printf("  chunks/sec:      %.0f\n", totals->chunks / elapsed);
+	printf("  nbt bytes/sec:   %.0f\n", totals->bytes / elapsed);
+	printf("  us/chunk:        %.1f\n",
+			totals->chunks ? elapsed * 1e6 / totals->chunks : 0.0);
+	printf("  malformed:       %llu\n", (unsigned long long)failed);
+}
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: ./region_bench <region> <passes> <threads>"
+					" <save passes>\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct mcp_region_writer_config config;
+	struct mcp_region_writer *writer;
+	struct mcp_region region;
+	struct fbuf_pages pages;
+	struct totals totals;
+	int passes = 10, threads = 0, saves = 0, i;
+	size_t failed;
+	double start, stall;
+	char dir[] = "/tmp/region_bench.XXXXXX", path[64];
+
+	if (argc < 2)
+		return usage();
+	if (argc > 2 && sscanf(argv[2], "%i", &passes) != 1)
+		return usage();
+	if (argc > 3 && sscanf(argv[3], "%i", &threads) != 1)
+		return usage();
+	if (argc > 4 && sscanf(argv[4], "%i", &saves) != 1)
+		return usage();
+	if (passes <= 0 || threads < 0 || saves < 0)
+		return usage();
+
+	if (mcp_region_open(&region, argv[1])) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	memset(&totals, 0, sizeof(totals));
+	failed = 0;
+	start = now();
+	for (i = 0; i < passes; i++)
+		failed += load_buffered(argv[1], &region, &totals);
+	report("buffered", &totals, failed, now() - start);
+
+	fbuf_pages_init(&pages, 4096, 16 << 20);
+	memset(&totals, 0, sizeof(totals));
+	failed = 0;
+	start = now();
+	for (i = 0; i < passes; i++)
+		failed += mcp_region_load(&region, NULL, 0, threads, &pages,
+									count_chunk, &totals);
+	report("mcp_region_load", &totals, failed, now() - start);
+
+	if (saves == 0 || mkdtemp(dir) == NULL)
+		goto done;
+
+	for (i = 0; i < MCP_REGION_CHUNKS; i++)
+		fbuf_init(&chunks[i], FBUF_MAX);
+	mcp_region_load(&region, NULL, 0, threads, NULL, keep_chunk, NULL);
+
+	/* every stall of the tick thread is a save, one chunk at a time */
+	start = now();
+	for (i = 0; i < saves; i++)
+		save_sync(dir);
+	stall = now() - start;
+	printf("save, synchronous:\n");
+	printf("  tick stall/pass: %.1f ms\n", stall * 1e3 / saves);
+
+	memset(&config, 0, sizeof(config));
+	config.dir = dir;
+	config.capacity = MCP_REGION_CHUNKS;
+	config.threads = threads;
+	config.level = -1;
+	config.pages = &pages;
+	writer = mcp_region_writer_start(&config);
+	if (writer == NULL) {
+		perror("mcp_region_writer_start");
+		goto done;
+	}
+
+	failed = 0;
+	stall = 0;
+	start = now();
+	for (i = 0; i < saves; i++) {
+		stall += save_writer(writer, &pages, &failed);
+		failed += mcp_region_flush(writer);
+	}
+	failed += mcp_region_writer_stop(writer);
+	printf("save, mcp_region_writer:\n");
+	printf("  tick stall/pass: %.1f ms\n", stall * 1e3 / saves);
+	printf("  durable/pass:    %.1f ms\n", (now() - start) * 1e3 / saves);
+	printf("  failed:          %llu\n", (unsigned long long)failed);
+
+	/* every chunk is in region 0, 0 */
+	snprintf(path, sizeof(path), "%s/r.0.0.mca", dir);
+	unlink(path);
+	rmdir(dir);
+
+done:
+	for (i = 0; i < MCP_REGION_CHUNKS; i++)
+		fbuf_free(&chunks[i]);
+	fbuf_pages_free(&pages);
+	mcp_region_close(&region);
+	return 0;
+}
@@ -0,0 +1,95 @@
+/* replay_bench.c - parse throughput over a packet capture
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for clock_gettime */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <mcp_base/mcp.h>
+#include <mcp_base/capture.h>
+
+struct totals {
+	uint64_t frames, bytes, errors;
+	/* frames seen with each packet id below 256 */
+	uint64_t ids[256];
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* parses the packet id of every frame, like a dispatcher would */
+static void parse_frame(struct mcp_record *record, void *user)
+{
+	struct totals *totals = user;
+	mcp_varint_t id = mcp_varint(&record->frame);
+
+	totals->frames++;
+	totals->bytes += mcp_consumed(&record->frame) + mcp_avail(&record->frame);
+
+	if (!mcp_ok(&record->frame))
+		totals->errors++;
+	else if (id < 256)
+		totals->ids[id]++;
+}
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: ./replay_bench <capture> <passes> <speed>\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct mcp_replay replay;
+	struct totals totals;
+	int passes = 10, i;
+	double speed = 0, start, elapsed;
+
+	if (argc < 2)
+		return usage();
+	if (argc > 2 && sscanf(argv[2], "%i", &passes) != 1)
+		return usage();
+	if (argc > 3 && sscanf(argv[3], "%lf", &speed) != 1)
+		return usage();
+	if (passes <= 0 || speed < 0)
+		return usage();
+
+	if (mcp_replay_open(&replay, argv[1])) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	memset(&totals, 0, sizeof(totals));
+	start = now();
+	for (i = 0; i < passes; i++) {
+		mcp_replay_rewind(&replay);
+		mcp_replay_run(&replay, speed, parse_frame, &totals);
+	}
+	elapsed = now() - start;
+
+	if (!mcp_ok(&replay.buf))
+		fprintf(stderr, "%s: capture ends in a malformed record\n", argv[1]);
+
+	printf("frames:            %llu\n", (unsigned long long)totals.frames);
+	printf("frames/sec:        %.0f\n", totals.frames / elapsed);
+	printf("bytes/sec:         %.0f\n", totals.bytes / elapsed);
+	printf("ns/frame:          %.1f\n",
+			totals.frames ? elapsed * 1e9 / totals.frames : 0.0);
+	printf("parse errors:      %llu\n", (unsigned long long)totals.errors);
+
+	mcp_replay_close(&replay);
+	return 0;
+}
@@ -0,0 +1,364 @@
+/* capture.c - Packet capture and replay
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for clock_gettime, nanosleep and madvise */
+#define _DEFAULT_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/capture.h>
+
+#define CAPTURE_MAGIC		"MCPCAP"
+#define CAPTURE_MAGIC_SIZE	(6)
+#define CAPTURE_HEADER_SIZE	(CAPTURE_MAGIC_SIZE + 2 + 8)
+
+struct mcp_capture {
+	int fd, failed;
+	/* held only while a record is appended to buf. a full buf is swapped
+	 * for an empty one under it, and written out after it is released */
+	int lock;
+	uint64_t start, last;
+	struct fbuf buf;
+
+	/* held while a swapped out buffer is written. the buffers are
+	 * numbered as they are swapped out, and written in that order */
+	pthread_mutex_t write_lock;
+	pthread_cond_t write_cond;
+	uint64_t swapped, written;
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void capture_lock(struct mcp_capture *capture)
+{
+	while (__atomic_exchange_n(&capture->lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&capture->lock, __ATOMIC_RELAXED))
+			;
+}
+
+static void capture_unlock(struct mcp_capture *capture)
+{
+	__atomic_store_n(&capture->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* writes buf out, called with the write lock held */
+static int capture_write(struct mcp_capture *capture, struct fbuf *buf)
+{
+	ssize_t ret;
+
+	while (fbuf_avail(buf) > 0) {
+		ret = write(capture->fd, fbuf_ptr(buf), fbuf_avail(buf));
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		/* the records are lost, remember it for mcp_capture_close */
+		if (ret < 0) {
+			capture->failed = 1;
+			fbuf_clear(buf);
+			return 1;
+		}
+
+		fbuf_consume(buf, ret);
+	}
+
+	return 0;
+}
+
+/* moves the records out of capture->buf into buf, called with the lock
+ * held. returns the number of buf, to pass to capture_write_swapped */
+static uint64_t capture_swap(struct mcp_capture *capture, struct fbuf *buf)
+{
+	*buf = capture->buf;
+	fbuf_init(&capture->buf, FBUF_MAX);
+	return capture->swapped++;
+}
+
+/* writes and frees a buffer from capture_swap once the ones swapped out
+ * before it are written, called without the lock held */
+static int capture_write_swapped(struct mcp_capture *capture,
+									struct fbuf *buf, uint64_t number)
+{
+	int ret;
+
+	pthread_mutex_lock(&capture->write_lock);
+	while (capture->written != number)
+		pthread_cond_wait(&capture->write_cond, &capture->write_lock);
+
+	ret = capture_write(capture, buf);
+
+	capture->written++;
+	pthread_cond_broadcast(&capture->write_cond);
+	pthread_mutex_unlock(&capture->write_lock);
+
+	fbuf_free(buf);
+	return ret;
+}
+
+struct mcp_capture *mcp_capture_open(const char *path)
+{
+	struct mcp_capture *capture = malloc(sizeof(*capture));
+	int err;
+
+	if (capture == NULL)
+		return NULL;
+
+	capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (capture->fd < 0) {
+		free(capture);
+		return NULL;
+	}
+
+	capture->failed = 0;
+	capture->lock = 0;
+	capture->swapped = 0;
+	capture->written = 0;
+	capture->start = clock_ns(CLOCK_MONOTONIC);
+	capture->last = capture->start;
+	fbuf_init(&capture->buf, FBUF_MAX);
+
+	if (mcg_raw(&capture->buf, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) ||
+			mcg_ushort(&capture->buf, MCP_CAPTURE_VERSION) ||
+			mcg_ulong(&capture->buf, clock_ns(CLOCK_REALTIME)) ||
+			capture_write(capture, &capture->buf)) {
+		err = capture->failed ? errno : ENOMEM;
+		close(capture->fd);
+		fbuf_free(&capture->buf);
+		free(capture);
+		errno = err;
+		return NULL;
+	}
+
+	pthread_mutex_init(&capture->write_lock, NULL);
+	pthread_cond_init(&capture->write_cond, NULL);
+	return capture;
+}
+
+int mcp_capture_flush(struct mcp_capture *capture)
+{
+	struct fbuf buf;
+	uint64_t number;
+
+	capture_lock(capture);
+	number = capture_swap(capture, &buf);
+	capture_unlock(capture);
+
+	return capture_write_swapped(capture, &buf, number);
+}
+
+int mcp_capture_close(struct mcp_capture *capture)
+{
+	int failed;
+
+	if (capture == NULL)
+		return 0;
+
+	/* no other thread may be using the capture */
+	capture_write(capture, &capture->buf);
+	failed = capture->failed;
+
+	if (close(capture->fd) < 0)
+		failed = 1;
+	fbuf_free(&capture->buf);
+	pthread_mutex_destroy(&capture->write_lock);
+	pthread_cond_destroy(&capture->write_cond);
+	free(capture);
+
+	return failed;
+}
+
+int mcp_capture_frame(struct mcp_capture *capture, uint32_t conn,
+						enum mcp_capture_dir dir, const void *body, size_t size)
+{
+	struct fbuf buf;
+	size_t old_avail;
+	uint64_t now, number;
+	int ret, full = 0;
+
+	assert(capture);
+
+	capture_lock(capture);
+
+	/* take the time under the lock so that records are in order */
+	now = clock_ns(CLOCK_MONOTONIC);
+	if (now < capture->last)
+		now = capture->last;
+
+	old_avail = fbuf_avail(&capture->buf);
+	ret = mcg_ubyte(&capture->buf, dir) ||
+			mcg_varlong(&capture->buf, now - capture->last) ||
+			mcg_varint(&capture->buf, conn) ||
+			mcg_bytes(&capture->buf, body, size);
+
+	if (ret) {
+		/* rollback partial writes */
+		fbuf_unproduce(&capture->buf, fbuf_avail(&capture->buf) - old_avail);
+	} else {
+		capture->last = now;
+		full = fbuf_avail(&capture->buf) >= MCP_CAPTURE_BUFFER;
+		if (full)
+			number = capture_swap(capture, &buf);
+	}
+
+	capture_unlock(capture);
+
+	/* the other threads go on appending to the new buffer while this one
+	 * is written */
+	if (full)
+		ret = capture_write_swapped(capture, &buf, number);
+	return ret;
+}
+
+int mcp_replay_open(struct mcp_replay *replay, const char *path)
+{
+	struct mcp_parse header;
+	struct stat st;
+	void *base;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto error;
+
+	if (st.st_size < CAPTURE_HEADER_SIZE) {
+		errno = EINVAL;
+		goto error;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		goto error;
+
+	/* the mapping keeps the file open */
+	close(fd);
+
+	/* records are read once, front to back */
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+	madvise(base, st.st_size, MADV_WILLNEED);
+
+	mcp_start(&header, base, st.st_size);
+	if (memcmp(mcp_raw(&header, CAPTURE_MAGIC_SIZE), CAPTURE_MAGIC,
+				CAPTURE_MAGIC_SIZE) != 0 ||
+			mcp_ushort(&header) != MCP_CAPTURE_VERSION) {
+		munmap(base, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	replay->base = base;
+	replay->size = st.st_size;
+	replay->start = mcp_ulong(&header);
+	mcp_replay_rewind(replay);
+	return 0;
+
+error:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+void mcp_replay_close(struct mcp_replay *replay)
+{
+	munmap((void *)replay->base, replay->size);
+	replay->base = NULL;
+	replay->size = 0;
+}
+
+void mcp_replay_rewind(struct mcp_replay *replay)
+{
+	mcp_start(&replay->buf, replay->base, replay->size);
+	mcp_consume(&replay->buf, CAPTURE_HEADER_SIZE);
+	replay->time = 0;
+}
+
+int mcp_replay_next(struct mcp_replay *replay, struct mcp_record *record)
+{
+	struct mcp_parse *buf = &replay->buf;
+	const void *body;
+	uint8_t dir;
+	size_t size;
+
+	/* pass errors, and stop at the end */
+	if (!mcp_ok(buf) || mcp_eof(buf))
+		return 0;
+
+	dir = mcp_ubyte(buf);
+	record->time = replay->time + mcp_varlong(buf);
+	record->conn = mcp_varint(buf);
+	body = mcp_bytes(buf, &size);
+
+	if (mcp_ok(buf) && dir != MCP_CAPTURE_IN && dir != MCP_CAPTURE_OUT)
+		buf->error = MCP_EINVAL;
+
+	if (!mcp_ok(buf))
+		return 0;
+
+	record->dir = dir;
+	mcp_start(&record->frame, body, size);
+	replay->time = record->time;
+	return 1;
+}
+
+/* sleeps until the monotonic clock reaches when, in nanoseconds */
+static void sleep_until(uint64_t when)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	while ((now = clock_ns(CLOCK_MONOTONIC)) < when) {
+		ts.tv_sec = (when - now) / 1000000000;
+		ts.tv_nsec = (when - now) % 1000000000;
+		nanosleep(&ts, NULL);
+	}
+}
+
+size_t mcp_replay_run(struct mcp_replay *replay, double speed,
+						mcp_replay_fn fn, void *user)
+{
+	struct mcp_record record;
+	uint64_t first = 0, start = clock_ns(CLOCK_MONOTONIC);
+	size_t count = 0;
+
+	assert(speed >= 0);
+
+	while (mcp_replay_next(replay, &record)) {
+		/* the timing is relative to the first record replayed */
+		if (count == 0)
+			first = record.time;
+
+		if (speed > 0)
+			sleep_until(start + (uint64_t)((record.time - first) / speed));
+
+		fn(&record, user);
+		count++;
+	}
+
+	return count;
+}
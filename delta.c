@@ -0,0 +1,269 @@
+/* delta.c - Delta encoding of entity updates
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memset and memcpy */
+#include <string.h>
+/* for assert */
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/delta.h>
+
+/* number of entities compared together, before any packet is written */
+#define DELTA_BLOCK			(64)
+
+/* the largest frame without metadata: a teleport with a prefix and two
+ * varints */
+#define DELTA_MAX_FRAME		(1 + 5 + 5 + 3 * 8 + 3)
+
+/* flags of struct mcp_delta */
+#define DELTA_SENT			(1)
+
+/* what changed for an entity */
+#define CHANGE_MOVED		(1)
+#define CHANGE_FAR			(2)
+#define CHANGE_TURNED		(4)
+#define CHANGE_GROUND		(8)
+#define CHANGE_META			(16)
+
+void mcp_delta_reset(struct mcp_delta *last, size_t count)
+{
+	memset(last, 0, count * sizeof(*last));
+}
+
+/* positions are rounded to the nearest 1/4096th of a block, as the relative
+ * moves are. adding 1.5 * 2^52 leaves the rounded value in the low bits of
+ * the double, which is cheaper than a conversion and needs no libm. this
+ * holds for positions within 2^39 blocks, far past the border of a world */
+static inline int64_t delta_fixed(double value)
+{
+	double shifted = value * 4096 + 6755399441055744.0;
+	int64_t bits;
+
+	memcpy(&bits, &shifted, sizeof(bits));
+	return bits - INT64_C(0x4338000000000000);
+}
+
+/* whether a delta fits in a short */
+static inline int delta_near(int64_t delta)
+{
+	return (uint64_t)(delta + 32768) <= 65535;
+}
+
+static inline size_t varint_size(mcp_varint_t value)
+{
+	size_t size = 1;
+
+	while (value > 0x7f) {
+		value >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+static inline unsigned char *put_varint(unsigned char *dest,
+										mcp_varint_t value)
+{
+	while (value > 0x7f) {
+		*dest++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	*dest++ = value;
+	return dest;
+}
+
+static inline unsigned char *put_short(unsigned char *dest, int64_t value)
+{
+	dest[0] = (value >> 8) & 0xff;
+	dest[1] = value & 0xff;
+	return dest + 2;
+}
+
+static inline unsigned char *put_double(unsigned char *dest, double x)
+{
+	union {
+		uint64_t i;
+		double f;
+	} value;
+	int i;
+
+	/* the same type-pun as mcg_double */
+	value.f = x;
+	for (i = 0; i < 8; i++)
+		dest[i] = (value.i >> (56 - 8 * i)) & 0xff;
+	return dest + 8;
+}
+
+/* writes the packet id and entity id of a frame after a one byte length
+ * prefix, which is filled in by end_frame. frames without metadata are
+ * always shorter than 128 bytes */
+static inline unsigned char *begin_frame(unsigned char *dest,
+											mcp_varint_t packet,
+											mcp_varint_t entity)
+{
+	return put_varint(put_varint(dest + 1, packet), entity);
+}
+
+static inline unsigned char *end_frame(unsigned char *frame,
+										unsigned char *end)
+{
+	assert(end - frame - 1 < 0x80);
+	frame[0] = end - frame - 1;
+	return end;
+}
+
+/* finds what changed for a block of entities. this loop has no branches
+ * and writes nothing but the changes, so it is cheap for idle entities */
+static void delta_compare(const struct mcp_entities *entities,
+						const struct mcp_delta *last, size_t start,
+						size_t n, unsigned char *changes)
+{
+	int64_t dx, dy, dz;
+	size_t i, j;
+
+	for (i = 0; i < n; i++) {
+		j = start + i;
+		dx = delta_fixed(entities->x[j]) - last[j].x;
+		dy = delta_fixed(entities->y[j]) - last[j].y;
+		dz = delta_fixed(entities->z[j]) - last[j].z;
+
+		/* an entity that was not sent anything is far from anywhere */
+		changes[i] = ((dx | dy | dz) != 0) * CHANGE_MOVED |
+				!(delta_near(dx) & delta_near(dy) & delta_near(dz) &
+					(last[j].flags & DELTA_SENT)) * CHANGE_FAR |
+				((entities->yaw[j] != last[j].yaw) |
+					(entities->pitch[j] != last[j].pitch)) * CHANGE_TURNED |
+				(entities->on_ground[j] != last[j].on_ground) * CHANGE_GROUND;
+	}
+
+	if (entities->meta_version != NULL) {
+		for (i = 0; i < n; i++) {
+			j = start + i;
+			changes[i] |= ((entities->meta_version[j] != last[j].meta_version) |
+							!(last[j].flags & DELTA_SENT)) * CHANGE_META;
+		}
+	}
+}
+
+/* writes the frames of one entity that changed */
+static int delta_entity(struct fbuf *out, const struct mcp_delta_ids *ids,
+						const struct mcp_entities *entities,
+						struct mcp_delta *last, size_t i, unsigned changes)
+{
+	struct mcp_delta *state = &last[i];
+	mcp_varint_t id = entities->ids[i];
+	unsigned char *start, *dest, *frame;
+	size_t meta = 0;
+	int64_t x, y, z;
+
+	if (changes & CHANGE_META) {
+		meta = entities->meta_size[i];
+
+		/* overflow check */
+		if (meta > MCP_BYTES_MAX_SIZE - 10)
+			return 1;
+	}
+
+	/* both frames are written, or neither */
+	start = fbuf_wptr(out, 2 * DELTA_MAX_FRAME + meta);
+	if (start == NULL)
+		return 1;
+	frame = dest = start;
+
+	x = delta_fixed(entities->x[i]);
+	y = delta_fixed(entities->y[i]);
+	z = delta_fixed(entities->z[i]);
+
+	if (changes & CHANGE_FAR) {
+		dest = begin_frame(frame, ids->teleport, id);
+		dest = put_double(dest, entities->x[i]);
+		dest = put_double(dest, entities->y[i]);
+		dest = put_double(dest, entities->z[i]);
+		*dest++ = entities->yaw[i];
+		*dest++ = entities->pitch[i];
+		*dest++ = !!entities->on_ground[i];
+		dest = end_frame(frame, dest);
+	} else if (changes & CHANGE_MOVED) {
+		dest = begin_frame(frame, changes & CHANGE_TURNED ?
+							ids->move_look : ids->move, id);
+		dest = put_short(dest, x - state->x);
+		dest = put_short(dest, y - state->y);
+		dest = put_short(dest, z - state->z);
+		if (changes & CHANGE_TURNED) {
+			*dest++ = entities->yaw[i];
+			*dest++ = entities->pitch[i];
+		}
+		*dest++ = !!entities->on_ground[i];
+		dest = end_frame(frame, dest);
+	} else if (changes & CHANGE_TURNED) {
+		/* a look also carries on ground */
+		dest = begin_frame(frame, ids->look, id);
+		*dest++ = entities->yaw[i];
+		*dest++ = entities->pitch[i];
+		*dest++ = !!entities->on_ground[i];
+		dest = end_frame(frame, dest);
+	} else if (changes & CHANGE_GROUND) {
+		dest = begin_frame(frame, ids->move, id);
+		dest = put_short(dest, 0);
+		dest = put_short(dest, 0);
+		dest = put_short(dest, 0);
+		*dest++ = !!entities->on_ground[i];
+		dest = end_frame(frame, dest);
+	}
+
+	if (changes & CHANGE_META) {
+		/* the length prefix of metadata may be longer than a byte */
+		dest = put_varint(dest, varint_size(ids->metadata) + varint_size(id) +
+									meta);
+		dest = put_varint(put_varint(dest, ids->metadata), id);
+		if (meta > 0)
+			memcpy(dest, entities->meta[i], meta);
+		dest += meta;
+		state->meta_version = entities->meta_version[i];
+	}
+
+	fbuf_produce(out, dest - start);
+
+	state->x = x;
+	state->y = y;
+	state->z = z;
+	state->yaw = entities->yaw[i];
+	state->pitch = entities->pitch[i];
+	state->on_ground = entities->on_ground[i];
+	state->flags |= DELTA_SENT;
+	return 0;
+}
+
+int mcp_delta_encode(struct fbuf *out, const struct mcp_delta_ids *ids,
+						const struct mcp_entities *entities,
+						struct mcp_delta *last)
+{
+	unsigned char changes[DELTA_BLOCK];
+	size_t start, n, i;
+
+	for (start = 0; start < entities->count; start += n) {
+		n = entities->count - start;
+		if (n > DELTA_BLOCK)
+			n = DELTA_BLOCK;
+
+		delta_compare(entities, last, start, n, changes);
+
+		for (i = 0; i < n; i++) {
+			if (changes[i] == 0)
+				continue;
+			if (delta_entity(out, ids, entities, last, start + i, changes[i]))
+				return 1;
+		}
+	}
+
+	return 0;
+}
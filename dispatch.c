@@ -0,0 +1,39 @@
+/* dispatch.c - Packet id dispatch tables
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <mcp_base/mcp.h>
+#include <mcp_base/trace.h>
+#include <mcp_base/dispatch.h>
+
+int mcp_dispatch_slow(const struct mcp_dispatch *table, uint64_t *counts,
+						void *context, struct mcp_parse *buf)
+{
+	mcp_varint_t id = mcp_varint(buf);
+	mcp_handler_t handler = NULL;
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return -1;
+
+	if (id < table->size)
+		handler = table->handlers[id];
+
+	if (handler == NULL) {
+		if (counts != NULL)
+			counts[table->size]++;
+		buf->error = MCP_EINVAL;
+		MCP_TRACE_ERROR(MCP_SITE_DISPATCH, MCP_EINVAL, mcp_consumed(buf));
+		return -1;
+	}
+
+	if (counts != NULL)
+		counts[id]++;
+
+	return handler(context, buf);
+}
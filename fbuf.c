@@ -7,15 +7,32 @@
  * of the ISC license. See the LICENSE file for details.
  */
 
+/* for mmap and madvise */
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
 #include <mcp_base/fbuf.h>
+#include <mcp_base/trace.h>
 
 /* verify fbuf invariants */
 static inline void assert_valid_fbuf(struct fbuf *buf)
 {
+	/* unused when assertions are disabled */
+	(void)buf;
+
 	/* valid pointer */
 	assert(buf);
 	/* base = NULL <=> buf->size = 0*/
@@ -31,13 +48,315 @@ static inline void assert_valid_fbuf(struct fbuf *buf)
 #define FBUF_INITIAL_SIZE	(1024)
 #define FBUF_EXPAND_COEFF	(2)
 
+/* charges size bytes to the budget, returns one if it does not fit */
+static int budget_charge(struct fbuf_budget *budget, size_t size)
+{
+	size_t used;
+
+	if (budget == NULL)
+		return 0;
+
+	used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+	do {
+		if (size > budget->limit || used > budget->limit - size)
+			return 1;
+	} while (!__atomic_compare_exchange_n(&budget->used, &used, used + size, 1,
+								__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return 0;
+}
+
+static void budget_refund(struct fbuf_budget *budget, size_t size)
+{
+	if (budget != NULL)
+		__atomic_fetch_sub(&budget->used, size, __ATOMIC_RELAXED);
+}
+
+int fbuf_set_budget(struct fbuf *buf, struct fbuf_budget *budget)
+{
+	assert_valid_fbuf(buf);
+
+	if (budget == buf->budget)
+		return 0;
+
+	if (budget_charge(budget, buf->size))
+		return 1;
+
+	budget_refund(buf->budget, buf->size);
+	buf->budget = budget;
+	return 0;
+}
+
+/* a free block of a pool, kept in the block itself */
+struct fbuf_page_block {
+	struct fbuf_page_block *next;
+	size_t size;
+};
+
+/* whether a block of size bytes is taken from the pool */
+static inline int pooled(struct fbuf_pages *pages, size_t size)
+{
+	return pages != NULL && size >= pages->threshold;
+}
+
+/* blocks of a pool are whole pages, or whole huge pages. the size of the
+ * buffer may be clamped below the size of its block by max_size, but never
+ * by a page or huge page, so the size of the block is found again by
+ * rounding up */
+static inline size_t block_size(size_t size)
+{
+	if (size <= FBUF_HUGE_PAGE)
+		return (size + FBUF_PAGE - 1) & ~(FBUF_PAGE - 1);
+	return (size + FBUF_HUGE_PAGE - 1) & ~(FBUF_HUGE_PAGE - 1);
+}
+
+/* the size of a new block for a buffer of size bytes */
+static size_t buf_block_size(struct fbuf *buf, size_t size)
+{
+	if (!pooled(buf->pages, size))
+		return size;
+
+	size = block_size(size);
+	return size > buf->max_size ? buf->max_size : size;
+}
+
+static void pages_lock(struct fbuf_pages *pages)
+{
+	while (__atomic_exchange_n(&pages->lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&pages->lock, __ATOMIC_RELAXED))
+			;
+}
+
+static void pages_unlock(struct fbuf_pages *pages)
+{
+	__atomic_store_n(&pages->lock, 0, __ATOMIC_RELEASE);
+}
+
+#if defined(__linux__) && defined(SYS_mbind)
+/* the MPOL_PREFERRED policy of mbind, and the nodes that a mask holds */
+# define MPOL_PREFERRED		(1)
+# define BIND_MAX_NODES		(1024)
+
+/* prefers the node of the pool for the pages of a block, before they are
+ * touched. this is best effort, as placement only affects speed */
+static void pages_bind(struct fbuf_pages *pages, void *ptr, size_t size)
+{
+	unsigned long mask[BIND_MAX_NODES / (8 * sizeof(unsigned long))];
+	size_t bits = 8 * sizeof(unsigned long);
+
+	if (!pages->bind || pages->node < 0 || pages->node >= BIND_MAX_NODES)
+		return;
+
+	memset(mask, 0, sizeof(mask));
+	mask[pages->node / bits] |= 1UL << (pages->node % bits);
+	syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, mask, BIND_MAX_NODES + 1, 0);
+}
+#else
+static void pages_bind(struct fbuf_pages *pages, void *ptr, size_t size)
+{
+	(void)pages;
+	(void)ptr;
+	(void)size;
+}
+#endif
+
+#ifdef MAP_ANONYMOUS
+static void *pages_map(struct fbuf_pages *pages, size_t size)
+{
+	unsigned char *ptr, *aligned;
+	size_t head;
+
+	/* smaller blocks are plain pages */
+	if (size < FBUF_HUGE_PAGE) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+		pages_bind(pages, ptr, size);
+		return ptr;
+	}
+
+# ifdef MAP_HUGETLB
+	/* explicit huge pages, if any were reserved */
+	if (!__atomic_load_n(&pages->no_hugetlb, __ATOMIC_RELAXED)) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			pages_bind(pages, ptr, size);
+			return ptr;
+		}
+		__atomic_store_n(&pages->no_hugetlb, 1, __ATOMIC_RELAXED);
+	}
+# endif
+
+	/* otherwise transparent huge pages, which are only used for ranges
+	 * aligned to a huge page. so map one more and trim it */
+	ptr = mmap(NULL, size + FBUF_HUGE_PAGE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+
+	aligned = (unsigned char *)(((uintptr_t)ptr + FBUF_HUGE_PAGE - 1) &
+								~(uintptr_t)(FBUF_HUGE_PAGE - 1));
+	head = aligned - ptr;
+	if (head > 0)
+		munmap(ptr, head);
+	if (head < FBUF_HUGE_PAGE)
+		munmap(aligned + size, FBUF_HUGE_PAGE - head);
+
+# ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+# endif
+	pages_bind(pages, aligned, size);
+	return aligned;
+}
+
+static void pages_unmap(void *ptr, size_t size)
+{
+	munmap(ptr, size);
+}
+#else
+/* without mmap the blocks are only pooled */
+static void *pages_map(struct fbuf_pages *pages, size_t size)
+{
+	(void)pages;
+	return malloc(size);
+}
+
+static void pages_unmap(void *ptr, size_t size)
+{
+	(void)size;
+	free(ptr);
+}
+#endif
+
+/* takes a free block of size bytes from the pool, or maps a new one */
+static unsigned char *pages_get(struct fbuf_pages *pages, size_t size)
+{
+	struct fbuf_page_block **link, *block = NULL;
+
+	pages_lock(pages);
+	for (link = &pages->free; *link != NULL; link = &(*link)->next) {
+		if ((*link)->size == size) {
+			block = *link;
+			*link = block->next;
+			pages->cached -= size;
+			break;
+		}
+	}
+	pages_unlock(pages);
+
+	if (block != NULL)
+		return (unsigned char *)block;
+
+	return pages_map(pages, size);
+}
+
+/* keeps a block for reuse, or unmaps it if the pool is full */
+static void pages_put(struct fbuf_pages *pages, void *ptr, size_t size)
+{
+	struct fbuf_page_block *block = ptr;
+
+	pages_lock(pages);
+	if (size <= pages->max_cached - pages->cached) {
+		block->next = pages->free;
+		block->size = size;
+		pages->free = block;
+		pages->cached += size;
+		block = NULL;
+	}
+	pages_unlock(pages);
+
+	if (block != NULL)
+		pages_unmap(ptr, size);
+}
+
+/* frees the block of buf, to its pool if it was taken from it */
+static void release_block(struct fbuf *buf)
+{
+	if (pooled(buf->pages, buf->size))
+		pages_put(buf->pages, buf->base, block_size(buf->size));
+	else
+		free(buf->base);
+}
+
+/* moves the data of buf to the front of a new block of size bytes from
+ * pages, and frees the old block. returns NULL if there is no memory */
+static unsigned char *move_block(struct fbuf *buf, struct fbuf_pages *pages,
+									size_t size)
+{
+	unsigned char *new_base;
+
+	if (pooled(pages, size))
+		new_base = pages_get(pages, block_size(size));
+	else
+		new_base = malloc(size);
+
+	if (new_base == NULL)
+		return NULL;
+
+	if (fbuf_avail(buf) > 0)
+		memcpy(new_base, fbuf_ptr(buf), fbuf_avail(buf));
+	if (buf->base != NULL)
+		release_block(buf);
+
+	buf->end -= buf->start;
+	buf->start = 0;
+	return new_base;
+}
+
+void fbuf_pages_free(struct fbuf_pages *pages)
+{
+	struct fbuf_page_block *block, *next;
+
+	pages_lock(pages);
+	block = pages->free;
+	pages->free = NULL;
+	pages->cached = 0;
+	pages_unlock(pages);
+
+	for (; block != NULL; block = next) {
+		next = block->next;
+		pages_unmap(block, block->size);
+	}
+}
+
+int fbuf_set_pages(struct fbuf *buf, struct fbuf_pages *pages)
+{
+	assert_valid_fbuf(buf);
+
+	/* a block can not be moved between pools */
+	if (buf->base != NULL && pages != buf->pages)
+		return 1;
+
+	buf->pages = pages;
+	return 0;
+}
+
+int fbuf_migrate(struct fbuf *buf, struct fbuf_pages *pages)
+{
+	unsigned char *new_base;
+	assert_valid_fbuf(buf);
+
+	if (buf->base != NULL) {
+		new_base = move_block(buf, pages, buf->size);
+		if (new_base == NULL)
+			return 1;
+		buf->base = new_base;
+	}
+
+	buf->pages = pages;
+	return 0;
+}
+
 void fbuf_free(struct fbuf *buf)
 {
 	assert_valid_fbuf(buf);
 
 	/* if we have a non-zero object then free it's buffer */
 	if (buf->base)
-		free(buf->base);
+		release_block(buf);
+	budget_refund(buf->budget, buf->size);
 
 	/* and ensure it is cleared */
 	buf->base = 0;
@@ -122,8 +441,10 @@ size_t fbuf_expand(struct fbuf *buf, size_t requested_size)
 	requested_size += fbuf_avail(buf);
 
 	/* check if we can ever satisfy this request */
-	if (buf->max_size < requested_size)
+	if (buf->max_size < requested_size) {
+		MCP_TRACE_ERROR(MCP_SITE_FBUF_EXPAND, MCP_EOVERFLOW, fbuf_avail(buf));
 		return fbuf_wavail(buf);
+	}
 
 	/* check if we can just compact the buffer to satisfy the request */
 	if (buf->size >= requested_size) {
@@ -131,13 +452,31 @@ size_t fbuf_expand(struct fbuf *buf, size_t requested_size)
 		return fbuf_wavail(buf);
 	}
 
-	/* allocate new space */
-	new_size = next_size(requested_size, buf->max_size);
-	new_base = realloc(buf->base, new_size);
+	/* allocate new space, if the budget allows it.
+	 * near the limit of the budget only grow as much as requested */
+	new_size = buf_block_size(buf, next_size(requested_size, buf->max_size));
+	if (budget_charge(buf->budget, new_size - buf->size)) {
+		new_size = buf_block_size(buf, requested_size);
+		if (budget_charge(buf->budget, new_size - buf->size)) {
+			MCP_TRACE_ERROR(MCP_SITE_FBUF_EXPAND, MCP_ENOMEM, fbuf_avail(buf));
+			return fbuf_wavail(buf);
+		}
+	}
+
+	/* large blocks are moved between blocks of the pool */
+	if (pooled(buf->pages, new_size))
+		new_base = move_block(buf, buf->pages, new_size);
+	else
+		new_base = realloc(buf->base, new_size);
 
 	/* check if realloc failed */
-	if (new_base == NULL)
+	if (new_base == NULL) {
+		budget_refund(buf->budget, new_size - buf->size);
+		MCP_TRACE_ERROR(MCP_SITE_FBUF_EXPAND, MCP_ENOMEM, fbuf_avail(buf));
 		return fbuf_wavail(buf);
+	}
+
+	MCP_TRACE_REALLOC(MCP_SITE_FBUF_EXPAND, buf->size, new_size);
 
 	/* update the pointers*/
 	buf->base = new_base;
@@ -179,22 +518,41 @@ int fbuf_shrink(struct fbuf *buf, size_t new_max)
 
 	/* avoid calling realloc with size=0 */
 	if (new_max == 0) {
-		free(buf->base);
+		budget_refund(buf->budget, buf->size);
+		release_block(buf);
 		buf->base = NULL;
 		buf->size = 0;
 		buf->max_size = 0;
 		return 0;
 	}
 
-	/* compact and realloc */
-	fbuf_compact(buf);
-	new_base = realloc(buf->base, new_max);
+	if (pooled(buf->pages, buf->size)) {
+		/* a pooled block that still fits is kept, as the size of its
+		 * block is found by rounding up */
+		if (pooled(buf->pages, new_max) &&
+				block_size(new_max) == block_size(buf->size)) {
+			fbuf_compact(buf);
+		} else {
+			new_base = move_block(buf, buf->pages, new_max);
+			if (new_base == NULL)
+				return 1;
+			buf->base = new_base;
+			MCP_TRACE_REALLOC(MCP_SITE_FBUF_SHRINK, buf->size, new_max);
+		}
+	} else {
+		/* compact and realloc */
+		fbuf_compact(buf);
+		new_base = realloc(buf->base, new_max);
 
-	/* check that realloc succeeded */
-	if (new_base != NULL)
-		buf->base = new_base;
+		/* check that realloc succeeded */
+		if (new_base != NULL) {
+			buf->base = new_base;
+			MCP_TRACE_REALLOC(MCP_SITE_FBUF_SHRINK, buf->size, new_max);
+		}
+	}
 
 	/* update pointers */
+	budget_refund(buf->budget, buf->size - new_max);
 	buf->size = new_max;
 	buf->max_size = new_max;
 	return 0;
@@ -0,0 +1,92 @@
+/* arena.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_ARENA_H
+#define MCP_BASE_ARENA_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uintptr_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the size of the chunks of an arena, unless one allocation is larger */
+#ifndef MCP_ARENA_CHUNK
+# define MCP_ARENA_CHUNK			(16384)
+#endif
+
+/* the alignment of mcp_arena_alloc, enough for any scalar type */
+#define MCP_ARENA_ALIGN				(16)
+
+struct mcp_arena_chunk;
+
+/* a bump-pointer allocator for the copies and decoded structures of a
+ * packet or a tick. nothing is freed on its own: mcp_arena_reset frees
+ * everything at once by rewinding to the first chunk. the chunks are kept
+ * and reused, so an arena that is reset after each packet stops calling
+ * malloc once it has grown to fit the largest packet */
+struct mcp_arena {
+	/* the free space of the current chunk */
+	unsigned char *next, *end;
+	struct mcp_arena_chunk *first, *current;
+};
+
+#define MCP_ARENA_INITIALIZER		{NULL, NULL, NULL, NULL}
+static inline void mcp_arena_init(struct mcp_arena *arena)
+{
+	arena->next = NULL;
+	arena->end = NULL;
+	arena->first = NULL;
+	arena->current = NULL;
+}
+
+/* frees the chunks of an arena, and everything allocated from it */
+void mcp_arena_free(struct mcp_arena *arena);
+/* frees everything allocated from an arena, but keeps its chunks */
+void mcp_arena_reset(struct mcp_arena *arena);
+
+/* allocates from the next chunk, growing the arena if needed */
+void *mcp_arena_grow(struct mcp_arena *arena, size_t size, size_t align);
+
+/* returns size bytes aligned to MCP_ARENA_ALIGN, or NULL if there is no
+ * memory. the memory is valid until the arena is reset or freed */
+static inline void *mcp_arena_alloc(struct mcp_arena *arena, size_t size)
+{
+	uintptr_t next = ((uintptr_t)arena->next + MCP_ARENA_ALIGN - 1) &
+						~(uintptr_t)(MCP_ARENA_ALIGN - 1);
+	uintptr_t end = (uintptr_t)arena->end;
+
+	/* an arena without chunks has next and end at zero */
+	if (next >= end || size > end - next)
+		return mcp_arena_grow(arena, size, MCP_ARENA_ALIGN);
+
+	arena->next = (unsigned char *)next + size;
+	return (void *)next;
+}
+
+/* decode a byte array or string into a copy in the arena. the copies are
+ * NUL-terminated, and size is set to their size without the terminator.
+ * the strings are bounded and validated like mcp_string. MCP_ENOMEM is
+ * asserted if the arena could not grow, and NULL is returned on error */
+void *mcp_arena_bytes(struct mcp_parse *buf, struct mcp_arena *arena,
+						size_t *size);
+char *mcp_arena_string(struct mcp_parse *buf, struct mcp_arena *arena,
+						size_t *size, size_t max_units);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+/* batch.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_BATCH_H
+#define MCP_BASE_BATCH_H
+
+/* for size_t */
+#include <stdlib.h>
+
+#include <mcp_base/mcp.h>
+
+/* fixed-width field types. each decodes like the mcp function of
+ * the same name into an array of the same c type */
+enum mcp_field {
+	MCP_FIELD_UBYTE,
+	MCP_FIELD_BYTE,
+	MCP_FIELD_BOOL,
+	MCP_FIELD_USHORT,
+	MCP_FIELD_SHORT,
+	MCP_FIELD_UINT,
+	MCP_FIELD_INT,
+	MCP_FIELD_ULONG,
+	MCP_FIELD_LONG,
+	MCP_FIELD_FLOAT,
+	MCP_FIELD_DOUBLE
+};
+
+/* one column of a structure-of-arrays batch.
+ * dest points to an array with one element per frame */
+struct mcp_column {
+	enum mcp_field type;
+	void *dest;
+};
+
+/* returns the size in bytes of one row of the layout described by columns */
+size_t mcp_batch_size(const struct mcp_column *columns, size_t ncolumns);
+
+/* decodes nframes frames that all start with the layout described by columns,
+ * one column at a time. each frame is consumed past the layout.
+ * frames without enough data for the layout get MCP_EAGAIN set.
+ * frames with an error get zero in every column.
+ * returns the number of frames decoded without error. */
+size_t mcp_batch(const struct mcp_column *columns, size_t ncolumns,
+					struct mcp_parse *frames, size_t nframes);
+
+#endif
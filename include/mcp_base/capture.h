@@ -0,0 +1,97 @@
+/* capture.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_CAPTURE_H
+#define MCP_BASE_CAPTURE_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint64_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+
+/* records are buffered until this many bytes are waiting */
+#ifndef MCP_CAPTURE_BUFFER
+# define MCP_CAPTURE_BUFFER			(1048576)
+#endif
+
+/* the current version of the capture format */
+#define MCP_CAPTURE_VERSION			(1)
+
+/* a capture file starts with a header:
+ *	raw			magic, "MCPCAP"
+ *	ushort		version
+ *	ulong		wall clock time the capture was opened, in nanoseconds
+ * followed by records until the end of the file:
+ *	ubyte		direction, see enum mcp_capture_dir
+ *	varlong		nanoseconds since the previous record, or the header
+ *	varint		connection id
+ *	bytes		body of the frame */
+
+enum mcp_capture_dir {
+	MCP_CAPTURE_IN = 0,
+	MCP_CAPTURE_OUT = 1
+};
+
+struct mcp_capture;
+
+/* creates or truncates the capture file at path.
+ * on error returns NULL and sets errno */
+struct mcp_capture *mcp_capture_open(const char *path);
+/* writes what is buffered and closes the capture.
+ * returns zero if every record was written */
+int mcp_capture_close(struct mcp_capture *capture);
+/* records the body of a frame, stamped with the current time.
+ * safe to call from any thread. returns zero on success */
+int mcp_capture_frame(struct mcp_capture *capture, uint32_t conn,
+						enum mcp_capture_dir dir, const void *body, size_t size);
+/* writes what is buffered. returns zero on success */
+int mcp_capture_flush(struct mcp_capture *capture);
+
+struct mcp_record {
+	/* nanoseconds since the capture was opened */
+	uint64_t time;
+	uint32_t conn;
+	enum mcp_capture_dir dir;
+	/* over the body of the frame */
+	struct mcp_parse frame;
+};
+
+/* a capture mapped into memory */
+struct mcp_replay {
+	const unsigned char *base;
+	size_t size;
+	/* wall clock time the capture was opened, in nanoseconds */
+	uint64_t start;
+	/* the records that are left. a malformed record sets MCP_EINVAL,
+	 * and a record cut short, e.g. by a crash, sets MCP_EAGAIN */
+	struct mcp_parse buf;
+	uint64_t time;
+};
+
+typedef void (*mcp_replay_fn)(struct mcp_record *record, void *user);
+
+/* maps the capture at path. on error returns non-zero and sets errno */
+int mcp_replay_open(struct mcp_replay *replay, const char *path);
+/* unmaps the capture */
+void mcp_replay_close(struct mcp_replay *replay);
+/* starts again from the first record */
+void mcp_replay_rewind(struct mcp_replay *replay);
+/* reads the next record. returns one if a record was read, or zero at
+ * the end of the capture or on error, see replay->buf */
+int mcp_replay_next(struct mcp_replay *replay, struct mcp_record *record);
+/* calls fn with every record that is left. with a speed of zero the
+ * records are replayed as fast as possible, otherwise at the recorded
+ * timing sped up by speed. returns the number of records replayed */
+size_t mcp_replay_run(struct mcp_replay *replay, double speed,
+						mcp_replay_fn fn, void *user);
+
+#endif
@@ -0,0 +1,428 @@
+/* coro.hpp
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_CORO_HPP
+#define MCP_BASE_CORO_HPP
+
+/* a C++20 coroutine reader over an inbound fbuf.
+ *
+ *	mcp::task handshake(mcp::stream &in)
+ *	{
+ *		mcp_varint_t version = co_await in.varint();
+ *		auto [host, port] = co_await in.read<mcp::layout<mcp::string<255>,
+ *														mcp::ushort>>();
+ *		if (!in.ok())
+ *			co_return;
+ *		...
+ *	}
+ *
+ * a read that runs out of data suspends the coroutine without blocking the
+ * thread, and is retried when more data is written to the stream. nothing
+ * is consumed from the fbuf until a read completes. errors are sticky, like
+ * those of a mcp_parse: once set, every later read completes immediately
+ * with a value-initialized result.
+ *
+ * coroutine frames come from per-thread free lists, so the frames of many
+ * connections stuck in a handshake reuse the same memory. */
+
+#include <cstddef>
+#include <cstdlib>
+#include <coroutine>
+#include <utility>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/mcp.hpp>
+
+/* frames up to this size come from the pool, larger ones from malloc */
+#ifndef MCP_CORO_POOL_MAX
+# define MCP_CORO_POOL_MAX			(4096)
+#endif
+
+/* frames are rounded up to a multiple of this */
+#ifndef MCP_CORO_POOL_ALIGN
+# define MCP_CORO_POOL_ALIGN		(64)
+#endif
+
+/* the pool takes memory from malloc in slabs of this size */
+#ifndef MCP_CORO_POOL_SLAB
+# define MCP_CORO_POOL_SLAB			(65536)
+#endif
+
+namespace mcp {
+
+/* per-thread free lists of coroutine frames, by size class.
+ * a frame must be freed on the thread that allocated it. frames still in
+ * use when the thread exits keep their slabs, which are freed with the last
+ * of them, e.g. by a task in a static */
+class frame_pool {
+public:
+	struct stats {
+		/* bytes of frames in use and bytes taken from malloc */
+		std::size_t used, reserved;
+	};
+
+	static void *allocate(std::size_t size)
+	{
+		pool &p = local();
+		std::size_t index = (size + MCP_CORO_POOL_ALIGN - 1) /
+							MCP_CORO_POOL_ALIGN;
+		void *frame;
+
+		if (index > NUM_CLASSES)
+			return std::malloc(size);
+
+		frame = p.free[index - 1];
+		if (frame != NULL) {
+			p.free[index - 1] = *static_cast<void **>(frame);
+		} else {
+			frame = p.carve(index * MCP_CORO_POOL_ALIGN);
+			if (frame == NULL)
+				return NULL;
+		}
+
+		p.used += index * MCP_CORO_POOL_ALIGN;
+		return frame;
+	}
+
+	static void deallocate(void *frame, std::size_t size)
+	{
+		pool &p = local();
+		std::size_t index = (size + MCP_CORO_POOL_ALIGN - 1) /
+							MCP_CORO_POOL_ALIGN;
+
+		if (index > NUM_CLASSES) {
+			std::free(frame);
+			return;
+		}
+
+		*static_cast<void **>(frame) = p.free[index - 1];
+		p.free[index - 1] = frame;
+		p.used -= index * MCP_CORO_POOL_ALIGN;
+
+		/* the last frame of a thread that has exited, e.g. of a task in a
+		 * static that is destroyed after the destructors of the thread */
+		if (p.exited && p.used == 0)
+			p.release();
+	}
+
+	/* the counts of the calling thread */
+	static stats get_stats()
+	{
+		pool &p = local();
+		return stats{p.used, p.reserved};
+	}
+
+private:
+	static constexpr std::size_t NUM_CLASSES =
+			MCP_CORO_POOL_MAX / MCP_CORO_POOL_ALIGN;
+
+	/* trivially destructible, so that it can still be reached by frames
+	 * that are freed after the destructors of its thread have run */
+	struct pool {
+		void *free[NUM_CLASSES];
+		/* the slabs, chained through their first pointer */
+		void *slabs;
+		unsigned char *next, *end;
+		std::size_t used, reserved;
+		/* set once the destructors of the thread have run */
+		bool exited;
+
+		/* takes size bytes from the current slab, or a new one */
+		void *carve(std::size_t size)
+		{
+			void *slab;
+
+			if (next == NULL || static_cast<std::size_t>(end - next) < size) {
+				slab = std::malloc(MCP_CORO_POOL_SLAB);
+				if (slab == NULL)
+					return NULL;
+
+				*static_cast<void **>(slab) = slabs;
+				slabs = slab;
+				next = static_cast<unsigned char *>(slab) + MCP_CORO_POOL_ALIGN;
+				end = static_cast<unsigned char *>(slab) + MCP_CORO_POOL_SLAB;
+				reserved += MCP_CORO_POOL_SLAB;
+			}
+
+			next += size;
+			return next - size;
+		}
+
+		/* frees the slabs, once no frame is in use */
+		void release()
+		{
+			void *slab;
+
+			while (slabs != NULL) {
+				slab = slabs;
+				slabs = *static_cast<void **>(slab);
+				std::free(slab);
+			}
+
+			for (std::size_t i = 0; i < NUM_CLASSES; i++)
+				free[i] = NULL;
+			next = end = NULL;
+			reserved = 0;
+		}
+	};
+
+	/* frees the slabs of the pool when its thread exits, or leaves that
+	 * to the last frame still in use */
+	struct reaper {
+		pool &p;
+
+		~reaper()
+		{
+			p.exited = true;
+			if (p.used == 0)
+				p.release();
+		}
+	};
+
+	static_assert(MCP_CORO_POOL_SLAB >= MCP_CORO_POOL_MAX + MCP_CORO_POOL_ALIGN,
+					"slabs must hold the largest frame");
+
+	static pool &local()
+	{
+		static thread_local pool p{};
+		static thread_local reaper r{p};
+
+		(void)r;
+		return p;
+	}
+};
+
+/* a coroutine that runs a state machine, e.g. a login or a handshake.
+ * it starts when start is called, or when it is awaited by another task,
+ * which resumes when it finishes. the frame is freed with the task */
+class task {
+public:
+	struct promise_type {
+		std::coroutine_handle<> continuation;
+
+		task get_return_object()
+		{
+			return task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		/* without exceptions, a frame that can not be allocated gives an
+		 * empty task */
+		static task get_return_object_on_allocation_failure() { return task(); }
+
+		static void *operator new(std::size_t size) noexcept
+		{
+			return frame_pool::allocate(size);
+		}
+
+		static void operator delete(void *frame, std::size_t size)
+		{
+			frame_pool::deallocate(frame, size);
+		}
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		struct final_awaiter {
+			bool await_ready() noexcept { return false; }
+
+			std::coroutine_handle<> await_suspend(
+					std::coroutine_handle<promise_type> handle) noexcept
+			{
+				/* return to the task that awaited this one, if any */
+				if (handle.promise().continuation)
+					return handle.promise().continuation;
+				return std::noop_coroutine();
+			}
+
+			void await_resume() noexcept {}
+		};
+
+		final_awaiter final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::abort(); }
+	};
+
+	task() : handle_() {}
+	task(task &&other) : handle_(std::exchange(other.handle_, nullptr)) {}
+	task(const task &) = delete;
+
+	task &operator=(task &&other)
+	{
+		if (this != &other) {
+			if (handle_)
+				handle_.destroy();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+		return *this;
+	}
+
+	~task()
+	{
+		if (handle_)
+			handle_.destroy();
+	}
+
+	/* false if the frame could not be allocated */
+	bool valid() const { return static_cast<bool>(handle_); }
+	/* true once the coroutine has returned */
+	bool done() const { return !handle_ || handle_.done(); }
+
+	/* runs the coroutine until it first suspends */
+	void start()
+	{
+		if (handle_ && !handle_.done())
+			handle_.resume();
+	}
+
+	/* awaiting a task runs it, and resumes the awaiter when it returns */
+	bool await_ready() const { return done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter)
+	{
+		handle_.promise().continuation = awaiter;
+		return handle_;
+	}
+
+	void await_resume() {}
+
+private:
+	explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+	std::coroutine_handle<promise_type> handle_;
+};
+
+/* the inbound side of a connection. data is written to it as it arrives,
+ * and coroutines read from it */
+class stream {
+public:
+	/* reads from buf, which is not owned */
+	explicit stream(fbuf &buf) : buf_(&buf), error_(MCP_EOK), closed_(false),
+			waiter_(), retry_(NULL), op_(NULL) {}
+
+	stream(const stream &) = delete;
+	stream &operator=(const stream &) = delete;
+
+	/* call after data was produced into the fbuf by other means, e.g.
+	 * fbuf_wptr and read(2), then fbuf_produce */
+	void produced()
+	{
+		std::coroutine_handle<> waiter;
+
+		/* retry the pending read, and resume its coroutine if it completes */
+		if (!waiter_ || !retry_(op_))
+			return;
+
+		waiter = std::exchange(waiter_, nullptr);
+		waiter.resume();
+	}
+
+	/* copies data into the fbuf, then resumes a waiting reader.
+	 * returns one if the fbuf can not grow */
+	int write(const void *data, std::size_t size)
+	{
+		if (fbuf_copy(buf_, data, size))
+			return 1;
+
+		produced();
+		return 0;
+	}
+
+	/* no more data will arrive. a waiting read completes with MCP_EAGAIN,
+	 * since it was cut short */
+	void close()
+	{
+		closed_ = true;
+		produced();
+	}
+
+	bool ok() const { return error_ == MCP_EOK; }
+	mcp_error_t error() const { return error_; }
+	bool waiting() const { return static_cast<bool>(waiter_); }
+	fbuf &buf() { return *buf_; }
+
+	/* an awaitable read of one value, parsed by Parse::parse */
+	template<class Parse>
+	class read_op {
+	public:
+		typedef typename Parse::value_type value_type;
+
+		explicit read_op(stream &in) : in_(&in), value_() {}
+
+		bool await_ready() { return attempt(); }
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			in_->waiter_ = handle;
+			in_->retry_ = retry;
+			in_->op_ = this;
+		}
+
+		/* values that point into the fbuf, e.g. strings, are valid until
+		 * the next read or write on the stream */
+		value_type await_resume() { return std::move(value_); }
+
+	private:
+		/* parses from the start of the fbuf, and consumes it on success.
+		 * returns true if the read completed */
+		bool attempt()
+		{
+			struct mcp_parse parse;
+			fbuf *buf = in_->buf_;
+
+			/* pass errors */
+			if (in_->error_ != MCP_EOK)
+				return true;
+
+			mcp_start(&parse, fbuf_ptr(buf), fbuf_avail(buf));
+			value_ = Parse::parse(parse);
+
+			if (mcp_ok(&parse)) {
+				if (mcp_consumed(&parse) > 0)
+					fbuf_consume(buf, mcp_consumed(&parse));
+				return true;
+			}
+
+			value_ = value_type();
+
+			if (mcp_error(&parse) == MCP_EAGAIN && !in_->closed_)
+				return false;
+
+			in_->error_ = mcp_error(&parse);
+			return true;
+		}
+
+		static bool retry(void *op)
+		{
+			return static_cast<read_op *>(op)->attempt();
+		}
+
+		stream *in_;
+		value_type value_;
+	};
+
+	/* reads a layout, or any other field type of mcp.hpp */
+	template<class T>
+	read_op<T> read() { return read_op<T>(*this); }
+
+	read_op<mcp::varint> varint() { return read_op<mcp::varint>(*this); }
+	read_op<mcp::varlong> varlong() { return read_op<mcp::varlong>(*this); }
+
+private:
+	fbuf *buf_;
+	mcp_error_t error_;
+	bool closed_;
+	/* the coroutine waiting for data, and its pending read */
+	std::coroutine_handle<> waiter_;
+	bool (*retry_)(void *op);
+	void *op_;
+};
+
+} /* namespace mcp */
+
+#endif
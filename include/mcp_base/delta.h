@@ -0,0 +1,88 @@
+/* delta.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_DELTA_H
+#define MCP_BASE_DELTA_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint8_t, uint32_t and int64_t */
+#include <stdint.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the ids of the packets written by the encoder, they differ between
+ * protocol versions. the bodies are, after the entity id:
+ *	move		dx, dy, dz as shorts, on ground as a bool
+ *	move_look	dx, dy, dz as shorts, yaw, pitch as angles, on ground
+ *	look		yaw, pitch as angles, on ground
+ *	teleport	x, y, z as doubles, yaw, pitch as angles, on ground
+ *	metadata	the encoded metadata, as given
+ * deltas are in 1/4096ths of a block */
+struct mcp_delta_ids {
+	mcp_varint_t move, move_look, look, teleport, metadata;
+};
+
+/* the entities of a tick as structure-of-arrays, row i of each array is
+ * the same entity */
+struct mcp_entities {
+	size_t count;
+	const mcp_varint_t *ids;
+	const double *x, *y, *z;
+	/* angles in 1/256ths of a turn, as they are sent */
+	const uint8_t *yaw, *pitch;
+	const uint8_t *on_ground;
+	/* changed by the caller whenever the metadata of an entity changes.
+	 * may be NULL, if no metadata is sent */
+	const uint32_t *meta_version;
+	/* the encoded metadata of each entity */
+	const unsigned char *const *meta;
+	const size_t *meta_size;
+};
+
+/* what a viewer was last sent about an entity. a zeroed state has not been
+ * sent anything, so the first update is a teleport */
+struct mcp_delta {
+	/* position in 1/4096ths of a block */
+	int64_t x, y, z;
+	uint32_t meta_version;
+	uint8_t yaw, pitch, on_ground, flags;
+};
+
+/* forgets what was sent about count entities, e.g. when they are spawned
+ * again for a viewer */
+void mcp_delta_reset(struct mcp_delta *last, size_t count);
+
+/* writes the packets that bring a viewer up to date from last to entities,
+ * each as a length-prefixed frame, and updates last. last has one state
+ * for each row of entities.
+ *
+ * only changed fields are sent, in the smallest packet that holds them:
+ * a move, look or move and look when the position changed by less than
+ * eight blocks on every axis, otherwise a teleport. metadata is sent when
+ * its version changed.
+ *
+ * returns 0 on success, 1 if out has no memory or metadata is too large.
+ * on error, the frames of the entities before the one that failed are
+ * written and their states updated */
+int mcp_delta_encode(struct fbuf *out, const struct mcp_delta_ids *ids,
+						const struct mcp_entities *entities,
+						struct mcp_delta *last);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
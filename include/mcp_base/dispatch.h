@@ -0,0 +1,104 @@
+/* dispatch.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_DISPATCH_H
+#define MCP_BASE_DISPATCH_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint64_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the states of a connection, each has its own packet ids. the first three
+ * are the same as the next state field of a handshake */
+enum mcp_state {
+	MCP_STATE_HANDSHAKE,
+	MCP_STATE_STATUS,
+	MCP_STATE_LOGIN,
+	MCP_STATE_PLAY,
+	MCP_NUM_STATES
+};
+
+/* handles the body of a packet, after its id.
+ * the return value is returned by mcp_dispatch */
+typedef int (*mcp_handler_t)(void *context, struct mcp_parse *buf);
+
+/* a dense table of handlers indexed by packet id. ids without a handler are
+ * NULL. the tables are meant to be static and const, with designated
+ * initializers, and shared by every thread, e.g.
+ *
+ * static const mcp_handler_t play[] = {
+ *	[0x0f] = on_chat,
+ *	[0x15] = on_move
+ * };
+ * static const struct mcp_dispatch server[MCP_NUM_STATES] = {
+ *	[MCP_STATE_PLAY] = MCP_DISPATCH(play)
+ * };
+ *
+ * the counts of packets are kept by the caller, see mcp_dispatch */
+struct mcp_dispatch {
+	const mcp_handler_t *handlers;
+	/* the entries of handlers, and the ids below which ids are one byte
+	 * and in the table */
+	size_t size, direct;
+};
+
+/* the entries of a handler table, and of its counts */
+#define MCP_DISPATCH_SIZE(handlers)		(sizeof(handlers) / sizeof((handlers)[0]))
+#define MCP_DISPATCH_COUNTS(handlers)	(MCP_DISPATCH_SIZE(handlers) + 1)
+#define MCP_DISPATCH_DIRECT(handlers)									\
+	(MCP_DISPATCH_SIZE(handlers) < 0x80 ? MCP_DISPATCH_SIZE(handlers) : 0x80)
+#define MCP_DISPATCH(handlers)											\
+	{(handlers), MCP_DISPATCH_SIZE(handlers), MCP_DISPATCH_DIRECT(handlers)}
+
+/* reads the id of multi-byte ids and ids that are not in the table */
+int mcp_dispatch_slow(const struct mcp_dispatch *table, uint64_t *counts,
+						void *context, struct mcp_parse *buf);
+
+/* reads a packet id from buf and calls its handler with the rest of buf.
+ * returns the value returned by the handler. returns -1 without calling a
+ * handler if there was an error, or if the id has no handler, in which case
+ * MCP_EINVAL is set on buf.
+ * counts, if not NULL, has MCP_DISPATCH_COUNTS(handlers) entries: one for
+ * each id, then one for unknown ids. it is not updated atomically, so each
+ * thread or connection should pass its own */
+static inline int mcp_dispatch(const struct mcp_dispatch *table,
+								uint64_t *counts, void *context,
+								struct mcp_parse *buf)
+{
+	const unsigned char *ptr = mcp_ptr(buf);
+	mcp_handler_t handler;
+
+	/* most ids are a single byte, and index the table directly */
+	if (!mcp_ok(buf) || mcp_avail(buf) == 0 || ptr[0] >= table->direct)
+		return mcp_dispatch_slow(table, counts, context, buf);
+
+	handler = table->handlers[ptr[0]];
+	if (handler == NULL)
+		return mcp_dispatch_slow(table, counts, context, buf);
+
+	if (counts != NULL)
+		counts[ptr[0]]++;
+
+	mcp_consume(buf, 1);
+	return handler(context, buf);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,18 +13,76 @@
 /* for size_t */
 #include <stdlib.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a limit on the total size of a set of fbufs, shared between threads.
+ * used is modified atomically */
+struct fbuf_budget {
+	size_t limit, used;
+	/* levels of used at which fbuf_pressure reports pressure */
+	size_t soft, hard;
+};
+
+/* the pressure on a budget, from least to most */
+enum fbuf_pressure {
+	/* there is plenty of memory */
+	FBUF_PRESSURE_NONE,
+	/* defer bulk sends, e.g. chunks */
+	FBUF_PRESSURE_SOFT,
+	/* stop reading, fbufs may soon fail to expand */
+	FBUF_PRESSURE_HARD
+};
+
+/* the size of a page and of a huge page. blocks from a pool are whole
+ * pages, and whole huge pages once they are a huge page or more */
+#ifndef FBUF_PAGE
+# define FBUF_PAGE				((size_t)4096)
+#endif
+#ifndef FBUF_HUGE_PAGE
+# define FBUF_HUGE_PAGE			((size_t)2 << 20)
+#endif
+
+struct fbuf_page_block;
+
+/* a pool of blocks for large fbufs, e.g. chunk, region and broadcast
+ * buffers. blocks of a huge page or more are mapped with MAP_HUGETLB, or
+ * with madvise(MADV_HUGEPAGE) if there are no explicit huge pages, so that
+ * copies within them take fewer TLB misses. the blocks of a pool may also
+ * be bound to a numa node, see numa.h. freed blocks are kept for the next
+ * buffer of the same size instead of being unmapped, which also saves the
+ * page faults of a new mapping. shared between threads */
+struct fbuf_pages {
+	/* blocks of at least threshold bytes are taken from the pool */
+	size_t threshold;
+	/* the bytes of free blocks kept, and the most that are kept */
+	size_t cached, max_cached;
+	/* the numa node of the blocks or -1, and whether they are bound to it */
+	int node, bind;
+	/* set once MAP_HUGETLB fails, so that it is not tried again */
+	int no_hugetlb;
+	/* held while the free blocks are changed, it is rarely contended */
+	int lock;
+	struct fbuf_page_block *free;
+};
+
 struct fbuf {
 	/* base pointer */
 	unsigned char *base;
 	/* size of the buffer and start/end of valid data */
 	size_t size, max_size, start, end;
+	/* budget that the block is charged to, or NULL */
+	struct fbuf_budget *budget;
+	/* pool of the block once it reaches the threshold of the pool, or NULL */
+	struct fbuf_pages *pages;
 };
 
 /* FBUF_MAX is the maximum value of max_size */
 #define FBUF_MAX				((~(size_t)0) >> 1)
 
 /* use fbuf_init to setup the buffer for first use */
-#define FBUF_INITIALIZER		{NULL, 0, FBUF_MAX, 0, 0}
+#define FBUF_INITIALIZER		{NULL, 0, FBUF_MAX, 0, 0, NULL, NULL}
 static inline void fbuf_init(struct fbuf *buf, size_t max)
 {
 	buf->base = NULL;
@@ -32,8 +90,76 @@ static inline void fbuf_init(struct fbuf *buf, size_t max)
 	buf->max_size = max;
 	buf->start = 0;
 	buf->end = 0;
+	buf->budget = NULL;
+	buf->pages = NULL;
+}
+
+/* sets up a budget of limit bytes, with soft pressure at three quarters
+ * and hard pressure at seven eighths of the limit */
+static inline void fbuf_budget_init(struct fbuf_budget *budget, size_t limit)
+{
+	budget->limit = limit;
+	budget->used = 0;
+	budget->soft = limit / 4 * 3;
+	budget->hard = limit / 8 * 7;
 }
 
+/* returns the number of bytes charged to the budget */
+static inline size_t fbuf_budget_used(struct fbuf_budget *budget)
+{
+	return __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+}
+
+/* returns the pressure on the budget */
+static inline enum fbuf_pressure fbuf_pressure(struct fbuf_budget *budget)
+{
+	size_t used = fbuf_budget_used(budget);
+
+	if (used >= budget->hard)
+		return FBUF_PRESSURE_HARD;
+	if (used >= budget->soft)
+		return FBUF_PRESSURE_SOFT;
+	return FBUF_PRESSURE_NONE;
+}
+
+/* charges the memory block of buf, now and as it grows, to budget.
+ * budget may be NULL to stop charging. returns one if the block
+ * does not fit in the budget */
+int fbuf_set_budget(struct fbuf *buf, struct fbuf_budget *budget);
+
+/* sets up an empty pool for blocks of at least threshold bytes, which
+ * keeps up to max_cached bytes of free blocks */
+static inline void fbuf_pages_init(struct fbuf_pages *pages, size_t threshold,
+									size_t max_cached)
+{
+	pages->threshold = threshold;
+	pages->cached = 0;
+	pages->max_cached = max_cached;
+	pages->node = -1;
+	pages->bind = 0;
+	pages->no_hugetlb = 0;
+	pages->lock = 0;
+	pages->free = NULL;
+}
+
+/* unmaps the free blocks of a pool. the fbufs of the pool must be freed
+ * first */
+void fbuf_pages_free(struct fbuf_pages *pages);
+
+/* takes the block of buf from pages once it grows to the threshold of the
+ * pool. pages may be NULL to stop. returns one if buf already has a block
+ * and pages differs from its pool */
+int fbuf_set_pages(struct fbuf *buf, struct fbuf_pages *pages);
+
+/* moves the data of buf to a new block from pages, or from malloc if it is
+ * below the threshold of pages, and frees the old block. used to keep the
+ * buffers of a connection local to the node of the thread that serves it
+ * when it moves. the data is copied by the calling thread, so a new block
+ * outside of a pool is placed on its node when it is first touched.
+ * pages may be NULL. returns one, and does not modify buf, if there is no
+ * memory */
+int fbuf_migrate(struct fbuf *buf, struct fbuf_pages *pages);
+
 /* clear the contents of the buffer, but keep the memory block */
 static inline void fbuf_clear(struct fbuf *buf)
 {
@@ -83,7 +209,8 @@ void fbuf_unproduce(struct fbuf *buf, size_t sz);
 void fbuf_consume(struct fbuf *buf, size_t sz);
 
 /* expands the buffer so that it can hold at least requested_size more bytes
- * returns the size of the writeable space */
+ * returns the size of the writeable space.
+ * fails to expand if the budget of the buffer would be exceeded */
 size_t fbuf_expand(struct fbuf *buf, size_t requested_size);
 /* rotates the buffer so that the read pointer is at the begining. */
 void fbuf_compact(struct fbuf *buf);
@@ -99,4 +226,8 @@ int fbuf_shrink(struct fbuf *buf, size_t new_max);
  * returns one if there was not enough space */
 int fbuf_copy(struct fbuf *dest, const void *src, size_t size);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,74 @@
+/* intern.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_INTERN_H
+#define MCP_BASE_INTERN_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint32_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returned for strings that are not interned */
+#define MCP_INTERN_NONE				((uint32_t)-1)
+
+/* a fixed-size table of interned strings, e.g. "minecraft:stone". each
+ * string has a small id, given out in the order strings are added, and a
+ * canonical NUL-terminated copy. the ids and copies stay valid until the
+ * table is freed.
+ *
+ * lookups take no locks and are safe from any number of threads while
+ * another thread adds strings. adding takes a spinlock, it is meant to
+ * happen rarely, e.g. once for each identifier of a registry at startup */
+struct mcp_intern;
+
+/* creates a table that holds up to capacity strings.
+ * returns NULL if there is no memory */
+struct mcp_intern *mcp_intern_new(size_t capacity);
+/* frees the table and the copies of its strings.
+ * no thread may be using the table */
+void mcp_intern_free(struct mcp_intern *table);
+
+/* returns the id of a string, adding a copy of it if it is not in the
+ * table. returns MCP_INTERN_NONE if the string is not valid utf-8, the table
+ * is full or there is no memory */
+uint32_t mcp_intern_add(struct mcp_intern *table, const void *name,
+						size_t size);
+/* returns the id of a string, or MCP_INTERN_NONE if it is not interned */
+uint32_t mcp_intern_find(const struct mcp_intern *table, const void *name,
+						size_t size);
+/* returns the canonical copy of an interned string and stores its size in
+ * size, if size is not NULL. returns NULL for an unknown id */
+const char *mcp_intern_name(const struct mcp_intern *table, uint32_t id,
+							size_t *size);
+/* returns the number of strings in the table */
+size_t mcp_intern_count(const struct mcp_intern *table);
+
+/* parses a string and looks it up without copying it. returns the id of
+ * the string, or MCP_INTERN_NONE if it is not interned or there was an
+ * error parsing it. the string is always consumed on success, and value
+ * and size are set to it as with mcp_bytes, so an unknown string can be
+ * validated and added. interned strings are valid, so a string that is
+ * found needs no further validation */
+uint32_t mcp_intern_parse(struct mcp_parse *buf,
+						const struct mcp_intern *table,
+						const char **value, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
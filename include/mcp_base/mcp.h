@@ -16,6 +16,10 @@
 /* for (u)int{8,16,32,64}_t*/
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* for compatibility with varint28 */
 #ifndef MCP_BYTES_MAX_SIZE
 # define MCP_BYTES_MAX_SIZE			(268435455)
@@ -60,7 +64,7 @@ static inline mcp_error_t mcp_error(struct mcp_parse *buf)
 /* initialzes a mcp_parse structure */
 static inline void mcp_start(struct mcp_parse *buf, const void *base, size_t size)
 {
-	buf->base = base;
+	buf->base = (const unsigned char *)base;
 	buf->start = 0;
 	buf->end = size;
 	buf->error = MCP_EOK;
@@ -131,6 +135,12 @@ size_t mcp_copy_bytes(void *dest, struct mcp_parse *buf, size_t max_size);
 /* same as mcp_copy_bytes, except the return value and max_size include
  * the final NUL-terminator. */
 size_t mcp_copy_string(char *dest, struct mcp_parse *buf, size_t max_size);
+/* parses a string of at most max_units utf-16 code units, which is how the
+ * protocol bounds the length of strings, and returns a pointer to it in the
+ * buffer. the string is not NUL-terminated, its size in bytes is stored in
+ * size. sets MCP_EINVAL if the string is not valid utf-8, and MCP_EOVERFLOW
+ * if it is too long */
+const char *mcp_string(struct mcp_parse *buf, size_t *size, size_t max_units);
 
 uint8_t mcp_ubyte(struct mcp_parse *buf);
 uint16_t mcp_ushort(struct mcp_parse *buf);
@@ -147,6 +157,23 @@ int mcp_bool(struct mcp_parse *buf);
 float mcp_float(struct mcp_parse *buf);
 double mcp_double(struct mcp_parse *buf);
 
+/* skip functions consume data from buf without decoding it, e.g. to move
+ * past the leading fields of a packet that is forwarded unchanged. they
+ * only look at continuation bits and length prefixes, so they do not check
+ * that the values they skip would fit in their types.
+ *
+ * errors are set as with the parse functions: MCP_EAGAIN if the data is cut
+ * short and MCP_EOVERFLOW if a varint is longer than ten bytes */
+
+/* skips a varint or a varlong */
+void mcp_skip_varint(struct mcp_parse *buf);
+/* skips count varints or varlongs, eight bytes at a time */
+void mcp_skip_varints(struct mcp_parse *buf, size_t count);
+/* skips a length-prefixed bytes or string value */
+void mcp_skip_bytes(struct mcp_parse *buf);
+/* skips count fixed width values of size bytes, e.g. three doubles */
+void mcp_skip_fixed(struct mcp_parse *buf, size_t size, size_t count);
+
 /* generator functions take a value and produce data
  * these functions return zero if there was no error
  *
@@ -184,5 +211,8 @@ int mcg_bool(struct fbuf *buf, int value);
 int mcg_float(struct fbuf *buf, float value);
 int mcg_double(struct fbuf *buf, double value);
 
+#ifdef __cplusplus
+}
 #endif
 
+#endif
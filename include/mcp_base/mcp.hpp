@@ -0,0 +1,656 @@
+/* mcp.hpp
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_MCP_HPP
+#define MCP_BASE_MCP_HPP
+
+/* a header-only C++17 layer over the mcp and mcg functions.
+ *
+ * packet layouts are lists of field types:
+ *	using move = mcp::layout<mcp::varint, mcp::double_, mcp::double_,
+ *							mcp::double_, mcp::bool_>;
+ *
+ * parsing checks the bounds of each run of fixed width fields once, and
+ * writing reserves space for the largest encoding of the whole packet with
+ * one fbuf_wptr, then encodes every field without further checks. */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+
+/* layouts whose largest encoding is bigger than this measure the exact size
+ * of each packet before reserving space, instead of reserving the largest */
+#ifndef MCP_HPP_RESERVE_MAX
+# define MCP_HPP_RESERVE_MAX		(4096)
+#endif
+
+namespace mcp {
+
+namespace detail {
+
+/* the number of bytes value takes as a varint */
+constexpr std::size_t varint_size(std::uint64_t value)
+{
+	std::size_t size = 1;
+
+	while (value > 0x7f) {
+		value >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+template<class T, std::size_t N>
+inline T load_be(const unsigned char *src)
+{
+	T value = 0;
+
+	/* folded into a single load and byte swap */
+	for (std::size_t i = 0; i < N; i++)
+		value = (value << 8) | src[i];
+
+	return value;
+}
+
+template<class T, std::size_t N>
+inline void store_be(unsigned char *dest, T value)
+{
+	for (std::size_t i = 0; i < N; i++)
+		dest[i] = (value >> (8 * (N - 1 - i))) & 0xff;
+}
+
+inline std::size_t store_varlong(unsigned char *dest, std::uint64_t value)
+{
+	std::size_t offset = 0;
+
+	while (value > 0x7f) {
+		dest[offset++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	dest[offset++] = value;
+	return offset;
+}
+
+/* the pointer to the next size bytes of buf, or NULL on error */
+inline const unsigned char *take(mcp_parse &buf, std::size_t size)
+{
+	return static_cast<const unsigned char *>(mcp_raw(&buf, size));
+}
+
+} /* namespace detail */
+
+/* every field type has:
+ *	value_type			the C++ type it parses to
+ *	fixed_size			its size if it is fixed width, otherwise zero
+ *	max_size			the size of its largest encoding
+ *	parse(buf)			parses it, setting the error on buf
+ *	valid(value)		true if value can be encoded
+ *	size(value)			the size of its encoding
+ *	store(dest, value)	encodes it, and returns the size of its encoding
+ * and fixed width fields also have:
+ *	load(src)			decodes it from fixed_size bytes without checks */
+
+/* fixed width integers, big endian */
+template<class T, std::size_t N = sizeof(T)>
+struct integer {
+	typedef T value_type;
+	static constexpr std::size_t fixed_size = N;
+	static constexpr std::size_t max_size = N;
+
+	static value_type load(const unsigned char *src)
+	{
+		typedef typename std::make_unsigned<T>::type unsigned_type;
+		return static_cast<T>(detail::load_be<unsigned_type, N>(src));
+	}
+
+	static value_type parse(mcp_parse &buf)
+	{
+		const unsigned char *src = detail::take(buf, N);
+		return src ? load(src) : 0;
+	}
+
+	static constexpr bool valid(value_type) { return true; }
+	static constexpr std::size_t size(value_type) { return N; }
+
+	static std::size_t store(unsigned char *dest, value_type value)
+	{
+		typedef typename std::make_unsigned<T>::type unsigned_type;
+		detail::store_be<unsigned_type, N>(dest, value);
+		return N;
+	}
+};
+
+typedef integer<std::uint8_t> ubyte;
+typedef integer<std::uint16_t> ushort;
+typedef integer<std::uint32_t> uint;
+typedef integer<std::uint64_t> ulong;
+typedef integer<std::int8_t> byte;
+typedef integer<std::int16_t> short_;
+typedef integer<std::int32_t> int_;
+typedef integer<std::int64_t> long_;
+
+struct bool_ {
+	typedef bool value_type;
+	static constexpr std::size_t fixed_size = 1;
+	static constexpr std::size_t max_size = 1;
+
+	static value_type load(const unsigned char *src) { return src[0] != 0; }
+
+	static value_type parse(mcp_parse &buf)
+	{
+		const unsigned char *src = detail::take(buf, 1);
+		return src ? load(src) : false;
+	}
+
+	static constexpr bool valid(value_type) { return true; }
+	static constexpr std::size_t size(value_type) { return 1; }
+
+	static std::size_t store(unsigned char *dest, value_type value)
+	{
+		dest[0] = value ? 1 : 0;
+		return 1;
+	}
+};
+
+/* floating point types, type-punned through the integer of their size */
+template<class T, class Bits>
+struct floating {
+	typedef T value_type;
+	static constexpr std::size_t fixed_size = sizeof(T);
+	static constexpr std::size_t max_size = sizeof(T);
+
+	static_assert(sizeof(T) == sizeof(Bits), "float size mismatch");
+
+	static value_type load(const unsigned char *src)
+	{
+		Bits bits = detail::load_be<Bits, sizeof(T)>(src);
+		T value;
+
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	static value_type parse(mcp_parse &buf)
+	{
+		const unsigned char *src = detail::take(buf, sizeof(T));
+		return src ? load(src) : 0;
+	}
+
+	static constexpr bool valid(value_type) { return true; }
+	static constexpr std::size_t size(value_type) { return sizeof(T); }
+
+	static std::size_t store(unsigned char *dest, value_type value)
+	{
+		Bits bits;
+
+		std::memcpy(&bits, &value, sizeof(bits));
+		detail::store_be<Bits, sizeof(T)>(dest, bits);
+		return sizeof(T);
+	}
+};
+
+typedef floating<float, std::uint32_t> float_;
+typedef floating<double, std::uint64_t> double_;
+
+/* varints, and zig-zag encoded signed varints */
+template<class T, std::size_t Max, bool Signed>
+struct variable {
+	typedef T value_type;
+	static constexpr std::size_t fixed_size = 0;
+	static constexpr std::size_t max_size = Max;
+
+	static value_type parse(mcp_parse &buf)
+	{
+		if constexpr (Max == 5 && Signed)
+			return mcp_svarint(&buf);
+		else if constexpr (Max == 5)
+			return mcp_varint(&buf);
+		else if constexpr (Signed)
+			return mcp_svarlong(&buf);
+		else
+			return mcp_varlong(&buf);
+	}
+
+	static std::uint64_t encoded(value_type value)
+	{
+		typedef typename std::make_unsigned<T>::type unsigned_type;
+
+		if constexpr (!Signed)
+			return value;
+		else
+			return static_cast<unsigned_type>(
+					(static_cast<unsigned_type>(value) << 1) ^
+					static_cast<unsigned_type>(value >> (8 * sizeof(T) - 1)));
+	}
+
+	static constexpr bool valid(value_type) { return true; }
+
+	static std::size_t size(value_type value)
+	{
+		return detail::varint_size(encoded(value));
+	}
+
+	static std::size_t store(unsigned char *dest, value_type value)
+	{
+		return detail::store_varlong(dest, encoded(value));
+	}
+};
+
+typedef variable<mcp_varint_t, 5, false> varint;
+typedef variable<mcp_varlong_t, 10, false> varlong;
+typedef variable<mcp_svarint_t, 5, true> svarint;
+typedef variable<mcp_svarlong_t, 10, true> svarlong;
+
+/* length prefixed bytes of at most Max bytes, parsed without copying.
+ * parsing a longer value sets MCP_EOVERFLOW */
+template<std::size_t Max>
+struct bytes {
+	typedef std::string_view value_type;
+	static constexpr std::size_t fixed_size = 0;
+	static constexpr std::size_t max_size = detail::varint_size(Max) + Max;
+
+	static_assert(Max <= MCP_BYTES_MAX_SIZE, "bytes too large");
+
+	static value_type parse(mcp_parse &buf)
+	{
+		std::size_t size;
+		const void *value = mcp_bytes(&buf, &size);
+
+		if (!mcp_ok(&buf))
+			return value_type();
+
+		if (size > Max) {
+			buf.error = MCP_EOVERFLOW;
+			return value_type();
+		}
+
+		return value_type(static_cast<const char *>(value), size);
+	}
+
+	static bool valid(value_type value) { return value.size() <= Max; }
+
+	static std::size_t size(value_type value)
+	{
+		return detail::varint_size(value.size()) + value.size();
+	}
+
+	static std::size_t store(unsigned char *dest, value_type value)
+	{
+		std::size_t prefix = detail::store_varlong(dest, value.size());
+
+		std::memcpy(dest + prefix, value.data(), value.size());
+		return prefix + value.size();
+	}
+};
+
+/* strings are encoded like bytes */
+template<std::size_t Max>
+using string = bytes<Max>;
+
+/* a varint count followed by at most MaxCount elements */
+template<class T, std::size_t MaxCount>
+struct array {
+	typedef std::vector<typename T::value_type> value_type;
+	static constexpr std::size_t fixed_size = 0;
+	static constexpr std::size_t max_size =
+			detail::varint_size(MaxCount) + MaxCount * T::max_size;
+
+	static value_type parse(mcp_parse &buf)
+	{
+		mcp_varint_t count = mcp_varint(&buf);
+		value_type value;
+
+		if (!mcp_ok(&buf))
+			return value;
+
+		if (count > MaxCount) {
+			buf.error = MCP_EOVERFLOW;
+			return value;
+		}
+
+		/* don't let a bogus count allocate more than the buffer could hold */
+		if (T::fixed_size != 0 && count * T::fixed_size > mcp_avail(&buf)) {
+			buf.error = MCP_EAGAIN;
+			return value;
+		}
+
+		value.reserve(count);
+		for (mcp_varint_t i = 0; i < count && mcp_ok(&buf); i++)
+			value.push_back(T::parse(buf));
+
+		return value;
+	}
+
+	static bool valid(const value_type &value)
+	{
+		if (value.size() > MaxCount)
+			return false;
+
+		for (const auto &element : value)
+			if (!T::valid(element))
+				return false;
+
+		return true;
+	}
+
+	static std::size_t size(const value_type &value)
+	{
+		std::size_t size = detail::varint_size(value.size());
+
+		for (const auto &element : value)
+			size += T::size(element);
+
+		return size;
+	}
+
+	static std::size_t store(unsigned char *dest, const value_type &value)
+	{
+		std::size_t offset = detail::store_varlong(dest, value.size());
+
+		for (const auto &element : value)
+			offset += T::store(dest + offset, element);
+
+		return offset;
+	}
+};
+
+/* exactly Count elements, without a count */
+template<class T, std::size_t Count>
+struct fixed_array {
+	typedef std::array<typename T::value_type, Count> value_type;
+	static constexpr std::size_t fixed_size = T::fixed_size * Count;
+	static constexpr std::size_t max_size = T::max_size * Count;
+
+	static value_type load(const unsigned char *src)
+	{
+		value_type value;
+
+		for (std::size_t i = 0; i < Count; i++)
+			value[i] = T::load(src + i * T::fixed_size);
+
+		return value;
+	}
+
+	static value_type parse(mcp_parse &buf)
+	{
+		value_type value{};
+
+		if constexpr (fixed_size != 0) {
+			const unsigned char *src = detail::take(buf, fixed_size);
+			if (src)
+				value = load(src);
+		} else {
+			for (std::size_t i = 0; i < Count && mcp_ok(&buf); i++)
+				value[i] = T::parse(buf);
+		}
+
+		return value;
+	}
+
+	static bool valid(const value_type &value)
+	{
+		for (const auto &element : value)
+			if (!T::valid(element))
+				return false;
+
+		return true;
+	}
+
+	static std::size_t size(const value_type &value)
+	{
+		std::size_t size = 0;
+
+		for (const auto &element : value)
+			size += T::size(element);
+
+		return size;
+	}
+
+	static std::size_t store(unsigned char *dest, const value_type &value)
+	{
+		std::size_t offset = 0;
+
+		for (const auto &element : value)
+			offset += T::store(dest + offset, element);
+
+		return offset;
+	}
+};
+
+/* a sequence of fields. a layout is itself a field, so layouts nest */
+template<class... Fields>
+struct layout {
+	typedef std::tuple<typename Fields::value_type...> value_type;
+
+	static constexpr std::size_t count = sizeof...(Fields);
+
+	/* fixed width only if every field is */
+	static constexpr std::size_t fixed_size =
+			((Fields::fixed_size != 0) && ...) ?
+				(Fields::fixed_size + ... + 0) : 0;
+	static constexpr std::size_t max_size = (Fields::max_size + ... + 0);
+
+private:
+	template<std::size_t I>
+	using field = typename std::tuple_element<I, std::tuple<Fields...>>::type;
+
+	/* the fixed sizes of the fields, with a zero after the last */
+	static constexpr std::size_t sizes[] = {Fields::fixed_size..., 0};
+
+	/* the first field at or after first that is not fixed width */
+	static constexpr std::size_t run_end(std::size_t first)
+	{
+		while (sizes[first] != 0)
+			first++;
+		return first;
+	}
+
+	/* the total size of the fields in [first, last) */
+	static constexpr std::size_t run_size(std::size_t first, std::size_t last)
+	{
+		std::size_t size = 0;
+
+		while (first < last)
+			size += sizes[first++];
+
+		return size;
+	}
+
+	template<std::size_t I, std::size_t End>
+	static void load_run(const unsigned char *src, value_type &value)
+	{
+		if constexpr (I < End) {
+			std::get<I>(value) = field<I>::load(src);
+			load_run<I + 1, End>(src + sizes[I], value);
+		}
+	}
+
+	template<std::size_t I>
+	static void parse_from(mcp_parse &buf, value_type &value)
+	{
+		if constexpr (I < count) {
+			if constexpr (sizes[I] != 0) {
+				/* one bounds check for the whole run of fixed width fields */
+				constexpr std::size_t end = run_end(I);
+				const unsigned char *src = detail::take(buf, run_size(I, end));
+
+				if (src == NULL)
+					return;
+
+				load_run<I, end>(src, value);
+				parse_from<end>(buf, value);
+			} else {
+				std::get<I>(value) = field<I>::parse(buf);
+
+				if (!mcp_ok(&buf))
+					return;
+
+				parse_from<I + 1>(buf, value);
+			}
+		}
+	}
+
+	template<std::size_t... I>
+	static value_type load_all(const unsigned char *src,
+								std::index_sequence<I...>)
+	{
+		return value_type(field<I>::load(src + run_size(0, I))...);
+	}
+
+	template<std::size_t... I>
+	static bool valid_all(const value_type &value, std::index_sequence<I...>)
+	{
+		return (field<I>::valid(std::get<I>(value)) && ...);
+	}
+
+	template<std::size_t... I>
+	static std::size_t size_all(const value_type &value,
+								std::index_sequence<I...>)
+	{
+		return (field<I>::size(std::get<I>(value)) + ... + 0);
+	}
+
+	template<std::size_t... I>
+	static std::size_t store_all(unsigned char *dest, const value_type &value,
+								std::index_sequence<I...>)
+	{
+		std::size_t offset = 0;
+
+		((offset += field<I>::store(dest + offset, std::get<I>(value))), ...);
+		return offset;
+	}
+
+public:
+	/* decodes a fixed width layout from fixed_size bytes without checks */
+	static value_type load(const unsigned char *src)
+	{
+		static_assert(fixed_size != 0, "layout is not fixed width");
+		return load_all(src, std::index_sequence_for<Fields...>());
+	}
+
+	/* parses every field. on error the error is set on buf and the fields
+	 * after it are left value-initialized */
+	static value_type parse(mcp_parse &buf)
+	{
+		value_type value{};
+
+		if (mcp_ok(&buf))
+			parse_from<0>(buf, value);
+
+		return value;
+	}
+
+	static bool valid(const value_type &value)
+	{
+		return valid_all(value, std::index_sequence_for<Fields...>());
+	}
+
+	static std::size_t size(const value_type &value)
+	{
+		if constexpr (fixed_size != 0)
+			return fixed_size;
+		else
+			return size_all(value, std::index_sequence_for<Fields...>());
+	}
+
+	static std::size_t store(unsigned char *dest, const value_type &value)
+	{
+		return store_all(dest, value, std::index_sequence_for<Fields...>());
+	}
+
+	/* encodes value into buf. like the mcg functions, returns zero on
+	 * success, or one if a field is too large or buf can not grow.
+	 * only a value_type itself is taken, so that a single field is never
+	 * converted to a tuple */
+	template<class Value, typename std::enable_if<
+			std::is_same<Value, value_type>::value, int>::type = 0>
+	static int write(fbuf &buf, const Value &value)
+	{
+		unsigned char *dest;
+
+		if (!valid(value))
+			return 1;
+
+		/* a buffer near its max_size may not hold the largest encoding,
+		 * but still hold this one */
+		if constexpr (max_size <= MCP_HPP_RESERVE_MAX)
+			dest = fbuf_wptr(&buf, max_size);
+		else
+			dest = NULL;
+
+		if (dest == NULL)
+			dest = fbuf_wptr(&buf, size(value));
+
+		if (dest == NULL)
+			return 1;
+
+		fbuf_produce(&buf, store(dest, value));
+		return 0;
+	}
+
+	static int write(fbuf &buf, const typename Fields::value_type &... values)
+	{
+		return write<value_type>(buf, value_type(values...));
+	}
+};
+
+/* a typed view over a mcp_parse */
+class reader {
+public:
+	explicit reader(mcp_parse &buf) : buf_(&buf) {}
+
+	template<class T>
+	typename T::value_type read() { return T::parse(*buf_); }
+
+	mcp_varint_t varint() { return mcp_varint(buf_); }
+	mcp_varlong_t varlong() { return mcp_varlong(buf_); }
+
+	bool ok() const { return buf_->error == MCP_EOK; }
+	mcp_error_t error() const { return buf_->error; }
+	mcp_parse &buf() { return *buf_; }
+
+private:
+	mcp_parse *buf_;
+};
+
+/* a typed view over a fbuf. errors are sticky, like those of a mcp_parse */
+class writer {
+public:
+	explicit writer(fbuf &buf) : buf_(&buf), failed_(0) {}
+
+	template<class T, class... Args>
+	writer &write(const Args &... args)
+	{
+		if (!failed_)
+			failed_ = T::write(*buf_, args...);
+		return *this;
+	}
+
+	bool ok() const { return !failed_; }
+	fbuf &buf() { return *buf_; }
+
+private:
+	fbuf *buf_;
+	int failed_;
+};
+
+} /* namespace mcp */
+
+#endif
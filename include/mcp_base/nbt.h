@@ -0,0 +1,99 @@
+/* nbt.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_NBT_H
+#define MCP_BASE_NBT_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint{16,32}_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+
+/* the deepest nesting of lists and compounds that mcp_nbt_skip accepts */
+#ifndef MCP_NBT_MAX_DEPTH
+# define MCP_NBT_MAX_DEPTH			(512)
+#endif
+
+/* number of hash slots in a mcp_nbt_index, must be a power of two.
+ * an index holds at most half as many keys as it has slots */
+#ifndef MCP_NBT_INDEX_SLOTS
+# define MCP_NBT_INDEX_SLOTS		(64)
+#endif
+
+enum mcp_nbt_tag {
+	MCP_NBT_END						= 0,
+	MCP_NBT_BYTE					= 1,
+	MCP_NBT_SHORT					= 2,
+	MCP_NBT_INT						= 3,
+	MCP_NBT_LONG					= 4,
+	MCP_NBT_FLOAT					= 5,
+	MCP_NBT_DOUBLE					= 6,
+	MCP_NBT_BYTE_ARRAY				= 7,
+	MCP_NBT_STRING					= 8,
+	MCP_NBT_LIST					= 9,
+	MCP_NBT_COMPOUND				= 10,
+	MCP_NBT_INT_ARRAY				= 11,
+	MCP_NBT_LONG_ARRAY				= 12
+};
+
+struct mcp_nbt_entry {
+	/* offset of the name from the base pointer, the payload follows it */
+	size_t name;
+	uint32_t hash;
+	uint16_t name_len;
+	unsigned char tag;
+};
+
+struct mcp_nbt_index {
+	/* base pointer of the indexed blob */
+	const unsigned char *base;
+	/* offset of the first unindexed tag and the end of the compound */
+	size_t resume, end;
+	/* number of indexed keys */
+	size_t count;
+	/* non-zero if every key in the compound was indexed */
+	int complete;
+	/* open addressed table of entry numbers plus one, zero if empty */
+	uint16_t slots[MCP_NBT_INDEX_SLOTS];
+	struct mcp_nbt_entry entries[MCP_NBT_INDEX_SLOTS / 2];
+};
+
+/* reads a tag id and its name. name and name_len are set to the
+ * zero-copy name of the tag, or NULL and zero for MCP_NBT_END.
+ * returns MCP_NBT_END on error */
+enum mcp_nbt_tag mcp_nbt_header(struct mcp_parse *buf, const char **name,
+								size_t *name_len);
+
+/* consumes the payload of a tag without decoding it.
+ * lists of fixed-size tags and arrays are skipped by their length prefix */
+void mcp_nbt_skip(struct mcp_parse *buf, enum mcp_nbt_tag tag);
+
+/* scans the payload of a compound for the tag named name, stopping as soon
+ * as it is found. on success buf is left at the payload of the tag and
+ * the tag is returned. otherwise buf is left after the end of the compound
+ * and MCP_NBT_END is returned */
+enum mcp_nbt_tag mcp_nbt_find(struct mcp_parse *buf, const char *name,
+								size_t name_len);
+
+/* consumes the payload of a compound, recording the offset of each key in idx.
+ * if the compound holds more keys than idx can hold, the remaining keys
+ * are skipped and found by scanning during mcp_nbt_lookup */
+void mcp_nbt_index(struct mcp_nbt_index *idx, struct mcp_parse *buf);
+
+/* looks up a key in an index built with mcp_nbt_index. on success value
+ * is started at the payload of the tag and the tag is returned.
+ * returns MCP_NBT_END if there is no such key */
+enum mcp_nbt_tag mcp_nbt_lookup(const struct mcp_nbt_index *idx,
+								struct mcp_parse *value,
+								const char *name, size_t name_len);
+
+#endif
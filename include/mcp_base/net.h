@@ -0,0 +1,198 @@
+/* net.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_NET_H
+#define MCP_BASE_NET_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint64_t */
+#include <stdint.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+
+/* the maximum number of worker threads */
+#ifndef MCP_NET_MAX_WORKERS
+# define MCP_NET_MAX_WORKERS		(256)
+#endif
+
+/* bytes read from a socket at a time */
+#ifndef MCP_NET_READ_SIZE
+# define MCP_NET_READ_SIZE			(16384)
+#endif
+
+/* the node-local pools of connection buffers, when workers are placed on
+ * numa nodes: buffers of at least the threshold are taken from the pool of
+ * the node, which keeps up to the cache of free blocks */
+#ifndef MCP_NET_NUMA_THRESHOLD
+# define MCP_NET_NUMA_THRESHOLD		(4096)
+#endif
+#ifndef MCP_NET_NUMA_CACHE
+# define MCP_NET_NUMA_CACHE			((size_t)64 << 20)
+#endif
+
+/* the flush threshold used when only flush_delay is set, about one segment */
+#ifndef MCP_NET_FLUSH_BYTES
+# define MCP_NET_FLUSH_BYTES		(1400)
+#endif
+
+struct mcp_net;
+struct mcp_conn;
+struct mcp_packet;
+struct mcp_capture;
+struct mcp_numa;
+
+/* transforms every frame sent on a connection, e.g. to compress or encrypt it.
+ * appends the bytes to put on the wire for the frame body to out.
+ * returns zero on success */
+typedef int (*mcp_conn_filter_t)(struct mcp_conn *conn, struct fbuf *out,
+									const void *body, size_t size, void *user);
+
+struct mcp_net_config {
+	/* address and port to listen on. host may be NULL to listen on all
+	 * addresses. port may be zero to pick a free port, see mcp_net_port.
+	 * set listen to zero to only make outbound connections */
+	const char *host;
+	unsigned short port;
+	int listen;
+
+	/* number of worker threads, zero for one per online cpu */
+	int workers;
+	/* pin worker i to cpu i, or to the cpus of its node */
+	int pin;
+
+	/* topology that the workers are spread over, or NULL. with pin, the
+	 * workers are pinned round robin to the nodes with cpus, see
+	 * mcp_numa_spread, and without it, or if pinning fails, each worker
+	 * stays on the node it starts on. the fbufs of its connections are
+	 * taken from a pool bound to that node. must outlive the engine */
+	const struct mcp_numa *numa;
+
+	/* limits of the inbound and outbound fbufs of each connection */
+	size_t in_max, out_max;
+
+	/* coalescing of small writes. when flush_delay is non-zero, data sent
+	 * on a connection is held until flush_bytes are waiting, until
+	 * flush_delay milliseconds have passed since the oldest of it was
+	 * sent, or until mcp_conn_urgent or mcp_net_flush is called.
+	 * when flush_delay is zero, data is written after every callback */
+	size_t flush_bytes;
+	unsigned int flush_delay;
+
+	/* budget that the fbufs of every connection are charged to, or NULL.
+	 * under hard pressure the workers stop reading from connections until
+	 * the budget has room again. check fbuf_pressure before bulk sends */
+	struct fbuf_budget *budget;
+
+	/* capture that the body of every frame sent and received is recorded
+	 * to, or NULL. see capture.h */
+	struct mcp_capture *capture;
+
+	/* called on the worker thread that owns the connection.
+	 * on_frame is given the body of each length-prefixed frame; the
+	 * parser is only valid until on_frame returns */
+	void (*on_open)(struct mcp_conn *conn, void *user);
+	void (*on_frame)(struct mcp_conn *conn, struct mcp_parse *frame, void *user);
+	void (*on_close)(struct mcp_conn *conn, void *user);
+	void *user;
+};
+
+/* counters of one worker. only read them after mcp_net_stop */
+struct mcp_net_stats {
+	uint64_t accepted, closed;
+	uint64_t frames_in, bytes_in;
+	uint64_t frames_out, bytes_out;
+	uint64_t reads, writes;
+	/* times reading from a connection was paused by the budget */
+	uint64_t pauses;
+};
+
+/* starts the worker threads. on error returns NULL and sets errno */
+struct mcp_net *mcp_net_start(const struct mcp_net_config *config);
+/* stops and joins the worker threads, closing every connection */
+void mcp_net_stop(struct mcp_net *net);
+/* frees an engine stopped with mcp_net_stop */
+void mcp_net_free(struct mcp_net *net);
+
+/* returns the port the engine is listening on */
+unsigned short mcp_net_port(struct mcp_net *net);
+/* returns the number of worker threads */
+int mcp_net_workers(struct mcp_net *net);
+/* returns the counters of a worker */
+const struct mcp_net_stats *mcp_net_stats(struct mcp_net *net, int worker);
+
+/* returns the pool of connection buffers of a numa node, e.g. to keep other
+ * buffers of a connection on its node, or NULL without a topology */
+struct fbuf_pages *mcp_net_pages(struct mcp_net *net, int node);
+
+/* writes the data held on every connection without waiting for the
+ * flush threshold or deadlines, e.g. at the end of a tick.
+ * safe to call from any thread */
+void mcp_net_flush(struct mcp_net *net);
+
+/* hands a connected socket over to a worker, which takes ownership of it.
+ * safe to call from any thread. returns zero on success */
+int mcp_net_adopt(struct mcp_net *net, int fd);
+/* makes a connection to host and port and adopts it.
+ * safe to call from any thread. returns zero on success */
+int mcp_net_connect(struct mcp_net *net, const char *host, unsigned short port);
+
+/* the following functions may only be called on the worker thread
+ * that owns the connection, i.e. from its callbacks */
+
+/* the inbound and outbound buffers of the connection */
+struct fbuf *mcp_conn_in(struct mcp_conn *conn);
+struct fbuf *mcp_conn_out(struct mcp_conn *conn);
+
+/* the socket of the connection */
+int mcp_conn_fd(struct mcp_conn *conn);
+/* the index of the worker that owns the connection */
+int mcp_conn_worker(struct mcp_conn *conn);
+/* the numa node of the worker that owns the connection, zero without a
+ * topology */
+int mcp_conn_node(struct mcp_conn *conn);
+/* a number unique to the connection within the engine */
+uint32_t mcp_conn_id(struct mcp_conn *conn);
+
+/* application data of the connection */
+void *mcp_conn_user(struct mcp_conn *conn);
+void mcp_conn_set_user(struct mcp_conn *conn, void *user);
+
+/* appends a length-prefixed frame to the outbound buffer.
+ * it is written when the current callback returns.
+ * returns zero on success, or one if the outbound buffer is full */
+int mcp_conn_send(struct mcp_conn *conn, const void *data, size_t size);
+/* queues a shared packet to be written straight from its buffer, after
+ * everything already in the outbound buffer. takes a new reference to
+ * packet, which is dropped once it is written.
+ * returns zero on success */
+int mcp_conn_send_packet(struct mcp_conn *conn, struct mcp_packet *packet);
+/* sets the filter that frames sent with mcp_conn_send and
+ * mcp_conn_send_packet go through. shared packets are copied through the
+ * filter, so only set one when the connection needs it. data written
+ * with mcp_conn_out does not go through the filter */
+void mcp_conn_set_filter(struct mcp_conn *conn, mcp_conn_filter_t filter,
+							void *user);
+/* writes everything waiting on the connection once the current callback
+ * returns, without waiting for the flush threshold or deadline. call it
+ * after sending a latency sensitive packet, e.g. a keep alive */
+void mcp_conn_urgent(struct mcp_conn *conn);
+/* sets the flush deadline of the connection in milliseconds,
+ * zero writes after every callback. defaults to flush_delay */
+void mcp_conn_set_delay(struct mcp_conn *conn, unsigned int delay);
+/* writes as much of the outbound buffer as the socket accepts.
+ * returns zero on success */
+int mcp_conn_flush(struct mcp_conn *conn);
+/* closes the connection once the current callback returns.
+ * on_close is called before it is freed */
+void mcp_conn_close(struct mcp_conn *conn);
+
+#endif
@@ -0,0 +1,72 @@
+/* numa.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_NUMA_H
+#define MCP_BASE_NUMA_H
+
+/* for size_t */
+#include <stdlib.h>
+
+#include <mcp_base/fbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the most nodes and cpus of a topology */
+#ifndef MCP_NUMA_MAX_NODES
+# define MCP_NUMA_MAX_NODES			(64)
+#endif
+#ifndef MCP_NUMA_MAX_CPUS
+# define MCP_NUMA_MAX_CPUS			(1024)
+#endif
+
+/* the numa nodes of a machine, and the node of each cpu.
+ * a simulated topology neither pins threads nor binds memory, it only
+ * keeps track of where they would be, so that placement can be tested
+ * on a machine with one node */
+struct mcp_numa {
+	int nodes, cpus;
+	int simulated;
+	unsigned char node[MCP_NUMA_MAX_CPUS];
+};
+
+/* reads the topology of the machine. a machine without numa, or whose
+ * topology can not be read, has one node with every cpu.
+ * returns the number of nodes */
+int mcp_numa_detect(struct mcp_numa *numa);
+
+/* sets up a simulated topology of nodes, each with an equal share of cpus */
+void mcp_numa_simulate(struct mcp_numa *numa, int nodes, int cpus);
+
+/* returns the node that the index-th of several threads is placed on.
+ * threads are spread round robin over the nodes with cpus, so that nodes
+ * with only memory are skipped */
+int mcp_numa_spread(const struct mcp_numa *numa, int index);
+
+/* pins the calling thread to the cpus of node.
+ * returns zero on success, or one if the node has no cpus or the thread
+ * could not be pinned */
+int mcp_numa_pin(const struct mcp_numa *numa, int node);
+
+/* returns the node of the calling thread: the node it was pinned to, or
+ * the node of the cpu it is running on */
+int mcp_numa_node(const struct mcp_numa *numa);
+
+/* sets up a pool like fbuf_pages_init, whose blocks are bound to node.
+ * the blocks of a pool for a simulated topology are only tagged with
+ * their node */
+void mcp_numa_pages_init(const struct mcp_numa *numa, struct fbuf_pages *pages,
+							int node, size_t threshold, size_t max_cached);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/* packed.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_PACKED_H
+#define MCP_BASE_PACKED_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint{16,32}_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+
+/* bit-packed arrays of big-endian longs, as used by paletted containers.
+ * entries are packed starting from the least significant bit of each long */
+enum mcp_packed_layout {
+	/* entries never span two longs, the high bits of each long are padding */
+	MCP_PACKED_ALIGNED				= 0,
+	/* entries are packed back to back and may span two longs */
+	MCP_PACKED_SPANNING				= 1
+};
+
+/* returns the number of longs that hold count entries of bits bits */
+size_t mcp_packed_longs(size_t count, unsigned int bits,
+						enum mcp_packed_layout layout);
+
+/* unpack count entries of bits bits into dest, consuming
+ * mcp_packed_longs(count, bits, layout) longs from buf.
+ * bits must be in 1..16 for ushort and 1..32 for uint, otherwise
+ * MCP_EINVAL is set on buf. */
+void mcp_packed_ushort(uint16_t *dest, size_t count, unsigned int bits,
+						enum mcp_packed_layout layout, struct mcp_parse *buf);
+void mcp_packed_uint(uint32_t *dest, size_t count, unsigned int bits,
+						enum mcp_packed_layout layout, struct mcp_parse *buf);
+
+/* pack count entries of bits bits from src into buf. only the low bits bits
+ * of each entry are written, and unused bits of the last long are zero.
+ * returns zero on success, or one if bits is out of range or on error */
+int mcg_packed_ushort(struct fbuf *buf, const uint16_t *src, size_t count,
+						unsigned int bits, enum mcp_packed_layout layout);
+int mcg_packed_uint(struct fbuf *buf, const uint32_t *src, size_t count,
+						unsigned int bits, enum mcp_packed_layout layout);
+
+#endif
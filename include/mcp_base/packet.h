@@ -0,0 +1,62 @@
+/* packet.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_PACKET_H
+#define MCP_BASE_PACKET_H
+
+/* for size_t */
+#include <stdlib.h>
+
+struct fbuf;
+
+/* an immutable, reference-counted, length-prefixed frame.
+ * encode a packet once and share it between every connection it is sent to */
+struct mcp_packet {
+	/* number of references, modified atomically */
+	unsigned int refs;
+	/* size of the whole frame and the offset of the body in it */
+	size_t size, body;
+	unsigned char data[];
+};
+
+/* creates a packet holding a copy of body with a length prefix.
+ * the new packet has one reference.
+ * returns NULL if there is no memory or the body is too large */
+struct mcp_packet *mcp_packet_new(const void *body, size_t size);
+/* same as mcp_packet_new with the data waiting in buf as the body */
+struct mcp_packet *mcp_packet_fbuf(struct fbuf *buf);
+
+/* adds a reference, and returns packet */
+struct mcp_packet *mcp_packet_ref(struct mcp_packet *packet);
+/* drops a reference, freeing the packet when the last one is dropped */
+void mcp_packet_unref(struct mcp_packet *packet);
+
+/* the whole frame, including the length prefix */
+static inline const unsigned char *mcp_packet_data(const struct mcp_packet *packet)
+{
+	return packet->data;
+}
+
+static inline size_t mcp_packet_size(const struct mcp_packet *packet)
+{
+	return packet->size;
+}
+
+/* the body of the frame, without the length prefix */
+static inline const unsigned char *mcp_packet_body(const struct mcp_packet *packet)
+{
+	return packet->data + packet->body;
+}
+
+static inline size_t mcp_packet_body_size(const struct mcp_packet *packet)
+{
+	return packet->size - packet->body;
+}
+
+#endif
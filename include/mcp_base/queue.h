@@ -0,0 +1,53 @@
+/* queue.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_QUEUE_H
+#define MCP_BASE_QUEUE_H
+
+/* for size_t */
+#include <stdlib.h>
+
+#include <mcp_base/fbuf.h>
+
+/* the size of a cache line, the indices of each queue are padded to it */
+#ifndef MCP_CACHE_LINE
+# define MCP_CACHE_LINE			(64)
+#endif
+
+/* bounded lock-free queues that hand fbufs from one thread to another.
+ * pushing moves the memory block of the fbuf into the queue and leaves the
+ * fbuf empty, popping moves it out again, so no data is copied. a segment
+ * of a block is handed over by consuming and unproducing the fbuf first. */
+
+/* one producer thread and one consumer thread */
+struct mcp_spsc;
+/* any number of producer threads and one consumer thread */
+struct mcp_mpsc;
+
+/* creates a queue that holds at least capacity fbufs.
+ * returns NULL if there is no memory */
+struct mcp_spsc *mcp_spsc_new(size_t capacity);
+/* frees the queue and every fbuf still in it.
+ * no thread may be using the queue */
+void mcp_spsc_free(struct mcp_spsc *queue);
+/* moves buf into the queue. on success buf is left empty, as if fbuf_free
+ * was called, and zero is returned. returns one if the queue is full */
+int mcp_spsc_push(struct mcp_spsc *queue, struct fbuf *buf);
+/* moves up to max fbufs out of the queue into bufs, oldest first.
+ * returns the number of fbufs moved */
+size_t mcp_spsc_pop(struct mcp_spsc *queue, struct fbuf *bufs, size_t max);
+
+struct mcp_mpsc *mcp_mpsc_new(size_t capacity);
+void mcp_mpsc_free(struct mcp_mpsc *queue);
+/* safe to call from any number of threads at once */
+int mcp_mpsc_push(struct mcp_mpsc *queue, struct fbuf *buf);
+/* fbufs pushed by one thread come out in the order they were pushed */
+size_t mcp_mpsc_pop(struct mcp_mpsc *queue, struct fbuf *bufs, size_t max);
+
+#endif
@@ -0,0 +1,160 @@
+/* region.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_REGION_H
+#define MCP_BASE_REGION_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint32_t */
+#include <stdint.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the chunks of a region, 32 by 32 */
+#define MCP_REGION_CHUNKS			(1024)
+/* region files are allocated in sectors, the first two hold the header */
+#define MCP_REGION_SECTOR			(4096)
+#define MCP_REGION_HEADER			(2 * MCP_REGION_SECTOR)
+
+/* the most sectors of a chunk, the size in the lower 8 bits of its location */
+#define MCP_REGION_MAX_SECTORS		(255)
+
+/* the largest chunk that is inflated, larger ones are treated as malformed
+ * rather than filling the memory */
+#ifndef MCP_REGION_MAX_INFLATED
+# define MCP_REGION_MAX_INFLATED	((size_t)64 << 20)
+#endif
+
+/* a region file starts with a header:
+ *	uint[1024]	location of each chunk: the offset of its first sector in
+ *				the upper 24 bits, and its number of sectors in the lower 8.
+ *				zero if the chunk is not in the file
+ *	uint[1024]	time each chunk was last saved, in seconds since the epoch
+ * each chunk starts at its first sector:
+ *	uint		length of what follows
+ *	ubyte		compression, see enum mcp_region_compression
+ *	raw			the compressed nbt of the chunk */
+enum mcp_region_compression {
+	MCP_REGION_GZIP = 1,
+	MCP_REGION_ZLIB = 2,
+	MCP_REGION_NONE = 3
+};
+
+/* a region file mapped into memory */
+struct mcp_region {
+	const unsigned char *base;
+	size_t size;
+	uint32_t locations[MCP_REGION_CHUNKS];
+	uint32_t timestamps[MCP_REGION_CHUNKS];
+};
+
+/* a chunk of a region, in the mapping */
+struct mcp_region_chunk {
+	enum mcp_region_compression compression;
+	uint32_t timestamp;
+	/* over the compressed data */
+	struct mcp_parse data;
+};
+
+/* returns the index in a region of the chunk at x, z */
+static inline int mcp_region_index(int x, int z)
+{
+	return (x & 31) | (z & 31) << 5;
+}
+
+/* maps the region at path and reads its header. an empty file is a region
+ * without chunks. on error returns non-zero and sets errno */
+int mcp_region_open(struct mcp_region *region, const char *path);
+/* unmaps the region */
+void mcp_region_close(struct mcp_region *region);
+
+/* finds the chunk at index, without copying it. returns one if the chunk
+ * was found, or zero if it is not in the region or is malformed, in which
+ * case MCP_EINVAL is set on chunk->data */
+int mcp_region_chunk(struct mcp_region *region, int index,
+						struct mcp_region_chunk *chunk);
+
+/* decompresses a chunk, appending its nbt to out. out may take its blocks
+ * from a pool, see fbuf_set_pages. returns zero on success, or one if the
+ * data is malformed or out is full, in which case nothing is appended */
+int mcp_region_inflate(struct fbuf *out, struct mcp_region_chunk *chunk);
+
+/* called with the nbt of each chunk loaded, on any of the threads */
+typedef void (*mcp_region_fn)(int index, struct fbuf *nbt, void *user);
+
+/* inflates chunks of a region on threads threads, including the calling
+ * one, and calls fn with each of them. the chunks are read in the order of
+ * the file, with read-ahead, and inflated into fbufs from pages, which may
+ * be NULL. indexes holds count chunks, at most MCP_REGION_CHUNKS, or is NULL
+ * to load every chunk. threads may be zero for one per online cpu. chunks
+ * not in the region are skipped. returns the number of malformed chunks */
+size_t mcp_region_load(struct mcp_region *region, const int *indexes,
+						size_t count, int threads, struct fbuf_pages *pages,
+						mcp_region_fn fn, void *user);
+
+/* region files kept open by a writer between batches */
+#ifndef MCP_REGION_OPEN_FILES
+# define MCP_REGION_OPEN_FILES		(32)
+#endif
+
+/* saves chunks to the region files of a world in the background. the nbt of
+ * each chunk is handed over in an fbuf, compressed on worker threads, and
+ * written by an io thread in batches, in the order the chunks were saved.
+ * the chunks of a batch are written to free sectors and each file is
+ * synced, then the header of each file is written and synced. the header
+ * on disk only points to chunks that are on disk, and the sectors that
+ * chunks moved out of are only reused once the new header is synced */
+struct mcp_region_writer;
+
+struct mcp_region_writer_config {
+	/* directory of the region files, named r.<x>.<z>.mca. files that do
+	 * not exist are created */
+	const char *dir;
+	/* most chunks that may be saved and not yet written */
+	size_t capacity;
+	/* number of compression threads, zero for one per online cpu */
+	int threads;
+	/* zlib compression level, or -1 for the default */
+	int level;
+	/* pool that the compressed chunks take their blocks from, or NULL.
+	 * must outlive the writer */
+	struct fbuf_pages *pages;
+};
+
+/* starts the threads of a writer. on error returns NULL and sets errno */
+struct mcp_region_writer *mcp_region_writer_start(
+							const struct mcp_region_writer_config *config);
+/* writes every chunk saved, joins the threads and frees the writer.
+ * returns the number of chunks that were not written since the last flush */
+size_t mcp_region_writer_stop(struct mcp_region_writer *writer);
+
+/* saves the nbt of the chunk at x, z, with a timestamp in seconds since the
+ * epoch. nbt is moved into the writer as with mcp_spsc_push, so it should
+ * take its blocks from a pool. on success nbt is left empty and zero is
+ * returned. returns one if capacity chunks are waiting to be written, in
+ * which case nbt is unchanged. safe to call from any thread */
+int mcp_region_save(struct mcp_region_writer *writer, int x, int z,
+						uint32_t timestamp, struct fbuf *nbt);
+
+/* waits until every chunk saved before is written and synced. returns the
+ * number of chunks that could not be written since the last flush */
+size_t mcp_region_flush(struct mcp_region_writer *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+/* rewrite.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_REWRITE_H
+#define MCP_BASE_REWRITE_H
+
+/* for size_t */
+#include <stdlib.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* rewrites fields of the frames waiting in an fbuf, e.g. to remap entity
+ * or packet ids in a proxy, without decoding and encoding the packets.
+ *
+ * frame is the offset from fbuf_ptr(buf) of the length prefix of a whole,
+ * uncompressed frame. offset is the offset of the field in the body of the
+ * frame, as given by mcp_consumed for a parser started at the body.
+ *
+ * these return 0 on success and 1 if the frame is not whole or is
+ * malformed, the field is not in the body, the frame would grow past
+ * MCP_BYTES_MAX_SIZE or there was no memory. on error, buf is not modified */
+
+/* replaces the varint or varlong at offset with value. a value that is
+ * narrower than the one it replaces is padded to the same width, so only a
+ * wider value moves the rest of the buffer. then the length prefix of the
+ * frame is rewritten, and only widened when the new size does not fit.
+ * fbuf_ptr may change when the buffer grows */
+int mcp_rewrite_varint(struct fbuf *buf, size_t frame, size_t offset,
+						mcp_varlong_t value);
+/* replaces size bytes at offset with a copy of value */
+int mcp_rewrite_fixed(struct fbuf *buf, size_t frame, size_t offset,
+						const void *value, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
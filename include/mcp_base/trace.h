@@ -0,0 +1,126 @@
+/* trace.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_TRACE_H
+#define MCP_BASE_TRACE_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for uint64_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+
+/* where an error was set or a buffer was reallocated */
+enum mcp_trace_site {
+	MCP_SITE_RAW,
+	MCP_SITE_VARINT,
+	MCP_SITE_VARLONG,
+	MCP_SITE_BYTES,
+	MCP_SITE_STRING,
+	MCP_SITE_SKIP,
+	MCP_SITE_DISPATCH,
+	MCP_SITE_ARENA,
+	MCP_SITE_REGION,
+	MCP_SITE_MCG_BYTES,
+	MCP_SITE_FBUF_EXPAND,
+	MCP_SITE_FBUF_SHRINK,
+	MCP_NUM_SITES
+};
+
+/* counts of the calling thread, only kept when built with MCP_BASE_STATS */
+struct mcp_stats {
+	/* errors by the site they were set at */
+	uint64_t eagain[MCP_NUM_SITES];
+	uint64_t enomem[MCP_NUM_SITES];
+	uint64_t eoverflow[MCP_NUM_SITES];
+	uint64_t einval[MCP_NUM_SITES];
+	/* fbuf reallocations and the bytes they moved to */
+	uint64_t reallocs, realloc_bytes;
+};
+
+/* returns the name of a site, e.g. "mcp_varlong" */
+const char *mcp_trace_site_name(enum mcp_trace_site site);
+/* copies the counts of the calling thread into stats.
+ * returns one if counts are not kept, and stats is zeroed */
+int mcp_stats_get(struct mcp_stats *stats);
+/* zeroes the counts of the calling thread */
+void mcp_stats_reset(void);
+
+/* the hooks below are used where errors are set. each expands to nothing
+ * unless the library is built with MCP_BASE_STATS or MCP_BASE_PROBES.
+ *
+ * the probes are USDT probes of the provider mcp_base:
+ *	error(site, error, offset)	an error was set, offset is the bytes
+ *								consumed or produced so far
+ *	realloc(site, old, new)		a fbuf was reallocated from old to new bytes
+ * e.g. bpftrace -e 'usdt:./libmcp_base.so:mcp_base:error
+ *					{ @[arg0, arg1, ustack] = count(); }' */
+
+#if defined(MCP_BASE_PROBES) && defined(MCP_BASE_HAVE_SDT)
+# include <sys/sdt.h>
+# define MCP_PROBE_ERROR(site, error, offset)								\
+	DTRACE_PROBE3(mcp_base, error, site, error, offset)
+# define MCP_PROBE_REALLOC(site, old_size, new_size)						\
+	DTRACE_PROBE3(mcp_base, realloc, site, old_size, new_size)
+#else
+# define MCP_PROBE_ERROR(site, error, offset)			do { } while (0)
+# define MCP_PROBE_REALLOC(site, old_size, new_size)	do { } while (0)
+#endif
+
+#ifdef MCP_BASE_STATS
+extern __thread struct mcp_stats mcp_thread_stats;
+
+static inline void mcp_stats_error(enum mcp_trace_site site, mcp_error_t error)
+{
+	switch (error) {
+	case MCP_EAGAIN:
+		mcp_thread_stats.eagain[site]++;
+		break;
+	case MCP_ENOMEM:
+		mcp_thread_stats.enomem[site]++;
+		break;
+	case MCP_EOVERFLOW:
+		mcp_thread_stats.eoverflow[site]++;
+		break;
+	case MCP_EINVAL:
+		mcp_thread_stats.einval[site]++;
+		break;
+	case MCP_EOK:
+		break;
+	}
+}
+
+# define MCP_STATS_ERROR(site, error)		mcp_stats_error(site, error)
+# define MCP_STATS_REALLOC(new_size)										\
+	do {																	\
+		mcp_thread_stats.reallocs++;										\
+		mcp_thread_stats.realloc_bytes += (new_size);						\
+	} while (0)
+#else
+# define MCP_STATS_ERROR(site, error)		do { } while (0)
+# define MCP_STATS_REALLOC(new_size)		do { } while (0)
+#endif
+
+/* records that error was set at site */
+#define MCP_TRACE_ERROR(site, error, offset)								\
+	do {																	\
+		MCP_STATS_ERROR(site, error);										\
+		MCP_PROBE_ERROR(site, error, offset);								\
+	} while (0)
+
+/* records that a fbuf was reallocated at site */
+#define MCP_TRACE_REALLOC(site, old_size, new_size)							\
+	do {																	\
+		MCP_STATS_REALLOC(new_size);										\
+		MCP_PROBE_REALLOC(site, old_size, new_size);						\
+	} while (0)
+
+#endif
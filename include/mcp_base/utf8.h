@@ -0,0 +1,33 @@
+/* utf8.h
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#ifndef MCP_BASE_UTF8_H
+#define MCP_BASE_UTF8_H
+
+/* for size_t */
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returned by mcp_utf8_units for malformed utf-8 */
+#define MCP_UTF8_INVALID			((size_t)-1)
+
+/* validates size bytes of utf-8 and returns the number of utf-16 code units
+ * they decode to, which is how the protocol bounds the length of strings.
+ * overlong encodings, surrogates and code points past U+10FFFF are
+ * malformed. returns MCP_UTF8_INVALID if data is malformed */
+size_t mcp_utf8_units(const void *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
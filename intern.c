@@ -0,0 +1,300 @@
+/* intern.c - Interned identifier strings
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memcpy and memcmp */
+#include <string.h>
+/* for uint64_t */
+#include <stdint.h>
+
+#include <mcp_base/mcp.h>
+#include <mcp_base/utf8.h>
+#include <mcp_base/intern.h>
+
+/* the copies of the strings are packed into chunks of this size, strings
+ * larger than a quarter of a chunk get their own allocation */
+#ifndef MCP_INTERN_CHUNK
+# define MCP_INTERN_CHUNK			(4096)
+#endif
+
+/* the slots are open addressed with linear probing. a slot is zero when it
+ * is empty, otherwise it holds the hash of a string in its upper half and
+ * its id plus one in its lower half, so most probes that miss never touch
+ * the string. slots are written under the lock, but read without it: the
+ * entry of an id is written before its slot is published. */
+
+struct intern_entry {
+	const char *name;
+	size_t size;
+};
+
+struct mcp_intern {
+	/* read only */
+	size_t mask, capacity;
+	struct intern_entry *entries;
+
+	/* written under the lock */
+	size_t count;
+	/* the chunks, chained through their first pointer */
+	void *chunks;
+	char *next, *end;
+	unsigned char lock;
+
+	uint64_t slots[];
+};
+
+/* a multiply-xorshift hash of eight bytes at a time. the last bytes are
+ * read with loads that overlap the ones before them, so that no load has a
+ * variable size */
+static uint32_t intern_hash(const void *data, size_t size)
+{
+	const unsigned char *ptr = data;
+	uint64_t hash = (size + 1) * UINT64_C(0x9e3779b97f4a7c15), word;
+	uint32_t half;
+	size_t left;
+
+	for (left = size; left > 8; left -= 8, ptr += 8) {
+		memcpy(&word, ptr, sizeof(word));
+		hash = (hash ^ word) * UINT64_C(0xff51afd7ed558ccd);
+		hash ^= hash >> 32;
+	}
+
+	if (size >= 8) {
+		memcpy(&word, ptr + left - 8, sizeof(word));
+	} else if (size >= 4) {
+		memcpy(&half, ptr, sizeof(half));
+		word = (uint64_t)half << 32;
+		memcpy(&half, ptr + left - 4, sizeof(half));
+		word |= half;
+	} else {
+		word = 0;
+		if (size > 0)
+			word = ((uint64_t)ptr[0] << 16) | ((uint64_t)ptr[left / 2] << 8) |
+					ptr[left - 1];
+	}
+
+	hash = (hash ^ word) * UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 32;
+	hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+	return hash >> 32;
+}
+
+static inline uint64_t slot_pack(uint32_t hash, uint32_t id)
+{
+	return ((uint64_t)hash << 32) | ((uint64_t)id + 1);
+}
+
+/* compares two strings of the same size, with the same overlapping loads as
+ * intern_hash. identifiers are short, so this beats a call to memcmp */
+static int intern_equal(const void *a, const void *b, size_t size)
+{
+	const unsigned char *x = a, *y = b;
+	uint64_t u, v;
+	size_t i;
+
+	if (size < 8)
+		return memcmp(a, b, size) == 0;
+
+	for (i = 0; i + 8 < size; i += 8) {
+		memcpy(&u, x + i, sizeof(u));
+		memcpy(&v, y + i, sizeof(v));
+		if (u != v)
+			return 0;
+	}
+
+	memcpy(&u, x + size - 8, sizeof(u));
+	memcpy(&v, y + size - 8, sizeof(v));
+	return u == v;
+}
+
+static uint32_t intern_lookup(const struct mcp_intern *table, uint32_t hash,
+								const void *name, size_t size)
+{
+	const struct intern_entry *entry;
+	size_t i;
+	uint64_t slot;
+
+	/* there are always empty slots, so this ends */
+	for (i = hash & table->mask;; i = (i + 1) & table->mask) {
+		slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+		if (slot == 0)
+			return MCP_INTERN_NONE;
+
+		if ((uint32_t)(slot >> 32) != hash)
+			continue;
+
+		entry = &table->entries[(uint32_t)slot - 1];
+		if (entry->size == size && intern_equal(entry->name, name, size))
+			return (uint32_t)slot - 1;
+	}
+}
+
+/* copies a string into the chunks, with a NUL-terminator */
+static char *intern_copy(struct mcp_intern *table, const void *name,
+						size_t size)
+{
+	void *chunk;
+	char *copy;
+
+	if (size + 1 > MCP_INTERN_CHUNK / 4) {
+		chunk = malloc(sizeof(void *) + size + 1);
+		if (chunk == NULL)
+			return NULL;
+
+		/* chained in front, the current chunk is still used */
+		*(void **)chunk = table->chunks;
+		table->chunks = chunk;
+		copy = (char *)chunk + sizeof(void *);
+	} else {
+		if (table->next == NULL ||
+				(size_t)(table->end - table->next) < size + 1) {
+			chunk = malloc(MCP_INTERN_CHUNK);
+			if (chunk == NULL)
+				return NULL;
+
+			*(void **)chunk = table->chunks;
+			table->chunks = chunk;
+			table->next = (char *)chunk + sizeof(void *);
+			table->end = (char *)chunk + MCP_INTERN_CHUNK;
+		}
+
+		copy = table->next;
+		table->next += size + 1;
+	}
+
+	memcpy(copy, name, size);
+	copy[size] = 0;
+	return copy;
+}
+
+struct mcp_intern *mcp_intern_new(size_t capacity)
+{
+	struct mcp_intern *table;
+	size_t slots = 2;
+
+	/* at most half of the slots are used */
+	while (slots < 2 * capacity) {
+		if (slots > MCP_INTERN_NONE / 4)
+			return NULL;
+		slots *= 2;
+	}
+
+	table = calloc(1, sizeof(*table) + slots * sizeof(table->slots[0]));
+	if (table == NULL)
+		return NULL;
+
+	table->entries = calloc(capacity ? capacity : 1, sizeof(*table->entries));
+	if (table->entries == NULL) {
+		free(table);
+		return NULL;
+	}
+
+	table->mask = slots - 1;
+	table->capacity = capacity;
+	return table;
+}
+
+void mcp_intern_free(struct mcp_intern *table)
+{
+	void *chunk;
+
+	if (table == NULL)
+		return;
+
+	while (table->chunks != NULL) {
+		chunk = table->chunks;
+		table->chunks = *(void **)chunk;
+		free(chunk);
+	}
+
+	free(table->entries);
+	free(table);
+}
+
+uint32_t mcp_intern_add(struct mcp_intern *table, const void *name,
+						size_t size)
+{
+	uint32_t hash = intern_hash(name, size), id;
+	size_t i;
+	char *copy;
+
+	/* most strings are already interned */
+	id = intern_lookup(table, hash, name, size);
+	if (id != MCP_INTERN_NONE)
+		return id;
+
+	/* lookups skip validation, so only valid strings are added */
+	if (mcp_utf8_units(name, size) == MCP_UTF8_INVALID)
+		return MCP_INTERN_NONE;
+
+	while (__atomic_test_and_set(&table->lock, __ATOMIC_ACQUIRE))
+		;
+
+	/* another thread may have added it */
+	id = intern_lookup(table, hash, name, size);
+	if (id != MCP_INTERN_NONE)
+		goto out;
+
+	if (table->count >= table->capacity)
+		goto out;
+
+	copy = intern_copy(table, name, size);
+	if (copy == NULL)
+		goto out;
+
+	id = table->count;
+	table->entries[id].name = copy;
+	table->entries[id].size = size;
+
+	i = hash & table->mask;
+	while (table->slots[i] != 0)
+		i = (i + 1) & table->mask;
+
+	/* publish the entry */
+	__atomic_store_n(&table->slots[i], slot_pack(hash, id), __ATOMIC_RELEASE);
+	__atomic_store_n(&table->count, table->count + 1, __ATOMIC_RELEASE);
+
+out:
+	__atomic_clear(&table->lock, __ATOMIC_RELEASE);
+	return id;
+}
+
+uint32_t mcp_intern_find(const struct mcp_intern *table, const void *name,
+						size_t size)
+{
+	return intern_lookup(table, intern_hash(name, size), name, size);
+}
+
+const char *mcp_intern_name(const struct mcp_intern *table, uint32_t id,
+							size_t *size)
+{
+	if (id >= __atomic_load_n(&table->count, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	if (size != NULL)
+		*size = table->entries[id].size;
+	return table->entries[id].name;
+}
+
+size_t mcp_intern_count(const struct mcp_intern *table)
+{
+	return __atomic_load_n(&table->count, __ATOMIC_ACQUIRE);
+}
+
+uint32_t mcp_intern_parse(struct mcp_parse *buf,
+						const struct mcp_intern *table,
+						const char **value, size_t *size)
+{
+	*value = mcp_bytes(buf, size);
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return MCP_INTERN_NONE;
+
+	return mcp_intern_find(table, *value, *size);
+}
@@ -12,6 +12,7 @@
 
 #include <mcp_base/fbuf.h>
 #include <mcp_base/mcp.h>
+#include <mcp_base/trace.h>
 
 int mcg_raw(struct fbuf *buf, const void *data, size_t size)
 {
@@ -67,8 +68,10 @@ int mcg_svarlong(struct fbuf *buf, mcp_svarlong_t value)
 int mcg_bytes(struct fbuf *buf, const void *value, size_t size)
 {
 	/* overflow check */
-	if (size > MCP_BYTES_MAX_SIZE)
+	if (size > MCP_BYTES_MAX_SIZE) {
+		MCP_TRACE_ERROR(MCP_SITE_MCG_BYTES, MCP_EOVERFLOW, fbuf_avail(buf));
 		return 1;
+	}
 
 	/* write size prefix */
 	if (mcg_varlong(buf, size))
@@ -13,9 +13,14 @@
 #include <assert.h>
 
 #include <mcp_base/mcp.h>
+#include <mcp_base/utf8.h>
+#include <mcp_base/trace.h>
 
 static inline void assert_valid_mcp(struct mcp_parse *buf)
 {
+	/* unused when assertions are disabled */
+	(void)buf;
+
 	/* valid pointer */
 	assert(buf);
 	/* offset invariants */
@@ -38,6 +43,7 @@ const void *mcp_raw(struct mcp_parse *buf, size_t size)
 	/* bounds check */
 	if (mcp_avail(buf) < size) {
 		buf->error = MCP_EAGAIN;
+		MCP_TRACE_ERROR(MCP_SITE_RAW, MCP_EAGAIN, mcp_consumed(buf));
 		return NULL;
 	}
 
@@ -71,6 +77,7 @@ mcp_varint_t mcp_varint(struct mcp_parse *buf)
 	/* check for overflow */
 	if (value > UINT32_MAX) {
 		buf->error = MCP_EOVERFLOW;
+		MCP_TRACE_ERROR(MCP_SITE_VARINT, MCP_EOVERFLOW, mcp_consumed(buf));
 		return value;
 	}
 
@@ -94,12 +101,14 @@ mcp_varlong_t mcp_varlong(struct mcp_parse *buf)
 		/* check if we are in bounds */
 		if ((size_t)offset >= mcp_avail(buf)) {
 			buf->error = MCP_EAGAIN;
+			MCP_TRACE_ERROR(MCP_SITE_VARLONG, MCP_EAGAIN, mcp_consumed(buf));
 			return ret;
 		}
 
 		/* check for overflow */
 		if (offset == 9 && base[offset] > 0x1) {
 			buf->error =  MCP_EOVERFLOW;
+			MCP_TRACE_ERROR(MCP_SITE_VARLONG, MCP_EOVERFLOW, mcp_consumed(buf));
 			return ret;
 		}
 
@@ -140,6 +149,7 @@ const void *mcp_bytes(struct mcp_parse *buf, size_t *size)
 
 	if (real_size > MCP_BYTES_MAX_SIZE) {
 		buf->error = MCP_EOVERFLOW;
+		MCP_TRACE_ERROR(MCP_SITE_BYTES, MCP_EOVERFLOW, mcp_consumed(buf));
 		return NULL;
 	}
 
@@ -152,7 +162,7 @@ const void *mcp_bytes(struct mcp_parse *buf, size_t *size)
 
 size_t mcp_copy_bytes(void *dest, struct mcp_parse *buf, size_t max_size)
 {
-	size_t size;
+	size_t size = 0;
 	struct mcp_parse saved_buf = *buf;
 	const void *value = mcp_bytes(buf, &size);
 
@@ -176,7 +186,7 @@ size_t mcp_copy_bytes(void *dest, struct mcp_parse *buf, size_t max_size)
 
 size_t mcp_copy_string(char *dest, struct mcp_parse *buf, size_t max_size)
 {
-	size_t size;
+	size_t size = 0;
 	struct mcp_parse saved_buf = *buf;
 	const void *value = mcp_bytes(buf, &size);
 
@@ -199,6 +209,50 @@ size_t mcp_copy_string(char *dest, struct mcp_parse *buf, size_t max_size)
 	return size + 1;
 }
 
+const char *mcp_string(struct mcp_parse *buf, size_t *size, size_t max_units)
+{
+	mcp_varlong_t real_size = mcp_varlong(buf);
+	const char *value;
+	size_t units;
+	assert(size);
+
+	if (!mcp_ok(buf))
+		return NULL;
+
+	/* a utf-16 code unit takes at most three bytes, so longer strings are
+	 * rejected before their data arrives */
+	if (real_size > MCP_BYTES_MAX_SIZE ||
+			(max_units < MCP_BYTES_MAX_SIZE / 3 && real_size > max_units * 3)) {
+		buf->error = MCP_EOVERFLOW;
+		MCP_TRACE_ERROR(MCP_SITE_STRING, MCP_EOVERFLOW, mcp_consumed(buf));
+		return NULL;
+	}
+
+	*size = real_size;
+	value = mcp_raw(buf, *size);
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return NULL;
+
+	/* validate and count the code units in one pass */
+	units = mcp_utf8_units(value, *size);
+
+	if (units == MCP_UTF8_INVALID) {
+		buf->error = MCP_EINVAL;
+		MCP_TRACE_ERROR(MCP_SITE_STRING, MCP_EINVAL, mcp_consumed(buf));
+		return NULL;
+	}
+
+	if (units > max_units) {
+		buf->error = MCP_EOVERFLOW;
+		MCP_TRACE_ERROR(MCP_SITE_STRING, MCP_EOVERFLOW, mcp_consumed(buf));
+		return NULL;
+	}
+
+	return value;
+}
+
 uint8_t mcp_ubyte(struct mcp_parse *buf)
 {
 	const unsigned char *value = mcp_raw(buf, 1);
@@ -311,3 +365,142 @@ double mcp_double(struct mcp_parse *buf)
 
 	return value.f;
 }
+
+/* sets an error for the skip functions */
+static void mcp_skip_error(struct mcp_parse *buf, mcp_error_t error)
+{
+	buf->error = error;
+	MCP_TRACE_ERROR(MCP_SITE_SKIP, error, mcp_consumed(buf));
+}
+
+void mcp_skip_varint(struct mcp_parse *buf)
+{
+	assert_valid_mcp(buf);
+
+	/* most varints are a single byte */
+	if (mcp_ok(buf) && mcp_avail(buf) > 0 && mcp_ptr(buf)[0] < 0x80) {
+		mcp_consume(buf, 1);
+		return;
+	}
+
+	mcp_skip_varints(buf, 1);
+}
+
+void mcp_skip_varints(struct mcp_parse *buf, size_t count)
+{
+	const unsigned char *base = mcp_ptr(buf);
+	size_t avail = mcp_avail(buf), offset = 0, run = 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+		__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	const uint64_t high = UINT64_C(0x8080808080808080);
+	uint64_t word, ends;
+	size_t found;
+#endif
+
+	assert_valid_mcp(buf);
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return;
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+		__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* eight bytes at a time. each byte without the more-data-bit ends a
+	 * varint, and run is the number of bytes of the current varint so far */
+	while (count > 0 && avail - offset >= 8) {
+		memcpy(&word, base + offset, sizeof(word));
+		ends = ~word & high;
+
+		if (ends == 0) {
+			run += 8;
+			if (run >= 10) {
+				mcp_skip_error(buf, MCP_EOVERFLOW);
+				return;
+			}
+			offset += 8;
+			continue;
+		}
+
+		/* the first varint to end here started before this word */
+		if (run + __builtin_ctzll(ends) / 8 >= 10) {
+			mcp_skip_error(buf, MCP_EOVERFLOW);
+			return;
+		}
+
+		/* count the ends by adding up their bits */
+		found = ((ends >> 7) * UINT64_C(0x0101010101010101)) >> 56;
+
+		if (found < count) {
+			count -= found;
+			run = 7 - (63 - __builtin_clzll(ends)) / 8;
+			offset += 8;
+			continue;
+		}
+
+		/* the last varint ends in this word, find its end */
+		while (--count > 0)
+			ends &= ends - 1;
+
+		offset += __builtin_ctzll(ends) / 8 + 1;
+		run = 0;
+	}
+#endif
+
+	/* the rest a byte at a time */
+	while (count > 0) {
+		if (offset >= avail) {
+			mcp_skip_error(buf, MCP_EAGAIN);
+			return;
+		}
+
+		if (base[offset++] & 0x80) {
+			if (++run >= 10) {
+				mcp_skip_error(buf, MCP_EOVERFLOW);
+				return;
+			}
+		} else {
+			run = 0;
+			count--;
+		}
+	}
+
+	mcp_consume(buf, offset);
+}
+
+void mcp_skip_bytes(struct mcp_parse *buf)
+{
+	mcp_varlong_t size = mcp_varlong(buf);
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return;
+
+	if (size > MCP_BYTES_MAX_SIZE) {
+		mcp_skip_error(buf, MCP_EOVERFLOW);
+		return;
+	}
+
+	mcp_skip_fixed(buf, size, 1);
+}
+
+void mcp_skip_fixed(struct mcp_parse *buf, size_t size, size_t count)
+{
+	assert_valid_mcp(buf);
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return;
+
+	/* a run longer than the buffer can never be skipped */
+	if (size != 0 && count > (size_t)-1 / size) {
+		mcp_skip_error(buf, MCP_EOVERFLOW);
+		return;
+	}
+
+	if (size * count > mcp_avail(buf)) {
+		mcp_skip_error(buf, MCP_EAGAIN);
+		return;
+	}
+
+	mcp_consume(buf, size * count);
+}
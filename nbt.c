@@ -0,0 +1,336 @@
+/* nbt.c - Lazy navigation of NBT blobs
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memcmp, memset */
+#include <string.h>
+/* for assert */
+#include <assert.h>
+
+#include <mcp_base/mcp.h>
+#include <mcp_base/nbt.h>
+
+/* an open list or compound while skipping */
+struct nbt_frame {
+	enum mcp_nbt_tag type, elem;
+	int32_t remaining;
+};
+
+/* payload sizes of the fixed-size tags, zero if the tag is not fixed-size */
+static const unsigned char nbt_sizes[] = {
+	0, 1, 2, 4, 8, 4, 8, 0, 0, 0, 0, 0, 0
+};
+
+/* element sizes of the array tags, zero if the tag is not an array */
+static const unsigned char nbt_array_sizes[] = {
+	0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 4, 8
+};
+
+static inline int nbt_fixed(enum mcp_nbt_tag tag)
+{
+	return tag <= MCP_NBT_DOUBLE;
+}
+
+/* skips count elements of size bytes using only the length prefix */
+static void nbt_skip_run(struct mcp_parse *buf, int32_t count, size_t size)
+{
+	if (!mcp_ok(buf))
+		return;
+
+	if (count < 0) {
+		buf->error = MCP_EINVAL;
+		return;
+	}
+
+	/* bounds check without overflowing count * size */
+	if (size > 0 && (size_t)count > mcp_avail(buf) / size) {
+		buf->error = MCP_EAGAIN;
+		return;
+	}
+
+	mcp_consume(buf, (size_t)count * size);
+}
+
+/* skips the payload of tag, pushing a frame if it holds nested tags */
+static void nbt_skip_payload(struct mcp_parse *buf, enum mcp_nbt_tag tag,
+								struct nbt_frame *stack, size_t *depth)
+{
+	enum mcp_nbt_tag elem;
+	int32_t count;
+
+	switch (tag) {
+	case MCP_NBT_END:
+	case MCP_NBT_BYTE:
+	case MCP_NBT_SHORT:
+	case MCP_NBT_INT:
+	case MCP_NBT_LONG:
+	case MCP_NBT_FLOAT:
+	case MCP_NBT_DOUBLE:
+		mcp_raw(buf, nbt_sizes[tag]);
+		return;
+
+	case MCP_NBT_BYTE_ARRAY:
+	case MCP_NBT_INT_ARRAY:
+	case MCP_NBT_LONG_ARRAY:
+		count = mcp_int(buf);
+		nbt_skip_run(buf, count, nbt_array_sizes[tag]);
+		return;
+
+	case MCP_NBT_STRING:
+		mcp_raw(buf, mcp_ushort(buf));
+		return;
+
+	case MCP_NBT_LIST:
+		elem = mcp_ubyte(buf);
+		count = mcp_int(buf);
+
+		if (!mcp_ok(buf))
+			return;
+
+		if (elem > MCP_NBT_LONG_ARRAY) {
+			buf->error = MCP_EINVAL;
+			return;
+		}
+
+		/* lists of fixed-size tags are skipped in one step */
+		if (nbt_fixed(elem) || count <= 0) {
+			nbt_skip_run(buf, count, nbt_sizes[elem]);
+			return;
+		}
+		break;
+
+	case MCP_NBT_COMPOUND:
+		elem = MCP_NBT_END;
+		count = 0;
+		break;
+
+	default:
+		buf->error = MCP_EINVAL;
+		return;
+	}
+
+	/* this tag holds nested tags, push it */
+	if (*depth >= MCP_NBT_MAX_DEPTH) {
+		buf->error = MCP_EOVERFLOW;
+		return;
+	}
+
+	stack[*depth].type = tag;
+	stack[*depth].elem = elem;
+	stack[*depth].remaining = count;
+	(*depth)++;
+}
+
+/* returns the next tag in the innermost open frame, popping frames
+ * that have ended. returns MCP_NBT_END once every frame is closed */
+static enum mcp_nbt_tag nbt_next(struct mcp_parse *buf,
+								struct nbt_frame *stack, size_t *depth)
+{
+	struct nbt_frame *top;
+	enum mcp_nbt_tag tag;
+	const char *name;
+	size_t name_len;
+
+	while (*depth > 0 && mcp_ok(buf)) {
+		top = &stack[*depth - 1];
+
+		if (top->type == MCP_NBT_COMPOUND) {
+			tag = mcp_nbt_header(buf, &name, &name_len);
+			if (tag != MCP_NBT_END)
+				return tag;
+		} else if (top->remaining > 0) {
+			top->remaining--;
+			return top->elem;
+		}
+
+		/* this frame has ended */
+		(*depth)--;
+	}
+
+	return MCP_NBT_END;
+}
+
+static uint32_t nbt_hash(const void *data, size_t size)
+{
+	const unsigned char *ptr = data;
+	uint32_t hash = 2166136261UL;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++) {
+		hash ^= ptr[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+enum mcp_nbt_tag mcp_nbt_header(struct mcp_parse *buf, const char **name,
+								size_t *name_len)
+{
+	enum mcp_nbt_tag tag = mcp_ubyte(buf);
+
+	assert(name && name_len);
+
+	*name = NULL;
+	*name_len = 0;
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return MCP_NBT_END;
+
+	if (tag > MCP_NBT_LONG_ARRAY) {
+		buf->error = MCP_EINVAL;
+		return MCP_NBT_END;
+	}
+
+	/* end tags do not have a name */
+	if (tag == MCP_NBT_END)
+		return MCP_NBT_END;
+
+	*name_len = mcp_ushort(buf);
+	*name = mcp_raw(buf, *name_len);
+
+	if (!mcp_ok(buf))
+		return MCP_NBT_END;
+
+	return tag;
+}
+
+void mcp_nbt_skip(struct mcp_parse *buf, enum mcp_nbt_tag tag)
+{
+	struct nbt_frame stack[MCP_NBT_MAX_DEPTH];
+	size_t depth = 0;
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return;
+
+	/* walk the tree iteratively so hostile nesting can not blow the stack */
+	do {
+		nbt_skip_payload(buf, tag, stack, &depth);
+	} while (mcp_ok(buf) && (tag = nbt_next(buf, stack, &depth)) != MCP_NBT_END);
+}
+
+enum mcp_nbt_tag mcp_nbt_find(struct mcp_parse *buf, const char *name,
+								size_t name_len)
+{
+	enum mcp_nbt_tag tag;
+	const char *key;
+	size_t key_len;
+
+	for (;;) {
+		tag = mcp_nbt_header(buf, &key, &key_len);
+
+		/* pass errors and stop at the end of the compound */
+		if (tag == MCP_NBT_END)
+			return MCP_NBT_END;
+
+		if (key_len == name_len && memcmp(key, name, name_len) == 0)
+			return tag;
+
+		mcp_nbt_skip(buf, tag);
+	}
+}
+
+/* adds a key to the index, the first of any duplicate keys wins */
+static void nbt_index_add(struct mcp_nbt_index *idx, size_t name,
+							size_t name_len, enum mcp_nbt_tag tag)
+{
+	struct mcp_nbt_entry *entry;
+	uint32_t hash = nbt_hash(idx->base + name, name_len);
+	size_t slot = hash & (MCP_NBT_INDEX_SLOTS - 1);
+
+	/* linear probe for an empty slot */
+	while (idx->slots[slot] != 0) {
+		entry = &idx->entries[idx->slots[slot] - 1];
+		if (entry->hash == hash && entry->name_len == name_len &&
+				memcmp(idx->base + entry->name, idx->base + name, name_len) == 0)
+			return;
+		slot = (slot + 1) & (MCP_NBT_INDEX_SLOTS - 1);
+	}
+
+	entry = &idx->entries[idx->count++];
+	entry->name = name;
+	entry->hash = hash;
+	entry->name_len = name_len;
+	entry->tag = tag;
+	idx->slots[slot] = idx->count;
+}
+
+void mcp_nbt_index(struct mcp_nbt_index *idx, struct mcp_parse *buf)
+{
+	enum mcp_nbt_tag tag;
+	const char *name;
+	size_t name_len, offset;
+
+	assert(idx);
+
+	idx->base = buf->base;
+	idx->count = 0;
+	idx->complete = 1;
+	idx->resume = idx->end = buf->start;
+	memset(idx->slots, 0, sizeof(idx->slots));
+
+	for (;;) {
+		offset = buf->start;
+		tag = mcp_nbt_header(buf, &name, &name_len);
+
+		/* pass errors and stop at the end of the compound */
+		if (tag == MCP_NBT_END)
+			break;
+
+		/* the index is full, leave the rest for mcp_nbt_lookup to scan */
+		if (idx->complete && idx->count >= MCP_NBT_INDEX_SLOTS / 2) {
+			idx->complete = 0;
+			idx->resume = offset;
+		}
+
+		if (idx->complete)
+			nbt_index_add(idx, (const unsigned char *)name - idx->base,
+							name_len, tag);
+
+		mcp_nbt_skip(buf, tag);
+	}
+
+	idx->end = buf->start;
+	if (idx->complete)
+		idx->resume = idx->end;
+}
+
+enum mcp_nbt_tag mcp_nbt_lookup(const struct mcp_nbt_index *idx,
+								struct mcp_parse *value,
+								const char *name, size_t name_len)
+{
+	const struct mcp_nbt_entry *entry;
+	uint32_t hash = nbt_hash(name, name_len);
+	size_t slot = hash & (MCP_NBT_INDEX_SLOTS - 1);
+
+	assert(idx && value);
+
+	value->base = idx->base;
+	value->end = idx->end;
+	value->error = MCP_EOK;
+
+	while (idx->slots[slot] != 0) {
+		entry = &idx->entries[idx->slots[slot] - 1];
+		if (entry->hash == hash && entry->name_len == name_len &&
+				memcmp(idx->base + entry->name, name, name_len) == 0) {
+			value->start = entry->name + entry->name_len;
+			return entry->tag;
+		}
+		slot = (slot + 1) & (MCP_NBT_INDEX_SLOTS - 1);
+	}
+
+	/* fall back to scanning the keys that did not fit */
+	value->start = idx->resume;
+	if (idx->complete)
+		return MCP_NBT_END;
+
+	return mcp_nbt_find(value, name, name_len);
+}
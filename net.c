@@ -0,0 +1,1347 @@
+/* net.c - Multi-threaded epoll connection engine
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for accept4, SO_REUSEPORT and pthread_setaffinity_np */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/net.h>
+#include <mcp_base/packet.h>
+#include <mcp_base/capture.h>
+#include <mcp_base/numa.h>
+
+/* events handled per call to epoll_wait */
+#define NET_MAX_EVENTS		(256)
+/* reads from one connection before moving on to the next */
+#define NET_READ_BUDGET		(16)
+/* buffers gathered into one write */
+#define NET_MAX_IOV			(64)
+/* milliseconds between checks of the budget while reading is paused */
+#define NET_PAUSE_RETRY		(10)
+
+/* connection flags */
+#define CONN_CLOSED			(1)
+#define CONN_DIRTY			(2)
+#define CONN_POLLOUT		(4)
+#define CONN_URGENT			(8)
+#define CONN_PAUSED			(16)
+
+/* the timer index of a connection without a flush deadline */
+#define NO_TIMER			((size_t)-1)
+
+struct mcp_worker;
+
+/* a shared packet queued after mark bytes of the outbound buffer */
+struct conn_seg {
+	struct mcp_packet *packet;
+	uint64_t mark;
+	size_t offset;
+};
+
+struct mcp_conn {
+	struct mcp_worker *worker;
+	/* all connections of the worker */
+	struct mcp_conn *prev, *next;
+	/* connections to flush or free once the callbacks return */
+	struct mcp_conn *dirty;
+	int fd, flags;
+	uint32_t id;
+	struct fbuf in, out;
+	void *user;
+
+	/* shared packets interleaved with the outbound buffer, in a ring.
+	 * marks count bytes produced into out since the connection opened */
+	struct conn_seg *segs;
+	size_t seg_head, seg_count, seg_size, seg_bytes;
+	uint64_t out_consumed;
+
+	/* data is held until deadline, in milliseconds, while it is small.
+	 * timer is the index of the connection in the timer heap */
+	unsigned int delay;
+	uint64_t deadline;
+	size_t timer;
+
+	mcp_conn_filter_t filter;
+	void *filter_user;
+};
+
+struct mcp_worker {
+	struct mcp_net *net;
+	int index, node;
+	pthread_t thread;
+	int started;
+	int epfd, listenfd, wakefd;
+	struct mcp_conn *conns, *dirty;
+	struct mcp_net_stats stats;
+
+	/* connections holding data, in a heap ordered by deadline */
+	struct mcp_conn **timers;
+	size_t ntimers, timers_size;
+	uint64_t now;
+
+	/* connections not read from while the budget is under hard pressure */
+	size_t npaused;
+
+	/* sockets handed over by mcp_net_adopt, and the stop and flush flags */
+	pthread_mutex_t lock;
+	int *pending;
+	size_t npending, pending_size;
+	int stop, flush;
+};
+
+struct mcp_net {
+	struct mcp_net_config config;
+	unsigned short port;
+	int nworkers;
+	unsigned int next_worker;
+	uint32_t next_id;
+	/* a pool of connection buffers for each numa node, or NULL */
+	struct fbuf_pages *pages;
+	struct mcp_worker workers[];
+};
+
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0)
+		return -1;
+
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* returns non-zero if there is anything waiting to be written */
+static int conn_pending(struct mcp_conn *conn)
+{
+	return fbuf_avail(&conn->out) > 0 || conn->seg_count > 0;
+}
+
+/* the monotonic clock in milliseconds */
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void timer_set(struct mcp_worker *worker, size_t i, struct mcp_conn *conn)
+{
+	worker->timers[i] = conn;
+	conn->timer = i;
+}
+
+/* restores the heap order around a timer that moved to i */
+static void timer_fix(struct mcp_worker *worker, size_t i)
+{
+	struct mcp_conn *conn = worker->timers[i];
+	size_t child;
+
+	/* sift up */
+	while (i > 0 && worker->timers[(i - 1) / 2]->deadline > conn->deadline) {
+		timer_set(worker, i, worker->timers[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+
+	/* sift down */
+	while ((child = 2 * i + 1) < worker->ntimers) {
+		if (child + 1 < worker->ntimers && worker->timers[child + 1]->deadline <
+												worker->timers[child]->deadline)
+			child++;
+		if (worker->timers[child]->deadline >= conn->deadline)
+			break;
+		timer_set(worker, i, worker->timers[child]);
+		i = child;
+	}
+
+	timer_set(worker, i, conn);
+}
+
+/* arms the flush deadline of the connection, returns zero on success */
+static int timer_add(struct mcp_conn *conn, uint64_t deadline)
+{
+	struct mcp_worker *worker = conn->worker;
+	struct mcp_conn **timers;
+	size_t new_size;
+
+	assert(conn->timer == NO_TIMER);
+
+	if (worker->ntimers >= worker->timers_size) {
+		new_size = worker->timers_size ? worker->timers_size * 2 : 64;
+		timers = realloc(worker->timers, new_size * sizeof(*timers));
+		if (timers == NULL)
+			return 1;
+		worker->timers = timers;
+		worker->timers_size = new_size;
+	}
+
+	conn->deadline = deadline;
+	timer_set(worker, worker->ntimers++, conn);
+	timer_fix(worker, conn->timer);
+	return 0;
+}
+
+static void timer_remove(struct mcp_conn *conn)
+{
+	struct mcp_worker *worker = conn->worker;
+	size_t i = conn->timer;
+
+	if (i == NO_TIMER)
+		return;
+
+	conn->timer = NO_TIMER;
+	if (--worker->ntimers == i)
+		return;
+
+	/* move the last timer into the hole */
+	timer_set(worker, i, worker->timers[worker->ntimers]);
+	timer_fix(worker, i);
+}
+
+/* returns non-zero if the budget is under hard pressure */
+static int worker_pressure(struct mcp_worker *worker)
+{
+	struct fbuf_budget *budget = worker->net->config.budget;
+
+	return budget != NULL && fbuf_pressure(budget) == FBUF_PRESSURE_HARD;
+}
+
+/* polls the connection for the events that flags ask for,
+ * and sets its flags on success. returns zero on success */
+static int conn_poll(struct mcp_conn *conn, int flags)
+{
+	struct epoll_event ev;
+
+	ev.events = (flags & CONN_PAUSED ? 0 : EPOLLIN) |
+				(flags & CONN_POLLOUT ? EPOLLOUT : 0);
+	ev.data.ptr = conn;
+	if (epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev) < 0)
+		return -1;
+
+	conn->flags = flags;
+	return 0;
+}
+
+/* queues the connection to be flushed or freed after the callbacks return */
+static void conn_dirty(struct mcp_conn *conn)
+{
+	if (conn->flags & CONN_DIRTY)
+		return;
+
+	conn->flags |= CONN_DIRTY;
+	conn->dirty = conn->worker->dirty;
+	conn->worker->dirty = conn;
+}
+
+static struct mcp_conn *conn_new(struct mcp_worker *worker, int fd)
+{
+	struct mcp_net *net = worker->net;
+	struct epoll_event ev;
+	struct mcp_conn *conn = malloc(sizeof(*conn));
+	int one = 1;
+
+	if (conn == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	/* frames are small and latency sensitive */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	conn->worker = worker;
+	conn->dirty = NULL;
+	conn->fd = fd;
+	conn->flags = 0;
+	conn->id = __atomic_fetch_add(&net->next_id, 1, __ATOMIC_RELAXED);
+	conn->user = NULL;
+	conn->segs = NULL;
+	conn->seg_head = 0;
+	conn->seg_count = 0;
+	conn->seg_size = 0;
+	conn->seg_bytes = 0;
+	conn->out_consumed = 0;
+	conn->delay = net->config.flush_delay;
+	conn->deadline = 0;
+	conn->timer = NO_TIMER;
+	conn->filter = NULL;
+	conn->filter_user = NULL;
+	fbuf_init(&conn->in, net->config.in_max);
+	fbuf_init(&conn->out, net->config.out_max);
+	fbuf_set_budget(&conn->in, net->config.budget);
+	fbuf_set_budget(&conn->out, net->config.budget);
+	if (net->pages != NULL) {
+		fbuf_set_pages(&conn->in, &net->pages[worker->node]);
+		fbuf_set_pages(&conn->out, &net->pages[worker->node]);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = conn;
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		free(conn);
+		return NULL;
+	}
+
+	/* link it in */
+	conn->prev = NULL;
+	conn->next = worker->conns;
+	if (worker->conns)
+		worker->conns->prev = conn;
+	worker->conns = conn;
+
+	worker->stats.accepted++;
+
+	if (net->config.on_open)
+		net->config.on_open(conn, net->config.user);
+
+	return conn;
+}
+
+static void conn_free(struct mcp_conn *conn)
+{
+	struct mcp_worker *worker = conn->worker;
+	struct mcp_net *net = worker->net;
+
+	/* keep on_close from queueing the connection again */
+	conn->flags |= CONN_CLOSED | CONN_DIRTY;
+
+	if (net->config.on_close)
+		net->config.on_close(conn, net->config.user);
+
+	/* unlink it */
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		worker->conns = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+
+	worker->stats.closed++;
+	timer_remove(conn);
+	if (conn->flags & CONN_PAUSED)
+		worker->npaused--;
+
+	/* closing the socket also removes it from the epoll set */
+	close(conn->fd);
+	fbuf_free(&conn->in);
+	fbuf_free(&conn->out);
+
+	for (; conn->seg_count > 0; conn->seg_count--) {
+		mcp_packet_unref(conn->segs[conn->seg_head].packet);
+		conn->seg_head = (conn->seg_head + 1) % conn->seg_size;
+	}
+	free(conn->segs);
+
+	free(conn);
+}
+
+/* hands every complete frame in the inbound buffer to on_frame */
+static void conn_frames(struct mcp_conn *conn)
+{
+	struct mcp_net *net = conn->worker->net;
+	struct mcp_parse buf, frame;
+	const void *body;
+	size_t size;
+
+	while (!(conn->flags & CONN_CLOSED) && fbuf_avail(&conn->in) > 0) {
+		mcp_start(&buf, fbuf_ptr(&conn->in), fbuf_avail(&conn->in));
+		body = mcp_bytes(&buf, &size);
+
+		/* wait for the rest of the frame */
+		if (mcp_error(&buf) == MCP_EAGAIN)
+			return;
+
+		/* the length prefix is malformed */
+		if (!mcp_ok(&buf)) {
+			mcp_conn_close(conn);
+			return;
+		}
+
+		conn->worker->stats.frames_in++;
+
+		if (net->config.capture)
+			mcp_capture_frame(net->config.capture, conn->id, MCP_CAPTURE_IN,
+								body, size);
+
+		mcp_start(&frame, body, size);
+		if (net->config.on_frame)
+			net->config.on_frame(conn, &frame, net->config.user);
+
+		fbuf_consume(&conn->in, mcp_consumed(&buf));
+	}
+}
+
+/* stops reading from the connection until the budget has room */
+static void conn_pause(struct mcp_conn *conn)
+{
+	struct mcp_worker *worker = conn->worker;
+
+	if (conn_poll(conn, conn->flags | CONN_PAUSED) < 0) {
+		mcp_conn_close(conn);
+		return;
+	}
+
+	worker->npaused++;
+	worker->stats.pauses++;
+}
+
+static void conn_read(struct mcp_conn *conn)
+{
+	struct mcp_worker *worker = conn->worker;
+	unsigned char *ptr;
+	size_t size;
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < NET_READ_BUDGET && !(conn->flags & CONN_CLOSED); i++) {
+		/* read as much as fits, a frame that does not fit is an error */
+		size = fbuf_max_wavail(&conn->in);
+		if (size > MCP_NET_READ_SIZE)
+			size = MCP_NET_READ_SIZE;
+
+		if (size == 0) {
+			mcp_conn_close(conn);
+			return;
+		}
+
+		/* out of budget, wait for it instead of dropping the client */
+		ptr = fbuf_wptr(&conn->in, size);
+		if (ptr == NULL && conn->worker->net->config.budget != NULL) {
+			conn_pause(conn);
+			return;
+		}
+
+		if (ptr == NULL) {
+			mcp_conn_close(conn);
+			return;
+		}
+
+		size = fbuf_wavail(&conn->in);
+		ret = read(conn->fd, ptr, size);
+		worker->stats.reads++;
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		/* end of file or error */
+		if (ret <= 0) {
+			mcp_conn_close(conn);
+			return;
+		}
+
+		fbuf_produce(&conn->in, ret);
+		worker->stats.bytes_in += ret;
+
+		conn_frames(conn);
+
+		/* the socket is drained */
+		if ((size_t)ret < size)
+			return;
+	}
+}
+
+/* returns non-zero if the data waiting on the connection should be held
+ * back to be coalesced with what is sent next, arming its deadline */
+static int conn_hold(struct mcp_conn *conn)
+{
+	struct mcp_net *net = conn->worker->net;
+
+	/* closed, urgent, or waiting for the socket to drain anyway */
+	if (conn->delay == 0 ||
+			(conn->flags & (CONN_CLOSED | CONN_URGENT | CONN_POLLOUT)))
+		return 0;
+
+	if (!conn_pending(conn) ||
+			fbuf_avail(&conn->out) + conn->seg_bytes >= net->config.flush_bytes)
+		return 0;
+
+	/* the deadline counts from the oldest data held */
+	if (conn->timer != NO_TIMER)
+		return 1;
+
+	return timer_add(conn, conn->worker->now + conn->delay) == 0;
+}
+
+/* flushes or frees every connection touched by the callbacks */
+static void worker_dirty(struct mcp_worker *worker)
+{
+	struct mcp_conn *conn;
+	int pollout;
+
+	worker->now = now_ms();
+
+	while ((conn = worker->dirty) != NULL) {
+		worker->dirty = conn->dirty;
+		conn->flags &= ~CONN_DIRTY;
+
+		if (conn_hold(conn))
+			continue;
+
+		if (!(conn->flags & CONN_CLOSED))
+			mcp_conn_flush(conn);
+
+		if (conn->flags & CONN_CLOSED) {
+			conn_free(conn);
+			continue;
+		}
+
+		/* only ask for writability while there is something to write */
+		pollout = conn_pending(conn);
+		if (pollout == !!(conn->flags & CONN_POLLOUT))
+			continue;
+
+		if (conn_poll(conn, conn->flags ^ CONN_POLLOUT) < 0)
+			mcp_conn_close(conn);
+	}
+}
+
+/* reads from paused connections again once the budget has room */
+static void worker_resume(struct mcp_worker *worker)
+{
+	struct mcp_conn *conn;
+
+	if (worker->npaused == 0 || worker_pressure(worker))
+		return;
+
+	for (conn = worker->conns; conn != NULL; conn = conn->next) {
+		if (!(conn->flags & CONN_PAUSED) || (conn->flags & CONN_CLOSED))
+			continue;
+
+		if (conn_poll(conn, conn->flags & ~CONN_PAUSED) < 0) {
+			mcp_conn_close(conn);
+			continue;
+		}
+
+		worker->npaused--;
+	}
+}
+
+static void worker_accept(struct mcp_worker *worker)
+{
+	int fd;
+
+	for (;;) {
+		fd = accept4(worker->listenfd, NULL, NULL,
+						SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd < 0 && errno == EINTR)
+			continue;
+
+		/* EAGAIN, or an error that we can not do anything about */
+		if (fd < 0)
+			return;
+
+		conn_new(worker, fd);
+	}
+}
+
+/* queues connections past their deadline, or all of them, to be flushed */
+static void worker_expire(struct mcp_worker *worker, int all)
+{
+	struct mcp_conn *conn;
+
+	worker->now = now_ms();
+
+	while (worker->ntimers > 0) {
+		conn = worker->timers[0];
+		if (!all && conn->deadline > worker->now)
+			return;
+
+		timer_remove(conn);
+		conn->flags |= CONN_URGENT;
+		conn_dirty(conn);
+	}
+}
+
+/* returns the epoll timeout until the next deadline,
+ * or the next check of the budget */
+static int worker_timeout(struct mcp_worker *worker)
+{
+	uint64_t deadline, wait;
+	int timeout = worker->npaused > 0 ? NET_PAUSE_RETRY : -1;
+
+	if (worker->ntimers == 0)
+		return timeout;
+
+	deadline = worker->timers[0]->deadline;
+	worker->now = now_ms();
+	wait = deadline > worker->now ? deadline - worker->now : 0;
+	if (wait > INT_MAX)
+		wait = INT_MAX;
+
+	if (timeout < 0 || wait < (uint64_t)timeout)
+		timeout = wait;
+	return timeout;
+}
+
+/* adopts pending sockets, returns non-zero if the worker should stop */
+static int worker_wake(struct mcp_worker *worker)
+{
+	uint64_t value;
+	int *pending, stop, flush;
+	size_t npending, i;
+
+	if (read(worker->wakefd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		return 1;
+
+	pthread_mutex_lock(&worker->lock);
+	pending = worker->pending;
+	npending = worker->npending;
+	worker->pending = NULL;
+	worker->npending = 0;
+	worker->pending_size = 0;
+	stop = worker->stop;
+	flush = worker->flush;
+	worker->flush = 0;
+	pthread_mutex_unlock(&worker->lock);
+
+	if (flush)
+		worker_expire(worker, 1);
+
+	for (i = 0; i < npending; i++) {
+		if (stop)
+			close(pending[i]);
+		else
+			conn_new(worker, pending[i]);
+	}
+
+	free(pending);
+	return stop;
+}
+
+static void worker_pin(struct mcp_worker *worker)
+{
+	cpu_set_t set;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus <= 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(worker->index % cpus, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *worker_main(void *arg)
+{
+	struct mcp_worker *worker = arg;
+	struct epoll_event events[NET_MAX_EVENTS];
+	struct mcp_conn *conn;
+	int i, n, stop = 0;
+
+	if (worker->net->config.pin && worker->net->config.numa != NULL) {
+		/* a worker that could not be pinned is treated as unpinned */
+		if (mcp_numa_pin(worker->net->config.numa, worker->node))
+			worker->node = mcp_numa_node(worker->net->config.numa);
+	} else if (worker->net->config.pin) {
+		worker_pin(worker);
+	} else if (worker->net->config.numa != NULL) {
+		/* an unpinned worker is not placed on a node, so its buffers are
+		 * taken from the node it starts on. connections are only made on
+		 * the worker, after this */
+		worker->node = mcp_numa_node(worker->net->config.numa);
+	}
+
+	while (!stop) {
+		n = epoll_wait(worker->epfd, events, NET_MAX_EVENTS,
+						worker_timeout(worker));
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n < 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &worker->wakefd) {
+				stop |= worker_wake(worker);
+				continue;
+			}
+
+			if (events[i].data.ptr == &worker->listenfd) {
+				worker_accept(worker);
+				continue;
+			}
+
+			/* connections closed earlier in this batch are freed below */
+			conn = events[i].data.ptr;
+			if (conn->flags & CONN_CLOSED)
+				continue;
+
+			/* stop reading from clients before the budget runs out,
+			 * hang ups and errors are still read to close them */
+			if ((events[i].events & EPOLLIN) &&
+					!(events[i].events & (EPOLLHUP | EPOLLERR)) &&
+					worker_pressure(worker))
+				conn_pause(conn);
+			else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				conn_read(conn);
+
+			if ((events[i].events & EPOLLOUT) && !(conn->flags & CONN_CLOSED))
+				conn_dirty(conn);
+		}
+
+		worker_expire(worker, 0);
+		worker_dirty(worker);
+		worker_resume(worker);
+	}
+
+	/* close every connection that is left */
+	for (conn = worker->conns; conn != NULL; conn = conn->next)
+		mcp_conn_close(conn);
+	worker_dirty(worker);
+
+	return NULL;
+}
+
+static int net_listen(struct mcp_net *net, struct mcp_worker *worker)
+{
+	struct addrinfo hints, *res;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	char port[8];
+	int fd, one = 1, err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	/* every worker after the first binds the port that the first got */
+	sprintf(port, "%hu", net->port);
+	if (getaddrinfo(net->config.host, port, &hints, &res) != 0) {
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+
+	fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				res->ai_protocol);
+	if (fd < 0) {
+		freeaddrinfo(res);
+		return -1;
+	}
+
+	/* each worker has its own listener, the kernel balances between them */
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+			setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+			bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
+			listen(fd, SOMAXCONN) < 0 ||
+			getsockname(fd, (struct sockaddr *)&addr, &addrlen) < 0)
+		goto error;
+
+	freeaddrinfo(res);
+
+	if (addr.ss_family == AF_INET)
+		net->port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+	else
+		net->port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+
+	worker->listenfd = fd;
+	return 0;
+
+error:
+	err = errno;
+	freeaddrinfo(res);
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+static int worker_init(struct mcp_net *net, struct mcp_worker *worker, int index)
+{
+	struct epoll_event ev;
+
+	worker->net = net;
+	worker->index = index;
+	/* see worker_main for unpinned workers */
+	worker->node = net->config.numa && net->config.pin ?
+					mcp_numa_spread(net->config.numa, index) : 0;
+	worker->started = 0;
+	worker->listenfd = -1;
+	worker->conns = NULL;
+	worker->dirty = NULL;
+	worker->pending = NULL;
+	worker->npending = 0;
+	worker->pending_size = 0;
+	worker->stop = 0;
+	worker->flush = 0;
+	worker->timers = NULL;
+	worker->ntimers = 0;
+	worker->timers_size = 0;
+	worker->now = 0;
+	worker->npaused = 0;
+	memset(&worker->stats, 0, sizeof(worker->stats));
+	pthread_mutex_init(&worker->lock, NULL);
+
+	worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+	worker->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (worker->epfd < 0 || worker->wakefd < 0)
+		return -1;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &worker->wakefd;
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->wakefd, &ev) < 0)
+		return -1;
+
+	if (!net->config.listen)
+		return 0;
+
+	if (net_listen(net, worker) < 0)
+		return -1;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &worker->listenfd;
+	return epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->listenfd, &ev);
+}
+
+static void worker_wakeup(struct mcp_worker *worker)
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	/* the eventfd only fails if its counter would overflow,
+	 * in which case the worker is awake anyway */
+	ret = write(worker->wakefd, &one, sizeof(one));
+	(void)ret;
+}
+
+struct mcp_net *mcp_net_start(const struct mcp_net_config *config)
+{
+	struct mcp_net *net;
+	long cpus;
+	int i, err, nworkers = config->workers;
+
+	assert(config);
+
+	if (nworkers <= 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nworkers = cpus > 0 ? cpus : 1;
+	}
+
+	if (nworkers > MCP_NET_MAX_WORKERS)
+		nworkers = MCP_NET_MAX_WORKERS;
+
+	net = malloc(sizeof(*net) + nworkers * sizeof(net->workers[0]));
+	if (net == NULL)
+		return NULL;
+
+	net->config = *config;
+	net->port = config->port;
+	net->nworkers = 0;
+	net->next_worker = 0;
+	net->next_id = 0;
+	net->pages = NULL;
+
+	if (net->config.in_max == 0)
+		net->config.in_max = FBUF_MAX;
+	if (net->config.out_max == 0)
+		net->config.out_max = FBUF_MAX;
+	if (net->config.flush_bytes == 0)
+		net->config.flush_bytes = MCP_NET_FLUSH_BYTES;
+
+	if (net->config.numa != NULL) {
+		net->pages = malloc(config->numa->nodes * sizeof(*net->pages));
+		if (net->pages == NULL)
+			goto error;
+		for (i = 0; i < config->numa->nodes; i++)
+			mcp_numa_pages_init(config->numa, &net->pages[i], i,
+								MCP_NET_NUMA_THRESHOLD, MCP_NET_NUMA_CACHE);
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		net->nworkers++;
+		if (worker_init(net, &net->workers[i], i) < 0)
+			goto error;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		errno = pthread_create(&net->workers[i].thread, NULL, worker_main,
+								&net->workers[i]);
+		if (errno != 0)
+			goto error;
+		net->workers[i].started = 1;
+	}
+
+	return net;
+
+error:
+	err = errno;
+	mcp_net_stop(net);
+	mcp_net_free(net);
+	errno = err;
+	return NULL;
+}
+
+void mcp_net_stop(struct mcp_net *net)
+{
+	struct mcp_worker *worker;
+	int i;
+
+	assert(net);
+
+	for (i = 0; i < net->nworkers; i++) {
+		worker = &net->workers[i];
+		if (!worker->started)
+			continue;
+
+		pthread_mutex_lock(&worker->lock);
+		worker->stop = 1;
+		pthread_mutex_unlock(&worker->lock);
+		worker_wakeup(worker);
+	}
+
+	for (i = 0; i < net->nworkers; i++) {
+		worker = &net->workers[i];
+		if (!worker->started)
+			continue;
+
+		pthread_join(worker->thread, NULL);
+		worker->started = 0;
+	}
+}
+
+void mcp_net_free(struct mcp_net *net)
+{
+	struct mcp_worker *worker;
+	size_t j;
+	int i;
+
+	if (net == NULL)
+		return;
+
+	for (i = 0; i < net->nworkers; i++) {
+		worker = &net->workers[i];
+		assert(!worker->started);
+
+		for (j = 0; j < worker->npending; j++)
+			close(worker->pending[j]);
+		free(worker->pending);
+		free(worker->timers);
+
+		if (worker->listenfd >= 0)
+			close(worker->listenfd);
+		if (worker->wakefd >= 0)
+			close(worker->wakefd);
+		if (worker->epfd >= 0)
+			close(worker->epfd);
+		pthread_mutex_destroy(&worker->lock);
+	}
+
+	if (net->pages != NULL) {
+		for (i = 0; i < net->config.numa->nodes; i++)
+			fbuf_pages_free(&net->pages[i]);
+		free(net->pages);
+	}
+
+	free(net);
+}
+
+unsigned short mcp_net_port(struct mcp_net *net)
+{
+	return net->port;
+}
+
+int mcp_net_workers(struct mcp_net *net)
+{
+	return net->nworkers;
+}
+
+struct fbuf_pages *mcp_net_pages(struct mcp_net *net, int node)
+{
+	if (net->pages == NULL)
+		return NULL;
+
+	assert(node >= 0 && node < net->config.numa->nodes);
+	return &net->pages[node];
+}
+
+const struct mcp_net_stats *mcp_net_stats(struct mcp_net *net, int worker)
+{
+	assert(worker >= 0 && worker < net->nworkers);
+	return &net->workers[worker].stats;
+}
+
+void mcp_net_flush(struct mcp_net *net)
+{
+	struct mcp_worker *worker;
+	int i;
+
+	for (i = 0; i < net->nworkers; i++) {
+		worker = &net->workers[i];
+
+		pthread_mutex_lock(&worker->lock);
+		worker->flush = 1;
+		pthread_mutex_unlock(&worker->lock);
+		worker_wakeup(worker);
+	}
+}
+
+int mcp_net_adopt(struct mcp_net *net, int fd)
+{
+	struct mcp_worker *worker;
+	unsigned int index;
+	size_t new_size;
+	int *pending;
+
+	if (set_nonblock(fd) < 0)
+		return -1;
+
+	/* spread connections between the workers */
+	index = __atomic_fetch_add(&net->next_worker, 1, __ATOMIC_RELAXED);
+	worker = &net->workers[index % net->nworkers];
+
+	pthread_mutex_lock(&worker->lock);
+
+	if (worker->stop) {
+		pthread_mutex_unlock(&worker->lock);
+		errno = ESHUTDOWN;
+		return -1;
+	}
+
+	if (worker->npending >= worker->pending_size) {
+		new_size = worker->pending_size ? worker->pending_size * 2 : 16;
+		pending = realloc(worker->pending, new_size * sizeof(*pending));
+		if (pending == NULL) {
+			pthread_mutex_unlock(&worker->lock);
+			errno = ENOMEM;
+			return -1;
+		}
+		worker->pending = pending;
+		worker->pending_size = new_size;
+	}
+
+	worker->pending[worker->npending++] = fd;
+	pthread_mutex_unlock(&worker->lock);
+
+	worker_wakeup(worker);
+	return 0;
+}
+
+int mcp_net_connect(struct mcp_net *net, const char *host, unsigned short port)
+{
+	struct addrinfo hints, *res;
+	char service[8];
+	int fd, err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	sprintf(service, "%hu", port);
+	if (getaddrinfo(host, service, &hints, &res) != 0) {
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+
+	fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				res->ai_protocol);
+	if (fd < 0) {
+		freeaddrinfo(res);
+		return -1;
+	}
+
+	/* the connection completes on the worker */
+	if (connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+		err = errno;
+		freeaddrinfo(res);
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (mcp_net_adopt(net, fd) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct fbuf *mcp_conn_in(struct mcp_conn *conn)
+{
+	return &conn->in;
+}
+
+struct fbuf *mcp_conn_out(struct mcp_conn *conn)
+{
+	/* whatever is written here is flushed after the callback */
+	conn_dirty(conn);
+	return &conn->out;
+}
+
+int mcp_conn_fd(struct mcp_conn *conn)
+{
+	return conn->fd;
+}
+
+int mcp_conn_worker(struct mcp_conn *conn)
+{
+	return conn->worker->index;
+}
+
+int mcp_conn_node(struct mcp_conn *conn)
+{
+	return conn->worker->node;
+}
+
+uint32_t mcp_conn_id(struct mcp_conn *conn)
+{
+	return conn->id;
+}
+
+void *mcp_conn_user(struct mcp_conn *conn)
+{
+	return conn->user;
+}
+
+void mcp_conn_set_user(struct mcp_conn *conn, void *user)
+{
+	conn->user = user;
+}
+
+void mcp_conn_set_filter(struct mcp_conn *conn, mcp_conn_filter_t filter,
+							void *user)
+{
+	conn->filter = filter;
+	conn->filter_user = user;
+}
+
+int mcp_conn_send(struct mcp_conn *conn, const void *data, size_t size)
+{
+	size_t old_avail = fbuf_avail(&conn->out);
+	int ret;
+
+	if (conn->flags & CONN_CLOSED)
+		return 1;
+
+	if (conn->filter)
+		ret = conn->filter(conn, &conn->out, data, size, conn->filter_user);
+	else
+		ret = mcg_bytes(&conn->out, data, size);
+
+	if (ret) {
+		/* rollback partial writes */
+		fbuf_unproduce(&conn->out, fbuf_avail(&conn->out) - old_avail);
+		return 1;
+	}
+
+	conn->worker->stats.frames_out++;
+	if (conn->worker->net->config.capture)
+		mcp_capture_frame(conn->worker->net->config.capture, conn->id,
+							MCP_CAPTURE_OUT, data, size);
+
+	conn_dirty(conn);
+	return 0;
+}
+
+int mcp_conn_send_packet(struct mcp_conn *conn, struct mcp_packet *packet)
+{
+	struct conn_seg *segs, *seg;
+	size_t i, new_size;
+
+	if (conn->flags & CONN_CLOSED)
+		return 1;
+
+	/* filtered connections need their own copy of the bytes */
+	if (conn->filter)
+		return mcp_conn_send(conn, mcp_packet_body(packet),
+								mcp_packet_body_size(packet));
+
+	if (conn->seg_count >= conn->seg_size) {
+		new_size = conn->seg_size ? conn->seg_size * 2 : 8;
+		segs = malloc(new_size * sizeof(*segs));
+		if (segs == NULL)
+			return 1;
+
+		/* unwrap the ring into the new array */
+		for (i = 0; i < conn->seg_count; i++)
+			segs[i] = conn->segs[(conn->seg_head + i) % conn->seg_size];
+
+		free(conn->segs);
+		conn->segs = segs;
+		conn->seg_head = 0;
+		conn->seg_size = new_size;
+	}
+
+	seg = &conn->segs[(conn->seg_head + conn->seg_count) % conn->seg_size];
+	seg->packet = mcp_packet_ref(packet);
+	seg->mark = conn->out_consumed + fbuf_avail(&conn->out);
+	seg->offset = 0;
+	conn->seg_count++;
+	conn->seg_bytes += mcp_packet_size(packet);
+
+	conn->worker->stats.frames_out++;
+	if (conn->worker->net->config.capture)
+		mcp_capture_frame(conn->worker->net->config.capture, conn->id,
+							MCP_CAPTURE_OUT, mcp_packet_body(packet),
+							mcp_packet_body_size(packet));
+
+	conn_dirty(conn);
+	return 0;
+}
+
+/* gathers the waiting data, in order, into iov. returns the number of buffers */
+static int conn_iov(struct mcp_conn *conn, struct iovec *iov, int max)
+{
+	const unsigned char *out = fbuf_ptr(&conn->out);
+	uint64_t pos = conn->out_consumed;
+	uint64_t end = conn->out_consumed + fbuf_avail(&conn->out);
+	struct conn_seg *seg;
+	size_t i;
+	int n = 0;
+
+	for (i = 0; i < conn->seg_count && n < max; i++) {
+		seg = &conn->segs[(conn->seg_head + i) % conn->seg_size];
+
+		/* the bytes of the outbound buffer queued before the packet */
+		if (seg->mark > pos) {
+			iov[n].iov_base = (void *)(out + (pos - conn->out_consumed));
+			iov[n].iov_len = seg->mark - pos;
+			pos = seg->mark;
+			if (++n >= max)
+				break;
+		}
+
+		iov[n].iov_base = (void *)(mcp_packet_data(seg->packet) + seg->offset);
+		iov[n].iov_len = mcp_packet_size(seg->packet) - seg->offset;
+		n++;
+	}
+
+	/* and the rest of the outbound buffer */
+	if (n < max && end > pos) {
+		iov[n].iov_base = (void *)(out + (pos - conn->out_consumed));
+		iov[n].iov_len = end - pos;
+		n++;
+	}
+
+	return n;
+}
+
+/* drops size written bytes from the front of the queue */
+static void conn_written(struct mcp_conn *conn, size_t size)
+{
+	struct conn_seg *seg;
+	size_t n;
+
+	while (size > 0) {
+		seg = conn->seg_count ? &conn->segs[conn->seg_head] : NULL;
+
+		/* the front of the queue is the outbound buffer */
+		if (seg == NULL || seg->mark > conn->out_consumed) {
+			n = seg ? seg->mark - conn->out_consumed : fbuf_avail(&conn->out);
+			if (n > size)
+				n = size;
+
+			fbuf_consume(&conn->out, n);
+			conn->out_consumed += n;
+			size -= n;
+			continue;
+		}
+
+		/* the front of the queue is a packet */
+		n = mcp_packet_size(seg->packet) - seg->offset;
+		if (n > size) {
+			seg->offset += size;
+			conn->seg_bytes -= size;
+			return;
+		}
+
+		size -= n;
+		conn->seg_bytes -= n;
+		mcp_packet_unref(seg->packet);
+		conn->seg_head = (conn->seg_head + 1) % conn->seg_size;
+		conn->seg_count--;
+	}
+}
+
+int mcp_conn_flush(struct mcp_conn *conn)
+{
+	struct mcp_worker *worker = conn->worker;
+	struct iovec iov[NET_MAX_IOV];
+	struct msghdr msg;
+	ssize_t ret;
+
+	if (conn->flags & CONN_CLOSED)
+		return 1;
+
+	/* nothing is held once it is flushed */
+	timer_remove(conn);
+	conn->flags &= ~CONN_URGENT;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+
+	while (conn_pending(conn)) {
+		/* shared packets are written straight from their buffers */
+		msg.msg_iovlen = conn_iov(conn, iov, NET_MAX_IOV);
+		ret = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+		worker->stats.writes++;
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		/* the rest is written when the socket is writable */
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+
+		if (ret < 0) {
+			mcp_conn_close(conn);
+			return 1;
+		}
+
+		conn_written(conn, ret);
+		worker->stats.bytes_out += ret;
+	}
+
+	return 0;
+}
+
+void mcp_conn_urgent(struct mcp_conn *conn)
+{
+	conn->flags |= CONN_URGENT;
+	conn_dirty(conn);
+}
+
+void mcp_conn_set_delay(struct mcp_conn *conn, unsigned int delay)
+{
+	conn->delay = delay;
+}
+
+void mcp_conn_close(struct mcp_conn *conn)
+{
+	conn->flags |= CONN_CLOSED;
+	conn_dirty(conn);
+}
@@ -0,0 +1,174 @@
+/* numa.c - Numa topology and node-local placement
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for sched_setaffinity and sched_getcpu */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/numa.h>
+
+/* the node that the calling thread was pinned to, or -1 */
+static __thread int thread_node = -1;
+
+/* sets the node of every cpu in a list such as "0-3,8-11" */
+static void parse_cpulist(struct mcp_numa *numa, const char *list, int node)
+{
+	long first, last;
+	char *end;
+
+	while (*list >= '0' && *list <= '9') {
+		first = last = strtol(list, &end, 10);
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+
+		for (; first <= last && first < MCP_NUMA_MAX_CPUS; first++) {
+			numa->node[first] = node;
+			if (first >= numa->cpus)
+				numa->cpus = first + 1;
+		}
+
+		list = *end == ',' ? end + 1 : end;
+	}
+}
+
+int mcp_numa_detect(struct mcp_numa *numa)
+{
+	char path[64], list[4096];
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	FILE *file;
+	int node;
+
+	if (cpus < 1)
+		cpus = 1;
+	if (cpus > MCP_NUMA_MAX_CPUS)
+		cpus = MCP_NUMA_MAX_CPUS;
+
+	memset(numa->node, 0, sizeof(numa->node));
+	numa->nodes = 1;
+	numa->cpus = cpus;
+	numa->simulated = 0;
+
+	/* node numbers may have gaps, e.g. after a node is taken offline */
+	for (node = 0; node < MCP_NUMA_MAX_NODES; node++) {
+		sprintf(path, "/sys/devices/system/node/node%i/cpulist", node);
+		file = fopen(path, "r");
+		if (file == NULL)
+			continue;
+
+		if (fgets(list, sizeof(list), file) != NULL)
+			parse_cpulist(numa, list, node);
+		fclose(file);
+
+		if (node >= numa->nodes)
+			numa->nodes = node + 1;
+	}
+
+	return numa->nodes;
+}
+
+void mcp_numa_simulate(struct mcp_numa *numa, int nodes, int cpus)
+{
+	int cpu;
+
+	if (nodes < 1)
+		nodes = 1;
+	if (nodes > MCP_NUMA_MAX_NODES)
+		nodes = MCP_NUMA_MAX_NODES;
+	if (cpus < nodes)
+		cpus = nodes;
+	if (cpus > MCP_NUMA_MAX_CPUS)
+		cpus = MCP_NUMA_MAX_CPUS;
+
+	memset(numa->node, 0, sizeof(numa->node));
+	numa->nodes = nodes;
+	numa->cpus = cpus;
+	numa->simulated = 1;
+
+	/* each node has a range of cpus, as is usual */
+	for (cpu = 0; cpu < cpus; cpu++)
+		numa->node[cpu] = (long)cpu * nodes / cpus;
+}
+
+int mcp_numa_spread(const struct mcp_numa *numa, int index)
+{
+	unsigned char cpus[MCP_NUMA_MAX_NODES];
+	int cpu, node, nodes = 0;
+
+	memset(cpus, 0, sizeof(cpus));
+	for (cpu = 0; cpu < numa->cpus; cpu++)
+		cpus[numa->node[cpu]] = 1;
+	for (node = 0; node < numa->nodes; node++)
+		nodes += cpus[node];
+
+	/* every cpu is on a node, so at least one has cpus */
+	index %= nodes;
+	for (node = 0; node < numa->nodes; node++)
+		if (cpus[node] && index-- == 0)
+			return node;
+	return 0;
+}
+
+int mcp_numa_pin(const struct mcp_numa *numa, int node)
+{
+	cpu_set_t set;
+	int cpu, any = 0;
+
+	if (node < 0 || node >= numa->nodes)
+		return 1;
+
+	CPU_ZERO(&set);
+	for (cpu = 0; cpu < numa->cpus && cpu < CPU_SETSIZE; cpu++) {
+		if (numa->node[cpu] == node) {
+			CPU_SET(cpu, &set);
+			any = 1;
+		}
+	}
+
+	if (!any)
+		return 1;
+
+	/* the scheduler still balances between the cpus of the node */
+	if (!numa->simulated && sched_setaffinity(0, sizeof(set), &set) < 0)
+		return 1;
+
+	thread_node = node;
+	return 0;
+}
+
+int mcp_numa_node(const struct mcp_numa *numa)
+{
+	int cpu;
+
+	if (thread_node >= 0 && thread_node < numa->nodes)
+		return thread_node;
+
+	cpu = sched_getcpu();
+	if (cpu < 0)
+		return 0;
+
+	/* the cpus of the machine are spread over the simulated ones */
+	if (numa->simulated)
+		cpu %= numa->cpus;
+
+	return cpu < numa->cpus ? numa->node[cpu] : 0;
+}
+
+void mcp_numa_pages_init(const struct mcp_numa *numa, struct fbuf_pages *pages,
+							int node, size_t threshold, size_t max_cached)
+{
+	fbuf_pages_init(pages, threshold, max_cached);
+	pages->node = node;
+	pages->bind = !numa->simulated;
+}
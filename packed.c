@@ -0,0 +1,348 @@
+/* packed.c - Bit-packed long arrays
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for assert */
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/packed.h>
+
+/* the kernels below are written once with the entry width and the element
+ * size as parameters, then instantiated for every width so that the
+ * shifts and masks are constants and the inner loops can be unrolled and
+ * vectorized by the compiler. the entry points pick an instance from a
+ * table indexed by layout and width. */
+
+typedef void (*unpack_fn)(void *dest, size_t count, const unsigned char *src);
+typedef void (*pack_fn)(unsigned char *dest, const void *src, size_t count);
+
+static inline uint64_t load_long(const unsigned char *src)
+{
+	return ((uint64_t)src[0] << 56) | ((uint64_t)src[1] << 48) |
+			((uint64_t)src[2] << 40) | ((uint64_t)src[3] << 32) |
+			((uint64_t)src[4] << 24) | ((uint64_t)src[5] << 16) |
+			((uint64_t)src[6] << 8) | src[7];
+}
+
+static inline void store_long(unsigned char *dest, uint64_t value)
+{
+	dest[0] = (value >> 56) & 0xff;
+	dest[1] = (value >> 48) & 0xff;
+	dest[2] = (value >> 40) & 0xff;
+	dest[3] = (value >> 32) & 0xff;
+	dest[4] = (value >> 24) & 0xff;
+	dest[5] = (value >> 16) & 0xff;
+	dest[6] = (value >> 8) & 0xff;
+	dest[7] = value & 0xff;
+}
+
+static inline void store_entry(void *dest, size_t i, uint32_t value, int wide)
+{
+	if (wide)
+		((uint32_t *)dest)[i] = value;
+	else
+		((uint16_t *)dest)[i] = value;
+}
+
+static inline uint64_t load_entry(const void *src, size_t i, int wide)
+{
+	if (wide)
+		return ((const uint32_t *)src)[i];
+	return ((const uint16_t *)src)[i];
+}
+
+static inline void unpack_aligned(void *dest, size_t count,
+									const unsigned char *src,
+									unsigned int bits, int wide)
+{
+	const unsigned int per = 64 / bits;
+	const uint64_t mask = ((uint64_t)1 << bits) - 1;
+	uint64_t value;
+	unsigned int j;
+	size_t i = 0;
+
+	/* whole longs */
+	for (; count - i >= per; i += per, src += 8) {
+		value = load_long(src);
+		for (j = 0; j < per; j++)
+			store_entry(dest, i + j, (value >> (j * bits)) & mask, wide);
+	}
+
+	/* the partially filled last long */
+	if (i < count) {
+		value = load_long(src);
+		for (; i < count; i++, value >>= bits)
+			store_entry(dest, i, value & mask, wide);
+	}
+}
+
+static inline void unpack_spanning(void *dest, size_t count,
+									const unsigned char *src,
+									unsigned int bits, int wide)
+{
+	const uint64_t mask = ((uint64_t)1 << bits) - 1;
+	uint64_t acc = 0, next;
+	unsigned int have = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (have >= bits) {
+			store_entry(dest, i, acc & mask, wide);
+			acc >>= bits;
+			have -= bits;
+			continue;
+		}
+
+		/* the entry continues in the next long */
+		next = load_long(src);
+		src += 8;
+		store_entry(dest, i, (acc | (next << have)) & mask, wide);
+		acc = next >> (bits - have);
+		have = 64 - (bits - have);
+	}
+}
+
+static inline void pack_aligned(unsigned char *dest, const void *src,
+								size_t count, unsigned int bits, int wide)
+{
+	const unsigned int per = 64 / bits;
+	const uint64_t mask = ((uint64_t)1 << bits) - 1;
+	uint64_t value;
+	unsigned int j;
+	size_t i = 0;
+
+	/* whole longs */
+	for (; count - i >= per; i += per, dest += 8) {
+		value = 0;
+		for (j = 0; j < per; j++)
+			value |= (load_entry(src, i + j, wide) & mask) << (j * bits);
+		store_long(dest, value);
+	}
+
+	/* the partially filled last long */
+	if (i < count) {
+		value = 0;
+		for (j = 0; i < count; i++, j++)
+			value |= (load_entry(src, i, wide) & mask) << (j * bits);
+		store_long(dest, value);
+	}
+}
+
+static inline void pack_spanning(unsigned char *dest, const void *src,
+								size_t count, unsigned int bits, int wide)
+{
+	const uint64_t mask = ((uint64_t)1 << bits) - 1;
+	uint64_t acc = 0, value;
+	unsigned int have = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		value = load_entry(src, i, wide) & mask;
+		acc |= value << have;
+		have += bits;
+
+		if (have >= 64) {
+			store_long(dest, acc);
+			dest += 8;
+			have -= 64;
+			/* carry the bits that did not fit, value >> bits is zero */
+			acc = value >> (bits - have);
+		}
+	}
+
+	if (have > 0)
+		store_long(dest, acc);
+}
+
+/* instantiate the kernels for one width */
+#define PACKED_KERNELS(bits, size, wide) \
+	static void unpack_aligned##size##_##bits(void *dest, size_t count, \
+											const unsigned char *src) \
+	{ \
+		unpack_aligned(dest, count, src, bits, wide); \
+	} \
+	static void unpack_spanning##size##_##bits(void *dest, size_t count, \
+											const unsigned char *src) \
+	{ \
+		unpack_spanning(dest, count, src, bits, wide); \
+	} \
+	static void pack_aligned##size##_##bits(unsigned char *dest, \
+											const void *src, size_t count) \
+	{ \
+		pack_aligned(dest, src, count, bits, wide); \
+	} \
+	static void pack_spanning##size##_##bits(unsigned char *dest, \
+											const void *src, size_t count) \
+	{ \
+		pack_spanning(dest, src, count, bits, wide); \
+	}
+
+#define PACKED_KERNELS16(bits)		PACKED_KERNELS(bits, 16, 0)
+#define PACKED_KERNELS32(bits)		PACKED_KERNELS(bits, 32, 1)
+
+#define PACKED_WIDTHS16(X) \
+	X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) \
+	X(9) X(10) X(11) X(12) X(13) X(14) X(15) X(16)
+#define PACKED_WIDTHS32(X) \
+	PACKED_WIDTHS16(X) \
+	X(17) X(18) X(19) X(20) X(21) X(22) X(23) X(24) \
+	X(25) X(26) X(27) X(28) X(29) X(30) X(31) X(32)
+
+PACKED_WIDTHS16(PACKED_KERNELS16)
+PACKED_WIDTHS32(PACKED_KERNELS32)
+
+#define UNPACK_ALIGNED16(bits)		[bits] = unpack_aligned16_##bits,
+#define UNPACK_SPANNING16(bits)		[bits] = unpack_spanning16_##bits,
+#define UNPACK_ALIGNED32(bits)		[bits] = unpack_aligned32_##bits,
+#define UNPACK_SPANNING32(bits)		[bits] = unpack_spanning32_##bits,
+#define PACK_ALIGNED16(bits)		[bits] = pack_aligned16_##bits,
+#define PACK_SPANNING16(bits)		[bits] = pack_spanning16_##bits,
+#define PACK_ALIGNED32(bits)		[bits] = pack_aligned32_##bits,
+#define PACK_SPANNING32(bits)		[bits] = pack_spanning32_##bits,
+
+static const unpack_fn unpack16[2][17] = {
+	{PACKED_WIDTHS16(UNPACK_ALIGNED16)},
+	{PACKED_WIDTHS16(UNPACK_SPANNING16)}
+};
+
+static const unpack_fn unpack32[2][33] = {
+	{PACKED_WIDTHS32(UNPACK_ALIGNED32)},
+	{PACKED_WIDTHS32(UNPACK_SPANNING32)}
+};
+
+static const pack_fn pack16[2][17] = {
+	{PACKED_WIDTHS16(PACK_ALIGNED16)},
+	{PACKED_WIDTHS16(PACK_SPANNING16)}
+};
+
+static const pack_fn pack32[2][33] = {
+	{PACKED_WIDTHS32(PACK_ALIGNED32)},
+	{PACKED_WIDTHS32(PACK_SPANNING32)}
+};
+
+size_t mcp_packed_longs(size_t count, unsigned int bits,
+						enum mcp_packed_layout layout)
+{
+	size_t per;
+
+	assert(bits > 0 && bits <= 64);
+
+	/* avoid overflowing count * bits */
+	if (layout == MCP_PACKED_SPANNING)
+		return (count / 64) * bits + ((count % 64) * bits + 63) / 64;
+
+	per = 64 / bits;
+	return count / per + (count % per != 0);
+}
+
+/* bounds checks and consumes the longs that hold count entries */
+static const unsigned char *packed_raw(struct mcp_parse *buf, size_t count,
+										unsigned int bits, unsigned int max,
+										enum mcp_packed_layout layout)
+{
+	size_t longs;
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return NULL;
+
+	if (bits == 0 || bits > max ||
+			(layout != MCP_PACKED_ALIGNED && layout != MCP_PACKED_SPANNING)) {
+		buf->error = MCP_EINVAL;
+		return NULL;
+	}
+
+	/* bounds check without overflowing longs * 8 */
+	longs = mcp_packed_longs(count, bits, layout);
+	if (longs > mcp_avail(buf) / 8) {
+		buf->error = MCP_EAGAIN;
+		return NULL;
+	}
+
+	return mcp_raw(buf, longs * 8);
+}
+
+void mcp_packed_ushort(uint16_t *dest, size_t count, unsigned int bits,
+						enum mcp_packed_layout layout, struct mcp_parse *buf)
+{
+	const unsigned char *src = packed_raw(buf, count, bits, 16, layout);
+
+	if (!mcp_ok(buf))
+		return;
+
+	unpack16[layout][bits](dest, count, src);
+}
+
+void mcp_packed_uint(uint32_t *dest, size_t count, unsigned int bits,
+						enum mcp_packed_layout layout, struct mcp_parse *buf)
+{
+	const unsigned char *src = packed_raw(buf, count, bits, 32, layout);
+
+	if (!mcp_ok(buf))
+		return;
+
+	unpack32[layout][bits](dest, count, src);
+}
+
+/* reserves and commits the longs that will hold count entries.
+ * returns zero on success */
+static int packed_wptr(unsigned char **dest, struct fbuf *buf, size_t count,
+						unsigned int bits, unsigned int max,
+						enum mcp_packed_layout layout)
+{
+	size_t longs;
+
+	if (bits == 0 || bits > max ||
+			(layout != MCP_PACKED_ALIGNED && layout != MCP_PACKED_SPANNING))
+		return 1;
+
+	/* overflow check */
+	longs = mcp_packed_longs(count, bits, layout);
+	if (longs > FBUF_MAX / 8)
+		return 1;
+
+	/* nothing to write */
+	*dest = NULL;
+	if (longs == 0)
+		return 0;
+
+	*dest = fbuf_wptr(buf, longs * 8);
+	if (*dest == NULL)
+		return 1;
+
+	fbuf_produce(buf, longs * 8);
+	return 0;
+}
+
+int mcg_packed_ushort(struct fbuf *buf, const uint16_t *src, size_t count,
+						unsigned int bits, enum mcp_packed_layout layout)
+{
+	unsigned char *dest;
+
+	if (packed_wptr(&dest, buf, count, bits, 16, layout))
+		return 1;
+
+	if (dest != NULL)
+		pack16[layout][bits](dest, src, count);
+	return 0;
+}
+
+int mcg_packed_uint(struct fbuf *buf, const uint32_t *src, size_t count,
+						unsigned int bits, enum mcp_packed_layout layout)
+{
+	unsigned char *dest;
+
+	if (packed_wptr(&dest, buf, count, bits, 32, layout))
+		return 1;
+
+	if (dest != NULL)
+		pack32[layout][bits](dest, src, count);
+	return 0;
+}
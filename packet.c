@@ -0,0 +1,73 @@
+/* packet.c - Shared immutable frames
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memcpy */
+#include <string.h>
+/* for assert */
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/packet.h>
+
+struct mcp_packet *mcp_packet_new(const void *body, size_t size)
+{
+	struct mcp_packet *packet;
+	size_t prefix = 1, value;
+
+	/* overflow check */
+	if (size > MCP_BYTES_MAX_SIZE)
+		return NULL;
+
+	for (value = size; value > 0x7f; value >>= 7)
+		prefix++;
+
+	packet = malloc(sizeof(*packet) + prefix + size);
+	if (packet == NULL)
+		return NULL;
+
+	packet->refs = 1;
+	packet->size = prefix + size;
+	packet->body = prefix;
+
+	/* write the length prefix, the same as mcg_varint */
+	for (value = size, prefix = 0; value > 0x7f; value >>= 7)
+		packet->data[prefix++] = (value & 0x7f) | 0x80;
+	packet->data[prefix] = value;
+
+	if (size > 0)
+		memcpy(packet->data + packet->body, body, size);
+
+	return packet;
+}
+
+struct mcp_packet *mcp_packet_fbuf(struct fbuf *buf)
+{
+	return mcp_packet_new(fbuf_ptr(buf), fbuf_avail(buf));
+}
+
+struct mcp_packet *mcp_packet_ref(struct mcp_packet *packet)
+{
+	assert(packet && __atomic_load_n(&packet->refs, __ATOMIC_RELAXED) > 0);
+
+	__atomic_fetch_add(&packet->refs, 1, __ATOMIC_RELAXED);
+	return packet;
+}
+
+void mcp_packet_unref(struct mcp_packet *packet)
+{
+	if (packet == NULL)
+		return;
+
+	assert(__atomic_load_n(&packet->refs, __ATOMIC_RELAXED) > 0);
+
+	/* the last reference frees the packet */
+	if (__atomic_sub_fetch(&packet->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(packet);
+}
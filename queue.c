@@ -0,0 +1,268 @@
+/* queue.c - Lock-free fbuf handoff queues
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for posix_memalign */
+#define _POSIX_C_SOURCE			200112L
+
+/* for ptrdiff_t */
+#include <stddef.h>
+/* for assert */
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/queue.h>
+
+/* the indices written by the producers and by the consumer are kept on
+ * separate cache lines so the two sides do not invalidate each other.
+ * each side also keeps a copy of the other side's index, which it only
+ * refreshes when the queue looks full or empty. */
+
+/* pads the rest of a cache line after used bytes */
+#define PAD(n, used)			char pad_##n[MCP_CACHE_LINE - (used)]
+
+struct mcp_spsc {
+	/* read only */
+	size_t mask;
+	PAD(0, sizeof(size_t));
+
+	/* written by the producer */
+	size_t tail, head_cache;
+	PAD(1, 2 * sizeof(size_t));
+
+	/* written by the consumer */
+	size_t head, tail_cache;
+	PAD(2, 2 * sizeof(size_t));
+
+	struct fbuf slots[];
+};
+
+/* each slot has a sequence number. a slot at position pos is free to write
+ * when its sequence is pos, and holds an fbuf when its sequence is pos + 1 */
+struct mpsc_slot {
+	size_t seq;
+	struct fbuf buf;
+};
+
+struct mcp_mpsc {
+	/* read only */
+	size_t mask;
+	PAD(0, sizeof(size_t));
+
+	/* claimed by the producers */
+	size_t tail;
+	PAD(1, sizeof(size_t));
+
+	/* written by the consumer */
+	size_t head;
+	PAD(2, sizeof(size_t));
+
+	struct mpsc_slot slots[];
+};
+
+/* rounds capacity up to a power of two, returns zero on overflow */
+static size_t queue_size(size_t capacity)
+{
+	size_t size = 1;
+
+	while (size < capacity) {
+		if (size > (~(size_t)0) / 2)
+			return 0;
+		size *= 2;
+	}
+
+	return size;
+}
+
+/* allocates a queue with cache line aligned indices */
+static void *queue_alloc(size_t header, size_t slot, size_t size)
+{
+	void *queue;
+
+	/* overflow check */
+	if (size == 0 || size > ((~(size_t)0) - header) / slot)
+		return NULL;
+
+	if (posix_memalign(&queue, MCP_CACHE_LINE, header + size * slot))
+		return NULL;
+
+	return queue;
+}
+
+/* moves the block out of buf, leaving it empty */
+static inline void queue_take(struct fbuf *dest, struct fbuf *buf)
+{
+	*dest = *buf;
+	buf->base = NULL;
+	buf->size = 0;
+	fbuf_clear(buf);
+}
+
+struct mcp_spsc *mcp_spsc_new(size_t capacity)
+{
+	struct mcp_spsc *queue;
+	size_t size = queue_size(capacity);
+
+	queue = queue_alloc(sizeof(*queue), sizeof(queue->slots[0]), size);
+	if (queue == NULL)
+		return NULL;
+
+	queue->mask = size - 1;
+	queue->tail = 0;
+	queue->head_cache = 0;
+	queue->head = 0;
+	queue->tail_cache = 0;
+	return queue;
+}
+
+void mcp_spsc_free(struct mcp_spsc *queue)
+{
+	struct fbuf buf;
+
+	if (queue == NULL)
+		return;
+
+	while (mcp_spsc_pop(queue, &buf, 1))
+		fbuf_free(&buf);
+
+	free(queue);
+}
+
+int mcp_spsc_push(struct mcp_spsc *queue, struct fbuf *buf)
+{
+	size_t tail;
+
+	assert(queue && buf);
+
+	tail = queue->tail;
+
+	/* refresh our copy of head only when the queue looks full */
+	if (tail - queue->head_cache > queue->mask) {
+		queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+		if (tail - queue->head_cache > queue->mask)
+			return 1;
+	}
+
+	queue_take(&queue->slots[tail & queue->mask], buf);
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+size_t mcp_spsc_pop(struct mcp_spsc *queue, struct fbuf *bufs, size_t max)
+{
+	size_t head, avail, i;
+
+	assert(queue && (bufs || max == 0));
+
+	head = queue->head;
+
+	/* refresh our copy of tail only when it cannot fill the batch */
+	avail = queue->tail_cache - head;
+	if (avail < max) {
+		queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+		avail = queue->tail_cache - head;
+	}
+
+	if (avail > max)
+		avail = max;
+
+	for (i = 0; i < avail; i++)
+		bufs[i] = queue->slots[(head + i) & queue->mask];
+
+	/* hand every slot of the batch back to the producer at once */
+	if (avail > 0)
+		__atomic_store_n(&queue->head, head + avail, __ATOMIC_RELEASE);
+	return avail;
+}
+
+struct mcp_mpsc *mcp_mpsc_new(size_t capacity)
+{
+	struct mcp_mpsc *queue;
+	size_t size = queue_size(capacity), i;
+
+	queue = queue_alloc(sizeof(*queue), sizeof(queue->slots[0]), size);
+	if (queue == NULL)
+		return NULL;
+
+	queue->mask = size - 1;
+	queue->tail = 0;
+	queue->head = 0;
+	for (i = 0; i < size; i++)
+		queue->slots[i].seq = i;
+	return queue;
+}
+
+void mcp_mpsc_free(struct mcp_mpsc *queue)
+{
+	struct fbuf buf;
+
+	if (queue == NULL)
+		return;
+
+	while (mcp_mpsc_pop(queue, &buf, 1))
+		fbuf_free(&buf);
+
+	free(queue);
+}
+
+int mcp_mpsc_push(struct mcp_mpsc *queue, struct fbuf *buf)
+{
+	struct mpsc_slot *slot;
+	size_t pos, seq;
+
+	assert(queue && buf);
+
+	/* claim a position by advancing tail past a free slot */
+	pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &queue->slots[pos & queue->mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1,
+									__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((ptrdiff_t)(seq - pos) < 0) {
+			/* the slot still holds the fbuf from the last lap */
+			return 1;
+		} else {
+			/* another producer claimed pos */
+			pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	queue_take(&slot->buf, buf);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+size_t mcp_mpsc_pop(struct mcp_mpsc *queue, struct fbuf *bufs, size_t max)
+{
+	struct mpsc_slot *slot;
+	size_t head, i;
+
+	assert(queue && (bufs || max == 0));
+
+	head = queue->head;
+
+	/* stops at the first slot that is not filled yet, even if later
+	 * producers have already finished */
+	for (i = 0; i < max; i++) {
+		slot = &queue->slots[(head + i) & queue->mask];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + i + 1)
+			break;
+
+		bufs[i] = slot->buf;
+		/* free the slot for the next lap */
+		__atomic_store_n(&slot->seq, head + i + queue->mask + 1,
+							__ATOMIC_RELEASE);
+	}
+
+	queue->head = head + i;
+	return i;
+}
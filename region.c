@@ -0,0 +1,993 @@
+/* region.c - Memory-mapped region file reader
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for madvise */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/trace.h>
+#include <mcp_base/region.h>
+
+/* bytes of output asked for at a time while inflating and deflating */
+#define INFLATE_STEP		(16384)
+#define DEFLATE_STEP		(MCP_REGION_SECTOR)
+
+/* the offset of a chunk in sectors, and its size in sectors */
+static inline size_t location_offset(uint32_t location)
+{
+	return location >> 8;
+}
+
+static inline size_t location_sectors(uint32_t location)
+{
+	return location & 0xff;
+}
+
+int mcp_region_open(struct mcp_region *region, const char *path)
+{
+	struct mcp_parse header;
+	struct stat st;
+	void *base = NULL;
+	int fd, err, i;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto error;
+
+	/* a region is created empty, and its header written with the first
+	 * chunk */
+	if (st.st_size > 0 && st.st_size < MCP_REGION_HEADER) {
+		errno = EINVAL;
+		goto error;
+	}
+
+	if (st.st_size > 0) {
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (base == MAP_FAILED)
+			goto error;
+
+		/* chunks are looked up one at a time, so reading ahead of one
+		 * would mostly read chunks that are not needed. see
+		 * mcp_region_load for the reads in bulk */
+		madvise(base, st.st_size, MADV_RANDOM);
+	}
+
+	/* the mapping keeps the file open */
+	close(fd);
+
+	region->base = base;
+	region->size = st.st_size;
+
+	if (base == NULL) {
+		memset(region->locations, 0, sizeof(region->locations));
+		memset(region->timestamps, 0, sizeof(region->timestamps));
+		return 0;
+	}
+
+	mcp_start(&header, base, MCP_REGION_HEADER);
+	for (i = 0; i < MCP_REGION_CHUNKS; i++)
+		region->locations[i] = mcp_uint(&header);
+	for (i = 0; i < MCP_REGION_CHUNKS; i++)
+		region->timestamps[i] = mcp_uint(&header);
+
+	return 0;
+
+error:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+void mcp_region_close(struct mcp_region *region)
+{
+	if (region->base != NULL)
+		munmap((void *)region->base, region->size);
+	region->base = NULL;
+	region->size = 0;
+}
+
+int mcp_region_chunk(struct mcp_region *region, int index,
+						struct mcp_region_chunk *chunk)
+{
+	struct mcp_parse *buf = &chunk->data;
+	uint32_t location, size;
+	size_t offset, span;
+
+	assert(index >= 0 && index < MCP_REGION_CHUNKS);
+
+	location = region->locations[index];
+	offset = location_offset(location) * MCP_REGION_SECTOR;
+	span = location_sectors(location) * MCP_REGION_SECTOR;
+
+	mcp_start(buf, NULL, 0);
+	chunk->timestamp = region->timestamps[index];
+
+	/* not in the region */
+	if (location == 0)
+		return 0;
+
+	/* the sectors are in the file and not in the header. the last sector
+	 * may be cut short, as it is not always padded */
+	if (offset < MCP_REGION_HEADER || offset >= region->size ||
+			span > region->size - offset + MCP_REGION_SECTOR)
+		goto malformed;
+
+	if (span > region->size - offset)
+		span = region->size - offset;
+
+	mcp_start(buf, region->base + offset, span);
+	size = mcp_uint(buf);
+	chunk->compression = mcp_ubyte(buf);
+
+	if (!mcp_ok(buf) || size == 0 || size - 1 > mcp_avail(buf))
+		goto malformed;
+
+	if (chunk->compression != MCP_REGION_GZIP &&
+			chunk->compression != MCP_REGION_ZLIB &&
+			chunk->compression != MCP_REGION_NONE)
+		goto malformed;
+
+	mcp_start(buf, mcp_ptr(buf), size - 1);
+	return 1;
+
+malformed:
+	buf->error = MCP_EINVAL;
+	MCP_TRACE_ERROR(MCP_SITE_REGION, MCP_EINVAL, offset);
+	return 0;
+}
+
+int mcp_region_inflate(struct fbuf *out, struct mcp_region_chunk *chunk)
+{
+	struct mcp_parse *buf = &chunk->data;
+	size_t produced = 0, size;
+	unsigned char *ptr;
+	z_stream stream;
+	int ret;
+
+	/* pass errors */
+	if (!mcp_ok(buf))
+		return 1;
+
+	if (chunk->compression == MCP_REGION_NONE)
+		return fbuf_copy(out, mcp_ptr(buf), mcp_avail(buf));
+
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, chunk->compression == MCP_REGION_GZIP ?
+										16 + MAX_WBITS : MAX_WBITS) != Z_OK)
+		return 1;
+
+	/* the chunk is at most 255 sectors, far below UINT_MAX */
+	stream.next_in = (Bytef *)mcp_ptr(buf);
+	stream.avail_in = mcp_avail(buf);
+
+	do {
+		ptr = fbuf_wptr(out, INFLATE_STEP);
+		if (ptr == NULL || produced >= MCP_REGION_MAX_INFLATED) {
+			ret = Z_MEM_ERROR;
+			break;
+		}
+
+		size = fbuf_wavail(out);
+		if (size > UINT_MAX)
+			size = UINT_MAX;
+
+		stream.next_out = ptr;
+		stream.avail_out = size;
+		ret = inflate(&stream, Z_NO_FLUSH);
+
+		fbuf_produce(out, size - stream.avail_out);
+		produced += size - stream.avail_out;
+	} while (ret == Z_OK);
+
+	inflateEnd(&stream);
+
+	/* a stream that is cut short stops with Z_BUF_ERROR */
+	if (ret != Z_STREAM_END) {
+		fbuf_unproduce(out, produced);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* a chunk to load, by its place in the file */
+struct load_entry {
+	size_t offset;
+	int index;
+};
+
+struct load {
+	struct mcp_region *region;
+	struct load_entry *entries;
+	size_t count, next, failed;
+	struct fbuf_pages *pages;
+	mcp_region_fn fn;
+	void *user;
+};
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct load_entry *x = a, *y = b;
+
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static void *load_main(void *arg)
+{
+	struct load *load = arg;
+	struct mcp_region_chunk chunk;
+	struct fbuf nbt;
+	size_t i;
+
+	fbuf_init(&nbt, MCP_REGION_MAX_INFLATED);
+	fbuf_set_pages(&nbt, load->pages);
+
+	/* the threads take the chunks in the order of the file, so that the
+	 * reads stay close to the read-ahead */
+	while ((i = __atomic_fetch_add(&load->next, 1, __ATOMIC_RELAXED)) <
+			load->count) {
+		mcp_region_chunk(load->region, load->entries[i].index, &chunk);
+
+		fbuf_clear(&nbt);
+		if (mcp_region_inflate(&nbt, &chunk)) {
+			__atomic_fetch_add(&load->failed, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		load->fn(load->entries[i].index, &nbt, load->user);
+	}
+
+	fbuf_free(&nbt);
+	return NULL;
+}
+
+size_t mcp_region_load(struct mcp_region *region, const int *indexes,
+						size_t count, int threads, struct fbuf_pages *pages,
+						mcp_region_fn fn, void *user)
+{
+	struct load_entry entries[MCP_REGION_CHUNKS];
+	pthread_t workers[MCP_REGION_CHUNKS];
+	struct load load;
+	size_t i, n = 0, start = SIZE_MAX, end = 0, offset, last;
+	int index, started = 0;
+	long cpus;
+
+	if (indexes == NULL)
+		count = MCP_REGION_CHUNKS;
+
+	assert(count <= MCP_REGION_CHUNKS);
+
+	for (i = 0; i < count; i++) {
+		index = indexes != NULL ? indexes[i] : (int)i;
+		assert(index >= 0 && index < MCP_REGION_CHUNKS);
+		if (region->locations[index] == 0)
+			continue;
+
+		offset = location_offset(region->locations[index]) * MCP_REGION_SECTOR;
+		last = offset + location_sectors(region->locations[index]) *
+							MCP_REGION_SECTOR;
+		entries[n].offset = offset;
+		entries[n].index = index;
+		n++;
+
+		if (offset < start)
+			start = offset;
+		if (last > end)
+			end = last;
+	}
+
+	if (n == 0)
+		return 0;
+
+	qsort(entries, n, sizeof(entries[0]), entry_cmp);
+
+	/* read the span of the chunks ahead, front to back */
+	if (end > region->size)
+		end = region->size;
+	if (start < end) {
+		offset = start & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+		madvise((void *)(region->base + offset), end - offset, MADV_SEQUENTIAL);
+		madvise((void *)(region->base + offset), end - offset, MADV_WILLNEED);
+	}
+
+	load.region = region;
+	load.entries = entries;
+	load.count = n;
+	load.next = 0;
+	load.failed = 0;
+	load.pages = pages;
+	load.fn = fn;
+	load.user = user;
+
+	if (threads <= 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+
+	/* more threads than chunks would have nothing to do */
+	if ((size_t)threads > n)
+		threads = n;
+
+	/* the calling thread is one of them. a thread that can not be started
+	 * leaves its share to the others */
+	for (; started < threads - 1; started++) {
+		if (pthread_create(&workers[started], NULL, load_main, &load) != 0)
+			break;
+	}
+
+	load_main(&load);
+
+	while (started > 0)
+		pthread_join(workers[--started], NULL);
+
+	if (start < end)
+		madvise((void *)(region->base + offset), end - offset, MADV_RANDOM);
+
+	return load.failed;
+}
+
+/* the state of each sector of a file being written */
+enum sector {
+	SECTOR_FREE,
+	SECTOR_USED,
+	/* no longer used, but still in the header on disk until it is synced */
+	SECTOR_FREED
+};
+
+/* a region file open for writing, only used by the io thread */
+struct region_file {
+	struct region_file *next;
+	int x, z, fd, dirty;
+	uint32_t locations[MCP_REGION_CHUNKS];
+	uint32_t timestamps[MCP_REGION_CHUNKS];
+	/* the state of each sector up to the end of the file */
+	unsigned char *sectors;
+	size_t count;
+};
+
+enum save_state {
+	SAVE_PENDING,
+	SAVE_COMPRESSING,
+	SAVE_COMPRESSED
+};
+
+/* a chunk on its way to a region file. the nbt in data is replaced with
+ * the sectors to write once it is compressed */
+struct save {
+	int x, z;
+	uint32_t timestamp;
+	enum save_state state;
+	int failed;
+	struct fbuf data;
+	struct region_file *file;
+};
+
+struct mcp_region_writer {
+	char *dir;
+	int level;
+	struct fbuf_pages *pages;
+
+	pthread_mutex_t lock;
+	/* signaled when there is a chunk to compress, when the next chunk to
+	 * write is compressed, and when chunks were written */
+	pthread_cond_t compress_cond, write_cond, done_cond;
+	int stopping;
+
+	/* the saves are numbered, and each is in the slot of its number modulo
+	 * capacity. saves from written to compressed are compressed or being
+	 * compressed, from compressed to saved are pending */
+	uint64_t written, compressed, saved;
+	size_t failed;
+
+	/* open files, most recently used first. only used by the io thread */
+	struct region_file *files;
+
+	int threads;
+	pthread_t io, *workers;
+
+	size_t capacity;
+	struct save saves[];
+};
+
+/* the region of a chunk coordinate, rounding down */
+static inline int region_of(int x)
+{
+	return (x - (x & 31)) / 32;
+}
+
+static void put_uint(unsigned char *ptr, uint32_t value)
+{
+	ptr[0] = (value >> 24) & 0xff;
+	ptr[1] = (value >> 16) & 0xff;
+	ptr[2] = (value >> 8) & 0xff;
+	ptr[3] = value & 0xff;
+}
+
+/* compresses nbt into out as the sectors of a chunk: its length,
+ * compression and zlib stream, padded to a sector. returns non-zero if the
+ * chunk does not fit in MCP_REGION_MAX_SECTORS */
+static int compress_chunk(z_stream *stream, struct fbuf *out, struct fbuf *nbt)
+{
+	unsigned char *ptr;
+	size_t size;
+	int ret;
+
+	if (fbuf_avail(nbt) > MCP_REGION_MAX_INFLATED ||
+			deflateReset(stream) != Z_OK)
+		return 1;
+
+	/* the length is filled in once it is known */
+	if (mcg_uint(out, 0) || mcg_ubyte(out, MCP_REGION_ZLIB))
+		return 1;
+
+	stream->next_in = (Bytef *)fbuf_ptr(nbt);
+	stream->avail_in = fbuf_avail(nbt);
+
+	do {
+		ptr = fbuf_wptr(out, DEFLATE_STEP);
+		if (ptr == NULL)
+			return 1;
+
+		size = fbuf_wavail(out);
+		if (size > UINT_MAX)
+			size = UINT_MAX;
+
+		stream->next_out = ptr;
+		stream->avail_out = size;
+		ret = deflate(stream, Z_FINISH);
+		fbuf_produce(out, size - stream->avail_out);
+	} while (ret == Z_OK);
+
+	if (ret != Z_STREAM_END)
+		return 1;
+
+	put_uint(out->base + out->start, fbuf_avail(out) - 4);
+
+	size = (MCP_REGION_SECTOR - fbuf_avail(out) % MCP_REGION_SECTOR) %
+				MCP_REGION_SECTOR;
+	ptr = fbuf_wptr(out, size);
+	if (ptr == NULL)
+		return 1;
+	memset(ptr, 0, size);
+	fbuf_produce(out, size);
+	return 0;
+}
+
+static void *compress_main(void *arg)
+{
+	struct mcp_region_writer *writer = arg;
+	struct save *save;
+	struct fbuf out;
+	z_stream stream;
+	int ready;
+
+	/* the stream is reset for each chunk, rather than allocating its
+	 * state again */
+	memset(&stream, 0, sizeof(stream));
+	ready = deflateInit(&stream, writer->level) == Z_OK;
+
+	pthread_mutex_lock(&writer->lock);
+	for (;;) {
+		while (writer->compressed == writer->saved && !writer->stopping)
+			pthread_cond_wait(&writer->compress_cond, &writer->lock);
+		if (writer->compressed == writer->saved)
+			break;
+
+		save = &writer->saves[writer->compressed++ % writer->capacity];
+		save->state = SAVE_COMPRESSING;
+		pthread_mutex_unlock(&writer->lock);
+
+		fbuf_init(&out, MCP_REGION_MAX_SECTORS * MCP_REGION_SECTOR);
+		fbuf_set_pages(&out, writer->pages);
+		save->failed = !ready || compress_chunk(&stream, &out, &save->data);
+		fbuf_free(&save->data);
+		save->data = out;
+
+		pthread_mutex_lock(&writer->lock);
+		save->state = SAVE_COMPRESSED;
+		if (save == &writer->saves[writer->written % writer->capacity])
+			pthread_cond_signal(&writer->write_cond);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	if (ready)
+		deflateEnd(&stream);
+	return NULL;
+}
+
+static void close_file(struct region_file *file)
+{
+	close(file->fd);
+	free(file->sectors);
+	free(file);
+}
+
+/* marks sectors as state, growing the sectors of the file to hold them.
+ * returns non-zero if there is no memory */
+static int mark_sectors(struct region_file *file, size_t start, size_t count,
+						enum sector state)
+{
+	unsigned char *sectors;
+	size_t size;
+
+	if (count == 0)
+		return 0;
+
+	if (start + count > file->count) {
+		size = file->count * 2;
+		if (size < start + count)
+			size = start + count;
+
+		sectors = realloc(file->sectors, size);
+		if (sectors == NULL)
+			return 1;
+
+		memset(sectors + file->count, SECTOR_FREE, size - file->count);
+		file->sectors = sectors;
+		file->count = size;
+	}
+
+	memset(file->sectors + start, state, count);
+	return 0;
+}
+
+static struct region_file *open_file(struct mcp_region_writer *writer,
+										int x, int z)
+{
+	unsigned char header[MCP_REGION_HEADER];
+	struct mcp_parse buf;
+	struct region_file *file;
+	char path[PATH_MAX];
+	struct stat st;
+	size_t size;
+	ssize_t ret;
+	int i;
+
+	if (snprintf(path, sizeof(path), "%s/r.%i.%i.mca", writer->dir, x, z) >=
+			(int)sizeof(path))
+		return NULL;
+
+	file = calloc(1, sizeof(*file));
+	if (file == NULL)
+		return NULL;
+
+	file->x = x;
+	file->z = z;
+	file->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (file->fd < 0) {
+		free(file);
+		return NULL;
+	}
+
+	if (fstat(file->fd, &st) < 0)
+		goto error;
+
+	/* an empty file gets its header with the first batch, but one that is
+	 * cut short is left alone */
+	if (st.st_size > 0) {
+		ret = pread(file->fd, header, sizeof(header), 0);
+		if (ret != (ssize_t)sizeof(header))
+			goto error;
+
+		mcp_start(&buf, header, sizeof(header));
+		for (i = 0; i < MCP_REGION_CHUNKS; i++)
+			file->locations[i] = mcp_uint(&buf);
+		for (i = 0; i < MCP_REGION_CHUNKS; i++)
+			file->timestamps[i] = mcp_uint(&buf);
+	}
+
+	size = (st.st_size + MCP_REGION_SECTOR - 1) / MCP_REGION_SECTOR;
+	if (mark_sectors(file, 0, size, SECTOR_FREE) ||
+			mark_sectors(file, 0, MCP_REGION_HEADER / MCP_REGION_SECTOR,
+							SECTOR_USED))
+		goto error;
+
+	/* chunks that point past the end of the file are malformed, and
+	 * their sectors are not reserved */
+	for (i = 0; i < MCP_REGION_CHUNKS; i++) {
+		if (location_offset(file->locations[i]) +
+				location_sectors(file->locations[i]) > size)
+			continue;
+		mark_sectors(file, location_offset(file->locations[i]),
+						location_sectors(file->locations[i]), SECTOR_USED);
+	}
+
+	return file;
+
+error:
+	close_file(file);
+	return NULL;
+}
+
+/* returns the open file of the region at x, z, opening it if needed */
+static struct region_file *find_file(struct mcp_region_writer *writer,
+										int x, int z)
+{
+	struct region_file **link, *file;
+
+	for (link = &writer->files; *link != NULL; link = &(*link)->next) {
+		file = *link;
+		if (file->x != x || file->z != z)
+			continue;
+
+		*link = file->next;
+		file->next = writer->files;
+		writer->files = file;
+		return file;
+	}
+
+	file = open_file(writer, x, z);
+	if (file != NULL) {
+		file->next = writer->files;
+		writer->files = file;
+	}
+	return file;
+}
+
+/* the first run of count free sectors, or the end of the file */
+static size_t find_sectors(struct region_file *file, size_t count)
+{
+	size_t i, run = 0;
+
+	for (i = 0; i < file->count; i++) {
+		run = file->sectors[i] == SECTOR_FREE ? run + 1 : 0;
+		if (run == count)
+			return i + 1 - count;
+	}
+
+	return file->count - run;
+}
+
+static int write_all(int fd, const unsigned char *data, size_t size,
+						size_t offset)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = pwrite(fd, data, size, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return 1;
+
+		data += ret;
+		size -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+static int write_chunk(struct region_file *file, struct save *save)
+{
+	int index = mcp_region_index(save->x, save->z);
+	uint32_t location = file->locations[index];
+	size_t count = fbuf_avail(&save->data) / MCP_REGION_SECTOR;
+	size_t start = find_sectors(file, count);
+
+	if (start + count > 0xffffff ||
+			mark_sectors(file, start, count, SECTOR_USED))
+		return 1;
+
+	if (write_all(file->fd, fbuf_ptr(&save->data), fbuf_avail(&save->data),
+					start * MCP_REGION_SECTOR)) {
+		mark_sectors(file, start, count, SECTOR_FREE);
+		return 1;
+	}
+
+	if (location != 0 && location_offset(location) +
+			location_sectors(location) <= file->count)
+		mark_sectors(file, location_offset(location),
+						location_sectors(location), SECTOR_FREED);
+
+	file->locations[index] = start << 8 | count;
+	file->timestamps[index] = save->timestamp;
+	file->dirty = 1;
+	return 0;
+}
+
+/* syncs the chunks written to the file, then writes its header and syncs
+ * that. the header only reaches the disk after the chunks it points to */
+static int commit_file(struct region_file *file)
+{
+	unsigned char header[MCP_REGION_HEADER];
+	size_t i;
+
+	if (fdatasync(file->fd))
+		return 1;
+
+	for (i = 0; i < MCP_REGION_CHUNKS; i++) {
+		put_uint(header + i * 4, file->locations[i]);
+		put_uint(header + MCP_REGION_HEADER / 2 + i * 4, file->timestamps[i]);
+	}
+
+	if (write_all(file->fd, header, sizeof(header), 0) || fsync(file->fd))
+		return 1;
+
+	for (i = 0; i < file->count; i++) {
+		if (file->sectors[i] == SECTOR_FREED)
+			file->sectors[i] = SECTOR_FREE;
+	}
+
+	file->dirty = 0;
+	return 0;
+}
+
+/* writes count saves from first, in order */
+static void write_batch(struct mcp_region_writer *writer, uint64_t first,
+						size_t count)
+{
+	struct region_file **link, *file;
+	struct save *save;
+	size_t i, open = 0;
+
+	for (i = 0; i < count; i++) {
+		save = &writer->saves[(first + i) % writer->capacity];
+		save->file = NULL;
+		if (save->failed)
+			continue;
+
+		save->file = find_file(writer, region_of(save->x),
+								region_of(save->z));
+		save->failed = save->file == NULL || write_chunk(save->file, save);
+	}
+
+	/* the chunks of each file are synced before its header is written. a
+	 * file that fails is closed, so that it is read again from what is on
+	 * disk */
+	for (link = &writer->files; *link != NULL;) {
+		file = *link;
+		if (!file->dirty || commit_file(file) == 0) {
+			link = &file->next;
+			continue;
+		}
+
+		for (i = 0; i < count; i++) {
+			save = &writer->saves[(first + i) % writer->capacity];
+			if (save->file == file)
+				save->failed = 1;
+		}
+
+		*link = file->next;
+		close_file(file);
+	}
+
+	/* close the files used least recently */
+	for (link = &writer->files; *link != NULL; open++) {
+		if (open < MCP_REGION_OPEN_FILES) {
+			link = &(*link)->next;
+			continue;
+		}
+
+		file = *link;
+		*link = file->next;
+		close_file(file);
+	}
+}
+
+static void *write_main(void *arg)
+{
+	struct mcp_region_writer *writer = arg;
+	uint64_t first;
+	size_t count, failed, i;
+	struct save *save;
+
+	pthread_mutex_lock(&writer->lock);
+	for (;;) {
+		/* wait for the oldest chunk, so that chunks are written in the
+		 * order they were saved */
+		while ((writer->written == writer->compressed ||
+					writer->saves[writer->written % writer->capacity].state !=
+						SAVE_COMPRESSED) && !writer->stopping)
+			pthread_cond_wait(&writer->write_cond, &writer->lock);
+		if (writer->written == writer->saved)
+			break;
+
+		/* the batch is every chunk compressed after it, up to the first
+		 * that is not */
+		first = writer->written;
+		for (count = 0; first + count < writer->compressed; count++) {
+			save = &writer->saves[(first + count) % writer->capacity];
+			if (save->state != SAVE_COMPRESSED)
+				break;
+		}
+		pthread_mutex_unlock(&writer->lock);
+
+		write_batch(writer, first, count);
+
+		failed = 0;
+		for (i = 0; i < count; i++) {
+			save = &writer->saves[(first + i) % writer->capacity];
+			failed += save->failed;
+			fbuf_free(&save->data);
+		}
+
+		pthread_mutex_lock(&writer->lock);
+		writer->written += count;
+		writer->failed += failed;
+		pthread_cond_broadcast(&writer->done_cond);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	return NULL;
+}
+
+/* stops and joins the threads, once every chunk is written */
+static void stop_threads(struct mcp_region_writer *writer)
+{
+	pthread_mutex_lock(&writer->lock);
+	writer->stopping = 1;
+	pthread_cond_broadcast(&writer->compress_cond);
+	pthread_cond_broadcast(&writer->write_cond);
+	pthread_mutex_unlock(&writer->lock);
+
+	while (writer->threads > 0)
+		pthread_join(writer->workers[--writer->threads], NULL);
+	pthread_join(writer->io, NULL);
+}
+
+static void free_writer(struct mcp_region_writer *writer)
+{
+	struct region_file *file;
+
+	while ((file = writer->files) != NULL) {
+		writer->files = file->next;
+		close_file(file);
+	}
+
+	pthread_mutex_destroy(&writer->lock);
+	pthread_cond_destroy(&writer->compress_cond);
+	pthread_cond_destroy(&writer->write_cond);
+	pthread_cond_destroy(&writer->done_cond);
+	free(writer->workers);
+	free(writer->dir);
+	free(writer);
+}
+
+struct mcp_region_writer *mcp_region_writer_start(
+							const struct mcp_region_writer_config *config)
+{
+	struct mcp_region_writer *writer;
+	size_t i, size = strlen(config->dir) + 1;
+	int threads = config->threads, err;
+	long cpus;
+
+	if (config->capacity == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	writer = malloc(sizeof(*writer) +
+						config->capacity * sizeof(writer->saves[0]));
+	if (writer == NULL)
+		return NULL;
+
+	if (threads <= 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+
+	writer->dir = malloc(size);
+	writer->workers = malloc(threads * sizeof(writer->workers[0]));
+	if (writer->dir == NULL || writer->workers == NULL) {
+		free(writer->dir);
+		free(writer->workers);
+		free(writer);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memcpy(writer->dir, config->dir, size);
+	writer->level = config->level;
+	writer->pages = config->pages;
+	writer->stopping = 0;
+	writer->written = 0;
+	writer->compressed = 0;
+	writer->saved = 0;
+	writer->failed = 0;
+	writer->files = NULL;
+	writer->capacity = config->capacity;
+
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->compress_cond, NULL);
+	pthread_cond_init(&writer->write_cond, NULL);
+	pthread_cond_init(&writer->done_cond, NULL);
+
+	writer->threads = 0;
+	err = pthread_create(&writer->io, NULL, write_main, writer);
+	if (err != 0) {
+		free_writer(writer);
+		errno = err;
+		return NULL;
+	}
+
+	for (i = 0; i < (size_t)threads; i++) {
+		err = pthread_create(&writer->workers[i], NULL, compress_main, writer);
+		if (err != 0) {
+			/* nothing was saved, so the threads stop at once */
+			stop_threads(writer);
+			free_writer(writer);
+			errno = err;
+			return NULL;
+		}
+		writer->threads++;
+	}
+
+	return writer;
+}
+
+size_t mcp_region_writer_stop(struct mcp_region_writer *writer)
+{
+	size_t failed = mcp_region_flush(writer);
+
+	stop_threads(writer);
+	free_writer(writer);
+	return failed;
+}
+
+int mcp_region_save(struct mcp_region_writer *writer, int x, int z,
+						uint32_t timestamp, struct fbuf *nbt)
+{
+	struct save *save;
+
+	pthread_mutex_lock(&writer->lock);
+	if (writer->saved - writer->written >= writer->capacity) {
+		pthread_mutex_unlock(&writer->lock);
+		return 1;
+	}
+
+	save = &writer->saves[writer->saved++ % writer->capacity];
+	save->x = x;
+	save->z = z;
+	save->timestamp = timestamp;
+	save->state = SAVE_PENDING;
+	save->data = *nbt;
+	pthread_cond_signal(&writer->compress_cond);
+	pthread_mutex_unlock(&writer->lock);
+
+	nbt->base = NULL;
+	nbt->size = 0;
+	fbuf_clear(nbt);
+	return 0;
+}
+
+size_t mcp_region_flush(struct mcp_region_writer *writer)
+{
+	uint64_t saved;
+	size_t failed;
+
+	pthread_mutex_lock(&writer->lock);
+	saved = writer->saved;
+	while (writer->written < saved)
+		pthread_cond_wait(&writer->done_cond, &writer->lock);
+	failed = writer->failed;
+	writer->failed = 0;
+	pthread_mutex_unlock(&writer->lock);
+
+	return failed;
+}
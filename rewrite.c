@@ -0,0 +1,137 @@
+/* rewrite.c - In-place rewriting of frame fields
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memcpy and memmove */
+#include <string.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/rewrite.h>
+
+/* the number of bytes of the shortest encoding of value */
+static size_t rewrite_width(mcp_varlong_t value)
+{
+	size_t width = 1;
+
+	while (value > 0x7f) {
+		value >>= 7;
+		width++;
+	}
+
+	return width;
+}
+
+/* writes value as a varint of exactly width bytes. the bytes past its
+ * shortest encoding are padded with more-data-bits, which every decoder
+ * of varints accepts */
+static void rewrite_put(unsigned char *dest, mcp_varlong_t value,
+						size_t width)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < width; i++) {
+		dest[i] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	dest[i] = value;
+}
+
+/* finds the size of the length prefix and the body of a frame */
+static int rewrite_frame(struct fbuf *buf, size_t frame, size_t *prefix,
+						size_t *body)
+{
+	struct mcp_parse parse;
+	mcp_varlong_t size;
+
+	if (frame > fbuf_avail(buf))
+		return 1;
+
+	mcp_start(&parse, fbuf_ptr(buf) + frame, fbuf_avail(buf) - frame);
+	size = mcp_varlong(&parse);
+
+	/* the whole frame must be in the buffer */
+	if (!mcp_ok(&parse) || size > MCP_BYTES_MAX_SIZE ||
+			size > mcp_avail(&parse))
+		return 1;
+
+	*prefix = mcp_consumed(&parse);
+	*body = size;
+	return 0;
+}
+
+int mcp_rewrite_varint(struct fbuf *buf, size_t frame, size_t offset,
+						mcp_varlong_t value)
+{
+	struct mcp_parse parse;
+	size_t prefix, body, field, old, width, grow, new_prefix, tail;
+	unsigned char *data;
+
+	if (rewrite_frame(buf, frame, &prefix, &body) || offset >= body)
+		return 1;
+
+	field = frame + prefix + offset;
+	mcp_start(&parse, fbuf_ptr(buf) + field, body - offset);
+	mcp_varlong(&parse);
+	if (!mcp_ok(&parse))
+		return 1;
+
+	old = mcp_consumed(&parse);
+	width = rewrite_width(value);
+
+	/* the common case: nothing moves */
+	if (width <= old) {
+		rewrite_put(buf->base + buf->start + field, value, old);
+		return 0;
+	}
+
+	/* overflow check */
+	grow = width - old;
+	if (body > MCP_BYTES_MAX_SIZE - grow)
+		return 1;
+
+	/* the prefix keeps its width if the new size fits in it */
+	new_prefix = rewrite_width(body + grow);
+	if (new_prefix < prefix)
+		new_prefix = prefix;
+	grow += new_prefix - prefix;
+
+	if (fbuf_wptr(buf, grow) == NULL)
+		return 1;
+
+	/* fbuf_wptr may have moved the data */
+	data = buf->base + buf->start;
+	tail = field + old;
+
+	/* both moves are towards the end, so the last bytes go first */
+	memmove(data + tail + grow, data + tail, fbuf_avail(buf) - tail);
+	if (new_prefix > prefix)
+		memmove(data + frame + new_prefix, data + frame + prefix, offset);
+
+	rewrite_put(data + frame + new_prefix + offset, value, width);
+	rewrite_put(data + frame, body + width - old, new_prefix);
+	fbuf_produce(buf, grow);
+	return 0;
+}
+
+int mcp_rewrite_fixed(struct fbuf *buf, size_t frame, size_t offset,
+						const void *value, size_t size)
+{
+	size_t prefix, body;
+
+	if (rewrite_frame(buf, frame, &prefix, &body))
+		return 1;
+
+	if (offset > body || size > body - offset)
+		return 1;
+
+	if (size > 0)
+		memcpy(buf->base + buf->start + frame + prefix + offset, value, size);
+	return 0;
+}
@@ -0,0 +1,185 @@
+/* arena_test.c - tests of the bump-pointer arenas
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/arena.h>
+
+static void alloc_test(void)
+{
+	struct mcp_arena arena = MCP_ARENA_INITIALIZER;
+	unsigned char *ptrs[100], *big, *first;
+	size_t i;
+
+	/* an empty arena can be reset and freed */
+	mcp_arena_reset(&arena);
+	mcp_arena_free(&arena);
+
+	/* aligned, and not overlapping */
+	for (i = 0; i < 100; i++) {
+		ptrs[i] = mcp_arena_alloc(&arena, i * 37);
+		assert(ptrs[i] != NULL);
+		assert(((uintptr_t)ptrs[i] & (MCP_ARENA_ALIGN - 1)) == 0);
+		memset(ptrs[i], (int)i, i * 37);
+	}
+	for (i = 0; i < 100; i++) {
+		if (i > 0)
+			assert(ptrs[i][0] == i && ptrs[i][i * 37 - 1] == i);
+	}
+
+	/* larger than a chunk */
+	big = mcp_arena_alloc(&arena, 3 * MCP_ARENA_CHUNK);
+	assert(big != NULL);
+	memset(big, 0xaa, 3 * MCP_ARENA_CHUNK);
+	assert(ptrs[99][0] == 99);
+
+	/* the chunks are reused in the same order after a reset */
+	mcp_arena_reset(&arena);
+	first = mcp_arena_alloc(&arena, 0);
+	assert(first == ptrs[0]);
+	for (i = 1; i < 100; i++)
+		assert(mcp_arena_alloc(&arena, i * 37) == ptrs[i]);
+	assert(mcp_arena_alloc(&arena, 3 * MCP_ARENA_CHUNK) == big);
+
+	/* a chunk that is too small is passed over */
+	mcp_arena_reset(&arena);
+	for (i = 0; i < 100; i++)
+		assert(mcp_arena_alloc(&arena, i * 37) == ptrs[i]);
+	big = mcp_arena_alloc(&arena, 5 * MCP_ARENA_CHUNK);
+	assert(big != NULL);
+	memset(big, 0x55, 5 * MCP_ARENA_CHUNK);
+
+	/* too large */
+	assert(mcp_arena_alloc(&arena, (size_t)-1) == NULL);
+	assert(mcp_arena_alloc(&arena, (size_t)-1 - 8) == NULL);
+	assert(mcp_arena_alloc(&arena, 16) != NULL);
+
+	mcp_arena_free(&arena);
+	assert(arena.first == NULL && arena.next == NULL);
+	assert(mcp_arena_alloc(&arena, 16) != NULL);
+	mcp_arena_free(&arena);
+}
+
+static void parse_test(void)
+{
+	struct mcp_arena arena = MCP_ARENA_INITIALIZER;
+	struct fbuf buf = FBUF_INITIALIZER;
+	static char large[50000];
+	struct mcp_parse parse;
+	unsigned char *bytes;
+	char *str;
+	size_t size, i;
+
+	memset(large, 'x', sizeof(large) - 1);
+	assert(mcg_string(&buf, "minecraft:brand") == 0);
+	assert(mcg_bytes(&buf, "\x00\x01\x02", 3) == 0);
+	assert(mcg_string(&buf, "") == 0);
+	assert(mcg_string(&buf, large) == 0);
+
+	for (i = 0; i < 3; i++) {
+		mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+		str = mcp_arena_string(&parse, &arena, &size, 64);
+		assert(str != NULL && size == 15);
+		assert(strcmp(str, "minecraft:brand") == 0);
+		assert((const unsigned char *)str < fbuf_ptr(&buf) ||
+				(const unsigned char *)str >= fbuf_ptr(&buf) + fbuf_avail(&buf));
+
+		bytes = mcp_arena_bytes(&parse, &arena, &size);
+		assert(bytes != NULL && size == 3);
+		assert(memcmp(bytes, "\x00\x01\x02", 4) == 0);
+
+		str = mcp_arena_string(&parse, &arena, &size, 0);
+		assert(str != NULL && size == 0 && str[0] == 0);
+
+		str = mcp_arena_string(&parse, &arena, &size, sizeof(large));
+		assert(str != NULL && size == sizeof(large) - 1);
+		assert(strcmp(str, large) == 0);
+		assert(mcp_ok(&parse) && mcp_eof(&parse));
+
+		/* the copies of one packet are freed together */
+		mcp_arena_reset(&arena);
+	}
+
+	/* errors pass through, and nothing is copied */
+	mcp_start(&parse, fbuf_ptr(&buf), 10);
+	assert(mcp_arena_string(&parse, &arena, &size, 64) == NULL);
+	assert(mcp_error(&parse) == MCP_EAGAIN);
+	assert(mcp_arena_bytes(&parse, &arena, &size) == NULL);
+	assert(mcp_error(&parse) == MCP_EAGAIN);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_arena_string(&parse, &arena, &size, 14) == NULL);
+	assert(mcp_error(&parse) == MCP_EOVERFLOW);
+
+	fbuf_clear(&buf);
+	assert(mcg_string(&buf, "bad \xff") == 0);
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_arena_string(&parse, &arena, &size, 64) == NULL);
+	assert(mcp_error(&parse) == MCP_EINVAL);
+
+	/* bytes are not validated */
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	bytes = mcp_arena_bytes(&parse, &arena, &size);
+	assert(bytes != NULL && size == 5 && bytes[4] == 0xff);
+
+	mcp_arena_free(&arena);
+	fbuf_free(&buf);
+}
+
+#define NUM_TESTS		(2)
+static void (*tests[NUM_TESTS])(void) = {alloc_test, parse_test};
+static const char *test_names[NUM_TESTS] = {"alloc_test", "parse_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
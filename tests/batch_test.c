@@ -0,0 +1,241 @@
+/* batch_test.c - tests of the structure-of-arrays batch decoder
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/batch.h>
+
+/* more than one block of frames */
+#define NUM_FRAMES			(1000)
+
+static double x[NUM_FRAMES], y[NUM_FRAMES], z[NUM_FRAMES];
+static float yaw[NUM_FRAMES], pitch[NUM_FRAMES];
+static int on_ground[NUM_FRAMES];
+
+static const struct mcp_column movement[] = {
+	{MCP_FIELD_DOUBLE, x},
+	{MCP_FIELD_DOUBLE, y},
+	{MCP_FIELD_DOUBLE, z},
+	{MCP_FIELD_FLOAT, yaw},
+	{MCP_FIELD_FLOAT, pitch},
+	{MCP_FIELD_BOOL, on_ground}
+};
+
+/* writes NUM_FRAMES movement packets, one after another */
+static void write_movement(struct fbuf *buf)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		ret |= mcg_double(buf, i * 0.5);
+		ret |= mcg_double(buf, 64.0 + i);
+		ret |= mcg_double(buf, -i * 0.25);
+		ret |= mcg_float(buf, i * 2.0f);
+		ret |= mcg_float(buf, -i * 1.0f);
+		ret |= mcg_bool(buf, i & 1);
+		/* trailing data that is not part of the layout */
+		ret |= mcg_varint(buf, i & 0x7f);
+	}
+
+	assert(ret == 0);
+}
+
+static void start_frames(struct mcp_parse *frames, struct fbuf *buf, size_t size)
+{
+	int i;
+
+	for (i = 0; i < NUM_FRAMES; i++)
+		mcp_start(&frames[i], fbuf_ptr(buf) + i * size, size);
+}
+
+static void movement_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	static struct mcp_parse frames[NUM_FRAMES];
+	size_t size = mcp_batch_size(movement, 6);
+	int i;
+
+	assert(size == 8 * 3 + 4 * 2 + 1);
+
+	/* frames spaced one layout plus one varint byte apart */
+	write_movement(&buf);
+	start_frames(frames, &buf, size + 1);
+
+	assert(mcp_batch(movement, 6, frames, NUM_FRAMES) == NUM_FRAMES);
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		assert(x[i] == i * 0.5);
+		assert(y[i] == 64.0 + i);
+		assert(z[i] == -i * 0.25);
+		assert(yaw[i] == i * 2.0f);
+		assert(pitch[i] == -i * 1.0f);
+		assert(on_ground[i] == (i & 1));
+
+		/* frames are left after the layout */
+		assert(mcp_ok(&frames[i]));
+		assert(mcp_varint(&frames[i]) == (mcp_varint_t)(i & 0x7f));
+		assert(mcp_eof(&frames[i]));
+	}
+
+	fbuf_free(&buf);
+}
+
+static void types_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	static struct mcp_parse frames[NUM_FRAMES];
+	static uint8_t ub[NUM_FRAMES];
+	static int8_t b[NUM_FRAMES];
+	static uint16_t us[NUM_FRAMES];
+	static int16_t s[NUM_FRAMES];
+	static uint32_t ui[NUM_FRAMES];
+	static int32_t si[NUM_FRAMES];
+	static uint64_t ul[NUM_FRAMES];
+	static int64_t sl[NUM_FRAMES];
+	const struct mcp_column columns[] = {
+		{MCP_FIELD_UBYTE, ub},
+		{MCP_FIELD_BYTE, b},
+		{MCP_FIELD_USHORT, us},
+		{MCP_FIELD_SHORT, s},
+		{MCP_FIELD_UINT, ui},
+		{MCP_FIELD_INT, si},
+		{MCP_FIELD_ULONG, ul},
+		{MCP_FIELD_LONG, sl}
+	};
+	size_t size = mcp_batch_size(columns, 8);
+	struct mcp_parse scalar;
+	int i, ret = 0;
+
+	assert(size == 30);
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		ret |= mcg_ubyte(&buf, i * 7);
+		ret |= mcg_byte(&buf, -i);
+		ret |= mcg_ushort(&buf, i * 771);
+		ret |= mcg_short(&buf, -i * 31);
+		ret |= mcg_uint(&buf, i * 0x01020304UL);
+		ret |= mcg_int(&buf, -i * 100003);
+		ret |= mcg_ulong(&buf, i * 0x0102030405060708ULL);
+		ret |= mcg_long(&buf, -i * 1000000007LL);
+	}
+	assert(ret == 0);
+
+	start_frames(frames, &buf, size);
+	assert(mcp_batch(columns, 8, frames, NUM_FRAMES) == NUM_FRAMES);
+
+	/* the columns should match the scalar parsers exactly */
+	mcp_start(&scalar, fbuf_ptr(&buf), fbuf_avail(&buf));
+	for (i = 0; i < NUM_FRAMES; i++) {
+		assert(ub[i] == mcp_ubyte(&scalar));
+		assert(b[i] == mcp_byte(&scalar));
+		assert(us[i] == mcp_ushort(&scalar));
+		assert(s[i] == mcp_short(&scalar));
+		assert(ui[i] == mcp_uint(&scalar));
+		assert(si[i] == mcp_int(&scalar));
+		assert(ul[i] == mcp_ulong(&scalar));
+		assert(sl[i] == mcp_long(&scalar));
+		assert(mcp_eof(&frames[i]));
+	}
+	assert(mcp_ok(&scalar) && mcp_eof(&scalar));
+
+	fbuf_free(&buf);
+}
+
+static void error_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	static struct mcp_parse frames[NUM_FRAMES];
+	size_t size = mcp_batch_size(movement, 6);
+	int i;
+
+	write_movement(&buf);
+
+	/* frames spaced one layout plus one varint byte apart */
+	start_frames(frames, &buf, size + 1);
+
+	/* a short frame and a frame with a previous error */
+	mcp_start(&frames[3], fbuf_ptr(&buf) + 3 * (size + 1), size - 1);
+	frames[10].error = MCP_EINVAL;
+
+	assert(mcp_batch(movement, 6, frames, NUM_FRAMES) == NUM_FRAMES - 2);
+
+	assert(mcp_error(&frames[3]) == MCP_EAGAIN);
+	assert(mcp_error(&frames[10]) == MCP_EINVAL);
+	for (i = 0; i < NUM_FRAMES; i++) {
+		if (i == 3 || i == 10) {
+			assert(x[i] == 0 && y[i] == 0 && z[i] == 0);
+			assert(yaw[i] == 0 && pitch[i] == 0 && on_ground[i] == 0);
+			continue;
+		}
+		assert(mcp_ok(&frames[i]));
+		assert(y[i] == 64.0 + i);
+	}
+
+	/* every frame bad */
+	for (i = 0; i < NUM_FRAMES; i++)
+		mcp_start(&frames[i], fbuf_ptr(&buf), 1);
+	assert(mcp_batch(movement, 6, frames, NUM_FRAMES) == 0);
+	assert(x[0] == 0 && on_ground[NUM_FRAMES - 1] == 0);
+
+	fbuf_free(&buf);
+}
+
+#define NUM_TESTS		(3)
+static void (*tests[NUM_TESTS])(void) = {movement_test, types_test,
+										error_test};
+static const char *test_names[NUM_TESTS] = {"movement_test", "types_test",
+											"error_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -0,0 +1,294 @@
+/* capture_test.c - tests of the packet capture and replay
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for nanosleep, clock_gettime and truncate */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/capture.h>
+
+#define NUM_RECORDS			(1000)
+
+static char path[64];
+
+static void make_path(void)
+{
+	sprintf(path, "/tmp/capture_test.%li", (long)getpid());
+}
+
+static size_t record_size(int i)
+{
+	return (i * 37) % 300;
+}
+
+static void write_capture(void)
+{
+	static unsigned char body[300 + 7];
+	struct mcp_capture *capture;
+	int i;
+
+	for (i = 0; i < (int)sizeof(body); i++)
+		body[i] = i;
+
+	capture = mcp_capture_open(path);
+	assert(capture);
+
+	for (i = 0; i < NUM_RECORDS; i++)
+		assert(mcp_capture_frame(capture, i % 7, i & 1, body + i % 7,
+									record_size(i)) == 0);
+
+	assert(mcp_capture_close(capture) == 0);
+}
+
+static void replay_test(void)
+{
+	struct mcp_replay replay;
+	struct mcp_record record;
+	uint64_t last = 0;
+	size_t j;
+	int i, pass;
+
+	make_path();
+	write_capture();
+
+	assert(mcp_replay_open(&replay, path) == 0);
+	assert(replay.start > 0);
+
+	/* rewinding replays the same records */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; mcp_replay_next(&replay, &record); i++) {
+			assert(record.conn == (uint32_t)(i % 7));
+			assert(record.dir == (enum mcp_capture_dir)(i & 1));
+			assert(record.time >= last);
+			assert(mcp_avail(&record.frame) == record_size(i));
+			for (j = 0; j < record_size(i); j++)
+				assert(mcp_ptr(&record.frame)[j] == (j + i % 7) % 256);
+			last = record.time;
+		}
+
+		assert(i == NUM_RECORDS);
+		assert(mcp_ok(&replay.buf));
+		mcp_replay_rewind(&replay);
+		last = 0;
+	}
+
+	mcp_replay_close(&replay);
+	unlink(path);
+}
+
+static void malformed_test(void)
+{
+	struct mcp_replay replay;
+	struct mcp_record record;
+	FILE *file;
+	int i;
+
+	make_path();
+
+	/* missing */
+	unlink(path);
+	assert(mcp_replay_open(&replay, path) != 0);
+	assert(errno == ENOENT);
+
+	/* not a capture */
+	file = fopen(path, "wb");
+	assert(file);
+	fputs("not a capture file at all", file);
+	fclose(file);
+	assert(mcp_replay_open(&replay, path) != 0);
+	assert(errno == EINVAL);
+
+	/* cut short in the middle of a record */
+	write_capture();
+	file = fopen(path, "rb");
+	assert(file);
+	assert(fseek(file, 0, SEEK_END) == 0);
+	assert(truncate(path, ftell(file) - 10) == 0);
+	fclose(file);
+
+	assert(mcp_replay_open(&replay, path) == 0);
+	for (i = 0; mcp_replay_next(&replay, &record); i++)
+		;
+	assert(i == NUM_RECORDS - 1);
+	assert(mcp_error(&replay.buf) == MCP_EAGAIN);
+	mcp_replay_close(&replay);
+
+	unlink(path);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void count_record(struct mcp_record *record, void *user)
+{
+	(void)record;
+	(*(int *)user)++;
+}
+
+static void timing_test(void)
+{
+	struct timespec ms = {0, 50000000};
+	struct mcp_capture *capture;
+	struct mcp_replay replay;
+	double start;
+	int count = 0;
+
+	make_path();
+
+	/* two frames 50ms apart */
+	capture = mcp_capture_open(path);
+	assert(capture);
+	assert(mcp_capture_frame(capture, 0, MCP_CAPTURE_IN, "a", 1) == 0);
+	nanosleep(&ms, NULL);
+	assert(mcp_capture_frame(capture, 0, MCP_CAPTURE_OUT, "b", 1) == 0);
+	assert(mcp_capture_flush(capture) == 0);
+	assert(mcp_capture_close(capture) == 0);
+
+	assert(mcp_replay_open(&replay, path) == 0);
+
+	/* at the recorded timing */
+	start = now();
+	assert(mcp_replay_run(&replay, 1, count_record, &count) == 2);
+	assert(now() - start >= 0.05);
+
+	/* as fast as possible */
+	mcp_replay_rewind(&replay);
+	assert(mcp_replay_run(&replay, 0, count_record, &count) == 2);
+	assert(count == 4);
+
+	mcp_replay_close(&replay);
+	unlink(path);
+}
+
+#define NUM_THREADS			(4)
+#define THREAD_RECORDS		(2000)
+
+static struct mcp_capture *shared_capture;
+
+static void *record_main(void *arg)
+{
+	unsigned char body[1000] = {0};
+	uint32_t conn = *(int *)arg, i;
+
+	/* the conn is the thread, and the body says which record it is */
+	for (i = 0; i < THREAD_RECORDS; i++) {
+		memcpy(body, &i, sizeof(i));
+		assert(mcp_capture_frame(shared_capture, conn, MCP_CAPTURE_IN, body,
+									sizeof(body)) == 0);
+	}
+
+	return NULL;
+}
+
+static void threads_test(void)
+{
+	pthread_t threads[NUM_THREADS];
+	struct mcp_capture *capture;
+	struct mcp_replay replay;
+	struct mcp_record record;
+	uint32_t next[NUM_THREADS], i;
+	uint64_t last = 0;
+	int ids[NUM_THREADS], t;
+
+	make_path();
+
+	/* the threads fill several buffers, which are written while the
+	 * others go on recording */
+	capture = mcp_capture_open(path);
+	assert(capture);
+	shared_capture = capture;
+	for (t = 0; t < NUM_THREADS; t++) {
+		ids[t] = t;
+		assert(pthread_create(&threads[t], NULL, record_main, &ids[t]) == 0);
+	}
+	for (t = 0; t < NUM_THREADS; t++)
+		assert(pthread_join(threads[t], NULL) == 0);
+	assert(mcp_capture_close(capture) == 0);
+
+	/* every record is there, in order */
+	assert(mcp_replay_open(&replay, path) == 0);
+	memset(next, 0, sizeof(next));
+	while (mcp_replay_next(&replay, &record)) {
+		assert(record.time >= last);
+		last = record.time;
+		assert(mcp_avail(&record.frame) == 1000);
+		memcpy(&i, mcp_ptr(&record.frame), sizeof(i));
+		assert(record.conn < NUM_THREADS);
+		assert(i == next[record.conn]++);
+	}
+	assert(mcp_ok(&replay.buf));
+	for (t = 0; t < NUM_THREADS; t++)
+		assert(next[t] == THREAD_RECORDS);
+
+	mcp_replay_close(&replay);
+	unlink(path);
+}
+
+#define NUM_TESTS		(4)
+static void (*tests[NUM_TESTS])(void) = {replay_test, malformed_test, timing_test,
+											threads_test};
+static const char *test_names[NUM_TESTS] = {"replay_test", "malformed_test",
+											"timing_test", "threads_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -0,0 +1,334 @@
+/* coro_test.cpp - tests of the coroutine packet reader
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <cassert>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/coro.hpp>
+
+/* protocol version, host, port, next state */
+typedef mcp::layout<mcp::varint, mcp::string<255>, mcp::ushort, mcp::varint>
+		handshake_packet;
+
+struct session {
+	int state;
+	mcp_varint_t version, next, packets;
+	std::string host, name;
+	uint16_t port;
+};
+
+/* reads one length prefixed packet and checks its id */
+static mcp::task expect_packet(mcp::stream &in, session &s, mcp_varint_t id)
+{
+	mcp_varint_t length = co_await in.varint();
+	mcp_varint_t got = co_await in.varint();
+
+	if (in.ok() && (got != id || length == 0))
+		s.state = -1;
+	s.packets++;
+}
+
+static mcp::task login(mcp::stream &in, session &s)
+{
+	/* the handshake */
+	co_await expect_packet(in, s, 0);
+	auto [version, host, port, next] = co_await in.read<handshake_packet>();
+	if (!in.ok() || s.state < 0)
+		co_return;
+
+	s.version = version;
+	s.host = std::string(host);
+	s.port = port;
+	s.next = next;
+	s.state = 1;
+
+	/* login start */
+	co_await expect_packet(in, s, 0);
+	auto name = co_await in.read<mcp::string<16>>();
+	if (!in.ok() || s.state < 0)
+		co_return;
+
+	s.name = std::string(name);
+	s.state = 2;
+}
+
+static void encode_login(struct fbuf *out, const char *name)
+{
+	struct fbuf body = FBUF_INITIALIZER;
+
+	assert(mcg_varint(&body, 0) == 0);
+	assert(handshake_packet::write(body, 47, "localhost", 25565, 2) == 0);
+	assert(mcg_bytes(out, fbuf_ptr(&body), fbuf_avail(&body)) == 0);
+
+	fbuf_clear(&body);
+	assert(mcg_varint(&body, 0) == 0);
+	assert(mcg_string(&body, name) == 0);
+	assert(mcg_bytes(out, fbuf_ptr(&body), fbuf_avail(&body)) == 0);
+
+	fbuf_free(&body);
+}
+
+static void trickle_test(void)
+{
+	struct fbuf wire = FBUF_INITIALIZER, inbound = FBUF_INITIALIZER;
+	mcp::stream in(inbound);
+	session s = {};
+	size_t i;
+
+	encode_login(&wire, "alice");
+
+	mcp::task t = login(in, s);
+	assert(t.valid());
+	t.start();
+	assert(!t.done() && in.waiting());
+
+	/* one byte at a time, the coroutine only finishes on the last one */
+	for (i = 0; i < fbuf_avail(&wire); i++) {
+		assert(!t.done());
+		assert(in.write(fbuf_ptr(&wire) + i, 1) == 0);
+	}
+
+	assert(t.done());
+	assert(in.ok());
+	assert(s.state == 2);
+	assert(s.version == 47);
+	assert(s.host == "localhost");
+	assert(s.port == 25565);
+	assert(s.next == 2);
+	assert(s.name == "alice");
+	assert(s.packets == 2);
+
+	/* everything was consumed */
+	assert(fbuf_avail(&inbound) == 0);
+
+	/* all at once, the coroutine never suspends */
+	session quick = {};
+	mcp::task u = login(in, quick);
+	assert(in.write(fbuf_ptr(&wire), fbuf_avail(&wire)) == 0);
+	u.start();
+	assert(u.done() && quick.state == 2 && quick.name == "alice");
+
+	fbuf_free(&wire);
+	fbuf_free(&inbound);
+}
+
+static void error_test(void)
+{
+	static const unsigned char overflow[] = {0xff, 0xff, 0xff, 0xff, 0x7f};
+	struct fbuf wire = FBUF_INITIALIZER, inbound = FBUF_INITIALIZER;
+	session s = {};
+
+	/* a malformed varint ends the exchange */
+	{
+		mcp::stream in(inbound);
+		mcp::task t = login(in, s);
+		t.start();
+		assert(in.write(overflow, sizeof(overflow)) == 0);
+		assert(t.done());
+		assert(in.error() == MCP_EOVERFLOW);
+		assert(s.state == 0);
+	}
+
+	/* a name longer than 16 bytes */
+	fbuf_clear(&inbound);
+	encode_login(&wire, "a name that is much too long");
+	{
+		mcp::stream in(inbound);
+		session t_s = {};
+		mcp::task t = login(in, t_s);
+		t.start();
+		assert(in.write(fbuf_ptr(&wire), fbuf_avail(&wire)) == 0);
+		assert(t.done());
+		assert(in.error() == MCP_EOVERFLOW);
+		assert(t_s.state == 1);
+	}
+
+	/* the connection closes partway through */
+	fbuf_clear(&inbound);
+	{
+		mcp::stream in(inbound);
+		session t_s = {};
+		mcp::task t = login(in, t_s);
+		t.start();
+		assert(in.write(fbuf_ptr(&wire), 5) == 0);
+		assert(!t.done());
+		in.close();
+		assert(t.done());
+		assert(in.error() == MCP_EAGAIN);
+	}
+
+	/* destroying a suspended task frees its frame */
+	fbuf_clear(&inbound);
+	{
+		size_t used = mcp::frame_pool::get_stats().used;
+		mcp::stream in(inbound);
+		session t_s = {};
+		{
+			mcp::task t = login(in, t_s);
+			t.start();
+			assert(mcp::frame_pool::get_stats().used > used);
+		}
+		assert(mcp::frame_pool::get_stats().used == used);
+	}
+
+	fbuf_free(&wire);
+	fbuf_free(&inbound);
+}
+
+#define NUM_CONNECTIONS		(10000)
+
+static void pool_test(void)
+{
+	std::vector<struct fbuf> inbound(NUM_CONNECTIONS);
+	std::vector<mcp::stream *> streams(NUM_CONNECTIONS);
+	std::vector<session> sessions(NUM_CONNECTIONS);
+	std::vector<mcp::task> tasks(NUM_CONNECTIONS);
+	struct fbuf wire = FBUF_INITIALIZER;
+	mcp::frame_pool::stats stats;
+	size_t i, half;
+
+	encode_login(&wire, "bob");
+	half = fbuf_avail(&wire) / 2;
+
+	/* thousands of connections stuck in the handshake */
+	for (i = 0; i < NUM_CONNECTIONS; i++) {
+		fbuf_init(&inbound[i], FBUF_MAX);
+		streams[i] = new mcp::stream(inbound[i]);
+		sessions[i] = session();
+		tasks[i] = login(*streams[i], sessions[i]);
+		assert(tasks[i].valid());
+		tasks[i].start();
+		assert(streams[i]->write(fbuf_ptr(&wire), half) == 0);
+		assert(!tasks[i].done());
+	}
+
+	/* the frames are packed into slabs, with little waste */
+	stats = mcp::frame_pool::get_stats();
+	fprintf(stderr, "%i suspended logins: %zu bytes of frames, %zu reserved\n",
+			NUM_CONNECTIONS, stats.used, stats.reserved);
+	assert(stats.used > 0);
+	assert(stats.reserved < stats.used + stats.used / 8 + 2 * MCP_CORO_POOL_SLAB);
+
+	for (i = 0; i < NUM_CONNECTIONS; i++) {
+		assert(streams[i]->write(fbuf_ptr(&wire) + half,
+								fbuf_avail(&wire) - half) == 0);
+		assert(tasks[i].done());
+		assert(sessions[i].state == 2 && sessions[i].name == "bob");
+		tasks[i] = mcp::task();
+	}
+
+	/* freed frames are reused, so the pool does not grow */
+	assert(mcp::frame_pool::get_stats().used == 0);
+	for (i = 0; i < NUM_CONNECTIONS; i++) {
+		tasks[i] = login(*streams[i], sessions[i]);
+		tasks[i].start();
+		assert(streams[i]->write(fbuf_ptr(&wire), half) == 0);
+	}
+	assert(mcp::frame_pool::get_stats().used == stats.used);
+	assert(mcp::frame_pool::get_stats().reserved == stats.reserved);
+
+	for (i = 0; i < NUM_CONNECTIONS; i++) {
+		tasks[i] = mcp::task();
+		delete streams[i];
+		fbuf_free(&inbound[i]);
+	}
+
+	fbuf_free(&wire);
+}
+
+/* a login that is still suspended when the program exits */
+struct late_login {
+	struct fbuf inbound;
+	mcp::stream *stream;
+	session s;
+	mcp::task task;
+
+	late_login()
+	{
+		fbuf_init(&inbound, FBUF_MAX);
+		stream = new mcp::stream(inbound);
+		s = session();
+		task = login(*stream, s);
+		assert(task.valid());
+		task.start();
+	}
+
+	/* runs after the destructors of the thread, so the frame is freed to a
+	 * pool that has exited */
+	~late_login()
+	{
+		task = mcp::task();
+		assert(mcp::frame_pool::get_stats().reserved == 0);
+		delete stream;
+		fbuf_free(&inbound);
+	}
+};
+
+static void exit_test(void)
+{
+	static late_login late;
+
+	assert(!late.task.done());
+	assert(mcp::frame_pool::get_stats().used > 0);
+}
+
+#define NUM_TESTS		(4)
+static void (*tests[NUM_TESTS])(void) = {trickle_test, error_test, pool_test,
+											exit_test};
+static const char *test_names[NUM_TESTS] = {"trickle_test", "error_test",
+											"pool_test", "exit_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
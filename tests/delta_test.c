@@ -0,0 +1,312 @@
+/* delta_test.c - tests of the entity delta encoder
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/delta.h>
+
+#define NUM_ENTITIES		(200)
+
+static const struct mcp_delta_ids ids = {0x25, 0x26, 0x27, 0x56, 0x44};
+
+static mcp_varint_t entity_ids[NUM_ENTITIES];
+static double xs[NUM_ENTITIES], ys[NUM_ENTITIES], zs[NUM_ENTITIES];
+static uint8_t yaws[NUM_ENTITIES], pitches[NUM_ENTITIES];
+static uint8_t grounds[NUM_ENTITIES];
+static uint32_t versions[NUM_ENTITIES];
+static const unsigned char *metas[NUM_ENTITIES];
+static size_t meta_sizes[NUM_ENTITIES];
+
+static const struct mcp_entities entities = {
+	NUM_ENTITIES, entity_ids, xs, ys, zs, yaws, pitches, grounds,
+	versions, metas, meta_sizes
+};
+
+/* what the client would know about each entity, from the frames */
+struct client {
+	double x[NUM_ENTITIES], y[NUM_ENTITIES], z[NUM_ENTITIES];
+	uint8_t yaw[NUM_ENTITIES], pitch[NUM_ENTITIES], ground[NUM_ENTITIES];
+	size_t meta_size[NUM_ENTITIES];
+	/* frames of each packet id, by its offset from the first */
+	int frames[5];
+};
+
+static size_t find(mcp_varint_t id)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ENTITIES; i++) {
+		if (entity_ids[i] == id)
+			return i;
+	}
+
+	assert(0);
+	return 0;
+}
+
+/* applies the frames in buf to client, as a client would */
+static void apply(struct client *client, struct fbuf *buf)
+{
+	struct mcp_parse parse, body;
+	const void *ptr;
+	mcp_varint_t packet;
+	size_t size, i;
+
+	memset(client->frames, 0, sizeof(client->frames));
+	mcp_start(&parse, fbuf_ptr(buf), fbuf_avail(buf));
+	while (!mcp_eof(&parse)) {
+		ptr = mcp_bytes(&parse, &size);
+		assert(mcp_ok(&parse));
+		mcp_start(&body, ptr, size);
+
+		packet = mcp_varint(&body);
+		i = find(mcp_varint(&body));
+
+		if (packet == ids.move || packet == ids.move_look) {
+			client->x[i] += mcp_short(&body) / 4096.0;
+			client->y[i] += mcp_short(&body) / 4096.0;
+			client->z[i] += mcp_short(&body) / 4096.0;
+			client->frames[packet == ids.move ? 0 : 1]++;
+		} else if (packet == ids.teleport) {
+			client->x[i] = mcp_double(&body);
+			client->y[i] = mcp_double(&body);
+			client->z[i] = mcp_double(&body);
+			client->frames[3]++;
+		} else if (packet == ids.look) {
+			client->frames[2]++;
+		}
+
+		if (packet == ids.move_look || packet == ids.look ||
+				packet == ids.teleport) {
+			client->yaw[i] = mcp_ubyte(&body);
+			client->pitch[i] = mcp_ubyte(&body);
+		}
+
+		if (packet == ids.metadata) {
+			/* the frames do not outlive the buffer, so the metadata is
+			 * checked here */
+			client->meta_size[i] = mcp_avail(&body);
+			assert(mcp_avail(&body) == meta_sizes[i]);
+			assert(memcmp(mcp_ptr(&body), metas[i], meta_sizes[i]) == 0);
+			mcp_consume(&body, mcp_avail(&body));
+			client->frames[4]++;
+		} else {
+			client->ground[i] = mcp_bool(&body);
+		}
+
+		assert(mcp_ok(&body) && mcp_eof(&body));
+	}
+}
+
+/* the client agrees with the entities, to the precision of the moves.
+ * the rounding of a teleport and of the moves after it can add up */
+static void check(struct client *client)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ENTITIES; i++) {
+		assert(client->x[i] - xs[i] < 1 / 4096.0 + 1e-9);
+		assert(xs[i] - client->x[i] < 1 / 4096.0 + 1e-9);
+		assert(client->y[i] - ys[i] < 1 / 4096.0 + 1e-9);
+		assert(ys[i] - client->y[i] < 1 / 4096.0 + 1e-9);
+		assert(client->z[i] - zs[i] < 1 / 4096.0 + 1e-9);
+		assert(zs[i] - client->z[i] < 1 / 4096.0 + 1e-9);
+		assert(client->yaw[i] == yaws[i] && client->pitch[i] == pitches[i]);
+		assert(client->ground[i] == grounds[i]);
+		assert(client->meta_size[i] == meta_sizes[i]);
+	}
+}
+
+static void frames(struct client *client, int move, int move_look, int look,
+					int teleport, int metadata)
+{
+	assert(client->frames[0] == move);
+	assert(client->frames[1] == move_look);
+	assert(client->frames[2] == look);
+	assert(client->frames[3] == teleport);
+	assert(client->frames[4] == metadata);
+}
+
+static void delta_test(void)
+{
+	static struct mcp_delta last[NUM_ENTITIES];
+	static struct client client;
+	static unsigned char big[300];
+	struct fbuf buf = FBUF_INITIALIZER;
+	size_t i;
+
+	for (i = 0; i < NUM_ENTITIES; i++) {
+		entity_ids[i] = i * 1000;
+		xs[i] = i * 10.5 - 1000;
+		ys[i] = 64;
+		zs[i] = -0.3 * i;
+		yaws[i] = i;
+		metas[i] = (const unsigned char *)"\x00\x01\xff";
+		meta_sizes[i] = 3;
+	}
+	memset(big, 0x7f, sizeof(big));
+	metas[7] = big;
+	meta_sizes[7] = sizeof(big);
+
+	/* the first update is a teleport, with the metadata */
+	mcp_delta_reset(last, NUM_ENTITIES);
+	assert(mcp_delta_encode(&buf, &ids, &entities, last) == 0);
+	apply(&client, &buf);
+	frames(&client, 0, 0, 0, NUM_ENTITIES, NUM_ENTITIES);
+	check(&client);
+
+	/* nothing changed */
+	fbuf_clear(&buf);
+	assert(mcp_delta_encode(&buf, &ids, &entities, last) == 0);
+	assert(fbuf_avail(&buf) == 0);
+
+	/* small moves, turns and landings */
+	xs[0] += 0.25;
+	zs[1] -= 7.9;
+	yaws[1]++;
+	pitches[2] = 0x80;
+	grounds[3] = 1;
+	grounds[4] = 1;
+	pitches[4] = 1;
+	versions[5]++;
+	xs[6] += 1e-6;
+	fbuf_clear(&buf);
+	assert(mcp_delta_encode(&buf, &ids, &entities, last) == 0);
+	apply(&client, &buf);
+	frames(&client, 2, 1, 2, 0, 1);
+	check(&client);
+
+	/* far moves, on one axis or after many small ones */
+	ys[10] += 8;
+	for (i = 0; i < 40; i++) {
+		ys[11] += 0.5;
+		fbuf_clear(&buf);
+		assert(mcp_delta_encode(&buf, &ids, &entities, last) == 0);
+		apply(&client, &buf);
+		frames(&client, 1, 0, 0, i == 0 ? 1 : 0, 0);
+		check(&client);
+	}
+
+	/* sub-block drift does not build up */
+	for (i = 0; i < 1000; i++) {
+		xs[12] += 1 / 10000.0;
+		fbuf_clear(&buf);
+		assert(mcp_delta_encode(&buf, &ids, &entities, last) == 0);
+		apply(&client, &buf);
+		check(&client);
+	}
+
+	/* forgotten entities are sent again */
+	mcp_delta_reset(last + 100, 50);
+	fbuf_clear(&buf);
+	assert(mcp_delta_encode(&buf, &ids, &entities, last) == 0);
+	apply(&client, &buf);
+	frames(&client, 0, 0, 0, 50, 50);
+	check(&client);
+
+	fbuf_free(&buf);
+}
+
+static void error_test(void)
+{
+	static struct mcp_delta last[NUM_ENTITIES];
+	static struct client client;
+	struct fbuf buf;
+	size_t i;
+
+	for (i = 0; i < NUM_ENTITIES; i++) {
+		entity_ids[i] = i;
+		xs[i] = ys[i] = zs[i] = i;
+		yaws[i] = pitches[i] = grounds[i] = 0;
+		versions[i] = 0;
+		metas[i] = (const unsigned char *)"\x00";
+		meta_sizes[i] = 1;
+	}
+
+	/* the buffer fills up part way through */
+	fbuf_init(&buf, 1000);
+	mcp_delta_reset(last, NUM_ENTITIES);
+	assert(mcp_delta_encode(&buf, &ids, &entities, last) == 1);
+	assert(fbuf_avail(&buf) > 0 && fbuf_avail(&buf) <= 1000);
+
+	/* the entities that were written are not written again */
+	memset(&client, 0, sizeof(client));
+	apply(&client, &buf);
+	assert(client.frames[3] > 0 && client.frames[3] == client.frames[4]);
+	i = client.frames[3];
+
+	while (fbuf_avail(&buf) > 0) {
+		fbuf_clear(&buf);
+		mcp_delta_encode(&buf, &ids, &entities, last);
+		apply(&client, &buf);
+		i += client.frames[3];
+	}
+	assert(i == NUM_ENTITIES);
+	check(&client);
+
+	/* metadata that can not be framed */
+	meta_sizes[0] = MCP_BYTES_MAX_SIZE;
+	versions[0]++;
+	assert(mcp_delta_encode(&buf, &ids, &entities, last) == 1);
+	assert(fbuf_avail(&buf) == 0);
+
+	fbuf_free(&buf);
+}
+
+#define NUM_TESTS		(2)
+static void (*tests[NUM_TESTS])(void) = {delta_test, error_test};
+static const char *test_names[NUM_TESTS] = {"delta_test", "error_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+/* dispatch_test.c - tests of the packet id dispatch tables
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/dispatch.h>
+
+struct connection {
+	enum mcp_state state;
+	mcp_varint_t last;
+	int calls;
+};
+
+static int on_value(void *context, struct mcp_parse *buf)
+{
+	struct connection *conn = context;
+
+	conn->last = mcp_varint(buf);
+	conn->calls++;
+	return mcp_ok(buf) ? 0 : 1;
+}
+
+static int on_other(void *context, struct mcp_parse *buf)
+{
+	(void)buf;
+	((struct connection *)context)->calls++;
+	return 7;
+}
+
+static const mcp_handler_t small[] = {
+	[0x00] = on_value,
+	[0x02] = on_other,
+	[0x03] = on_value
+};
+
+static const mcp_handler_t large[] = {
+	[0x05] = on_value,
+	[0x90] = on_other,
+	[0xff] = on_value
+};
+
+/* dispatches the packet in data */
+static int dispatch(const struct mcp_dispatch *table, uint64_t *counts,
+					struct connection *conn, const void *data, size_t size,
+					mcp_error_t *error)
+{
+	struct mcp_parse buf;
+	int ret;
+
+	mcp_start(&buf, data, size);
+	ret = mcp_dispatch(table, counts, conn, &buf);
+	*error = mcp_error(&buf);
+	return ret;
+}
+
+static void dispatch_test(void)
+{
+	const struct mcp_dispatch table = MCP_DISPATCH(small);
+	uint64_t counts[MCP_DISPATCH_COUNTS(small)] = {0};
+	struct connection conn = {MCP_STATE_PLAY, 0, 0};
+	struct mcp_parse buf;
+	mcp_error_t error;
+
+	assert(table.size == 4 && table.direct == 4);
+	assert(MCP_DISPATCH_COUNTS(small) == 5);
+
+	assert(dispatch(&table, counts, &conn, "\x00\x2a", 2, &error) == 0);
+	assert(error == MCP_EOK && conn.last == 42 && conn.calls == 1);
+	assert(dispatch(&table, counts, &conn, "\x03\xac\x02", 3, &error) == 0);
+	assert(error == MCP_EOK && conn.last == 300 && conn.calls == 2);
+	assert(dispatch(&table, counts, &conn, "\x02", 1, &error) == 7);
+	assert(error == MCP_EOK && conn.calls == 3);
+
+	/* the handler sees the rest of the packet */
+	assert(dispatch(&table, counts, &conn, "\x00", 1, &error) == 1);
+	assert(error == MCP_EAGAIN && conn.calls == 4);
+
+	/* a padded id is read as a varint */
+	assert(dispatch(&table, counts, &conn, "\x83\x00\x05", 3, &error) == 0);
+	assert(error == MCP_EOK && conn.last == 5 && conn.calls == 5);
+
+	/* unknown ids, in and out of the table */
+	assert(dispatch(&table, counts, &conn, "\x01\x00", 2, &error) == -1);
+	assert(error == MCP_EINVAL);
+	assert(dispatch(&table, counts, &conn, "\x04\x00", 2, &error) == -1);
+	assert(error == MCP_EINVAL);
+	assert(dispatch(&table, counts, &conn, "\xff\x01", 2, &error) == -1);
+	assert(error == MCP_EINVAL);
+	assert(conn.calls == 5);
+
+	/* ids that are not there */
+	assert(dispatch(&table, counts, &conn, "", 0, &error) == -1);
+	assert(error == MCP_EAGAIN);
+	assert(dispatch(&table, counts, &conn, "\x80", 1, &error) == -1);
+	assert(error == MCP_EAGAIN);
+
+	/* errors pass through */
+	mcp_start(&buf, "\x00\x00", 2);
+	buf.error = MCP_EOVERFLOW;
+	assert(mcp_dispatch(&table, counts, &conn, &buf) == -1);
+	assert(mcp_error(&buf) == MCP_EOVERFLOW && mcp_consumed(&buf) == 0);
+	assert(conn.calls == 5);
+
+	assert(counts[0] == 2 && counts[1] == 0 && counts[2] == 1);
+	assert(counts[3] == 2 && counts[4] == 3);
+
+	assert(dispatch(&table, NULL, &conn, "\x00\x01", 2, &error) == 0);
+	assert(dispatch(&table, NULL, &conn, "\x01", 1, &error) == -1);
+	assert(counts[0] == 2 && counts[4] == 3);
+}
+
+static void large_test(void)
+{
+	const struct mcp_dispatch table = MCP_DISPATCH(large);
+	uint64_t counts[MCP_DISPATCH_COUNTS(large)] = {0};
+	struct connection conn = {MCP_STATE_PLAY, 0, 0};
+	mcp_error_t error;
+
+	assert(table.size == 0x100 && table.direct == 0x80);
+
+	assert(dispatch(&table, counts, &conn, "\x05\x01", 2, &error) == 0);
+	assert(error == MCP_EOK && conn.last == 1);
+	assert(dispatch(&table, counts, &conn, "\x90\x01", 2, &error) == 7);
+	assert(dispatch(&table, counts, &conn, "\xff\x01\x02", 3, &error) == 0);
+	assert(error == MCP_EOK && conn.last == 2);
+	assert(dispatch(&table, counts, &conn, "\x80\x02", 2, &error) == -1);
+	assert(error == MCP_EINVAL);
+	assert(dispatch(&table, counts, &conn, "\x80\x80\x80\x80\x80\x01", 6,
+					&error) == -1);
+	assert(error == MCP_EOVERFLOW);
+
+	assert(counts[0x05] == 1 && counts[0x90] == 1 && counts[0xff] == 1);
+	assert(counts[0x100] == 1);
+	assert(conn.calls == 3);
+}
+
+/* a handshake changes the state of the connection */
+static int on_handshake(void *context, struct mcp_parse *buf)
+{
+	struct connection *conn = context;
+	mcp_varint_t next = mcp_varint(buf);
+
+	if (!mcp_ok(buf) || (next != MCP_STATE_STATUS && next != MCP_STATE_LOGIN))
+		return 1;
+
+	conn->state = next;
+	conn->calls++;
+	return 0;
+}
+
+static int on_login(void *context, struct mcp_parse *buf)
+{
+	(void)buf;
+	((struct connection *)context)->state = MCP_STATE_PLAY;
+	return 0;
+}
+
+static const mcp_handler_t handshake[] = {[0x00] = on_handshake};
+static const mcp_handler_t status[] = {[0x00] = on_other, [0x01] = on_value};
+static const mcp_handler_t login[] = {[0x00] = on_login};
+
+static const struct mcp_dispatch server[MCP_NUM_STATES] = {
+	[MCP_STATE_HANDSHAKE] = MCP_DISPATCH(handshake),
+	[MCP_STATE_STATUS] = MCP_DISPATCH(status),
+	[MCP_STATE_LOGIN] = MCP_DISPATCH(login),
+	[MCP_STATE_PLAY] = MCP_DISPATCH(large)
+};
+
+static void state_test(void)
+{
+	struct connection conn = {MCP_STATE_HANDSHAKE, 0, 0};
+	mcp_error_t error;
+
+	assert(dispatch(&server[conn.state], NULL, &conn, "\x00\x02", 2, &error) == 0);
+	assert(conn.state == MCP_STATE_LOGIN);
+
+	/* the same id has a different handler in each state */
+	assert(dispatch(&server[conn.state], NULL, &conn, "\x00", 1, &error) == 0);
+	assert(conn.state == MCP_STATE_PLAY);
+	assert(dispatch(&server[conn.state], NULL, &conn, "\x00", 1, &error) == -1);
+	assert(error == MCP_EINVAL);
+	assert(dispatch(&server[conn.state], NULL, &conn, "\x05\x09", 2, &error) == 0);
+	assert(conn.last == 9);
+
+	conn.state = MCP_STATE_HANDSHAKE;
+	assert(dispatch(&server[conn.state], NULL, &conn, "\x00\x01", 2, &error) == 0);
+	assert(conn.state == MCP_STATE_STATUS);
+	assert(dispatch(&server[conn.state], NULL, &conn, "\x01\x03", 2, &error) == 0);
+	assert(conn.last == 3);
+	assert(dispatch(&server[conn.state], NULL, &conn, "\x02", 1, &error) == -1);
+	assert(error == MCP_EINVAL);
+}
+
+#define NUM_TESTS		(3)
+static void (*tests[NUM_TESTS])(void) = {dispatch_test, large_test,
+										state_test};
+static const char *test_names[NUM_TESTS] = {"dispatch_test", "large_test",
+											"state_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -220,13 +220,164 @@ static void limit_test(void)
 	fbuf_free(&buf);
 }
 
-#define NUM_TESTS		(3)
+static void budget_test(void)
+{
+	struct fbuf_budget budget;
+	struct fbuf a = FBUF_INITIALIZER, b = FBUF_INITIALIZER;
+
+	fbuf_budget_init(&budget, 8000);
+	assert(fbuf_pressure(&budget) == FBUF_PRESSURE_NONE);
+
+	/* growing charges the budget */
+	assert(fbuf_set_budget(&a, &budget) == 0);
+	assert(fbuf_set_budget(&b, &budget) == 0);
+	assert(fbuf_expand(&a, 4096) >= 4096);
+	assert(fbuf_budget_used(&budget) == 4096);
+
+	/* past three quarters */
+	assert(fbuf_expand(&b, 2048) >= 2048);
+	assert(fbuf_budget_used(&budget) == 6144);
+	assert(fbuf_pressure(&budget) == FBUF_PRESSURE_SOFT);
+
+	/* near the limit, only what is requested is allocated */
+	assert(fbuf_expand(&b, 3000) == 3000);
+	assert(fbuf_budget_used(&budget) == 7096);
+	assert(fbuf_pressure(&budget) == FBUF_PRESSURE_HARD);
+
+	/* past the limit, expansion fails and nothing is charged */
+	assert(fbuf_wptr(&b, 4096) == NULL);
+	assert(fbuf_budget_used(&budget) == 7096);
+
+	/* shrinking and freeing refund it */
+	assert(!fbuf_shrink(&a, 1024));
+	assert(fbuf_budget_used(&budget) == 4024);
+	fbuf_free(&b);
+	assert(fbuf_budget_used(&budget) == 1024);
+	assert(fbuf_pressure(&budget) == FBUF_PRESSURE_NONE);
+
+	/* the budget is kept across fbuf_free */
+	assert(fbuf_expand(&b, 100) >= 100);
+	assert(fbuf_budget_used(&budget) == 1024 + b.size);
+
+	/* moving a block to another budget, or none */
+	assert(fbuf_set_budget(&b, NULL) == 0);
+	assert(fbuf_budget_used(&budget) == 1024);
+	assert(fbuf_set_budget(&b, &budget) == 0);
+	assert(fbuf_budget_used(&budget) == 1024 + b.size);
+
+	fbuf_free(&a);
+	fbuf_free(&b);
+	assert(fbuf_budget_used(&budget) == 0);
+}
+
+/* fills buf with size bytes of a pattern, starting at offset */
+static void pattern(struct fbuf *buf, size_t offset, size_t size)
+{
+	unsigned char *ptr = fbuf_wptr(buf, size);
+	size_t i;
+
+	assert(ptr != NULL);
+	for (i = 0; i < size; i++)
+		ptr[i] = (offset + i) * 7;
+	fbuf_produce(buf, size);
+}
+
+/* checks that buf holds the pattern, starting at offset */
+static void check_pattern(struct fbuf *buf, size_t offset)
+{
+	const unsigned char *ptr = fbuf_ptr(buf);
+	size_t i;
+
+	for (i = 0; i < fbuf_avail(buf); i++)
+		assert(ptr[i] == (unsigned char)((offset + i) * 7));
+}
+
+static void pages_test(void)
+{
+	struct fbuf_pages pages, other;
+	struct fbuf_budget budget;
+	struct fbuf a = FBUF_INITIALIZER, b = FBUF_INITIALIZER;
+	unsigned char *base;
+
+	fbuf_pages_init(&pages, 1 << 20, 4 * FBUF_HUGE_PAGE);
+	fbuf_pages_init(&other, 1 << 20, 4 * FBUF_HUGE_PAGE);
+	fbuf_budget_init(&budget, 64 * FBUF_HUGE_PAGE);
+	assert(fbuf_set_budget(&a, &budget) == 0);
+	assert(fbuf_set_pages(&a, &pages) == 0);
+
+	/* small buffers are not pooled */
+	pattern(&a, 0, 1000);
+	assert(a.size < (1 << 20));
+	assert(fbuf_set_pages(&a, &other) == 1);
+	assert(fbuf_set_pages(&a, &pages) == 0);
+
+	/* large ones are whole huge pages, and keep their data */
+	pattern(&a, 1000, 3000000);
+	assert(a.size == 2 * FBUF_HUGE_PAGE);
+	assert(fbuf_budget_used(&budget) == a.size);
+	check_pattern(&a, 0);
+
+	/* and are moved to a larger block as they grow */
+	fbuf_consume(&a, 1000000);
+	pattern(&a, 3001000, 3000000);
+	assert(a.size == 4 * FBUF_HUGE_PAGE);
+	assert(fbuf_budget_used(&budget) == a.size);
+	check_pattern(&a, 1000000);
+	assert(pages.cached == 2 * FBUF_HUGE_PAGE);
+
+	/* the smaller block is reused */
+	assert(fbuf_set_pages(&b, &pages) == 0);
+	pattern(&b, 0, 3000000);
+	assert(b.size == 2 * FBUF_HUGE_PAGE);
+	assert(pages.cached == 0);
+	base = a.base;
+	fbuf_free(&a);
+	assert(pages.cached == 4 * FBUF_HUGE_PAGE);
+	assert(fbuf_budget_used(&budget) == 0);
+	pattern(&a, 0, 5000000);
+	assert(a.base == base && a.size == 4 * FBUF_HUGE_PAGE);
+	check_pattern(&a, 0);
+
+	/* max_size clamps the size, but not the block */
+	fbuf_consume(&a, fbuf_avail(&a));
+	assert(fbuf_shrink(&a, 3 * FBUF_HUGE_PAGE + 5) == 0);
+	assert(a.size == 3 * FBUF_HUGE_PAGE + 5);
+	pattern(&a, 0, 3 * FBUF_HUGE_PAGE);
+	check_pattern(&a, 0);
+	assert(fbuf_budget_used(&budget) == a.size);
+
+	/* shrinking moves the data to a smaller block, or out of the pool */
+	fbuf_consume(&a, fbuf_avail(&a) - 100000);
+	assert(fbuf_shrink(&a, FBUF_HUGE_PAGE) == 0);
+	assert(a.size == FBUF_HUGE_PAGE);
+	check_pattern(&a, 3 * FBUF_HUGE_PAGE - 100000);
+	assert(fbuf_shrink(&a, 200000) == 0);
+	assert(a.size == 200000);
+	check_pattern(&a, 3 * FBUF_HUGE_PAGE - 100000);
+	assert(fbuf_budget_used(&budget) == a.size);
+
+	/* blocks past max_cached are unmapped */
+	fbuf_free(&b);
+	assert(pages.cached == 4 * FBUF_HUGE_PAGE);
+	fbuf_pages_free(&pages);
+	assert(pages.cached == 0 && pages.free == NULL);
+
+	fbuf_free(&a);
+	assert(fbuf_budget_used(&budget) == 0);
+	fbuf_pages_free(&other);
+}
+
+#define NUM_TESTS		(5)
 static void (*tests[NUM_TESTS])(void) = {simple_test,
 										random_test,
-										limit_test};
+										limit_test,
+										budget_test,
+										pages_test};
 static const char *test_names[NUM_TESTS] = {"simple_test",
 											"random_test",
-											"limit_test"};
+											"limit_test",
+											"budget_test",
+											"pages_test"};
 
 static int print_usage();
 
@@ -0,0 +1,285 @@
+/* intern_test.c - tests of the interned string table
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for pthreads */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/intern.h>
+
+static uint32_t add(struct mcp_intern *table, const char *name)
+{
+	return mcp_intern_add(table, name, strlen(name));
+}
+
+static uint32_t find(struct mcp_intern *table, const char *name)
+{
+	return mcp_intern_find(table, name, strlen(name));
+}
+
+static void intern_test(void)
+{
+	struct mcp_intern *table = mcp_intern_new(1000);
+	char name[64], big[2000];
+	const char *copy;
+	size_t size = 0;
+	uint32_t i;
+
+	assert(table != NULL);
+	assert(mcp_intern_count(table) == 0);
+	assert(find(table, "minecraft:stone") == MCP_INTERN_NONE);
+
+	/* ids are given out in order, and are stable */
+	assert(add(table, "minecraft:air") == 0);
+	assert(add(table, "minecraft:stone") == 1);
+	assert(add(table, "minecraft:air") == 0);
+	assert(add(table, "") == 2);
+	assert(find(table, "minecraft:stone") == 1);
+	assert(find(table, "") == 2);
+	assert(find(table, "minecraft:ston") == MCP_INTERN_NONE);
+	assert(find(table, "minecraft:stone ") == MCP_INTERN_NONE);
+	assert(mcp_intern_count(table) == 3);
+
+	/* the canonical copies are NUL-terminated */
+	copy = mcp_intern_name(table, 1, &size);
+	assert(size == 15 && strcmp(copy, "minecraft:stone") == 0);
+	assert(mcp_intern_name(table, 1, NULL) == copy);
+	assert(mcp_intern_name(table, 3, &size) == NULL);
+	assert(mcp_intern_name(table, MCP_INTERN_NONE, &size) == NULL);
+
+	/* names that differ only in their last bytes */
+	for (i = 3; i < 900; i++) {
+		sprintf(name, "minecraft:block_%u", (unsigned)i);
+		assert(add(table, name) == i);
+	}
+
+	/* a name larger than a chunk */
+	memset(big, 'x', sizeof(big));
+	assert(mcp_intern_add(table, big, sizeof(big)) == 900);
+	assert(mcp_intern_find(table, big, sizeof(big)) == 900);
+	assert(mcp_intern_find(table, big, sizeof(big) - 1) == MCP_INTERN_NONE);
+
+	/* the earlier copies did not move */
+	assert(mcp_intern_name(table, 1, NULL) == copy);
+	for (i = 3; i < 900; i++) {
+		sprintf(name, "minecraft:block_%u", (unsigned)i);
+		assert(find(table, name) == i);
+		assert(strcmp(mcp_intern_name(table, i, NULL), name) == 0);
+	}
+
+	/* invalid utf-8 is not added */
+	assert(add(table, "minecraft:\xc0\x80") == MCP_INTERN_NONE);
+	assert(mcp_intern_count(table) == 901);
+
+	/* the table is full */
+	for (i = 901; i < 1000; i++) {
+		sprintf(name, "minecraft:item_%u", (unsigned)i);
+		assert(add(table, name) == i);
+	}
+	assert(add(table, "minecraft:one_more") == MCP_INTERN_NONE);
+	assert(add(table, "minecraft:stone") == 1);
+	assert(mcp_intern_count(table) == 1000);
+
+	mcp_intern_free(table);
+	mcp_intern_free(NULL);
+
+	/* strings of every size up to a few words, each differing from the
+	 * last in a single byte */
+	table = mcp_intern_new(1000);
+	memset(big, 'a', sizeof(big));
+	for (size = 0; size < 30; size++) {
+		assert(mcp_intern_add(table, big, size) != MCP_INTERN_NONE);
+		for (i = 0; i < size; i++) {
+			big[i] = 'b';
+			assert(mcp_intern_find(table, big, size) == MCP_INTERN_NONE);
+			assert(mcp_intern_add(table, big, size) != MCP_INTERN_NONE);
+			big[i] = 'a';
+		}
+	}
+	assert(mcp_intern_count(table) == 30 + 29 * 30 / 2);
+	for (size = 0; size < 30; size++) {
+		for (i = 0; i < size; i++) {
+			big[i] = 'b';
+			copy = mcp_intern_name(table, mcp_intern_find(table, big, size),
+									NULL);
+			assert(copy != NULL && memcmp(copy, big, size) == 0);
+			big[i] = 'a';
+		}
+	}
+	mcp_intern_free(table);
+
+	/* an empty table */
+	table = mcp_intern_new(0);
+	assert(table != NULL);
+	assert(add(table, "a") == MCP_INTERN_NONE);
+	assert(find(table, "a") == MCP_INTERN_NONE);
+	mcp_intern_free(table);
+}
+
+static void parse_test(void)
+{
+	struct mcp_intern *table = mcp_intern_new(16);
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	const char *value;
+	size_t size;
+
+	assert(add(table, "minecraft:brand") == 0);
+	assert(add(table, "minecraft:register") == 1);
+
+	assert(mcg_string(&buf, "minecraft:register") == 0);
+	assert(mcg_string(&buf, "mymod:channel") == 0);
+	assert(mcg_string(&buf, "minecraft:brand") == 0);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_intern_parse(&parse, table, &value, &size) == 1);
+	assert(value == (const char *)fbuf_ptr(&buf) + 1 && size == 18);
+
+	/* unknown strings are consumed, and can be added */
+	assert(mcp_intern_parse(&parse, table, &value, &size) == MCP_INTERN_NONE);
+	assert(mcp_ok(&parse));
+	assert(size == 13 && memcmp(value, "mymod:channel", 13) == 0);
+	assert(mcp_intern_add(table, value, size) == 2);
+
+	assert(mcp_intern_parse(&parse, table, &value, &size) == 0);
+	assert(mcp_ok(&parse) && mcp_eof(&parse));
+
+	/* errors */
+	mcp_start(&parse, fbuf_ptr(&buf), 5);
+	assert(mcp_intern_parse(&parse, table, &value, &size) == MCP_INTERN_NONE);
+	assert(mcp_error(&parse) == MCP_EAGAIN);
+
+	fbuf_free(&buf);
+	mcp_intern_free(table);
+}
+
+#define NUM_NAMES		(4000)
+#define NUM_READERS		(3)
+
+static struct mcp_intern *shared;
+
+static void *reader(void *arg)
+{
+	char name[64];
+	size_t i, found = 0;
+	uint32_t id;
+	const char *copy;
+
+	(void)arg;
+
+	/* every id seen maps back to its name */
+	while (found < NUM_NAMES) {
+		found = 0;
+		for (i = 0; i < NUM_NAMES; i++) {
+			sprintf(name, "mod:name_%u", (unsigned)i);
+			id = find(shared, name);
+			if (id == MCP_INTERN_NONE)
+				continue;
+			copy = mcp_intern_name(shared, id, NULL);
+			assert(copy != NULL && strcmp(copy, name) == 0);
+			found++;
+		}
+	}
+
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	char name[64];
+	size_t i;
+
+	/* two writers add the same names */
+	for (i = 0; i < NUM_NAMES; i++) {
+		sprintf(name, "mod:name_%u", (unsigned)(arg ? i : NUM_NAMES - 1 - i));
+		assert(add(shared, name) != MCP_INTERN_NONE);
+	}
+
+	return NULL;
+}
+
+static void threads_test(void)
+{
+	pthread_t readers[NUM_READERS], writers[2];
+	size_t i;
+
+	shared = mcp_intern_new(NUM_NAMES);
+	assert(shared != NULL);
+
+	for (i = 0; i < NUM_READERS; i++)
+		assert(pthread_create(&readers[i], NULL, reader, NULL) == 0);
+	assert(pthread_create(&writers[0], NULL, writer, NULL) == 0);
+	assert(pthread_create(&writers[1], NULL, writer, shared) == 0);
+
+	for (i = 0; i < 2; i++)
+		assert(pthread_join(writers[i], NULL) == 0);
+	for (i = 0; i < NUM_READERS; i++)
+		assert(pthread_join(readers[i], NULL) == 0);
+
+	/* no name was added twice */
+	assert(mcp_intern_count(shared) == NUM_NAMES);
+
+	mcp_intern_free(shared);
+}
+
+#define NUM_TESTS		(3)
+static void (*tests[NUM_TESTS])(void) = {intern_test, parse_test,
+										threads_test};
+static const char *test_names[NUM_TESTS] = {"intern_test", "parse_test",
+											"threads_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
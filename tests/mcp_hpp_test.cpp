@@ -0,0 +1,251 @@
+/* mcp_hpp_test.cpp - tests of the C++ packet layouts
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <cassert>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/mcp.hpp>
+
+/* entity, x, y, z, yaw, pitch, on ground */
+typedef mcp::layout<mcp::varint, mcp::double_, mcp::double_, mcp::double_,
+					mcp::ubyte, mcp::ubyte, mcp::bool_> move;
+
+/* message, position */
+typedef mcp::layout<mcp::string<256>, mcp::byte> chat;
+
+/* every kind of field, nested */
+typedef mcp::layout<mcp::varlong, mcp::svarint, mcp::svarlong, mcp::short_,
+					mcp::int_, mcp::long_, mcp::float_, mcp::uint, mcp::ushort,
+					mcp::array<mcp::string<16>, 4>,
+					mcp::fixed_array<mcp::int_, 3>,
+					mcp::layout<mcp::ulong, mcp::bytes<8>>> everything;
+
+/* the sizes are known at compile time */
+static_assert(move::fixed_size == 0, "move has a varint");
+static_assert(move::max_size == 5 + 3 * 8 + 3, "move max size");
+static_assert(chat::max_size == 2 + 256 + 1, "chat max size");
+static_assert(mcp::layout<mcp::int_, mcp::double_>::fixed_size == 12,
+				"fixed layout size");
+static_assert(mcp::fixed_array<mcp::ushort, 4>::fixed_size == 8,
+				"fixed array size");
+static_assert(mcp::array<mcp::varint, 200>::max_size == 2 + 200 * 5,
+				"array max size");
+
+static void round_trip_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		fbuf_clear(&buf);
+
+		/* C++ written, C parsed */
+		assert(move::write(buf, 1000 + i, i * 0.5, 64, -i * 0.5, i, 255 - i,
+							i & 1) == 0);
+		mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+		assert(mcp_varint(&parse) == (mcp_varint_t)(1000 + i));
+		assert(mcp_double(&parse) == i * 0.5);
+		assert(mcp_double(&parse) == 64);
+		assert(mcp_double(&parse) == -i * 0.5);
+		assert(mcp_ubyte(&parse) == i);
+		assert(mcp_ubyte(&parse) == 255 - i);
+		assert(mcp_bool(&parse) == (i & 1));
+		assert(mcp_ok(&parse) && mcp_eof(&parse));
+
+		/* C++ parsed */
+		mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+		move::value_type value = move::parse(parse);
+		assert(mcp_ok(&parse) && mcp_eof(&parse));
+		assert(std::get<0>(value) == (mcp_varint_t)(1000 + i));
+		assert(std::get<3>(value) == -i * 0.5);
+		assert(std::get<5>(value) == 255 - i);
+		assert(std::get<6>(value) == (bool)(i & 1));
+	}
+
+	/* C written, C++ parsed */
+	fbuf_clear(&buf);
+	assert(mcg_string(&buf, "hello") == 0);
+	assert(mcg_byte(&buf, -2) == 0);
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	chat::value_type message = chat::parse(parse);
+	assert(mcp_ok(&parse) && mcp_eof(&parse));
+	assert(std::get<0>(message) == "hello");
+	assert(std::get<1>(message) == -2);
+
+	/* every kind of field, against the C generators */
+	everything::value_type value(-1, -5, -(1LL << 40), -300, -70000, -(1LL << 50),
+			1.5f, 0xdeadbeef, 0xbeef, {"a", "bc", ""}, {{1, -2, 3}},
+			std::make_tuple(7, "xyz"));
+	fbuf_clear(&buf);
+	assert(everything::write(buf, value) == 0);
+
+	struct fbuf expect = FBUF_INITIALIZER;
+	int ret = mcg_varlong(&expect, -1) ||
+			mcg_svarint(&expect, -5) ||
+			mcg_svarlong(&expect, -(1LL << 40)) ||
+			mcg_short(&expect, -300) ||
+			mcg_int(&expect, -70000) ||
+			mcg_long(&expect, -(1LL << 50)) ||
+			mcg_float(&expect, 1.5f) ||
+			mcg_uint(&expect, 0xdeadbeef) ||
+			mcg_ushort(&expect, 0xbeef) ||
+			mcg_varint(&expect, 3) ||
+			mcg_string(&expect, "a") ||
+			mcg_string(&expect, "bc") ||
+			mcg_string(&expect, "") ||
+			mcg_int(&expect, 1) ||
+			mcg_int(&expect, -2) ||
+			mcg_int(&expect, 3) ||
+			mcg_ulong(&expect, 7) ||
+			mcg_string(&expect, "xyz");
+	assert(ret == 0);
+	assert(fbuf_avail(&buf) == fbuf_avail(&expect));
+	assert(memcmp(fbuf_ptr(&buf), fbuf_ptr(&expect), fbuf_avail(&buf)) == 0);
+	assert(everything::size(value) == fbuf_avail(&buf));
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(everything::parse(parse) == value);
+	assert(mcp_ok(&parse) && mcp_eof(&parse));
+
+	/* the reader and writer wrappers */
+	fbuf_clear(&buf);
+	mcp::writer writer(buf);
+	writer.write<chat>("hi", 1).write<move>(1, 2, 3, 4, 5, 6, true);
+	assert(writer.ok());
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	mcp::reader reader(parse);
+	assert(std::get<0>(reader.read<chat>()) == "hi");
+	assert(std::get<6>(reader.read<move>()) == true);
+	assert(reader.ok() && mcp_eof(&parse));
+
+	fbuf_free(&expect);
+	fbuf_free(&buf);
+}
+
+static void error_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	size_t i, size;
+
+	assert(move::write(buf, 1, 2, 3, 4, 5, 6, true) == 0);
+	size = fbuf_avail(&buf);
+
+	/* every truncation fails with MCP_EAGAIN, without reading past it */
+	for (i = 0; i < size; i++) {
+		mcp_start(&parse, fbuf_ptr(&buf), i);
+		move::parse(parse);
+		assert(mcp_error(&parse) == MCP_EAGAIN);
+	}
+
+	/* errors pass through */
+	mcp_start(&parse, fbuf_ptr(&buf), size);
+	parse.error = MCP_EINVAL;
+	move::parse(parse);
+	assert(mcp_error(&parse) == MCP_EINVAL);
+
+	/* values too large to encode are not written */
+	fbuf_clear(&buf);
+	std::string longer(257, 'a');
+	assert(chat::write(buf, longer, 0) != 0);
+	assert(fbuf_avail(&buf) == 0);
+	assert((mcp::layout<mcp::array<mcp::varint, 2>>::write(buf,
+			std::vector<mcp_varint_t>{1, 2, 3}) != 0));
+	assert(fbuf_avail(&buf) == 0);
+
+	/* and values too large are rejected when parsed */
+	assert(mcg_string(&buf, longer.c_str()) == 0);
+	assert(mcg_byte(&buf, 0) == 0);
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	chat::parse(parse);
+	assert(mcp_error(&parse) == MCP_EOVERFLOW);
+
+	/* a bogus array count does not allocate */
+	fbuf_clear(&buf);
+	assert(mcg_varint(&buf, 1000000) == 0);
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	mcp::layout<mcp::array<mcp::long_, 10000000>>::parse(parse);
+	assert(mcp_error(&parse) == MCP_EAGAIN);
+
+	/* a buffer that can not hold the largest encoding, but holds this one */
+	fbuf_free(&buf);
+	fbuf_init(&buf, move::max_size - 1);
+	assert(move::write(buf, 1, 2, 3, 4, 5, 6, true) == 0);
+	assert(fbuf_avail(&buf) == 28);
+
+	/* and one that can not hold this one either */
+	fbuf_free(&buf);
+	fbuf_init(&buf, 27);
+	assert(move::write(buf, 1, 2, 3, 4, 5, 6, true) != 0);
+	assert(fbuf_avail(&buf) == 0);
+
+	/* large layouts reserve only what each packet needs */
+	typedef mcp::layout<mcp::string<32767>> big;
+	static_assert(big::max_size > MCP_HPP_RESERVE_MAX, "big is not big");
+	fbuf_free(&buf);
+	fbuf_init(&buf, 16);
+	assert(big::write(buf, "short") == 0);
+	assert(fbuf_avail(&buf) == 6);
+
+	fbuf_free(&buf);
+}
+
+#define NUM_TESTS		(2)
+static void (*tests[NUM_TESTS])(void) = {round_trip_test, error_test};
+static const char *test_names[NUM_TESTS] = {"round_trip_test", "error_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -170,7 +170,7 @@ static void simple_test(void)
 	assert(mcp_svarlong(&buf) == -1);
 	assert(mcp_svarlong(&buf) == (-0x7fffffffffffffffLL-1));
 
-	size_t szb, szc;
+	size_t szb = 0, szc = 0;
 	const void *testa = mcp_raw(&buf, 4),
 			*testb = mcp_bytes(&buf, &szb),
 			*testc = mcp_bytes(&buf, &szc);
@@ -246,9 +246,122 @@ static void copy_test(void)
 	assert(mcp_eof(&buf));
 }
 
+static void skip_test(void)
+{
+	static const unsigned char padded[] = {0x81, 0x80, 0x80, 0x80, 0x80,
+											0x80, 0x80, 0x80, 0x80, 0x00};
+	unsigned char data[512];
+	struct fbuf out;
+	struct mcp_parse buf, expect;
+	unsigned int seed = 7;
+	size_t i, j, k, count, size;
+
+	/* varints of random lengths at every alignment */
+	fbuf_init(&out, FBUF_MAX);
+	for (i = 0; i < 300; i++) {
+		seed = seed * 1103515245 + 12345;
+		j = (seed >> 16) % 10;
+		assert(mcg_varlong(&out, j == 0 ? 0 : (uint64_t)1 << (7 * j - 1)) == 0);
+		if (i % 37 == 0)
+			assert(mcg_raw(&out, padded, sizeof(padded)) == 0);
+	}
+	count = 300 + 9;
+
+	for (i = 0; i < 8; i++) {
+		for (k = 0; k <= count; k += 1 + k / 4) {
+			mcp_start(&expect, fbuf_ptr(&out), fbuf_avail(&out));
+			for (j = 0; j < i + k; j++)
+				mcp_varlong(&expect);
+			assert(mcp_ok(&expect));
+
+			mcp_start(&buf, fbuf_ptr(&out), fbuf_avail(&out));
+			for (j = 0; j < i; j++)
+				mcp_skip_varint(&buf);
+			mcp_skip_varints(&buf, k);
+			assert(mcp_ok(&buf));
+			assert(mcp_consumed(&buf) == mcp_consumed(&expect));
+		}
+	}
+
+	/* one varint too many */
+	mcp_start(&buf, fbuf_ptr(&out), fbuf_avail(&out));
+	mcp_skip_varints(&buf, count + 1);
+	assert(mcp_error(&buf) == MCP_EAGAIN);
+	assert(mcp_consumed(&buf) == 0);
+	fbuf_free(&out);
+
+	/* a varint of eleven bytes, cut short and not, at every alignment */
+	for (i = 0; i < 16; i++) {
+		memset(data, 0x01, sizeof(data));
+		memset(data + i, 0x80, 10);
+
+		for (size = i; size < i + 20; size++) {
+			mcp_start(&buf, data, size);
+			mcp_skip_varints(&buf, i + 1);
+			assert(mcp_error(&buf) == (size < i + 10 ? MCP_EAGAIN : MCP_EOVERFLOW));
+
+			mcp_start(&buf, data, size);
+			mcp_skip_varints(&buf, i);
+			assert(mcp_ok(&buf) && mcp_consumed(&buf) == i);
+		}
+
+		/* ten bytes is the longest varint */
+		data[i + 9] = 0x01;
+		mcp_start(&buf, data, sizeof(data));
+		mcp_skip_varints(&buf, i + 2);
+		assert(mcp_ok(&buf) && mcp_consumed(&buf) == i + 11);
+	}
+
+	/* errors pass through */
+	mcp_start(&buf, data, sizeof(data));
+	buf.error = MCP_EINVAL;
+	mcp_skip_varints(&buf, 1);
+	mcp_skip_bytes(&buf);
+	mcp_skip_fixed(&buf, 1, 1);
+	assert(mcp_error(&buf) == MCP_EINVAL && mcp_consumed(&buf) == 0);
+
+	/* bytes and fixed width values */
+	fbuf_init(&out, FBUF_MAX);
+	assert(mcg_string(&out, "minecraft:brand") == 0);
+	assert(mcg_bytes(&out, data, 300) == 0);
+	assert(mcg_double(&out, 1) == 0);
+	assert(mcg_double(&out, 2) == 0);
+	assert(mcg_double(&out, 3) == 0);
+	assert(mcg_int(&out, 4) == 0);
+
+	mcp_start(&buf, fbuf_ptr(&out), fbuf_avail(&out));
+	mcp_skip_bytes(&buf);
+	assert(mcp_consumed(&buf) == 16);
+	mcp_skip_bytes(&buf);
+	mcp_skip_fixed(&buf, 8, 3);
+	assert(mcp_int(&buf) == 4);
+	assert(mcp_ok(&buf) && mcp_eof(&buf));
+
+	mcp_start(&buf, fbuf_ptr(&out), fbuf_avail(&out) - 1);
+	mcp_skip_bytes(&buf);
+	mcp_skip_bytes(&buf);
+	mcp_skip_fixed(&buf, 8, 3);
+	mcp_skip_fixed(&buf, 4, 1);
+	assert(mcp_error(&buf) == MCP_EAGAIN);
+
+	mcp_start(&buf, fbuf_ptr(&out), fbuf_avail(&out));
+	mcp_skip_fixed(&buf, (size_t)1 << (sizeof(size_t) * 4),
+					(size_t)1 << (sizeof(size_t) * 4));
+	assert(mcp_error(&buf) == MCP_EOVERFLOW);
+
+	fbuf_clear(&out);
+	assert(mcg_varlong(&out, (uint64_t)MCP_BYTES_MAX_SIZE + 1) == 0);
+	mcp_start(&buf, fbuf_ptr(&out), fbuf_avail(&out));
+	mcp_skip_bytes(&buf);
+	assert(mcp_error(&buf) == MCP_EOVERFLOW);
+
+	fbuf_free(&out);
+}
+
 #define NUM_TESTS		(4)
-static void (*tests[NUM_TESTS])(void) = {simple_test, copy_test};
-static const char *test_names[NUM_TESTS] = {"simple_test", "copy_test"};
+static void (*tests[NUM_TESTS])(void) = {simple_test, copy_test, skip_test};
+static const char *test_names[NUM_TESTS] = {"simple_test", "copy_test",
+											"skip_test"};
 
 static int print_usage();
 
@@ -0,0 +1,312 @@
+/* nbt_test.c - tests of the lazy nbt accessors
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/nbt.h>
+
+static int tag(struct fbuf *buf, enum mcp_nbt_tag type, const char *name)
+{
+	int ret = 0;
+	ret |= mcg_ubyte(buf, type);
+	ret |= mcg_ushort(buf, strlen(name));
+	ret |= mcg_raw(buf, name, strlen(name));
+	return ret;
+}
+
+/* builds an item-like compound, with a large nested subtree before the
+ * interesting keys so that finding them has to skip it */
+static int item(struct fbuf *buf)
+{
+	int ret = 0, i;
+
+	ret |= tag(buf, MCP_NBT_COMPOUND, "");
+
+	ret |= tag(buf, MCP_NBT_COMPOUND, "tag");
+	ret |= tag(buf, MCP_NBT_LIST, "Enchantments");
+	ret |= mcg_ubyte(buf, MCP_NBT_COMPOUND);
+	ret |= mcg_int(buf, 3);
+	for (i = 0; i < 3; i++) {
+		ret |= tag(buf, MCP_NBT_STRING, "id");
+		ret |= mcg_ushort(buf, 9);
+		ret |= mcg_raw(buf, "sharpness", 9);
+		ret |= tag(buf, MCP_NBT_SHORT, "lvl");
+		ret |= mcg_short(buf, i);
+		ret |= mcg_ubyte(buf, MCP_NBT_END);
+	}
+	ret |= tag(buf, MCP_NBT_LIST, "Lore");
+	ret |= mcg_ubyte(buf, MCP_NBT_STRING);
+	ret |= mcg_int(buf, 2);
+	ret |= mcg_ushort(buf, 1);
+	ret |= mcg_raw(buf, "a", 1);
+	ret |= mcg_ushort(buf, 2);
+	ret |= mcg_raw(buf, "bc", 2);
+	ret |= tag(buf, MCP_NBT_LIST, "Pos");
+	ret |= mcg_ubyte(buf, MCP_NBT_DOUBLE);
+	ret |= mcg_int(buf, 3);
+	ret |= mcg_double(buf, 1.0);
+	ret |= mcg_double(buf, 2.0);
+	ret |= mcg_double(buf, 3.0);
+	ret |= tag(buf, MCP_NBT_LONG_ARRAY, "BlockStates");
+	ret |= mcg_int(buf, 4);
+	for (i = 0; i < 4; i++)
+		ret |= mcg_long(buf, i);
+	ret |= tag(buf, MCP_NBT_BYTE_ARRAY, "Light");
+	ret |= mcg_int(buf, 3);
+	ret |= mcg_raw(buf, "xyz", 3);
+	ret |= tag(buf, MCP_NBT_INT_ARRAY, "UUID");
+	ret |= mcg_int(buf, 4);
+	for (i = 0; i < 4; i++)
+		ret |= mcg_int(buf, i);
+	ret |= tag(buf, MCP_NBT_LIST, "Empty");
+	ret |= mcg_ubyte(buf, MCP_NBT_END);
+	ret |= mcg_int(buf, 0);
+	ret |= mcg_ubyte(buf, MCP_NBT_END);
+
+	ret |= tag(buf, MCP_NBT_STRING, "id");
+	ret |= mcg_ushort(buf, 18);
+	ret |= mcg_raw(buf, "minecraft:iron_axe", 18);
+	ret |= tag(buf, MCP_NBT_BYTE, "Count");
+	ret |= mcg_byte(buf, 7);
+	ret |= tag(buf, MCP_NBT_FLOAT, "Damage");
+	ret |= mcg_float(buf, 0.5f);
+
+	ret |= mcg_ubyte(buf, MCP_NBT_END);
+	return ret;
+}
+
+static void skip_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	const char *name;
+	size_t name_len;
+
+	assert(item(&buf) == 0);
+	assert(mcg_uint(&buf, 0xdeadbeef) == 0);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_nbt_header(&parse, &name, &name_len) == MCP_NBT_COMPOUND);
+	assert(name_len == 0);
+	mcp_nbt_skip(&parse, MCP_NBT_COMPOUND);
+
+	/* the skip should land exactly after the root compound */
+	assert(mcp_uint(&parse) == 0xdeadbeef);
+	assert(mcp_ok(&parse));
+	assert(mcp_eof(&parse));
+
+	fbuf_free(&buf);
+}
+
+static void find_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse, saved;
+	const char *name;
+	size_t name_len, size;
+	const void *value;
+
+	assert(item(&buf) == 0);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_nbt_header(&parse, &name, &name_len) == MCP_NBT_COMPOUND);
+	saved = parse;
+
+	/* find skips the nested subtree to get to the id */
+	assert(mcp_nbt_find(&parse, "id", 2) == MCP_NBT_STRING);
+	size = mcp_ushort(&parse);
+	value = mcp_raw(&parse, size);
+	assert(size == 18 && memcmp(value, "minecraft:iron_axe", 18) == 0);
+
+	/* and continues from where it left off */
+	assert(mcp_nbt_find(&parse, "Count", 5) == MCP_NBT_BYTE);
+	assert(mcp_byte(&parse) == 7);
+	assert(mcp_ok(&parse));
+
+	/* keys behind the current position are not found */
+	assert(mcp_nbt_find(&parse, "tag", 3) == MCP_NBT_END);
+	assert(mcp_ok(&parse));
+	assert(mcp_eof(&parse));
+
+	/* nested keys are found by descending into the compound */
+	parse = saved;
+	assert(mcp_nbt_find(&parse, "tag", 3) == MCP_NBT_COMPOUND);
+	assert(mcp_nbt_find(&parse, "Pos", 3) == MCP_NBT_LIST);
+	assert(mcp_ubyte(&parse) == MCP_NBT_DOUBLE);
+	assert(mcp_int(&parse) == 3);
+	assert(mcp_double(&parse) == 1.0);
+	assert(mcp_ok(&parse));
+
+	fbuf_free(&buf);
+}
+
+static void index_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse, value;
+	struct mcp_nbt_index idx;
+	char key[16];
+	const char *name;
+	size_t name_len;
+	int i, keys = MCP_NBT_INDEX_SLOTS;
+
+	assert(item(&buf) == 0);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_nbt_header(&parse, &name, &name_len) == MCP_NBT_COMPOUND);
+	mcp_nbt_index(&idx, &parse);
+	assert(mcp_ok(&parse));
+	assert(mcp_eof(&parse));
+	assert(idx.complete);
+	assert(idx.count == 4);
+
+	/* lookups work in any order */
+	assert(mcp_nbt_lookup(&idx, &value, "Count", 5) == MCP_NBT_BYTE);
+	assert(mcp_byte(&value) == 7);
+	assert(mcp_nbt_lookup(&idx, &value, "Damage", 6) == MCP_NBT_FLOAT);
+	assert(mcp_float(&value) == 0.5f);
+	assert(mcp_nbt_lookup(&idx, &value, "id", 2) == MCP_NBT_STRING);
+	assert(mcp_ushort(&value) == 18);
+	assert(mcp_nbt_lookup(&idx, &value, "lvl", 3) == MCP_NBT_END);
+	assert(mcp_ok(&value));
+
+	/* a compound with more keys than the index can hold */
+	fbuf_clear(&buf);
+	for (i = 0; i < keys; i++) {
+		sprintf(key, "key%i", i);
+		assert(tag(&buf, MCP_NBT_INT, key) == 0);
+		assert(mcg_int(&buf, i * 3) == 0);
+	}
+	assert(mcg_ubyte(&buf, MCP_NBT_END) == 0);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	mcp_nbt_index(&idx, &parse);
+	assert(mcp_ok(&parse));
+	assert(mcp_eof(&parse));
+	assert(!idx.complete);
+	assert(idx.count == MCP_NBT_INDEX_SLOTS / 2);
+
+	/* keys that did not fit are still found */
+	for (i = keys - 1; i >= 0; i--) {
+		sprintf(key, "key%i", i);
+		assert(mcp_nbt_lookup(&idx, &value, key, strlen(key)) == MCP_NBT_INT);
+		assert(mcp_int(&value) == i * 3);
+		assert(mcp_ok(&value));
+	}
+	assert(mcp_nbt_lookup(&idx, &value, "nope", 4) == MCP_NBT_END);
+	assert(mcp_ok(&value));
+
+	fbuf_free(&buf);
+}
+
+static void error_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	const unsigned char bad_tag[] = {0x0d, 0x00, 0x00};
+	const unsigned char end_list[] = {0x00, 0x00, 0x00, 0x00, 0x01};
+	const unsigned char negative[] = {0xff, 0xff, 0xff, 0xff};
+	const char *name;
+	size_t name_len;
+	int i;
+
+	/* unknown tag ids are invalid */
+	mcp_start(&parse, bad_tag, sizeof(bad_tag));
+	assert(mcp_nbt_header(&parse, &name, &name_len) == MCP_NBT_END);
+	assert(mcp_error(&parse) == MCP_EINVAL);
+
+	/* lists of end tags have no payload */
+	mcp_start(&parse, end_list, sizeof(end_list));
+	mcp_nbt_skip(&parse, MCP_NBT_LIST);
+	assert(mcp_ok(&parse));
+	assert(mcp_eof(&parse));
+	mcp_start(&parse, end_list, 1);
+	mcp_nbt_skip(&parse, MCP_NBT_LIST);
+	assert(mcp_error(&parse) == MCP_EAGAIN);
+
+	/* negative array lengths are invalid */
+	mcp_start(&parse, negative, sizeof(negative));
+	mcp_nbt_skip(&parse, MCP_NBT_LONG_ARRAY);
+	assert(mcp_error(&parse) == MCP_EINVAL);
+
+	/* truncated blobs ask for more data */
+	assert(item(&buf) == 0);
+	for (i = 0; i < (int)fbuf_avail(&buf); i++) {
+		mcp_start(&parse, fbuf_ptr(&buf), i);
+		mcp_nbt_header(&parse, &name, &name_len);
+		mcp_nbt_skip(&parse, MCP_NBT_COMPOUND);
+		assert(mcp_error(&parse) == MCP_EAGAIN);
+	}
+
+	/* too deeply nested lists are rejected */
+	fbuf_clear(&buf);
+	for (i = 0; i <= MCP_NBT_MAX_DEPTH; i++) {
+		assert(mcg_ubyte(&buf, MCP_NBT_LIST) == 0);
+		assert(mcg_int(&buf, 1) == 0);
+	}
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	mcp_nbt_skip(&parse, MCP_NBT_LIST);
+	assert(mcp_error(&parse) == MCP_EOVERFLOW);
+
+	fbuf_free(&buf);
+}
+
+#define NUM_TESTS		(4)
+static void (*tests[NUM_TESTS])(void) = {skip_test, find_test, index_test,
+										error_test};
+static const char *test_names[NUM_TESTS] = {"skip_test", "find_test",
+											"index_test", "error_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
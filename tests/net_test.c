@@ -0,0 +1,840 @@
+/* net_test.c - tests of the connection engine over loopback
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for nanosleep and clock_gettime */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/net.h>
+#include <mcp_base/packet.h>
+#include <mcp_base/capture.h>
+#include <mcp_base/numa.h>
+
+#define NUM_CONNS			(8)
+#define NUM_FRAMES			(200)
+#define PIPELINE			(4)
+/* frames sent at once by the coalescing tests */
+#define BURST				(16)
+
+/* frame sizes cycle through these, some larger than a single read */
+static const size_t frame_sizes[] = {0, 1, 127, 128, 3000, 70000};
+#define NUM_SIZES			(sizeof(frame_sizes) / sizeof(frame_sizes[0]))
+
+static int opened, closed, done, failures;
+
+struct client {
+	int sent, received;
+};
+
+static void count(int *counter)
+{
+	__atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST);
+}
+
+/* waits up to ten seconds for counter to reach target */
+static int wait_for(int *counter, int target)
+{
+	struct timespec ms = {0, 1000000};
+	int i;
+
+	for (i = 0; i < 10000; i++) {
+		if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) >= target)
+			return 1;
+		nanosleep(&ms, NULL);
+	}
+
+	return 0;
+}
+
+static void reset(void)
+{
+	opened = closed = done = failures = 0;
+}
+
+static void send_frame(struct mcp_conn *conn, int k)
+{
+	static unsigned char data[70000];
+	size_t i, size = frame_sizes[k % NUM_SIZES];
+
+	for (i = 0; i < size; i++)
+		data[i] = (k + i) & 0xff;
+
+	if (mcp_conn_send(conn, data, size))
+		count(&failures);
+}
+
+static void echo_frame(struct mcp_conn *conn, struct mcp_parse *frame, void *user)
+{
+	(void)user;
+	if (mcp_conn_send(conn, mcp_ptr(frame), mcp_avail(frame)))
+		count(&failures);
+}
+
+static void server_open(struct mcp_conn *conn, void *user)
+{
+	(void)conn;
+	(void)user;
+	count(&opened);
+}
+
+static void server_close(struct mcp_conn *conn, void *user)
+{
+	(void)conn;
+	(void)user;
+	count(&closed);
+}
+
+static void client_open(struct mcp_conn *conn, void *user)
+{
+	struct client *client = malloc(sizeof(*client));
+	(void)user;
+
+	assert(client);
+	client->sent = 0;
+	client->received = 0;
+	mcp_conn_set_user(conn, client);
+
+	while (client->sent < PIPELINE)
+		send_frame(conn, client->sent++);
+}
+
+static void client_frame(struct mcp_conn *conn, struct mcp_parse *frame, void *user)
+{
+	struct client *client = mcp_conn_user(conn);
+	const unsigned char *data = mcp_ptr(frame);
+	int k = client->received++;
+	size_t i, size = mcp_avail(frame);
+	(void)user;
+
+	/* frames come back whole and in order */
+	if (size != frame_sizes[k % NUM_SIZES])
+		count(&failures);
+	for (i = 0; i < size; i++)
+		if (data[i] != ((k + i) & 0xff))
+			count(&failures);
+
+	if (client->received == NUM_FRAMES) {
+		count(&done);
+		mcp_conn_close(conn);
+	} else if (client->sent < NUM_FRAMES) {
+		send_frame(conn, client->sent++);
+	}
+}
+
+static void client_close(struct mcp_conn *conn, void *user)
+{
+	(void)user;
+	free(mcp_conn_user(conn));
+}
+
+static struct mcp_net *start_server(size_t in_max)
+{
+	struct mcp_net_config config;
+	struct mcp_net *net;
+
+	memset(&config, 0, sizeof(config));
+	config.host = "127.0.0.1";
+	config.listen = 1;
+	config.workers = 2;
+	config.in_max = in_max;
+	config.on_open = server_open;
+	config.on_frame = echo_frame;
+	config.on_close = server_close;
+
+	net = mcp_net_start(&config);
+	assert(net);
+	assert(mcp_net_port(net) != 0);
+	assert(mcp_net_workers(net) == 2);
+	return net;
+}
+
+static struct mcp_net *start_client(void (*on_open)(struct mcp_conn *, void *))
+{
+	struct mcp_net_config config;
+	struct mcp_net *net;
+
+	memset(&config, 0, sizeof(config));
+	config.workers = 1;
+	config.on_open = on_open;
+	config.on_frame = client_frame;
+	config.on_close = client_close;
+
+	net = mcp_net_start(&config);
+	assert(net);
+	return net;
+}
+
+static void echo_test(void)
+{
+	struct mcp_net *server, *client;
+	uint64_t frames = 0, accepted = 0;
+	int i;
+
+	reset();
+	server = start_server(0);
+	client = start_client(client_open);
+
+	for (i = 0; i < NUM_CONNS; i++)
+		assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+
+	assert(wait_for(&done, NUM_CONNS));
+	assert(wait_for(&closed, NUM_CONNS));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+	assert(opened == NUM_CONNS);
+
+	for (i = 0; i < mcp_net_workers(server); i++) {
+		frames += mcp_net_stats(server, i)->frames_in;
+		accepted += mcp_net_stats(server, i)->accepted;
+	}
+	assert(frames == NUM_CONNS * NUM_FRAMES);
+	assert(accepted == NUM_CONNS);
+
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+static void send_malformed(struct mcp_conn *conn, void *user)
+{
+	/* a length prefix that overflows */
+	static const unsigned char data[] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+
+	client_open(conn, user);
+	fbuf_clear(mcp_conn_out(conn));
+	assert(mcg_raw(mcp_conn_out(conn), data, sizeof(data)) == 0);
+}
+
+static void malformed_test(void)
+{
+	struct mcp_net *server, *client;
+
+	reset();
+	server = start_server(0);
+	client = start_client(send_malformed);
+
+	assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+
+	/* the server should hang up */
+	assert(wait_for(&closed, 1));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(done == 0);
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+static void send_large(struct mcp_conn *conn, void *user)
+{
+	static unsigned char data[4096];
+
+	client_open(conn, user);
+	fbuf_clear(mcp_conn_out(conn));
+	assert(mcp_conn_send(conn, data, sizeof(data)) == 0);
+}
+
+static void limit_test(void)
+{
+	struct mcp_net *server, *client;
+
+	reset();
+	server = start_server(1024);
+	client = start_client(send_large);
+
+	assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+
+	/* frames that can not fit in the inbound buffer are refused */
+	assert(wait_for(&closed, 1));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(done == 0);
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+/* the frames each client expects, in order */
+static const char *expected[BURST];
+static int num_expected;
+static struct mcp_packet *shared;
+
+static void expect_open(struct mcp_conn *conn, void *user)
+{
+	client_open(conn, user);
+	fbuf_clear(mcp_conn_out(conn));
+	((struct client *)mcp_conn_user(conn))->sent = 0;
+}
+
+static void expect_frame(struct mcp_conn *conn, struct mcp_parse *frame, void *user)
+{
+	struct client *client = mcp_conn_user(conn);
+	const char *body = expected[client->received++];
+	(void)user;
+
+	if (mcp_avail(frame) != strlen(body) ||
+			memcmp(mcp_ptr(frame), body, strlen(body)) != 0)
+		count(&failures);
+
+	if (client->received == num_expected) {
+		count(&done);
+		mcp_conn_close(conn);
+	}
+}
+
+static struct mcp_net *start_expect_client(void)
+{
+	struct mcp_net_config config;
+	struct mcp_net *net;
+
+	memset(&config, 0, sizeof(config));
+	config.workers = 1;
+	config.on_open = expect_open;
+	config.on_frame = expect_frame;
+	config.on_close = client_close;
+
+	net = mcp_net_start(&config);
+	assert(net);
+	return net;
+}
+
+static struct mcp_net *start_sending_server(void (*on_open)(struct mcp_conn *, void *))
+{
+	struct mcp_net_config config;
+	struct mcp_net *net;
+
+	memset(&config, 0, sizeof(config));
+	config.host = "127.0.0.1";
+	config.listen = 1;
+	config.workers = 2;
+	config.on_open = on_open;
+	config.on_close = server_close;
+
+	net = mcp_net_start(&config);
+	assert(net);
+	return net;
+}
+
+static void send_broadcast(struct mcp_conn *conn, void *user)
+{
+	(void)user;
+
+	/* shared packets are interleaved with private frames in order */
+	if (mcp_conn_send(conn, "a", 1) ||
+			mcp_conn_send_packet(conn, shared) ||
+			mcp_conn_send(conn, "bb", 2) ||
+			mcp_conn_send_packet(conn, shared) ||
+			mcp_conn_send_packet(conn, shared) ||
+			mcp_conn_send(conn, "", 0))
+		count(&failures);
+}
+
+static void broadcast_test(void)
+{
+	struct mcp_net *server, *client;
+	int i;
+
+	reset();
+	shared = mcp_packet_new("shared", 6);
+	assert(shared);
+	assert(mcp_packet_size(shared) == 7);
+	assert(mcp_packet_data(shared)[0] == 6);
+
+	expected[0] = "a";
+	expected[1] = "shared";
+	expected[2] = "bb";
+	expected[3] = "shared";
+	expected[4] = "shared";
+	expected[5] = "";
+	num_expected = 6;
+
+	server = start_sending_server(send_broadcast);
+	client = start_expect_client();
+
+	for (i = 0; i < NUM_CONNS; i++)
+		assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+
+	assert(wait_for(&done, NUM_CONNS));
+	assert(wait_for(&closed, NUM_CONNS));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+
+	/* every connection has dropped its references */
+	assert(shared->refs == 1);
+	mcp_packet_unref(shared);
+
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+/* shifts every byte of the body up by one */
+static int shift_filter(struct mcp_conn *conn, struct fbuf *out,
+						const void *body, size_t size, void *user)
+{
+	const unsigned char *src = body;
+	unsigned char data[16];
+	size_t i;
+	(void)conn;
+	(void)user;
+
+	assert(size <= sizeof(data));
+	for (i = 0; i < size; i++)
+		data[i] = src[i] + 1;
+
+	return mcg_bytes(out, data, size);
+}
+
+static void send_filtered(struct mcp_conn *conn, void *user)
+{
+	(void)user;
+
+	mcp_conn_set_filter(conn, shift_filter, NULL);
+	if (mcp_conn_send(conn, "abc", 3) ||
+			mcp_conn_send_packet(conn, shared) ||
+			mcp_conn_send(conn, "xyz", 3))
+		count(&failures);
+}
+
+static void filter_test(void)
+{
+	struct mcp_net *server, *client;
+
+	reset();
+	shared = mcp_packet_new("shared", 6);
+	assert(shared);
+
+	expected[0] = "bcd";
+	expected[1] = "tibsfe";
+	expected[2] = "yz{";
+	num_expected = 3;
+
+	server = start_sending_server(send_filtered);
+	client = start_expect_client();
+
+	assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+	assert(wait_for(&done, 1));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+
+	/* filtered connections copy instead of taking a reference */
+	assert(shared->refs == 1);
+	mcp_packet_unref(shared);
+
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+static int echoed;
+
+static void burst_open(struct mcp_conn *conn, void *user)
+{
+	int i;
+
+	expect_open(conn, user);
+	for (i = 0; i < BURST; i++)
+		if (mcp_conn_send(conn, "x", 1))
+			count(&failures);
+}
+
+static void counting_echo(struct mcp_conn *conn, struct mcp_parse *frame, void *user)
+{
+	echo_frame(conn, frame, user);
+	count(&echoed);
+}
+
+static void urgent_echo(struct mcp_conn *conn, struct mcp_parse *frame, void *user)
+{
+	echo_frame(conn, frame, user);
+	mcp_conn_urgent(conn);
+}
+
+static struct mcp_net *start_coalescing_server(unsigned int delay, size_t bytes,
+		void (*on_frame)(struct mcp_conn *, struct mcp_parse *, void *))
+{
+	struct mcp_net_config config;
+	struct mcp_net *net;
+
+	memset(&config, 0, sizeof(config));
+	config.host = "127.0.0.1";
+	config.listen = 1;
+	config.workers = 2;
+	config.flush_delay = delay;
+	config.flush_bytes = bytes;
+	config.on_open = server_open;
+	config.on_frame = on_frame;
+	config.on_close = server_close;
+
+	net = mcp_net_start(&config);
+	assert(net);
+	return net;
+}
+
+static struct mcp_net *start_burst_client(void)
+{
+	struct mcp_net_config config;
+	struct mcp_net *net;
+	int i;
+
+	for (i = 0; i < BURST; i++)
+		expected[i] = "x";
+	num_expected = BURST;
+
+	memset(&config, 0, sizeof(config));
+	config.workers = 1;
+	config.on_open = burst_open;
+	config.on_frame = expect_frame;
+	config.on_close = client_close;
+
+	net = mcp_net_start(&config);
+	assert(net);
+	return net;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void deadline_test(void)
+{
+	struct mcp_net *server, *client;
+	uint64_t frames = 0, writes = 0;
+	double start;
+	int i;
+
+	reset();
+	server = start_coalescing_server(100, 1 << 20, echo_frame);
+	client = start_burst_client();
+
+	start = now();
+	for (i = 0; i < NUM_CONNS; i++)
+		assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+
+	/* the echoes are held until the deadline */
+	assert(wait_for(&done, NUM_CONNS));
+	assert(now() - start >= 0.1);
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+
+	/* and coalesced into one write per connection */
+	for (i = 0; i < mcp_net_workers(server); i++) {
+		frames += mcp_net_stats(server, i)->frames_out;
+		writes += mcp_net_stats(server, i)->writes;
+	}
+	assert(frames == NUM_CONNS * BURST);
+	assert(writes == NUM_CONNS);
+
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+static void urgent_test(void)
+{
+	struct mcp_net *server, *client;
+	int i;
+
+	/* urgent packets are written without waiting for the deadline */
+	reset();
+	server = start_coalescing_server(60000, 1 << 20, urgent_echo);
+	client = start_burst_client();
+
+	for (i = 0; i < NUM_CONNS; i++)
+		assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+	assert(wait_for(&done, NUM_CONNS));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+	mcp_net_free(client);
+	mcp_net_free(server);
+
+	/* every echo is two bytes, so the threshold is crossed by the last */
+	reset();
+	server = start_coalescing_server(60000, 8, echo_frame);
+	client = start_burst_client();
+
+	for (i = 0; i < NUM_CONNS; i++)
+		assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+	assert(wait_for(&done, NUM_CONNS));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+	mcp_net_free(client);
+	mcp_net_free(server);
+
+	/* the end of a tick flushes everything that is held */
+	reset();
+	echoed = 0;
+	server = start_coalescing_server(60000, 1 << 20, counting_echo);
+	client = start_burst_client();
+
+	for (i = 0; i < NUM_CONNS; i++)
+		assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+	assert(wait_for(&echoed, NUM_CONNS * BURST));
+	assert(__atomic_load_n(&done, __ATOMIC_SEQ_CST) == 0);
+
+	mcp_net_flush(server);
+	assert(wait_for(&done, NUM_CONNS));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+static void budget_test(void)
+{
+	struct mcp_net_config config;
+	struct mcp_net *server, *client;
+	struct fbuf_budget budget;
+	struct fbuf hog = FBUF_INITIALIZER;
+	struct timespec ms = {0, 50000000};
+	uint64_t pauses = 0;
+	int i;
+
+	reset();
+	echoed = 0;
+
+	/* put the budget under hard pressure */
+	fbuf_budget_init(&budget, 1 << 20);
+	assert(fbuf_set_budget(&hog, &budget) == 0);
+	assert(fbuf_expand(&hog, budget.hard) >= budget.hard);
+	assert(fbuf_pressure(&budget) == FBUF_PRESSURE_HARD);
+
+	memset(&config, 0, sizeof(config));
+	config.host = "127.0.0.1";
+	config.listen = 1;
+	config.workers = 2;
+	config.budget = &budget;
+	config.on_open = server_open;
+	config.on_frame = counting_echo;
+	config.on_close = server_close;
+	server = mcp_net_start(&config);
+	assert(server);
+	client = start_burst_client();
+
+	for (i = 0; i < NUM_CONNS; i++)
+		assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+	assert(wait_for(&opened, NUM_CONNS));
+
+	/* nothing is read while under pressure */
+	nanosleep(&ms, NULL);
+	assert(__atomic_load_n(&echoed, __ATOMIC_SEQ_CST) == 0);
+
+	/* and everything once there is room */
+	fbuf_free(&hog);
+	assert(wait_for(&done, NUM_CONNS));
+	assert(wait_for(&closed, NUM_CONNS));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+	assert(fbuf_budget_used(&budget) == 0);
+
+	for (i = 0; i < mcp_net_workers(server); i++)
+		pauses += mcp_net_stats(server, i)->pauses;
+	assert(pauses >= NUM_CONNS);
+
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+static void capture_test(void)
+{
+	struct mcp_net_config config;
+	struct mcp_net *server, *client;
+	struct mcp_replay replay;
+	struct mcp_record record;
+	char path[64];
+	int in = 0, out = 0;
+
+	reset();
+	sprintf(path, "/tmp/net_test.%li.cap", (long)getpid());
+
+	memset(&config, 0, sizeof(config));
+	config.host = "127.0.0.1";
+	config.listen = 1;
+	config.workers = 2;
+	config.capture = mcp_capture_open(path);
+	config.on_open = server_open;
+	config.on_frame = echo_frame;
+	config.on_close = server_close;
+	assert(config.capture);
+	server = mcp_net_start(&config);
+	assert(server);
+	client = start_burst_client();
+
+	assert(mcp_net_connect(client, "127.0.0.1", mcp_net_port(server)) == 0);
+	assert(wait_for(&done, 1));
+
+	mcp_net_stop(client);
+	mcp_net_stop(server);
+	assert(failures == 0);
+	assert(mcp_capture_close(config.capture) == 0);
+
+	/* every frame received and echoed by the server was recorded */
+	assert(mcp_replay_open(&replay, path) == 0);
+	while (mcp_replay_next(&replay, &record)) {
+		assert(record.conn == 0);
+		assert(mcp_avail(&record.frame) == 1 && *mcp_ptr(&record.frame) == 'x');
+		if (record.dir == MCP_CAPTURE_IN)
+			in++;
+		else
+			out++;
+	}
+	assert(mcp_ok(&replay.buf));
+	assert(in == BURST && out == BURST);
+	mcp_replay_close(&replay);
+	unlink(path);
+
+	mcp_net_free(client);
+	mcp_net_free(server);
+}
+
+static struct mcp_numa topology;
+static struct mcp_net *local_server;
+static int local_pinned;
+
+/* echoes frames, checking that the connection is served on its node and
+ * that its buffers come from the pool of that node */
+static void local_echo(struct mcp_conn *conn, struct mcp_parse *frame,
+						void *user)
+{
+	int node = mcp_conn_node(conn);
+	struct fbuf_pages *pages = mcp_net_pages(local_server, node);
+
+	/* an unpinned worker keeps the node it started on, wherever it runs */
+	if (node < 0 || node >= topology.nodes ||
+			(local_pinned && node != mcp_conn_worker(conn) % topology.nodes) ||
+			(local_pinned && mcp_numa_node(&topology) != node) ||
+			mcp_conn_in(conn)->pages != pages ||
+			mcp_conn_out(conn)->pages != pages || pages->node != node)
+		count(&failures);
+
+	echo_frame(conn, frame, user);
+}
+
+static void numa_test(void)
+{
+	struct mcp_net_config config;
+	struct mcp_net *server, *client;
+	int i;
+
+	/* two nodes, on a machine that probably has one */
+	mcp_numa_simulate(&topology, 2, 8);
+
+	for (local_pinned = 1; local_pinned >= 0; local_pinned--) {
+		reset();
+
+		memset(&config, 0, sizeof(config));
+		config.host = "127.0.0.1";
+		config.listen = 1;
+		config.workers = 4;
+		config.pin = local_pinned;
+		config.numa = &topology;
+		config.on_open = server_open;
+		config.on_frame = local_echo;
+		config.on_close = server_close;
+		server = local_server = mcp_net_start(&config);
+		assert(server);
+		client = start_client(client_open);
+		assert(mcp_net_pages(server, 0)->node == 0);
+		assert(mcp_net_pages(server, 1)->node == 1);
+
+		for (i = 0; i < NUM_CONNS; i++)
+			assert(mcp_net_connect(client, "127.0.0.1",
+									mcp_net_port(server)) == 0);
+
+		assert(wait_for(&done, NUM_CONNS));
+		assert(wait_for(&closed, NUM_CONNS));
+
+		mcp_net_stop(client);
+		mcp_net_stop(server);
+		assert(failures == 0);
+
+		mcp_net_free(client);
+		mcp_net_free(server);
+	}
+}
+
+#define NUM_TESTS		(10)
+static void (*tests[NUM_TESTS])(void) = {echo_test, malformed_test,
+										limit_test, broadcast_test,
+										filter_test, deadline_test,
+										urgent_test, budget_test,
+										capture_test, numa_test};
+static const char *test_names[NUM_TESTS] = {"echo_test", "malformed_test",
+											"limit_test", "broadcast_test",
+											"filter_test", "deadline_test",
+											"urgent_test", "budget_test",
+											"capture_test", "numa_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+/* numa_test.c - tests of numa placement, on a simulated topology
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/numa.h>
+
+static void topology_test(void)
+{
+	struct mcp_numa numa;
+	int cpu;
+
+	/* nodes have equal ranges of cpus */
+	mcp_numa_simulate(&numa, 2, 8);
+	assert(numa.nodes == 2 && numa.cpus == 8 && numa.simulated);
+	for (cpu = 0; cpu < 8; cpu++)
+		assert(numa.node[cpu] == cpu / 4);
+
+	mcp_numa_simulate(&numa, 3, 7);
+	assert(numa.node[0] == 0 && numa.node[2] == 0);
+	assert(numa.node[3] == 1 && numa.node[4] == 1);
+	assert(numa.node[5] == 2 && numa.node[6] == 2);
+
+	/* every node has a cpu */
+	mcp_numa_simulate(&numa, 4, 2);
+	assert(numa.nodes == 4 && numa.cpus == 4);
+	mcp_numa_simulate(&numa, 0, 0);
+	assert(numa.nodes == 1 && numa.cpus == 1);
+
+	/* threads are spread over the nodes with cpus */
+	mcp_numa_simulate(&numa, 4, 16);
+	for (cpu = 0; cpu < 8; cpu++)
+		assert(mcp_numa_spread(&numa, cpu) == cpu % 4);
+
+	/* and skip a node with only memory */
+	for (cpu = 4; cpu < 8; cpu++)
+		numa.node[cpu] = 0;
+	assert(mcp_numa_spread(&numa, 0) == 0);
+	assert(mcp_numa_spread(&numa, 1) == 2);
+	assert(mcp_numa_spread(&numa, 2) == 3);
+	assert(mcp_numa_spread(&numa, 3) == 0);
+	assert(mcp_numa_spread(&numa, 4) == 2);
+
+	/* the machine has at least one node, and each cpu is on one of them */
+	assert(mcp_numa_detect(&numa) >= 1);
+	assert(!numa.simulated && numa.cpus >= 1);
+	for (cpu = 0; cpu < numa.cpus; cpu++)
+		assert(numa.node[cpu] < numa.nodes);
+	assert(mcp_numa_node(&numa) < numa.nodes);
+
+	/* and threads are only spread to nodes with cpus */
+	for (cpu = 0; numa.node[cpu] != mcp_numa_spread(&numa, 1); cpu++)
+		assert(cpu + 1 < numa.cpus);
+}
+
+static struct mcp_numa simulated;
+
+/* pins a thread to the node given, and returns the node it is on after */
+static void *pinned(void *arg)
+{
+	int node = *(int *)arg;
+
+	assert(mcp_numa_pin(&simulated, node) == 0);
+	*(int *)arg = mcp_numa_node(&simulated);
+	return NULL;
+}
+
+static void pin_test(void)
+{
+	struct mcp_numa numa;
+	pthread_t threads[4];
+	int nodes[4], i;
+
+	/* threads are placed on the node they are pinned to */
+	mcp_numa_simulate(&simulated, 4, 16);
+	for (i = 0; i < 4; i++) {
+		nodes[i] = 3 - i;
+		assert(pthread_create(&threads[i], NULL, pinned, &nodes[i]) == 0);
+	}
+	for (i = 0; i < 4; i++) {
+		assert(pthread_join(threads[i], NULL) == 0);
+		assert(nodes[i] == 3 - i);
+	}
+
+	/* the main thread was not pinned by them */
+	assert(mcp_numa_node(&simulated) < 4);
+	assert(mcp_numa_pin(&simulated, 4) == 1);
+	assert(mcp_numa_pin(&simulated, -1) == 1);
+
+	/* pinning to a real node */
+	mcp_numa_detect(&numa);
+	assert(mcp_numa_pin(&numa, numa.node[0]) == 0);
+	assert(mcp_numa_node(&numa) == numa.node[0]);
+}
+
+/* fills buf with size bytes of a pattern */
+static void pattern(struct fbuf *buf, size_t size)
+{
+	unsigned char *ptr = fbuf_wptr(buf, size);
+	size_t i;
+
+	assert(ptr != NULL);
+	for (i = 0; i < size; i++)
+		ptr[i] = (fbuf_avail(buf) + i) * 13;
+	fbuf_produce(buf, size);
+}
+
+static void check_pattern(struct fbuf *buf, size_t offset)
+{
+	const unsigned char *ptr = fbuf_ptr(buf);
+	size_t i;
+
+	for (i = 0; i < fbuf_avail(buf); i++)
+		assert(ptr[i] == (unsigned char)((offset + i) * 13));
+}
+
+static void pages_test(void)
+{
+	struct mcp_numa numa;
+	struct fbuf_pages pages[2], local;
+	struct fbuf a = FBUF_INITIALIZER, b = FBUF_INITIALIZER;
+	size_t size;
+
+	mcp_numa_simulate(&numa, 2, 8);
+	mcp_numa_pages_init(&numa, &pages[0], 0, 4096, 1 << 20);
+	mcp_numa_pages_init(&numa, &pages[1], 1, 4096, 1 << 20);
+	assert(pages[0].node == 0 && pages[1].node == 1);
+	assert(!pages[0].bind && !pages[1].bind);
+
+	/* a connection's buffer on node 0 */
+	assert(fbuf_set_pages(&a, &pages[0]) == 0);
+	pattern(&a, 100);
+	pattern(&a, 40000);
+	fbuf_consume(&a, 1000);
+	size = a.size;
+
+	/* moves to node 1 with its data, and its block goes back to node 0 */
+	assert(fbuf_migrate(&a, &pages[1]) == 0);
+	assert(a.pages == &pages[1] && a.size == size && a.start == 0);
+	check_pattern(&a, 1000);
+	assert(pages[0].cached == size && pages[1].cached == 0);
+
+	/* and grows on node 1 */
+	pattern(&a, 100000);
+	assert(pages[1].cached > 0);
+	fbuf_free(&a);
+	assert(pages[0].cached == size);
+
+	/* a small buffer is moved out of any pool, and back into one */
+	pattern(&b, 100);
+	assert(fbuf_migrate(&b, NULL) == 0);
+	check_pattern(&b, 0);
+	assert(fbuf_migrate(&b, &pages[0]) == 0);
+	check_pattern(&b, 0);
+	pattern(&b, 10000);
+	check_pattern(&b, 0);
+	fbuf_free(&b);
+
+	fbuf_pages_free(&pages[0]);
+	fbuf_pages_free(&pages[1]);
+
+	/* a pool bound to a real node */
+	mcp_numa_detect(&numa);
+	mcp_numa_pages_init(&numa, &local, numa.node[0], 4096, 8 << 20);
+	assert(local.bind);
+	assert(fbuf_set_pages(&a, &local) == 0);
+	pattern(&a, 3 << 20);
+	check_pattern(&a, 0);
+	fbuf_free(&a);
+	fbuf_pages_free(&local);
+}
+
+#define NUM_TESTS		(3)
+static void (*tests[NUM_TESTS])(void) = {topology_test, pin_test, pages_test};
+static const char *test_names[NUM_TESTS] = {"topology_test", "pin_test",
+											"pages_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
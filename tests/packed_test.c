@@ -0,0 +1,218 @@
+/* packed_test.c - tests of the bit-packed long arrays
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/packed.h>
+
+#define NUM_ENTRIES			(4096 + 7)
+
+static uint32_t entries[NUM_ENTRIES];
+
+/* packs one bit at a time, the slowest possible but obviously correct way */
+static void reference_pack(unsigned char *dest, const uint32_t *src,
+							size_t count, unsigned int bits,
+							enum mcp_packed_layout layout)
+{
+	size_t i, bit = 0, longs = mcp_packed_longs(count, bits, layout);
+	unsigned int j;
+
+	memset(dest, 0, longs * 8);
+	for (i = 0; i < count; i++) {
+		/* aligned entries skip the padding at the top of each long */
+		if (layout == MCP_PACKED_ALIGNED && bit % 64 + bits > 64)
+			bit += 64 - bit % 64;
+
+		for (j = 0; j < bits; j++, bit++) {
+			if ((src[i] >> j) & 1)
+				dest[(bit / 64) * 8 + 7 - (bit % 64) / 8] |= 1 << (bit % 8);
+		}
+	}
+}
+
+static void fill(unsigned int bits)
+{
+	size_t i;
+	for (i = 0; i < NUM_ENTRIES; i++)
+		entries[i] = ((uint32_t)rand() ^ ((uint32_t)rand() << 16)) &
+					(uint32_t)(((uint64_t)1 << bits) - 1);
+}
+
+static void reference_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	unsigned char expected[NUM_ENTRIES * 4 + 8];
+	uint16_t shorts[NUM_ENTRIES];
+	unsigned int bits, layout;
+	size_t count, i;
+
+	srand(time(NULL));
+
+	for (layout = 0; layout < 2; layout++) {
+		for (bits = 1; bits <= 32; bits++) {
+			fill(bits);
+			for (count = 0; count < 200; count += 13) {
+				reference_pack(expected, entries, count, bits, layout);
+
+				fbuf_clear(&buf);
+				assert(mcg_packed_uint(&buf, entries, count, bits, layout) == 0);
+				assert(fbuf_avail(&buf) == mcp_packed_longs(count, bits, layout) * 8);
+				assert(fbuf_avail(&buf) == 0 ||
+						memcmp(fbuf_ptr(&buf), expected, fbuf_avail(&buf)) == 0);
+
+				if (bits > 16)
+					continue;
+
+				for (i = 0; i < count; i++)
+					shorts[i] = entries[i];
+
+				fbuf_clear(&buf);
+				assert(mcg_packed_ushort(&buf, shorts, count, bits, layout) == 0);
+				assert(fbuf_avail(&buf) == 0 ||
+						memcmp(fbuf_ptr(&buf), expected, fbuf_avail(&buf)) == 0);
+			}
+		}
+	}
+
+	fbuf_free(&buf);
+}
+
+static void roundtrip_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	uint32_t ints[NUM_ENTRIES];
+	uint16_t shorts[NUM_ENTRIES];
+	unsigned int bits, layout;
+	size_t i;
+
+	srand(time(NULL));
+
+	for (layout = 0; layout < 2; layout++) {
+		for (bits = 1; bits <= 32; bits++) {
+			fill(bits);
+
+			/* a trailing marker checks that exactly the array is consumed */
+			fbuf_clear(&buf);
+			assert(mcg_packed_uint(&buf, entries, NUM_ENTRIES, bits, layout) == 0);
+			assert(mcg_uint(&buf, 0xdeadbeef) == 0);
+
+			mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+			mcp_packed_uint(ints, NUM_ENTRIES, bits, layout, &parse);
+			assert(mcp_uint(&parse) == 0xdeadbeef);
+			assert(mcp_ok(&parse));
+			assert(mcp_eof(&parse));
+			assert(memcmp(ints, entries, sizeof(ints)) == 0);
+
+			if (bits > 16)
+				continue;
+
+			mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+			mcp_packed_ushort(shorts, NUM_ENTRIES, bits, layout, &parse);
+			assert(mcp_uint(&parse) == 0xdeadbeef);
+			assert(mcp_ok(&parse));
+			for (i = 0; i < NUM_ENTRIES; i++)
+				assert(shorts[i] == entries[i]);
+		}
+	}
+
+	fbuf_free(&buf);
+}
+
+static void error_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	uint16_t shorts[64];
+	uint32_t ints[64];
+
+	memset(ints, 0, sizeof(ints));
+	memset(shorts, 0, sizeof(shorts));
+
+	/* out of range widths */
+	assert(mcg_packed_uint(&buf, ints, 64, 0, MCP_PACKED_ALIGNED) == 1);
+	assert(mcg_packed_uint(&buf, ints, 64, 33, MCP_PACKED_ALIGNED) == 1);
+	assert(mcg_packed_ushort(&buf, shorts, 64, 17, MCP_PACKED_SPANNING) == 1);
+	assert(fbuf_avail(&buf) == 0);
+
+	assert(mcg_packed_uint(&buf, ints, 64, 5, MCP_PACKED_ALIGNED) == 0);
+	assert(fbuf_avail(&buf) == 6 * 8);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	mcp_packed_ushort(shorts, 64, 17, MCP_PACKED_ALIGNED, &parse);
+	assert(mcp_error(&parse) == MCP_EINVAL);
+
+	/* truncated arrays ask for more data */
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf) - 1);
+	mcp_packed_uint(ints, 64, 5, MCP_PACKED_ALIGNED, &parse);
+	assert(mcp_error(&parse) == MCP_EAGAIN);
+
+	/* the same entries need fewer longs when they span */
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	mcp_packed_uint(ints, 64, 5, MCP_PACKED_SPANNING, &parse);
+	assert(mcp_ok(&parse));
+	assert(mcp_avail(&parse) == 8);
+
+	fbuf_free(&buf);
+}
+
+#define NUM_TESTS		(3)
+static void (*tests[NUM_TESTS])(void) = {reference_test, roundtrip_test,
+										error_test};
+static const char *test_names[NUM_TESTS] = {"reference_test", "roundtrip_test",
+											"error_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/* packet_test.c - tests of the shared packets
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/packet.h>
+
+static void frame_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_packet *packet;
+	struct mcp_parse parse;
+	static unsigned char body[300];
+	const void *value;
+	size_t size, i;
+
+	for (i = 0; i < sizeof(body); i++)
+		body[i] = i;
+
+	/* the frame is the same as mcg_bytes would write */
+	for (size = 0; size <= sizeof(body); size += 100) {
+		fbuf_clear(&buf);
+		assert(mcg_bytes(&buf, body, size) == 0);
+
+		packet = mcp_packet_new(body, size);
+		assert(packet);
+		assert(mcp_packet_size(packet) == fbuf_avail(&buf));
+		assert(memcmp(mcp_packet_data(packet), fbuf_ptr(&buf),
+						fbuf_avail(&buf)) == 0);
+		assert(mcp_packet_body_size(packet) == size);
+		assert(memcmp(mcp_packet_body(packet), body, size) == 0);
+
+		mcp_start(&parse, mcp_packet_data(packet), mcp_packet_size(packet));
+		value = mcp_bytes(&parse, &i);
+		assert(mcp_ok(&parse) && mcp_eof(&parse));
+		assert(i == size && value == mcp_packet_body(packet));
+
+		mcp_packet_unref(packet);
+	}
+
+	/* the body can come from a fbuf */
+	fbuf_clear(&buf);
+	assert(mcg_varint(&buf, 0x21) == 0);
+	assert(mcg_long(&buf, 12345) == 0);
+	packet = mcp_packet_fbuf(&buf);
+	assert(packet);
+	assert(mcp_packet_body_size(packet) == 9);
+	assert(mcp_packet_data(packet)[0] == 9);
+	assert(memcmp(mcp_packet_body(packet), fbuf_ptr(&buf), 9) == 0);
+	mcp_packet_unref(packet);
+
+	/* too large for a length prefix */
+	assert(mcp_packet_new(body, (size_t)MCP_BYTES_MAX_SIZE + 1) == NULL);
+
+	fbuf_free(&buf);
+}
+
+static void ref_test(void)
+{
+	struct mcp_packet *packet = mcp_packet_new("test", 4);
+	int i;
+
+	assert(packet);
+	assert(packet->refs == 1);
+
+	for (i = 0; i < 100; i++)
+		assert(mcp_packet_ref(packet) == packet);
+	assert(packet->refs == 101);
+
+	for (i = 0; i < 100; i++)
+		mcp_packet_unref(packet);
+	assert(packet->refs == 1);
+
+	/* the last reference frees it, NULL is ignored */
+	mcp_packet_unref(packet);
+	mcp_packet_unref(NULL);
+}
+
+#define NUM_TESTS		(2)
+static void (*tests[NUM_TESTS])(void) = {frame_test, ref_test};
+static const char *test_names[NUM_TESTS] = {"frame_test", "ref_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -0,0 +1,251 @@
+/* queue_test.c - tests of the fbuf handoff queues
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for sched_yield */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/queue.h>
+
+#define PRODUCERS		(4)
+#define PER_PRODUCER	(20000)
+
+/* each fbuf holds the producer and sequence number it was pushed with */
+static void make_buf(struct fbuf *buf, unsigned int producer, unsigned int seq)
+{
+	unsigned int value[2];
+
+	value[0] = producer;
+	value[1] = seq;
+	fbuf_init(buf, FBUF_MAX);
+	assert(fbuf_copy(buf, value, sizeof(value)) == 0);
+}
+
+static void check_buf(struct fbuf *buf, unsigned int *producer, unsigned int *seq)
+{
+	unsigned int value[2];
+
+	assert(fbuf_avail(buf) == sizeof(value));
+	memcpy(value, fbuf_ptr(buf), sizeof(value));
+	*producer = value[0];
+	*seq = value[1];
+	fbuf_free(buf);
+}
+
+static void spsc_test(void)
+{
+	struct mcp_spsc *queue;
+	struct fbuf buf, out[8];
+	unsigned int producer, seq, i;
+
+	/* rounded up to a power of two */
+	queue = mcp_spsc_new(5);
+	assert(queue);
+
+	assert(mcp_spsc_pop(queue, out, 8) == 0);
+
+	/* push moves the block and leaves buf empty */
+	for (i = 0; i < 8; i++) {
+		make_buf(&buf, 0, i);
+		assert(mcp_spsc_push(queue, &buf) == 0);
+		assert(buf.base == NULL && fbuf_avail(&buf) == 0);
+	}
+
+	/* full */
+	make_buf(&buf, 0, 8);
+	assert(mcp_spsc_push(queue, &buf) == 1);
+	assert(fbuf_avail(&buf) != 0);
+
+	/* batches come out in order */
+	assert(mcp_spsc_pop(queue, out, 3) == 3);
+	for (i = 0; i < 3; i++) {
+		check_buf(&out[i], &producer, &seq);
+		assert(producer == 0 && seq == i);
+	}
+
+	/* wraps around */
+	assert(mcp_spsc_push(queue, &buf) == 0);
+	assert(mcp_spsc_pop(queue, out, 8) == 6);
+	for (i = 0; i < 6; i++) {
+		check_buf(&out[i], &producer, &seq);
+		assert(producer == 0 && seq == i + 3);
+	}
+
+	/* segments of a block */
+	make_buf(&buf, 0, 0);
+	fbuf_consume(&buf, sizeof(unsigned int));
+	assert(mcp_spsc_push(queue, &buf) == 0);
+	assert(mcp_spsc_pop(queue, out, 1) == 1);
+	assert(fbuf_avail(&out[0]) == sizeof(unsigned int));
+	fbuf_free(&out[0]);
+
+	/* free releases what is left in the queue */
+	make_buf(&buf, 0, 0);
+	assert(mcp_spsc_push(queue, &buf) == 0);
+	mcp_spsc_free(queue);
+}
+
+static struct mcp_spsc *spsc_queue;
+static struct mcp_mpsc *mpsc_queue;
+
+static void *spsc_producer(void *arg)
+{
+	struct fbuf buf;
+	unsigned int i;
+	(void)arg;
+
+	for (i = 0; i < PER_PRODUCER; i++) {
+		make_buf(&buf, 0, i);
+		while (mcp_spsc_push(spsc_queue, &buf))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static void spsc_thread_test(void)
+{
+	pthread_t thread;
+	struct fbuf out[16];
+	unsigned int producer, seq, next = 0;
+	size_t n, i;
+
+	spsc_queue = mcp_spsc_new(64);
+	assert(spsc_queue);
+	assert(pthread_create(&thread, NULL, spsc_producer, NULL) == 0);
+
+	while (next < PER_PRODUCER) {
+		n = mcp_spsc_pop(spsc_queue, out, 16);
+		for (i = 0; i < n; i++) {
+			check_buf(&out[i], &producer, &seq);
+			assert(producer == 0 && seq == next++);
+		}
+		if (n == 0)
+			sched_yield();
+	}
+
+	assert(pthread_join(thread, NULL) == 0);
+	assert(mcp_spsc_pop(spsc_queue, out, 16) == 0);
+	mcp_spsc_free(spsc_queue);
+}
+
+static void *mpsc_producer(void *arg)
+{
+	unsigned int producer = *(unsigned int *)arg, i;
+	struct fbuf buf;
+
+	for (i = 0; i < PER_PRODUCER; i++) {
+		make_buf(&buf, producer, i);
+		while (mcp_mpsc_push(mpsc_queue, &buf))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static void mpsc_test(void)
+{
+	pthread_t threads[PRODUCERS];
+	unsigned int ids[PRODUCERS], next[PRODUCERS];
+	unsigned int producer, seq, total = 0, i;
+	struct fbuf out[16], buf;
+	size_t n, j;
+
+	mpsc_queue = mcp_mpsc_new(64);
+	assert(mpsc_queue);
+
+	/* full */
+	for (i = 0; i < 64; i++) {
+		make_buf(&buf, 0, 0);
+		assert(mcp_mpsc_push(mpsc_queue, &buf) == 0);
+	}
+	make_buf(&buf, 0, 0);
+	assert(mcp_mpsc_push(mpsc_queue, &buf) == 1);
+	fbuf_free(&buf);
+	while ((n = mcp_mpsc_pop(mpsc_queue, out, 16)) > 0)
+		for (j = 0; j < n; j++)
+			fbuf_free(&out[j]);
+
+	for (i = 0; i < PRODUCERS; i++) {
+		ids[i] = i;
+		next[i] = 0;
+		assert(pthread_create(&threads[i], NULL, mpsc_producer, &ids[i]) == 0);
+	}
+
+	/* each producer's fbufs come out in order */
+	while (total < PRODUCERS * PER_PRODUCER) {
+		n = mcp_mpsc_pop(mpsc_queue, out, 16);
+		for (j = 0; j < n; j++) {
+			check_buf(&out[j], &producer, &seq);
+			assert(producer < PRODUCERS && seq == next[producer]++);
+			total++;
+		}
+		if (n == 0)
+			sched_yield();
+	}
+
+	for (i = 0; i < PRODUCERS; i++)
+		assert(pthread_join(threads[i], NULL) == 0);
+	assert(mcp_mpsc_pop(mpsc_queue, out, 16) == 0);
+	mcp_mpsc_free(mpsc_queue);
+}
+
+#define NUM_TESTS		(3)
+static void (*tests[NUM_TESTS])(void) = {spsc_test, spsc_thread_test, mpsc_test};
+static const char *test_names[NUM_TESTS] = {"spsc_test", "spsc_thread_test", "mpsc_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
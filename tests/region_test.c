@@ -0,0 +1,539 @@
+/* region_test.c - tests of the region file reader
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for getpid and mkdtemp */
+#define _POSIX_C_SOURCE			200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/region.h>
+
+static char path[64], dir[32];
+
+/* the nbt of a chunk, a compressible pattern of a size that depends on it */
+static size_t chunk_nbt(int index, unsigned char *dest)
+{
+	size_t size = 100 + index * 97 % 20000, i;
+
+	for (i = 0; i < size; i++)
+		dest[i] = (i / 16 + index) & 0xff;
+	return size;
+}
+
+/* compresses src as zlib or gzip into dest */
+static size_t deflate_to(unsigned char *dest, size_t max, const void *src,
+							size_t size, int compression)
+{
+	z_stream stream;
+
+	memset(&stream, 0, sizeof(stream));
+	assert(deflateInit2(&stream, 6, Z_DEFLATED,
+						compression == MCP_REGION_GZIP ? 16 + MAX_WBITS :
+														MAX_WBITS,
+						8, Z_DEFAULT_STRATEGY) == Z_OK);
+	stream.next_in = (Bytef *)src;
+	stream.avail_in = size;
+	stream.next_out = dest;
+	stream.avail_out = max;
+	assert(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+	deflateEnd(&stream);
+	return max - stream.avail_out;
+}
+
+/* writes a region with the chunks for which present returns true, the
+ * compressions cycling between the three */
+static void write_region(int (*present)(int index))
+{
+	static unsigned char nbt[32768], data[40000];
+	struct fbuf body = FBUF_INITIALIZER, file = FBUF_INITIALIZER;
+	uint32_t locations[MCP_REGION_CHUNKS];
+	size_t size, sector = 2, sectors;
+	int index, compression;
+	FILE *out;
+
+	for (index = 0; index < MCP_REGION_CHUNKS; index++) {
+		locations[index] = 0;
+		if (!present(index))
+			continue;
+
+		size = chunk_nbt(index, nbt);
+		compression = index % 3 + 1;
+		if (compression != MCP_REGION_NONE)
+			size = deflate_to(data, sizeof(data), nbt, size, compression);
+		else
+			memcpy(data, nbt, size);
+
+		assert(mcg_uint(&body, size + 1) == 0);
+		assert(mcg_ubyte(&body, compression) == 0);
+		assert(mcg_raw(&body, data, size) == 0);
+
+		/* padded to a sector */
+		sectors = (size + 5 + MCP_REGION_SECTOR - 1) / MCP_REGION_SECTOR;
+		fbuf_wptr(&body, sectors * MCP_REGION_SECTOR);
+		memset(fbuf_wptr(&body, 0), 0, sectors * MCP_REGION_SECTOR - size - 5);
+		fbuf_produce(&body, sectors * MCP_REGION_SECTOR - size - 5);
+
+		locations[index] = sector << 8 | sectors;
+		sector += sectors;
+	}
+
+	for (index = 0; index < MCP_REGION_CHUNKS; index++)
+		assert(mcg_uint(&file, locations[index]) == 0);
+	for (index = 0; index < MCP_REGION_CHUNKS; index++)
+		assert(mcg_uint(&file, 1400000000 + index) == 0);
+	assert(fbuf_copy(&file, fbuf_ptr(&body), fbuf_avail(&body)) == 0);
+
+	out = fopen(path, "wb");
+	assert(out);
+	assert(fwrite(fbuf_ptr(&file), 1, fbuf_avail(&file), out) ==
+			fbuf_avail(&file));
+	fclose(out);
+
+	fbuf_free(&body);
+	fbuf_free(&file);
+}
+
+/* overwrites size bytes of the region at offset */
+static void patch_region(long offset, const void *data, size_t size)
+{
+	FILE *out = fopen(path, "r+b");
+
+	assert(out);
+	assert(fseek(out, offset, SEEK_SET) == 0);
+	assert(fwrite(data, 1, size, out) == size);
+	fclose(out);
+}
+
+static void check_nbt(int index, struct fbuf *nbt)
+{
+	static __thread unsigned char expected[32768];
+	size_t size = chunk_nbt(index, expected);
+
+	assert(fbuf_avail(nbt) == size);
+	assert(memcmp(fbuf_ptr(nbt), expected, size) == 0);
+}
+
+static int some_chunks(int index)
+{
+	return index % 5 != 4;
+}
+
+static void read_test(void)
+{
+	struct mcp_region region;
+	struct mcp_region_chunk chunk;
+	struct fbuf nbt = FBUF_INITIALIZER;
+	int index, found = 0;
+	FILE *out;
+
+	write_region(some_chunks);
+	assert(mcp_region_open(&region, path) == 0);
+
+	for (index = 0; index < MCP_REGION_CHUNKS; index++) {
+		if (!mcp_region_chunk(&region, index, &chunk)) {
+			/* not in the region, which is not an error */
+			assert(!some_chunks(index));
+			assert(mcp_ok(&chunk.data));
+			continue;
+		}
+
+		found++;
+		assert((int)chunk.compression == index % 3 + 1);
+		assert(chunk.timestamp == 1400000000u + index);
+
+		/* the data is in the mapping */
+		assert(mcp_ptr(&chunk.data) > region.base &&
+				mcp_ptr(&chunk.data) < region.base + region.size);
+
+		fbuf_clear(&nbt);
+		assert(mcp_region_inflate(&nbt, &chunk) == 0);
+		check_nbt(index, &nbt);
+	}
+	assert(found == MCP_REGION_CHUNKS - MCP_REGION_CHUNKS / 5);
+	assert(mcp_region_index(33, -1) == (1 | 31 << 5));
+
+	/* out is full */
+	fbuf_free(&nbt);
+	fbuf_init(&nbt, 100);
+	assert(mcp_region_chunk(&region, 1, &chunk));
+	assert(mcp_region_inflate(&nbt, &chunk) == 1);
+	assert(fbuf_avail(&nbt) == 0);
+	fbuf_free(&nbt);
+
+	mcp_region_close(&region);
+
+	/* an empty region has no chunks */
+	out = fopen(path, "wb");
+	assert(out);
+	fclose(out);
+	assert(mcp_region_open(&region, path) == 0);
+	assert(!mcp_region_chunk(&region, 0, &chunk) && mcp_ok(&chunk.data));
+	mcp_region_close(&region);
+
+	/* but a header cut short is an error */
+	out = fopen(path, "wb");
+	assert(out);
+	assert(fwrite("\0\0\0\0", 1, 4, out) == 4);
+	fclose(out);
+	assert(mcp_region_open(&region, path) != 0);
+	unlink(path);
+	assert(mcp_region_open(&region, path) != 0);
+}
+
+static int loaded[MCP_REGION_CHUNKS];
+
+static void load_chunk(int index, struct fbuf *nbt, void *user)
+{
+	struct fbuf_pages *pages = user;
+
+	assert(nbt->pages == pages);
+	check_nbt(index, nbt);
+	__atomic_fetch_add(&loaded[index], 1, __ATOMIC_RELAXED);
+}
+
+static int first_chunks(int index)
+{
+	return index < 8;
+}
+
+static void malformed_test(void)
+{
+	static const unsigned char bad_compression = 9, in_header[4] = {0, 0, 1, 1};
+	static const unsigned char past_end[4] = {0, 0xff, 0, 1};
+	static const unsigned char too_long[4] = {0, 1, 0, 0};
+	static const unsigned char garbage[16] = {0xde, 0xad, 0xbe, 0xef};
+	struct mcp_region region;
+	struct mcp_region_chunk chunk;
+	struct fbuf nbt = FBUF_INITIALIZER;
+	int index;
+
+	write_region(first_chunks);
+	assert(mcp_region_open(&region, path) == 0);
+	for (index = 0; index < 8; index++)
+		assert(mcp_region_chunk(&region, index, &chunk));
+	mcp_region_close(&region);
+
+	/* chunk 0 points into the header, chunk 1 past the end of the file */
+	patch_region(0, in_header, 4);
+	patch_region(4, past_end, 4);
+	/* chunk 2 has an unknown compression, chunk 3 is longer than its
+	 * sectors, and chunk 4 is not a zlib stream */
+	patch_region(((region.locations[2] >> 8) * MCP_REGION_SECTOR) + 4,
+					&bad_compression, 1);
+	patch_region((region.locations[3] >> 8) * MCP_REGION_SECTOR,
+					too_long, 4);
+	patch_region((region.locations[4] >> 8) * MCP_REGION_SECTOR + 5,
+					garbage, sizeof(garbage));
+
+	assert(mcp_region_open(&region, path) == 0);
+	for (index = 0; index < 4; index++) {
+		assert(!mcp_region_chunk(&region, index, &chunk));
+		assert(mcp_error(&chunk.data) == MCP_EINVAL);
+		assert(mcp_region_inflate(&nbt, &chunk) == 1);
+	}
+
+	assert(mcp_region_chunk(&region, 4, &chunk));
+	assert(mcp_region_inflate(&nbt, &chunk) == 1);
+	assert(fbuf_avail(&nbt) == 0);
+
+	/* a gzip stream cut short */
+	assert(mcp_region_chunk(&region, 6, &chunk));
+	assert(chunk.compression == MCP_REGION_GZIP);
+	chunk.data.end -= 10;
+	assert(mcp_region_inflate(&nbt, &chunk) == 1);
+	assert(fbuf_avail(&nbt) == 0);
+
+	/* the rest are fine */
+	for (index = 5; index < 8; index++) {
+		assert(mcp_region_chunk(&region, index, &chunk));
+		fbuf_clear(&nbt);
+		assert(mcp_region_inflate(&nbt, &chunk) == 0);
+		check_nbt(index, &nbt);
+	}
+
+	/* malformed chunks are counted by the bulk load */
+	assert(mcp_region_load(&region, NULL, 0, 2, NULL, load_chunk, NULL) == 5);
+
+	mcp_region_close(&region);
+	fbuf_free(&nbt);
+	unlink(path);
+}
+
+static void load_test(void)
+{
+	struct mcp_region region;
+	struct fbuf_pages pages;
+	int indexes[100], index;
+
+	write_region(some_chunks);
+	assert(mcp_region_open(&region, path) == 0);
+	fbuf_pages_init(&pages, 4096, 1 << 20);
+
+	/* every chunk, on four threads */
+	memset(loaded, 0, sizeof(loaded));
+	assert(mcp_region_load(&region, NULL, 0, 4, &pages, load_chunk,
+							&pages) == 0);
+	for (index = 0; index < MCP_REGION_CHUNKS; index++)
+		assert(loaded[index] == some_chunks(index));
+
+	/* some of them, out of order, on as many threads as cpus */
+	memset(loaded, 0, sizeof(loaded));
+	for (index = 0; index < 100; index++)
+		indexes[index] = (index * 37 + 11) % MCP_REGION_CHUNKS;
+	assert(mcp_region_load(&region, indexes, 100, 0, &pages, load_chunk,
+							&pages) == 0);
+	for (index = 0; index < 100; index++)
+		assert(loaded[indexes[index]] == some_chunks(indexes[index]));
+
+	/* nothing to load */
+	assert(mcp_region_load(&region, indexes, 0, 4, &pages, load_chunk,
+							&pages) == 0);
+
+	mcp_region_close(&region);
+	fbuf_pages_free(&pages);
+	unlink(path);
+}
+
+/* a region of the world in dir */
+static void region_path(char *dest, int x, int z)
+{
+	sprintf(dest, "%s/r.%i.%i.mca", dir, x, z);
+}
+
+/* saves the chunks x0 <= x < x0 + 8 and z0 <= z < z0 + 8, with the nbt of
+ * seed */
+static void save_chunks(struct mcp_region_writer *writer,
+						struct fbuf_pages *pages, int x0, int z0, int seed)
+{
+	static unsigned char data[32768];
+	struct fbuf nbt;
+	size_t size;
+	int x, z;
+
+	for (x = x0; x < x0 + 8; x++) {
+		for (z = z0; z < z0 + 8; z++) {
+			fbuf_init(&nbt, FBUF_MAX);
+			fbuf_set_pages(&nbt, pages);
+			size = chunk_nbt(mcp_region_index(x, z) + seed, data);
+			assert(fbuf_copy(&nbt, data, size) == 0);
+
+			/* wait for the writer when it is full */
+			while (mcp_region_save(writer, x, z, 1400000000 + seed, &nbt))
+				mcp_region_flush(writer);
+			assert(fbuf_avail(&nbt) == 0 && nbt.base == NULL);
+		}
+	}
+}
+
+/* checks the chunks saved by save_chunks */
+static void check_chunks(int x0, int z0, int seed)
+{
+	struct mcp_region region;
+	struct mcp_region_chunk chunk;
+	struct fbuf nbt = FBUF_INITIALIZER;
+	char file[128];
+	int x, z;
+
+	for (x = x0; x < x0 + 8; x++) {
+		for (z = z0; z < z0 + 8; z++) {
+			region_path(file, (x - (x & 31)) / 32, (z - (z & 31)) / 32);
+			assert(mcp_region_open(&region, file) == 0);
+			assert(mcp_region_chunk(&region, mcp_region_index(x, z), &chunk));
+			assert(chunk.compression == MCP_REGION_ZLIB);
+			assert(chunk.timestamp == 1400000000u + seed);
+
+			fbuf_clear(&nbt);
+			assert(mcp_region_inflate(&nbt, &chunk) == 0);
+			check_nbt(mcp_region_index(x, z) + seed, &nbt);
+			mcp_region_close(&region);
+		}
+	}
+
+	fbuf_free(&nbt);
+}
+
+static off_t region_size(int x, int z)
+{
+	char file[128];
+	struct stat st;
+
+	region_path(file, x, z);
+	assert(stat(file, &st) == 0);
+	return st.st_size;
+}
+
+static void write_test(void)
+{
+	struct mcp_region_writer_config config;
+	struct mcp_region_writer *writer;
+	struct fbuf_pages pages;
+	off_t size;
+	int i;
+
+	fbuf_pages_init(&pages, 4096, 1 << 20);
+	memset(&config, 0, sizeof(config));
+	config.dir = dir;
+	config.capacity = 16;
+	config.threads = 3;
+	config.level = -1;
+	config.pages = &pages;
+	writer = mcp_region_writer_start(&config);
+	assert(writer);
+
+	/* chunks in four regions, across the origin */
+	save_chunks(writer, &pages, -4, -4, 0);
+	assert(mcp_region_flush(writer) == 0);
+	check_chunks(-4, -4, 0);
+	assert(region_size(0, 0) % MCP_REGION_SECTOR == 0);
+
+	/* saved again, the chunks move to free sectors and the old sectors are
+	 * reused once the header is synced, so the file stops growing */
+	save_chunks(writer, &pages, -4, -4, 1);
+	assert(mcp_region_flush(writer) == 0);
+	size = region_size(-1, -1);
+	for (i = 2; i < 6; i++) {
+		save_chunks(writer, &pages, -4, -4, i);
+		assert(mcp_region_flush(writer) == 0);
+	}
+	check_chunks(-4, -4, 5);
+	assert(region_size(-1, -1) <= size * 2);
+
+	/* the same chunks many times before a flush are written in order */
+	for (i = 6; i < 10; i++)
+		save_chunks(writer, &pages, 100, 100, i);
+	assert(mcp_region_writer_stop(writer) == 0);
+	check_chunks(100, 100, 9);
+
+	/* a second writer keeps the chunks of the first */
+	writer = mcp_region_writer_start(&config);
+	assert(writer);
+	save_chunks(writer, &pages, 108, 100, 10);
+	assert(mcp_region_writer_stop(writer) == 0);
+	check_chunks(100, 100, 9);
+	check_chunks(108, 100, 10);
+
+	fbuf_pages_free(&pages);
+}
+
+static void write_error_test(void)
+{
+	struct mcp_region_writer_config config;
+	struct mcp_region_writer *writer;
+	struct fbuf nbt = FBUF_INITIALIZER;
+	unsigned char *ptr;
+	char file[128];
+	size_t i;
+	FILE *out;
+
+	memset(&config, 0, sizeof(config));
+	config.dir = dir;
+	config.capacity = 0;
+	config.level = -1;
+	assert(mcp_region_writer_start(&config) == NULL);
+
+	config.capacity = 4;
+	writer = mcp_region_writer_start(&config);
+	assert(writer);
+
+	/* a chunk that does not compress to 255 sectors */
+	ptr = fbuf_wptr(&nbt, 2 << 20);
+	assert(ptr);
+	srand(1);
+	for (i = 0; i < 2 << 20; i++)
+		ptr[i] = rand();
+	fbuf_produce(&nbt, 2 << 20);
+	assert(mcp_region_save(writer, 0, 0, 0, &nbt) == 0);
+	assert(mcp_region_flush(writer) == 1);
+	assert(mcp_region_flush(writer) == 0);
+
+	/* a region that is cut short is not written over */
+	region_path(file, 1, 0);
+	out = fopen(file, "wb");
+	assert(out);
+	assert(fwrite("\0\0\0\0", 1, 4, out) == 4);
+	fclose(out);
+	assert(mcg_raw(&nbt, "nbt", 3) == 0);
+	assert(mcp_region_save(writer, 32, 0, 0, &nbt) == 0);
+	assert(mcp_region_writer_stop(writer) == 1);
+	assert(region_size(1, 0) == 4);
+
+	/* and nothing is written to a directory that does not exist */
+	config.dir = "/nonexistent/region";
+	writer = mcp_region_writer_start(&config);
+	assert(writer);
+	assert(mcg_raw(&nbt, "nbt", 3) == 0);
+	assert(mcp_region_save(writer, 0, 0, 0, &nbt) == 0);
+	assert(mcp_region_writer_stop(writer) == 1);
+}
+
+#define NUM_TESTS		(5)
+static void (*tests[NUM_TESTS])(void) = {read_test, malformed_test, load_test,
+											write_test, write_error_test};
+static const char *test_names[NUM_TESTS] = {"read_test", "malformed_test",
+											"load_test", "write_test",
+											"write_error_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	sprintf(path, "/tmp/region_test.%li.mca", (long)getpid());
+	sprintf(dir, "/tmp/region_test.XXXXXX");
+	assert(mkdtemp(dir));
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	/* the regions written by the tests */
+	sprintf(path, "rm -r %s", dir);
+	return system(path) != 0;
+}
@@ -0,0 +1,226 @@
+/* rewrite_test.c - tests of in-place frame rewriting
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/rewrite.h>
+
+/* the size of the padding in the body of the first frame, so that the body
+ * is one byte short of needing a wider length prefix */
+#define PADDING			(116)
+
+/* a movement packet followed by a block change, after a frame that is
+ * consumed before the test so that the data does not start at the base */
+static void build(struct fbuf *buf)
+{
+	static unsigned char padding[PADDING];
+
+	memset(padding, 0x55, sizeof(padding));
+
+	fbuf_clear(buf);
+	assert(mcg_varint(buf, 3) == 0);
+	assert(mcg_raw(buf, "old", 3) == 0);
+
+	assert(mcg_varint(buf, 1 + 1 + 8 + PADDING) == 0);
+	assert(mcg_varint(buf, 0x15) == 0);
+	assert(mcg_varint(buf, 5) == 0);
+	assert(mcg_double(buf, 1.5) == 0);
+	assert(mcg_raw(buf, padding, sizeof(padding)) == 0);
+
+	assert(mcg_varint(buf, 1 + 8 + 2) == 0);
+	assert(mcg_varint(buf, 0x0b) == 0);
+	assert(mcg_ulong(buf, 0x100001) == 0);
+	assert(mcg_varint(buf, 300) == 0);
+
+	fbuf_consume(buf, 4);
+}
+
+/* checks every field of both frames, and returns the size of the first */
+static size_t check(struct fbuf *buf, mcp_varint_t id, mcp_varint_t entity,
+					double x)
+{
+	struct mcp_parse parse, body;
+	const unsigned char *ptr;
+	size_t size, first, i;
+
+	mcp_start(&parse, fbuf_ptr(buf), fbuf_avail(buf));
+	ptr = mcp_bytes(&parse, &size);
+	assert(mcp_ok(&parse));
+	first = mcp_consumed(&parse);
+
+	mcp_start(&body, ptr, size);
+	assert(mcp_varint(&body) == id);
+	assert(mcp_varint(&body) == entity);
+	assert(mcp_double(&body) == x);
+	assert(mcp_avail(&body) == PADDING);
+	for (i = 0; i < PADDING; i++)
+		assert(mcp_ptr(&body)[i] == 0x55);
+
+	ptr = mcp_bytes(&parse, &size);
+	assert(mcp_ok(&parse) && mcp_eof(&parse));
+	mcp_start(&body, ptr, size);
+	assert(mcp_varint(&body) == 0x0b);
+	assert(mcp_ulong(&body) == 0x100001);
+	assert(mcp_varint(&body) == 300);
+	assert(mcp_ok(&body) && mcp_eof(&body));
+
+	return first;
+}
+
+static void rewrite_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER, expect = FBUF_INITIALIZER;
+	size_t size, second;
+
+	build(&buf);
+	size = check(&buf, 0x15, 5, 1.5);
+	assert(size == 1 + 126);
+
+	/* the same width, nothing moves */
+	assert(mcp_rewrite_varint(&buf, 0, 0, 0x14) == 0);
+	assert(check(&buf, 0x14, 5, 1.5) == size);
+
+	/* fixed width fields */
+	fbuf_clear(&expect);
+	assert(mcg_double(&expect, -2.25) == 0);
+	assert(mcp_rewrite_fixed(&buf, 0, 2, fbuf_ptr(&expect), 8) == 0);
+	assert(check(&buf, 0x14, 5, -2.25) == size);
+
+	/* one byte wider fits in the same length prefix */
+	assert(mcp_rewrite_varint(&buf, 0, 1, 300) == 0);
+	assert(check(&buf, 0x14, 300, -2.25) == size + 1);
+
+	/* one more needs a wider length prefix */
+	assert(mcp_rewrite_varint(&buf, 0, 1, 1 << 14) == 0);
+	assert(check(&buf, 0x14, 1 << 14, -2.25) == size + 3);
+	assert(fbuf_ptr(&buf)[0] == 0x80 && fbuf_ptr(&buf)[1] == 0x01);
+
+	/* narrower values are padded, and the length prefix is kept */
+	assert(mcp_rewrite_varint(&buf, 0, 1, 7) == 0);
+	assert(check(&buf, 0x14, 7, -2.25) == size + 3);
+	assert(fbuf_ptr(&buf)[3] == 0x87 && fbuf_ptr(&buf)[5] == 0x00);
+
+	assert(mcp_rewrite_varint(&buf, 0, 1, 1 << 14) == 0);
+	assert(check(&buf, 0x14, 1 << 14, -2.25) == size + 3);
+
+	/* the same as mcg would have written */
+	fbuf_clear(&expect);
+	assert(mcg_varint(&expect, 0x14) == 0);
+	assert(mcg_varint(&expect, 1 << 14) == 0);
+	assert(memcmp(fbuf_ptr(&buf) + 2, fbuf_ptr(&expect), 4) == 0);
+
+	/* a field of the second frame */
+	second = size + 3;
+	assert(mcp_rewrite_varint(&buf, second, 9, (mcp_varint_t)-1) == 0);
+	assert(fbuf_ptr(&buf)[second] == 1 + 8 + 5);
+	assert(mcp_rewrite_varint(&buf, second, 9, 300) == 0);
+	assert(check(&buf, 0x14, 1 << 14, -2.25) == size + 3);
+
+	/* varlongs */
+	build(&buf);
+	assert(mcp_rewrite_varint(&buf, 0, 1, UINT64_MAX) == 0);
+	assert(fbuf_avail(&buf) == size + 10 + 12);
+	assert(mcp_rewrite_varint(&buf, 0, 1, 5) == 0);
+	assert(check(&buf, 0x15, 5, 1.5) == size + 10);
+
+	fbuf_free(&buf);
+	fbuf_free(&expect);
+}
+
+static void error_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER, copy = FBUF_INITIALIZER;
+	size_t size;
+
+	build(&buf);
+	size = fbuf_avail(&buf);
+	assert(fbuf_copy(&copy, fbuf_ptr(&buf), size) == 0);
+
+	/* frames and fields that are not there */
+	assert(mcp_rewrite_varint(&buf, size + 1, 0, 0) == 1);
+	assert(mcp_rewrite_varint(&buf, size, 0, 0) == 1);
+	assert(mcp_rewrite_varint(&buf, 0, 126, 0) == 1);
+	assert(mcp_rewrite_fixed(&buf, 0, 119, "12345678", 8) == 1);
+	assert(mcp_rewrite_fixed(&buf, 0, 126, "", 0) == 0);
+	assert(mcp_rewrite_fixed(&buf, 0, 127, "", 0) == 1);
+	assert(mcp_rewrite_fixed(&buf, 0, 1, "", (size_t)-1) == 1);
+
+	/* a varint that runs past the body into the next frame */
+	assert(mcp_rewrite_fixed(&buf, 0, 125, "\x80", 1) == 0);
+	assert(mcp_rewrite_varint(&buf, 0, 125, 1) == 1);
+	assert(mcp_rewrite_fixed(&buf, 0, 125, "\x55", 1) == 0);
+
+	/* frames that are not whole */
+	buf.end--;
+	assert(mcp_rewrite_varint(&buf, 127, 0, 0) == 1);
+	assert(mcp_rewrite_fixed(&buf, 127, 0, "\x0b", 1) == 1);
+	buf.end++;
+
+	/* the buffer can not grow */
+	assert(fbuf_shrink(&buf, size) == 0);
+	assert(mcp_rewrite_varint(&buf, 0, 1, 300) == 1);
+
+	assert(fbuf_avail(&buf) == size);
+	assert(memcmp(fbuf_ptr(&buf), fbuf_ptr(&copy), size) == 0);
+
+	fbuf_free(&buf);
+	fbuf_free(&copy);
+}
+
+#define NUM_TESTS		(2)
+static void (*tests[NUM_TESTS])(void) = {rewrite_test, error_test};
+static const char *test_names[NUM_TESTS] = {"rewrite_test", "error_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
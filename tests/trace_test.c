@@ -0,0 +1,146 @@
+/* trace_test.c - tests of the error and reallocation counters
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/trace.h>
+
+static void errors_test(void)
+{
+	static const unsigned char overflow[] = {0xff, 0xff, 0xff, 0xff, 0x7f};
+	static const unsigned char truncated[] = {0x80, 0x80};
+	struct mcp_stats stats;
+	struct mcp_parse buf;
+	struct fbuf out;
+	int kept;
+
+	mcp_stats_reset();
+
+	/* a varint cut short */
+	mcp_start(&buf, truncated, sizeof(truncated));
+	mcp_varint(&buf);
+	assert(mcp_error(&buf) == MCP_EAGAIN);
+
+	/* errors are only counted where they are set, not where they pass */
+	mcp_ushort(&buf);
+
+	/* a varint that does not fit in 32 bits */
+	mcp_start(&buf, overflow, sizeof(overflow));
+	mcp_varint(&buf);
+	assert(mcp_error(&buf) == MCP_EOVERFLOW);
+
+	/* a short cut short */
+	mcp_start(&buf, truncated, 1);
+	mcp_ushort(&buf);
+	assert(mcp_error(&buf) == MCP_EAGAIN);
+
+	/* a buffer that can not grow */
+	fbuf_init(&out, 4);
+	assert(mcg_ulong(&out, 1) != 0);
+	fbuf_free(&out);
+
+	kept = mcp_stats_get(&stats) == 0;
+
+#ifdef MCP_BASE_STATS
+	assert(kept);
+	assert(stats.eagain[MCP_SITE_VARLONG] == 1);
+	assert(stats.eoverflow[MCP_SITE_VARINT] == 1);
+	assert(stats.eagain[MCP_SITE_RAW] == 1);
+	assert(stats.eoverflow[MCP_SITE_FBUF_EXPAND] == 1);
+	assert(stats.einval[MCP_SITE_RAW] == 0);
+
+	mcp_stats_reset();
+	mcp_stats_get(&stats);
+	assert(stats.eagain[MCP_SITE_VARLONG] == 0);
+#else
+	assert(!kept);
+	assert(stats.eagain[MCP_SITE_VARLONG] == 0);
+#endif
+}
+
+static void realloc_test(void)
+{
+	struct mcp_stats stats;
+	struct fbuf buf;
+	int i;
+
+	mcp_stats_reset();
+
+	/* growing to 8k in small writes takes a few reallocations */
+	fbuf_init(&buf, FBUF_MAX);
+	for (i = 0; i < 1024; i++)
+		assert(mcg_ulong(&buf, i) == 0);
+	assert(fbuf_shrink(&buf, fbuf_avail(&buf)) == 0);
+
+	mcp_stats_get(&stats);
+	fbuf_free(&buf);
+
+#ifdef MCP_BASE_STATS
+	/* 1k, 2k, 4k, 8k, then the shrink */
+	assert(stats.reallocs == 4);
+	assert(stats.realloc_bytes == 1024 + 2048 + 4096 + 8192);
+#else
+	assert(stats.reallocs == 0);
+#endif
+
+	assert(strcmp(mcp_trace_site_name(MCP_SITE_VARLONG), "mcp_varlong") == 0);
+	assert(strcmp(mcp_trace_site_name(MCP_NUM_SITES), "unknown") == 0);
+}
+
+#define NUM_TESTS		(2)
+static void (*tests[NUM_TESTS])(void) = {errors_test, realloc_test};
+static const char *test_names[NUM_TESTS] = {"errors_test", "realloc_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
@@ -0,0 +1,321 @@
+/* utf8_test.c - tests of utf-8 validation and mcp_string
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* NOTE: It is important that assert always aborts on failed assertion */
+#undef NDEBUG
+#include <assert.h>
+
+#include <mcp_base/fbuf.h>
+#include <mcp_base/mcp.h>
+#include <mcp_base/utf8.h>
+
+/* decodes one code point at a time, without any of the fast paths */
+static size_t reference_units(const unsigned char *data, size_t size)
+{
+	size_t i = 0, units = 0, length, j;
+	unsigned long code, min;
+
+	while (i < size) {
+		if (data[i] < 0x80) {
+			length = 1;
+			code = data[i];
+			min = 0;
+		} else if ((data[i] & 0xe0) == 0xc0) {
+			length = 2;
+			code = data[i] & 0x1f;
+			min = 0x80;
+		} else if ((data[i] & 0xf0) == 0xe0) {
+			length = 3;
+			code = data[i] & 0x0f;
+			min = 0x800;
+		} else if ((data[i] & 0xf8) == 0xf0) {
+			length = 4;
+			code = data[i] & 0x07;
+			min = 0x10000;
+		} else {
+			return MCP_UTF8_INVALID;
+		}
+
+		if (size - i < length)
+			return MCP_UTF8_INVALID;
+
+		for (j = 1; j < length; j++) {
+			if ((data[i + j] & 0xc0) != 0x80)
+				return MCP_UTF8_INVALID;
+			code = (code << 6) | (data[i + j] & 0x3f);
+		}
+
+		if (code < min || code > 0x10ffff ||
+				(code >= 0xd800 && code <= 0xdfff))
+			return MCP_UTF8_INVALID;
+
+		units += code >= 0x10000 ? 2 : 1;
+		i += length;
+	}
+
+	return units;
+}
+
+static size_t units(const char *str)
+{
+	return mcp_utf8_units(str, strlen(str));
+}
+
+static void validate_test(void)
+{
+	static const char *invalid[] = {
+		"\x80",					/* lone continuation */
+		"\xbf",
+		"\xc0\x80",				/* overlong */
+		"\xc1\xbf",
+		"\xe0\x80\x80",
+		"\xe0\x9f\xbf",
+		"\xf0\x80\x80\x80",
+		"\xf0\x8f\xbf\xbf",
+		"\xed\xa0\x80",			/* surrogates */
+		"\xed\xbf\xbf",
+		"\xf4\x90\x80\x80",		/* past U+10FFFF */
+		"\xf5\x80\x80\x80",
+		"\xff",
+		"\xc3",					/* truncated */
+		"\xe2\x82",
+		"\xf0\x9f\x98",
+		"\xc3\x28",				/* bad continuation */
+		"\xe2\x28\xa1",
+		"\xf0\x9f\x28\x80"
+	};
+	unsigned char data[300];
+	unsigned int seed = 1;
+	size_t i, j, k;
+
+	assert(units("") == 0);
+	assert(units("hello") == 5);
+	assert(units("h\xc3\xa9llo") == 5);
+	assert(units("\xe2\x82\xac") == 1);
+	assert(units("\xef\xbf\xbf") == 1);
+	assert(units("\xf0\x9f\x98\x80") == 2);
+	assert(units("\xf4\x8f\xbf\xbf") == 2);
+	assert(units("\xed\x9f\xbf\xee\x80\x80") == 2);
+	assert(mcp_utf8_units("a\0b", 3) == 3);
+
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		assert(units(invalid[i]) == MCP_UTF8_INVALID);
+		assert(reference_units((const unsigned char *)invalid[i],
+								strlen(invalid[i])) == MCP_UTF8_INVALID);
+	}
+
+	/* a bad byte is found at every offset in and around the vector blocks */
+	for (i = 0; i < 80; i++) {
+		memset(data, 'a', sizeof(data));
+		assert(mcp_utf8_units(data, i) == i);
+		for (j = 0; j < i; j++) {
+			data[j] = 0x80;
+			assert(mcp_utf8_units(data, i) == MCP_UTF8_INVALID);
+			data[j] = 0xc3;
+			assert(mcp_utf8_units(data, i) == MCP_UTF8_INVALID);
+			if (j + 1 < i) {
+				data[j + 1] = 0xa9;
+				assert(mcp_utf8_units(data, i) == i - 1);
+				data[j + 1] = 'a';
+			}
+			data[j] = 'a';
+		}
+	}
+
+	/* every sequence at every offset across the vector blocks */
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		size_t length = strlen(invalid[i]);
+
+		for (j = 0; j + length <= 70; j++) {
+			memset(data, 'a', sizeof(data));
+			memcpy(data + j, invalid[i], length);
+			assert(mcp_utf8_units(data, 70) == MCP_UTF8_INVALID);
+			assert(mcp_utf8_units(data, j + length) == MCP_UTF8_INVALID);
+		}
+	}
+
+	for (j = 0; j + 4 <= 70; j++) {
+		memset(data, 'a', sizeof(data));
+		memcpy(data + j, "\xf0\x9f\x98\x80", 4);
+		assert(mcp_utf8_units(data, 70) == 68);
+		assert(mcp_utf8_units(data, j + 3) == MCP_UTF8_INVALID);
+
+		memset(data, 'a', sizeof(data));
+		memcpy(data + j, "\xe2\x82\xac", 3);
+		assert(mcp_utf8_units(data, 70) == 68);
+		assert(mcp_utf8_units(data, j + 3) == j + 1);
+	}
+
+	/* random mixes of ascii, sequences and garbage match the reference */
+	for (i = 0; i < 20000; i++) {
+		size_t size = 0, length;
+
+		length = (seed = seed * 1103515245 + 12345) % 280;
+		while (size < length) {
+			seed = seed * 1103515245 + 12345;
+			k = (seed >> 16) % 100;
+			if (k < 60) {
+				data[size++] = 'a' + k % 26;
+			} else if (k < 70 && size + 2 <= length) {
+				data[size++] = 0xc3;
+				data[size++] = 0xa9;
+			} else if (k < 80 && size + 3 <= length) {
+				data[size++] = 0xe2;
+				data[size++] = 0x82;
+				data[size++] = 0xac;
+			} else if (k < 88 && size + 4 <= length) {
+				data[size++] = 0xf0;
+				data[size++] = 0x9f;
+				data[size++] = 0x98;
+				data[size++] = 0x80 + k % 0x40;
+			} else if (k < 89) {
+				data[size++] = seed >> 24;
+			} else {
+				data[size++] = ' ';
+			}
+		}
+		assert(mcp_utf8_units(data, size) == reference_units(data, size));
+	}
+
+	/* every two byte string */
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 256; j++) {
+			data[0] = i;
+			data[1] = j;
+			assert(mcp_utf8_units(data, 2) == reference_units(data, 2));
+		}
+	}
+
+	/* every second and third byte after each lead */
+	for (i = 0xe0; i < 0x100; i++) {
+		for (j = 0x70; j < 0xd0; j++) {
+			for (k = 0x70; k < 0xd0; k++) {
+				data[0] = i;
+				data[1] = j;
+				data[2] = k;
+				data[3] = 0x80;
+				assert(mcp_utf8_units(data, 3) == reference_units(data, 3));
+				assert(mcp_utf8_units(data, 4) == reference_units(data, 4));
+			}
+		}
+	}
+}
+
+static void string_test(void)
+{
+	struct fbuf buf = FBUF_INITIALIZER;
+	struct mcp_parse parse;
+	const char *value;
+	size_t size, i;
+
+	assert(mcg_string(&buf, "h\xc3\xa9llo") == 0);
+	assert(mcg_string(&buf, "\xf0\x9f\x98\x80!") == 0);
+
+	/* zero-copy views into the buffer */
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	value = mcp_string(&parse, &size, 5);
+	assert(mcp_ok(&parse));
+	assert(size == 6 && memcmp(value, "h\xc3\xa9llo", 6) == 0);
+	assert(value == (const char *)fbuf_ptr(&buf) + 1);
+	value = mcp_string(&parse, &size, 3);
+	assert(mcp_ok(&parse) && mcp_eof(&parse));
+	assert(size == 5);
+
+	/* the bound is in utf-16 code units, not bytes or code points */
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	mcp_string(&parse, &size, 5);
+	mcp_string(&parse, &size, 2);
+	assert(mcp_error(&parse) == MCP_EOVERFLOW);
+
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_string(&parse, &size, 4) == NULL);
+	assert(mcp_error(&parse) == MCP_EOVERFLOW);
+
+	/* errors pass through */
+	assert(mcp_string(&parse, &size, 100) == NULL);
+	assert(mcp_error(&parse) == MCP_EOVERFLOW);
+
+	/* every truncation */
+	for (i = 0; i < 7; i++) {
+		mcp_start(&parse, fbuf_ptr(&buf), i);
+		assert(mcp_string(&parse, &size, 5) == NULL);
+		assert(mcp_error(&parse) == MCP_EAGAIN);
+	}
+
+	/* malformed strings */
+	fbuf_clear(&buf);
+	assert(mcg_string(&buf, "abc\xed\xa0\x80") == 0);
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_string(&parse, &size, 100) == NULL);
+	assert(mcp_error(&parse) == MCP_EINVAL);
+
+	/* long strings are rejected by their byte length, before the data */
+	fbuf_clear(&buf);
+	assert(mcg_varint(&buf, 1000) == 0);
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_string(&parse, &size, 256) == NULL);
+	assert(mcp_error(&parse) == MCP_EOVERFLOW);
+
+	/* the largest bound */
+	fbuf_clear(&buf);
+	assert(mcg_string(&buf, "abc") == 0);
+	mcp_start(&parse, fbuf_ptr(&buf), fbuf_avail(&buf));
+	assert(mcp_string(&parse, &size, (size_t)-1) != NULL);
+	assert(mcp_ok(&parse) && size == 3);
+
+	fbuf_free(&buf);
+}
+
+#define NUM_TESTS		(2)
+static void (*tests[NUM_TESTS])(void) = {validate_test, string_test};
+static const char *test_names[NUM_TESTS] = {"validate_test", "string_test"};
+
+static int print_usage();
+
+static int do_test(int test_num)
+{
+	if (test_num < 0 || test_num >= NUM_TESTS)
+		return print_usage();
+	fprintf(stderr, "starting subtest: %s\n", test_names[test_num]);
+	fflush(stderr);
+	tests[test_num]();
+	return 0;
+}
+
+static int print_usage()
+{
+	int i;
+	fprintf(stderr, "usage: ./test <subtest_no> <subtest_no> ...\n");
+	fprintf(stderr, "subtests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		fprintf(stderr, "\t%i\t%s\n", i, test_names[i]);
+	fflush(stderr);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int test, i, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (sscanf(argv[i], "%i", &test) != 1)
+			return print_usage();
+		ret = do_test(test);
+		if (ret)
+			return ret;
+	}
+
+	if (argc < 2)
+		return print_usage();
+
+	return 0;
+}
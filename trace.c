@@ -0,0 +1,56 @@
+/* trace.c - Per-thread error and reallocation counters
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+#include <string.h>
+
+#include <mcp_base/trace.h>
+
+static const char *site_names[MCP_NUM_SITES] = {
+	"mcp_raw",
+	"mcp_varint",
+	"mcp_varlong",
+	"mcp_bytes",
+	"mcp_string",
+	"mcp_skip",
+	"mcp_dispatch",
+	"mcp_arena",
+	"mcp_region",
+	"mcg_bytes",
+	"fbuf_expand",
+	"fbuf_shrink"
+};
+
+#ifdef MCP_BASE_STATS
+__thread struct mcp_stats mcp_thread_stats;
+#endif
+
+const char *mcp_trace_site_name(enum mcp_trace_site site)
+{
+	if ((unsigned)site >= MCP_NUM_SITES)
+		return "unknown";
+	return site_names[site];
+}
+
+int mcp_stats_get(struct mcp_stats *stats)
+{
+#ifdef MCP_BASE_STATS
+	*stats = mcp_thread_stats;
+	return 0;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return 1;
+#endif
+}
+
+void mcp_stats_reset(void)
+{
+#ifdef MCP_BASE_STATS
+	memset(&mcp_thread_stats, 0, sizeof(mcp_thread_stats));
+#endif
+}
@@ -0,0 +1,353 @@
+/* utf8.c - Implementation of utf-8 validation
+ *
+ * Copyright (c) 2015 Eric Chai <electromatter@gmail.com>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license. See the LICENSE file for details.
+ */
+
+/* for memcpy */
+#include <string.h>
+/* for uint64_t */
+#include <stdint.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+# include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+#endif
+
+/* the vector validator needs pshufb, which is not in the baseline of x86,
+ * so it is compiled for ssse3 and chosen at run time */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define MCP_UTF8_SSSE3
+# include <tmmintrin.h>
+#endif
+
+#include <mcp_base/utf8.h>
+
+/* bytes decoded one character at a time between checks for ascii runs */
+#define MCP_UTF8_BLOCK				(16)
+
+/* returns the length of the run of ascii at the start of data.
+ * most strings are entirely ascii, so this checks a vector at a time with
+ * whatever the target was compiled for, then a word at a time, then a byte
+ * at a time to find where the run ends */
+static size_t ascii_run(const unsigned char *data, size_t size)
+{
+	size_t i = 0;
+	uint64_t word;
+
+#if defined(__AVX2__)
+	for (; i + 32 <= size; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+		if (_mm256_movemask_epi8(block) != 0)
+			break;
+	}
+#endif
+
+#if defined(__SSE2__)
+	/* four vectors to a branch */
+	for (; i + 64 <= size; i += 64) {
+		__m128i block = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(data + i)),
+						_mm_loadu_si128((const __m128i *)(data + i + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(data + i + 32)),
+						_mm_loadu_si128((const __m128i *)(data + i + 48))));
+		if (_mm_movemask_epi8(block) != 0)
+			break;
+	}
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+		if (_mm_movemask_epi8(block) != 0)
+			break;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (; i + 16 <= size; i += 16) {
+		if (vmaxvq_u8(vld1q_u8(data + i)) >= 0x80)
+			break;
+	}
+#endif
+
+	for (; i + 8 <= size; i += 8) {
+		memcpy(&word, data + i, sizeof(word));
+		if (word & UINT64_C(0x8080808080808080))
+			break;
+	}
+
+	while (i < size && data[i] < 0x80)
+		i++;
+
+	return i;
+}
+
+/* validates and counts a character at a time */
+static size_t scalar_units(const unsigned char *bytes, size_t size)
+{
+	size_t i = 0, units = 0, run, end, length, j;
+	unsigned char lead, low, high;
+
+	while (i < size) {
+		run = ascii_run(bytes + i, size - i);
+		units += run;
+		i += run;
+
+		/* text that is not ascii is decoded a block at a time before
+		 * looking for another run, so that short runs of ascii between
+		 * multibyte characters are not checked twice */
+		end = size - i < MCP_UTF8_BLOCK ? size : i + MCP_UTF8_BLOCK;
+
+		while (i < end) {
+			lead = bytes[i];
+
+			if (lead < 0x80) {
+				units++;
+				i++;
+				continue;
+			}
+
+			/* continuation bytes, overlong two byte sequences and code
+			 * points past U+10FFFF can not start a sequence */
+			if (lead < 0xc2 || lead > 0xf4)
+				return MCP_UTF8_INVALID;
+
+			/* the range of the second byte rules out the remaining overlong
+			 * sequences, surrogates and code points past U+10FFFF */
+			low = 0x80;
+			high = 0xbf;
+			switch (lead) {
+			case 0xe0:
+				low = 0xa0;
+				break;
+			case 0xed:
+				high = 0x9f;
+				break;
+			case 0xf0:
+				low = 0x90;
+				break;
+			case 0xf4:
+				high = 0x8f;
+				break;
+			}
+
+			length = lead < 0xe0 ? 2 : lead < 0xf0 ? 3 : 4;
+			if (size - i < length)
+				return MCP_UTF8_INVALID;
+
+			if (bytes[i + 1] < low || bytes[i + 1] > high)
+				return MCP_UTF8_INVALID;
+
+			for (j = 2; j < length; j++) {
+				if ((bytes[i + j] & 0xc0) != 0x80)
+					return MCP_UTF8_INVALID;
+			}
+
+			/* code points past the basic multilingual plane take a
+			 * surrogate pair in utf-16 */
+			units += length == 4 ? 2 : 1;
+			i += length;
+		}
+	}
+
+	return units;
+}
+
+#ifdef MCP_UTF8_SSSE3
+/* the errors found by looking at each byte and the one before it.
+ * see Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+ * Byte". each table gives the errors that are possible for a nibble, and an
+ * error is found if it is possible for all three nibbles */
+#define TOO_SHORT					(0x01)	/* 11______ 0_______ */
+#define TOO_LONG					(0x02)	/* 0_______ 10______ */
+#define OVERLONG_3					(0x04)	/* 11100000 100_____ */
+#define TOO_LARGE					(0x08)	/* 11110100 1001____ */
+#define SURROGATE					(0x10)	/* 11101101 101_____ */
+#define OVERLONG_2					(0x20)	/* 1100000_ 10______ */
+#define TOO_LARGE_1000				(0x40)	/* 11110101 1000____ */
+#define OVERLONG_4					(0x40)	/* 11110000 1000____ */
+#define TWO_CONTS					(0x80)	/* 10______ 10______ */
+#define CARRY						(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+/* validates the whole blocks of data and counts their code units. the
+ * count includes a character cut off by the end of the last block, its
+ * offset is stored in done */
+__attribute__((target("ssse3")))
+static size_t ssse3_units(const unsigned char *bytes, size_t size,
+						size_t *done)
+{
+	const __m128i byte_1_high_table = _mm_setr_epi8(
+		/* 0_______ ascii */
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		/* 10______ continuation */
+		(char)TWO_CONTS, (char)TWO_CONTS, (char)TWO_CONTS, (char)TWO_CONTS,
+		/* 1100____ and 1101____ two byte lead */
+		TOO_SHORT | OVERLONG_2,
+		TOO_SHORT,
+		/* 1110____ three byte lead */
+		TOO_SHORT | OVERLONG_3 | SURROGATE,
+		/* 1111____ four byte lead */
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+	const __m128i byte_1_low_table = _mm_setr_epi8(
+		(char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+		(char)(CARRY | OVERLONG_2),
+		(char)CARRY,
+		(char)CARRY,
+		(char)(CARRY | TOO_LARGE),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000));
+	const __m128i byte_2_high_table = _mm_setr_epi8(
+		/* ________ 0_______ */
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		/* ________ 1000____ */
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 |
+				TOO_LARGE_1000 | OVERLONG_4),
+		/* ________ 1001____ */
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+		/* ________ 101_____ */
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+		/* ________ 11______ */
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+	/* a lead this close to the end of a block continues in the next */
+	const __m128i max_complete = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, (char)(0xf0 - 1), (char)(0xe0 - 1),
+		(char)(0xc0 - 1));
+	const __m128i nibble = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+	__m128i input, prev = zero, error = zero, incomplete = zero;
+	__m128i prev1, special, must23, counts = zero, sums = zero;
+	size_t i, j, units, length, ascii = 0;
+	int rounds = 0;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		input = _mm_loadu_si128((const __m128i *)(bytes + i));
+
+		if (_mm_movemask_epi8(input) == 0) {
+			/* ascii, so a sequence can not continue from the last block */
+			error = _mm_or_si128(error, incomplete);
+			incomplete = zero;
+			prev = input;
+			ascii += 16;
+			continue;
+		}
+
+		prev1 = _mm_alignr_epi8(input, prev, 15);
+		special = _mm_and_si128(
+			_mm_and_si128(
+				_mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(
+						_mm_srli_epi16(prev1, 4), nibble)),
+				_mm_shuffle_epi8(byte_1_low_table,
+						_mm_and_si128(prev1, nibble))),
+			_mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(
+					_mm_srli_epi16(input, 4), nibble)));
+
+		/* the third and fourth bytes of a sequence must continue it */
+		must23 = _mm_or_si128(
+			_mm_subs_epu8(_mm_alignr_epi8(input, prev, 14),
+						_mm_set1_epi8((char)(0xe0 - 0x80))),
+			_mm_subs_epu8(_mm_alignr_epi8(input, prev, 13),
+						_mm_set1_epi8((char)(0xf0 - 0x80))));
+		must23 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+
+		error = _mm_or_si128(error, _mm_xor_si128(must23, special));
+		incomplete = _mm_subs_epu8(input, max_complete);
+
+		/* every byte that is not a continuation is one code unit, and four
+		 * byte leads are one more */
+		counts = _mm_sub_epi8(counts, _mm_cmpgt_epi8(input,
+											_mm_set1_epi8(-65)));
+		counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(input,
+						_mm_max_epu8(input, _mm_set1_epi8((char)0xf0))));
+
+		/* flush the counts before a lane can overflow */
+		if (++rounds == 127) {
+			sums = _mm_add_epi64(sums, _mm_sad_epu8(counts, zero));
+			counts = zero;
+			rounds = 0;
+		}
+
+		prev = input;
+	}
+
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xffff)
+		return MCP_UTF8_INVALID;
+
+	sums = _mm_add_epi64(sums, _mm_sad_epu8(counts, zero));
+	units = ascii + (size_t)_mm_cvtsi128_si32(sums) +
+			(size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+
+	/* leave a character cut off by the last block to the caller */
+	for (j = i - 1; j + 4 > i; j--) {
+		if (bytes[j] < 0x80)
+			break;
+		if (bytes[j] < 0xc0)
+			continue;
+
+		length = bytes[j] < 0xe0 ? 2 : bytes[j] < 0xf0 ? 3 : 4;
+		if (j + length > i) {
+			units -= bytes[j] >= 0xf0 ? 2 : 1;
+			i = j;
+		}
+		break;
+	}
+
+	*done = i;
+	return units;
+}
+#endif
+
+size_t mcp_utf8_units(const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	size_t run, units, rest, done;
+
+	/* most strings are entirely ascii. otherwise skip the run in whole
+	 * blocks, so that short strings still fill a vector */
+	run = ascii_run(bytes, size);
+	if (run == size)
+		return size;
+
+	run &= ~(size_t)15;
+	bytes += run;
+	size -= run;
+
+#ifdef MCP_UTF8_SSSE3
+	if (size >= 16 && __builtin_cpu_supports("ssse3")) {
+		units = ssse3_units(bytes, size, &done);
+		if (units == MCP_UTF8_INVALID)
+			return MCP_UTF8_INVALID;
+
+		rest = scalar_units(bytes + done, size - done);
+		if (rest == MCP_UTF8_INVALID)
+			return MCP_UTF8_INVALID;
+
+		return run + units + rest;
+	}
+#endif
+
+	/* unused without a vector validator */
+	(void)units;
+	(void)done;
+
+	rest = scalar_units(bytes, size);
+	if (rest == MCP_UTF8_INVALID)
+		return MCP_UTF8_INVALID;
+
+	return run + rest;
+}